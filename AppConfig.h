@@ -38,6 +38,49 @@
 // How thick to make the lines
 #define LINE_WIDTH (2.0)
 
+/// The time step: the fraction of the field vector that each step moves the particles
+#define STEP_DT (0.0900f)
+
+/// The number of simulation steps a second; each moves the particles STEP_DT of the field vector
+#define STEPS_PER_SECOND (60.0)
+
+/// The most steps taken in one frame to catch up with the time; any more time than that is dropped
+#define MAX_CATCHUP_STEPS (4)
+
+/// Setting this to 1 runs each step in the background, into the other of two vertex buffers,
+/// while the frame is drawn from the one the last step wrote; what is drawn is a step behind.
+/// Setting this to 0 steps and then draws, one after the other, from the one buffer
+#define PIPELINE_EN (1)
+
+/// Setting this to 1 keeps the particles in separate streams of position, previous position,
+/// age and lifetime: they expire by age and are respawned in one batched pass each step.
+/// Setting this to 0 keeps only the tail/head pairs, respawning a fixed number each step
+#define PARTICLE_STREAMS_EN (1)
+
+/// The shortest and longest that a particle lives, in steps; each gets a lifetime between them
+#define PARTICLE_MIN_AGE (64)
+#define PARTICLE_MAX_AGE (192)
+
+/// The number of positions each of the particle streams keeps, and draws as a trail of one less
+/// segments: a ring in the vertex buffer that each step writes one slot of, drawn through a static
+/// index buffer.  2 or less draws only the tail/head pair of each particle, as before
+#define TRAIL_LENGTH (16)
+
+/// Setting this to 1 spawns the particle streams from an alias table built with each field,
+/// in proportion to the speed and area of each bin, rather than uniformly (see cpu/BWSpawnTable.h)
+#define SPAWN_TABLE_EN (1)
+
+/// Setting this to 1 shares the built fields between the instances of the plugin fed the same
+/// data at the same size, through a process wide cache (see cpu/BWFieldCache.h)
+#define FIELD_CACHE_EN (1)
+
+/// Setting this to 1 times each stage of the animation and counts the respawned particles
+/// (see cpu/BWStats.h); 0 takes the instrumentation out of the hot paths entirely
+#define STATS_EN (1)
+
+/// How often, in frames, the plugin logs the statistics
+#define STATS_LOG_FRAMES (300)
+
 /// The prefix that entries will appear in the log with
 #define LogPrefix @"BWAnimateVectorFieldPlugin: "
 
@@ -26,6 +26,7 @@
 
 #import <Quartz/Quartz.h>
 #import "BWGrid.h"
+#import "BWGLTexturePool.h"
 
 
 
@@ -33,6 +34,18 @@
 {
     /// This is the field animation model
     BWGrid* field;
+
+    /// The time that the blend to the latest field started
+    NSTimeInterval blendStart;
+
+    /// The time of the last frame, which the animation has been stepped up to
+    NSTimeInterval lastTime;
+
+    /// The textures that the frames are drawn into, kept from one frame (and grid) to the next
+    BWGLTexturePool* texturePool;
+
+    /// The frame buffer that the frames are drawn with, made once
+    GLuint frameBuffer;
 }
 
 // --- Inputs ----------------------------------------------------------------------
@@ -54,6 +67,20 @@
 @property(assign) NSUInteger inputWidth;
 @property(assign) NSUInteger inputHeight;
 
+/* Declare a property input port of type "Number" and with the key "inputTransitionTime"
+ This is the number of seconds to blend from one field to the next when the data changes. */
+@property(assign) double inputTransitionTime;
+
+/* Declare a property input port of type "Number" and with the key "inputTrailFade"
+ This is the fraction of the last frame kept under the next one; 0 clears each frame. */
+@property(assign) double inputTrailFade;
+
+#if STATS_EN
+/* Declare a property input port of type "Boolean" and with the key "inputPublishStatistics"
+ This puts the timings of the stages on the outputStatistics port. */
+@property(assign) BOOL inputPublishStatistics;
+#endif
+
 /* Declare a property input port of type "Color" and with the key "inputEndColor" */
 //@property(assign) CGColorRef inputEndColor;
 
@@ -62,6 +89,13 @@
 /* Declare a property output port of type "Image" and with the key "outputImage" */
 @property(assign) id<QCPlugInOutputImageProvider> outputImage;
 
+#if STATS_EN
+/* Declare a property output port of type "Structure" and with the key "outputStatistics"
+ This is the rolling average and 99th percentile of each stage, in milliseconds, and the
+ number of particles respawned each frame. */
+@property(assign) NSDictionary* outputStatistics;
+#endif
+
 // --- Settings --------------------------------------------------------------------
 /* Declare a property input port of type "Index" and with the key "inputNumParticles"
  This is the number of particles to use in the animation.*/
@@ -38,15 +38,25 @@
 #define	kQCPlugIn_Name				@"Animated Vector Field"
 #define	kQCPlugIn_Description		@"Produces an animated image of a given size containing am animation of a vector field.\nRandall Maas 2014"
 
+/// Quartz Composer is done with the texture, so put it back in the pool it came from
 static void _TextureReleaseCallback(CGLContextObj cgl_ctx, GLuint name, void* info)
 {
-	glDeleteTextures(1, &name);
+    BWGLTexturePool* pool = (__bridge_transfer BWGLTexturePool*) info;
+    [pool recycle: name];
+}
+
+/// The trail textures belong to the grid, which draws the frames after next in them
+static void _TrailReleaseCallback(CGLContextObj cgl_ctx, GLuint name, void* info)
+{
 }
 
 @implementation BWAnimateVectorFieldPlugin
 
 /* We need to declare the input / output properties as dynamic as Quartz Composer will handle their implementation */
-@dynamic inputVectorColor,  outputImage, inputNumParticles, inputStructure, inputHeight, inputWidth;
+@dynamic inputVectorColor,  outputImage, inputNumParticles, inputStructure, inputHeight, inputWidth, inputTransitionTime, inputTrailFade;
+#if STATS_EN
+@dynamic inputPublishStatistics, outputStatistics;
+#endif
 
 NSDictionary* attributesForPort = nil;
 
@@ -88,6 +98,30 @@ NSDictionary* attributesForPort = nil;
                   QCPortAttributeNameKey        : @"data",
                   QCPortAttributeDefaultValueKey: @""
                 },
+          @"inputTransitionTime":
+              @{
+                  QCPortAttributeNameKey        : @"Transition time",
+                  QCPortAttributeMinimumValueKey: [NSNumber numberWithDouble:0.0],
+                  QCPortAttributeDefaultValueKey: [NSNumber numberWithDouble:2.0]
+                },
+          @"inputTrailFade":
+              @{
+                  QCPortAttributeNameKey        : @"Trail fade",
+                  QCPortAttributeMinimumValueKey: [NSNumber numberWithDouble:0.0],
+                  QCPortAttributeMaximumValueKey: [NSNumber numberWithDouble:0.99],
+                  QCPortAttributeDefaultValueKey: [NSNumber numberWithDouble:0.0]
+                },
+#if STATS_EN
+          @"inputPublishStatistics":
+              @{
+                  QCPortAttributeNameKey        : @"Publish statistics",
+                  QCPortAttributeDefaultValueKey: [NSNumber numberWithBool:NO]
+                },
+          @"outputStatistics":
+              @{
+                  QCPortAttributeNameKey        : @"Statistics",
+                },
+#endif
           /*
            @"inputStructure":
            @{
@@ -126,7 +160,7 @@ NSDictionary* attributesForPort = nil;
 
 + (QCPlugInTimeMode) timeMode
 {
-	/* This plug-in does not depend on the time (time parameter is completely ignored in the -execute:atTime:withArguments: method) */
+	/* The animation is stepped at a fixed rate with the time passed to the -execute:atTime:withArguments: method */
     return kQCPlugInTimeModeTimeBase;
 }
 
@@ -151,6 +185,16 @@ NSDictionary* attributesForPort = nil;
 {
     // The execution is stopped, so get rid of the grid.  If we do it later, the cgl_ctx isn't valid
     field = nil;
+
+    // The textures still out are deleted as they come back
+    [texturePool logStatistics: (id<Logging>) context];
+    [texturePool retire];
+    texturePool = nil;
+
+    CGLContextObj cgl_ctx = [context CGLContextObj];
+    if (frameBuffer)
+        glDeleteFramebuffersEXT(1, &frameBuffer);
+    frameBuffer = 0;
 }
 
 /** This is used to load the given data
@@ -189,16 +233,76 @@ NSDictionary* attributesForPort = nil;
 }
 
 
+#if STATS_EN
+/** Close off the frame's statistics; log them every so often, and put them on the
+    outputStatistics port if that is asked for
+    @param logger  The object to log with
+ */
+- (void) publishStatistics: (id<Logging>) logger
+{
+    BWStats* stats = [field stats];
+    NSMutableDictionary* output = nil;
+    @synchronized(field)
+    {
+        BWStatsEndFrame(stats);
+        if (0 == stats->numFrames % STATS_LOG_FRAMES)
+        {
+            char line[512];
+            BWStatsFormat(stats, line, sizeof(line));
+            [logger logMessage: LogPrefix @"%s", line];
+        }
+        if (self.inputPublishStatistics)
+        {
+            output = [NSMutableDictionary dictionary];
+            for (int stage = 0; stage < BWNumStages; stage++)
+            {
+                output[@(BWStageName((BWStage) stage))] =
+                    @{ @"average": @(BWRollingAverage(&stats->stage[stage]))
+                     , @"p99"    : @(BWRollingP99(&stats->stage[stage]))
+                     };
+            }
+            output[@"respawnedInit"] =
+                @{ @"average": @(BWRollingAverage(&stats->respawnedInit))
+                 , @"p99"    : @(BWRollingP99(&stats->respawnedInit))
+                 };
+            output[@"respawnedMove"] =
+                @{ @"average": @(BWRollingAverage(&stats->respawnedMove))
+                 , @"p99"    : @(BWRollingP99(&stats->respawnedMove))
+                 };
+            output[@"frames"] = @(stats->numFrames);
+        }
+    }
+    self.outputStatistics = output;
+}
+#endif
+
+
 // This is the good version of the procedure
 - (BOOL) execute: (id<QCPlugInContext>)context
           atTime: (NSTimeInterval)time
    withArguments: (NSDictionary*)arguments
 {
+    BWStatsStart(frameStart);
     bool updated = !time;
-    if ([self didValueForInputKeyChange:@"inputStructure"] || !time)
+    if (!time)
     {
         field = nil;
     }
+    else if (field && [self didValueForInputKeyChange:@"inputStructure"])
+    {
+        // Build the new field in the background, rather than stalling this frame to rebuild
+        // everything; then either blend to it, or swap it in (keeping the particles)
+        if (self.inputTransitionTime > 0.0)
+        {
+            [field prefetchData: self.inputStructure
+                  velocityScale: self.inputWidth /  (5000.0f)];
+        }
+        else
+        {
+            [field replaceData: self.inputStructure
+                 velocityScale: self.inputWidth /  (5000.0f)];
+        }
+    }
     if (!field)
     {
         // Load the data
@@ -220,7 +324,7 @@ NSDictionary* attributesForPort = nil;
     id<Logging>   logger  = (id<Logging>) context;
     if ([self didValueForInputKeyChange:@"inputVectorColor"] || updated)
     {
-        // update the particle color
+        // update the particle color; it is drawn with from the next step on
         [field setColor : self.inputVectorColor
                   logger: logger];
     }
@@ -232,35 +336,77 @@ NSDictionary* attributesForPort = nil;
         return YES;
     }
 
+    // Blend from the current field to the next one, if there is one
+    if ([field advanceField])
+    {
+        blendStart = time;
+    }
+    if (field.nextField)
+    {
+        double blend = self.inputTransitionTime > 0.0 ? (time - blendStart) / self.inputTransitionTime : 1.0;
+        if (blend >= 1.0)
+            [field finishBlend];
+        else
+            field.fieldTime = blend;
+    }
+
+    // Uppdate the anination, by as many fixed steps as fit in the time since the last frame
+    // (all in one dispatch).  If that isn't a whole step yet, the last image stands, even if
+    // the color or fade changed: drawing again would fade the trails, and draw the same lines
+    // over them, a second time; the change shows from the next step.  With
+    // PIPELINE_EN, the steps run in the background while this frame is drawn from what the
+    // last frame's steps wrote, so a frame costs the longer of the two rather than both
+    int numSteps = [field advanceTime: updated ? 1.0 / STEPS_PER_SECOND : time - lastTime];
+    lastTime = time;
+    if (!numSteps && !updated && self.outputImage)
+    {
+        return YES;
+    }
+
     CGLContextObj cgl_ctx = [context CGLContextObj];
     
     // Create the rendering target.   This later steps will render to a frame buffer
     // The framebuffer can contain textures
-    GLuint frameBuffer = 0;
-	/* Create temporary FBO to render in texture */
-	glGenFramebuffersEXT(1, &frameBuffer);
+    if (!frameBuffer)
+    {
+        /* Create the FBO to render in texture; it is kept for the frames after */
+        glGenFramebuffersEXT(1, &frameBuffer);
+    }
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, frameBuffer);
+
+    // The textures to render in are kept in a pool, only replaced when the size changes
+    if (!texturePool || texturePool.width != field.width || texturePool.height != field.height)
+    {
+        [texturePool logStatistics: logger];
+        [texturePool retire];
+        texturePool = [[BWGLTexturePool alloc] initWithWidth: field.width
+                                                      height: field.height
+                                                     context: cgl_ctx];
+    }
+    field.texturePool = texturePool;
     
 
-    // Uppdate the anination
-    [field animationStep];
-    // Render the contents
+    // Render the contents, over the faded last frame if there are trails; the fade is per
+    // step, so that the trails are as long whatever the frame rate
+    field.trailFade = pow(self.inputTrailFade, numSteps > 1 ? numSteps : 1);
+    BWStatsStart(drawStart);
     GLuint texName = [field draw: logger];
+    BWStatsStop([field stats], BWStageDraw, drawStart);
+    BOOL owned = [field ownsTexture: texName];
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 
     /* Make sure to flush as we use FBOs and the passed OpenGL context may not have a surface attached */
 #if EXTRA_LOGGING_EN
     [context logMessage: LogPrefix @"%s,%d: glFushRenderApple", __FILE__, __LINE__];
 #endif
+    BWStatsStart(flushStart);
     glFlushRenderAPPLE();
+    BWStatsStop([field stats], BWStageFlush, flushStart);
     /* Check for OpenGL errors */
-    if(LogGLErrors())
+    if(LogGLErrors() && !owned)
     {
-        //When you're done using the texture, delete it. This will set texname to 0 and
-        //delete all of the graphics card memory associated with the texture. If you
-        //don't call this method, the texture will stay in graphics card memory until you
-        //close the application.
-        glDeleteTextures(1, &texName);
+        // Put the texture back in the pool, rather than pass on a bad frame
+        [texturePool recycle: texName];
         texName = 0;
     }
     
@@ -268,29 +414,37 @@ NSDictionary* attributesForPort = nil;
     
     // Pass the results to Quartz Composer, by passing it the texture identifer
     id provider = nil;
+    // The pool rides along with the texture, so that it can be put back even if the pool is replaced
+    void* releaseContext = NULL;
     if (texName)
     {
+        if (!owned)
+            releaseContext = (__bridge_retained void*) texturePool;
         provider= [context outputImageProviderFromTextureWithPixelFormat: HostFormat
                                                               pixelsWide: field.width
                                                               pixelsHigh: field.height
                                                                     name: texName
                                                                  flipped: YES
-                                                         releaseCallback: _TextureReleaseCallback
-                                                          releaseContext: NULL
+                                                         releaseCallback: owned ? _TrailReleaseCallback : _TextureReleaseCallback
+                                                          releaseContext: releaseContext
                                                               colorSpace: [context colorSpace]
                                                         shouldColorMatch: YES];
     }
-    glDeleteFramebuffersEXT(1, &frameBuffer);
     // Check for an error, and clean up if there was a problem
     if (!provider)
     {
         [context logMessage:LogPrefix @"unable to send texture rectangle to Quartz Composer"];
-        glDeleteTextures(1, &texName);
+        if (releaseContext)
+            _TextureReleaseCallback(cgl_ctx, texName, releaseContext);
     }
 
 	// Let Quartz know our output
 	self.outputImage = provider;
-	
+
+#if STATS_EN
+    BWStatsStop([field stats], BWStageFrame, frameStart);
+    [self publishStatistics: logger];
+#endif
 	return YES;
 }
 
@@ -43,7 +43,18 @@
 
 /** Stroke each of the particle motions
     @param logger  The object to log with
+    @returns The texture with the scene, 0 on error.  This is the caller's to return to
+             texturePool, unless it is one of the trail textures (see ownsTexture:)
  */
 - (GLuint) draw: (id<Logging>) logger
                ;
+
+/** Whether a texture from draw: is one of the trail textures, which the grid keeps
+    @param texName  The texture
+    @returns YES if the grid keeps the texture, NO if the caller should return it to the pool
+ */
+- (BOOL) ownsTexture: (GLuint) texName;
+
+/// Delete the trail textures
+- (void) deleteTrails;
 @end
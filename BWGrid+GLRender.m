@@ -34,6 +34,7 @@
 #import "BWGLVertexArray.h"
 #import "BWGLVertexBuffer.h"
 #import "BWGLParameter.h"
+#import "BWGLTexturePool.h"
 
 #define _max(a,b) (a>b?b:a)
 
@@ -136,6 +137,11 @@
 //    glPointSize(POINT_SIZE);
     glLineWidth(LINE_WIDTH);
 
+#if TRAILS_EN
+    // Leave out the block of segments from each particle's newest position back to its oldest
+    GLuint blockSize = 2*_numAllocatedParticles;
+    shader.vertices.skipElements = NSMakeRange(ringHead*blockSize, blockSize);
+#endif
     // Run the shader on the particle vertices
     [shader evaluate:logger];
     // Check for errors to make sure all of our setup went ok
@@ -162,38 +168,114 @@
 
 
 
-/** Draw the scene
+/** Fade the last frame into the current target, as the background for the new segments
     @param logger  The object to log with
+
+    This is a single full screen quad, with the fixed function pipeline: the first texture
+    unit multiplies the last frame by the fade, and the second takes away one step (1/255),
+    so that the faint trails do fade all the way out instead of rounding back to themselves.
  */
-- (GLuint) draw: (id<Logging>) logger
+- (void) fadeTrails: (id<Logging>) logger
 {
-    GLuint texType;
-    GLuint texName = 0;      // This texture that will be passed to Quartz Composer
-    // Create an OpenGL texture that we will pass to Quartz Composer.
-    // We will also render to this
-    glGenTextures(1, &texName);
-
-    // We'll use texture rectangles
-    // Uses GL_TEXTURE_RECTANGLE_EXT since the rectangles may be non power of two
-    texType = GL_TEXTURE_RECTANGLE_EXT;
-    glEnable(GL_TEXTURE_RECTANGLE_EXT);
-	glBindTexture(texType, texName);
-    LogGLErrors();
+    GLint saveViewport[4];
+    GLint saveMode;
+    GLenum texType = GL_TEXTURE_RECTANGLE_EXT;
+    GLfloat fade = self.trailFade;
+    GLfloat step[4] = {1.0f/255.0f, 1.0f/255.0f, 1.0f/255.0f, 1.0f/255.0f};
+
+    glGetIntegerv(GL_VIEWPORT, saveViewport);
+    glGetIntegerv(GL_MATRIX_MODE, &saveMode);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho( 0.0, self.width
+            , 0.0, self.height, -1, 1);
+    glViewport(0, 0, self.width, self.height);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    // Replace, rather than blend with, what is in the target
+    glUseProgram(0);
+    glDisable(GL_BLEND);
+    glDisable(GL_ALPHA_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_CULL_FACE);
 
-    // The tutorial says we need filtering
-    glTexParameteri(texType, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(texType, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(texType, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(texType, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // last frame * fade
+    glActiveTexture(GL_TEXTURE0);
+    glEnable(texType);
+    glBindTexture(texType, trailTextures[trailFront]);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB,   GL_MODULATE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA, GL_MODULATE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_RGB,   GL_TEXTURE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_ALPHA, GL_TEXTURE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE1_RGB,   GL_PRIMARY_COLOR);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE1_ALPHA, GL_PRIMARY_COLOR);
+    // - one step (the texture here is only bound to enable the unit)
+    glActiveTexture(GL_TEXTURE1);
+    glEnable(texType);
+    glBindTexture(texType, trailTextures[trailFront]);
+    glTexEnvfv(GL_TEXTURE_ENV, GL_TEXTURE_ENV_COLOR, step);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
+    glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_RGB,   GL_SUBTRACT);
+    glTexEnvi(GL_TEXTURE_ENV, GL_COMBINE_ALPHA, GL_SUBTRACT);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_RGB,   GL_PREVIOUS);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE0_ALPHA, GL_PREVIOUS);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE1_RGB,   GL_CONSTANT);
+    glTexEnvi(GL_TEXTURE_ENV, GL_SOURCE1_ALPHA, GL_CONSTANT);
 
-    // Define the size and initial contents of the texture buffer.
-    glTexImage2D(texType, 0, GL_RGBA8, self.width, self.height, 0,
-                 GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    // Rectangle textures are addressed in pixels
+    glColor4f(fade, fade, fade, fade);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 0.0f);                 glVertex2f(0.0f, 0.0f);
+    glTexCoord2f(self.width, 0.0f);           glVertex2f(self.width, 0.0f);
+    glTexCoord2f(self.width, self.height);    glVertex2f(self.width, self.height);
+    glTexCoord2f(0.0f, self.height);          glVertex2f(0.0f, self.height);
+    glEnd();
     LogGLErrors();
-    
+
+    glDisable(texType);
+    glActiveTexture(GL_TEXTURE0);
+    glDisable(texType);
+
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(saveMode);
+    glViewport(saveViewport[0], saveViewport[1], saveViewport[2], saveViewport[3]);
+}
+
+
+/** The pool that the render targets are taken from
+    @returns The pool given to the grid, or one of its own
+ */
+- (BWGLTexturePool*) targetPool
+{
+    if (!self.texturePool || self.texturePool.width != self.width || self.texturePool.height != self.height)
+    {
+        self.texturePool = [[BWGLTexturePool alloc] initWithWidth: self.width
+                                                           height: self.height
+                                                          context: cgl_ctx];
+    }
+    return self.texturePool;
+}
+
+
+/** Attach a texture to the frame buffer, as where to draw
+    @param texName  The texture
+    @param logger   The object to log with
+    @returns true if the frame buffer can be drawn to, false on error
+ */
+- (bool) attachTexture: (GLuint) texName
+                logger: (id<Logging>) logger
+{
     // Configure the frame buffer
     // The texName is color attachment 0
-	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, texType, texName, 0);
+	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_RECTANGLE_EXT, texName, 0);
     // Set the list of draw buffers
     GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0_EXT};
     glDrawBuffers(1, DrawBuffers);
@@ -203,35 +285,113 @@
     [logger logMessage:LogPrefix @"%s,%d: checking frame buffer status", __FILE__, __LINE__];
 #endif
 	GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
-    
     // Always check that it is ok
 	if(status == GL_FRAMEBUFFER_COMPLETE_EXT)
+        return true;
+    [logger logMessage:LogPrefix @"Frame buffer status: 0x%x", status];
+    LogGLErrors();
+    return false;
+}
+
+
+/** Create the trail textures, cleared to transparent
+    @param logger  The object to log with
+    @returns true on success, false on error
+ */
+- (bool) makeTrails: (id<Logging>) logger
+{
+    if (trailTextures[0])
+        return true;
+    // They are taken from the pool, and kept until the trails are deleted
+    trailPool = [self targetPool];
+    for (int I = 0; I < 2; I++)
     {
-#if CLEAR_BACKGROUND_EN
-        // I'm not sure if this does anything yet
-        // Set to transparent
+        trailTextures[I] = [trailPool texture: logger];
+        if (![self attachTexture: trailTextures[I]
+                          logger: logger])
+        {
+            [self deleteTrails];
+            return false;
+        }
         glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        // Clear the background
         glClear(GL_COLOR_BUFFER_BIT);
-        LogGLErrors();
-#endif
+    }
+    trailFront = 0;
+    return true;
+}
+
+
+/// Delete the trail textures (or rather, return them to the pool)
+- (void) deleteTrails
+{
+    [trailPool recycle: trailTextures[0]];
+    [trailPool recycle: trailTextures[1]];
+    trailTextures[0] = trailTextures[1] = 0;
+    trailPool = nil;
+}
+
+
+/** Whether a texture from draw: is one of the trail textures, which the grid keeps
+    @param texName  The texture
+    @returns YES if the grid keeps the texture, NO if the caller should return it to the pool
+ */
+- (BOOL) ownsTexture: (GLuint) texName
+{
+    return texName && (texName == trailTextures[0] || texName == trailTextures[1]);
+}
+
+
+/** Draw the scene
+    @param logger  The object to log with
+    @returns The texture with the scene, 0 on error
 
+    Normally each frame is drawn into a texture from the texture pool, which is handed
+    off (to be returned to the pool when Quartz Composer is done with it).  With a trail fade, the frames ping-pong
+    between the two trail textures instead: the last frame is faded into the other one,
+    the segments are drawn over it, and it becomes the last frame.  Quartz Composer is
+    done with a frame's image by the time the one after next is drawn over it.
+ */
+- (GLuint) draw: (id<Logging>) logger
+{
+    bool accumulate = self.trailFade > 0.0f && [self makeTrails: logger];
+    // This texture that will be passed to Quartz Composer.  We will also render to this
+    GLuint texName = accumulate ? trailTextures[!trailFront] : [[self targetPool] texture: logger];
+
+	if ([self attachTexture: texName
+                     logger: logger])
+    {
         // This might be over kill, but we need to save atleast some of the state .. just not sure which
         // If we don't the rendering of other gradients doesn't come out right
         glPushAttrib(GL_ALL_ATTRIB_BITS);
+        if (accumulate)
+        {
+            // The faded last frame covers the whole target, so there is nothing to clear
+            [self fadeTrails: logger];
+            trailFront = !trailFront;
+        }
+#if CLEAR_BACKGROUND_EN
+        else
+        {
+            // I'm not sure if this does anything yet
+            // Set to transparent
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            // Clear the background
+            glClear(GL_COLOR_BUFFER_BIT);
+            LogGLErrors();
+        }
+#endif
         [shader validate];
         [self drawParticles: logger];
         glPopAttrib(); // Restore old OpenGL States
     }
+    else if (!accumulate)
+    {
+        // Put the texture back for the next frame
+        [self.texturePool recycle: texName];
+        texName = 0;
+    }
     else
     {
-        [logger logMessage:LogPrefix @"Frame buffer status: 0x%x", status];
-        LogGLErrors();
-        //When you're done using the texture, delete it. This will set texname to 0 and
-        //delete all of the graphics card memory associated with the texture. If you
-        //don't call this method, the texture will stay in graphics card memory until you
-        //close the application.
-        glDeleteTextures(1, &texName);
         texName = 0;
     }
     return texName;
@@ -36,4 +36,56 @@
          velocityScale: (float) velocityScale
                       ;
 
+/** Load the flow data from a binary vector field file (see BWFieldFile.h).
+    The file is memory mapped, and the u/v planes are handed to gridBuild without copying.
+    Other files are read as earth JSON, streamed straight into the u/v arrays
+    @param path          The path to the .bwvf or .json file
+    @param velocityScale how much to scale the velocity magnitude by
+    @return true on success, false on failure
+*/
+- (bool) interpretFile: (NSString*) path
+         velocityScale: (float) velocityScale
+                      ;
+
+/** Build the field for the next time step on a background queue, while the current
+    field animates.  Call advanceField to start blending to it, once it is ready.
+    @param data          The flow data, as for interpretData:
+    @param velocityScale how much to scale the velocity magnitude by
+*/
+- (void) prefetchData: (NSDictionary*) data
+        velocityScale: (float) velocityScale
+                     ;
+
+/** If the prefetched field is ready, make it the next time step (nextField), and
+    restart the blend (fieldTime) at 0; the old next time step becomes the current one.
+    @return true if the fields moved on, false if there was nothing ready
+*/
+- (bool) advanceField;
+
+/** The blend has reached the next time step (fieldTime 1): make it the only field
+*/
+- (void) finishBlend;
+
+/** Replace the field of a live grid.  The field is built on a background queue, and
+    swapped in at the start of the first animationStep after it is ready; the particles,
+    the openCL queue, the vertex buffer and the shaders are all kept.  The old field's
+    buffer is reused by the next build, unless it came from the field cache.
+    @param data          The flow data, as for interpretData:
+    @param velocityScale how much to scale the velocity magnitude by
+*/
+- (void) replaceData: (NSDictionary*) data
+       velocityScale: (float) velocityScale
+                    ;
+
+/** Swap in the field from replaceData:, if it is ready.  animationStep calls this
+    first thing, so the swap always falls between frames.
+*/
+- (void) swapReplacementField;
+
+/** Let go of a field that is no longer used: free its buffer, or, if it came from the
+    field cache (see BWFieldCache.h), the reference to it
+    @param field  The field buffer; may be NULL
+*/
+- (void) releaseField: (cl_float2*) field;
+
 @end
@@ -26,6 +26,10 @@
 #import "BWGrid+build.h"
 #import "gridBuild.cl.h"
 #import "BWGrid-Animate.h"
+#import "BWEarthJSON.h"
+#import "BWFieldFile.h"
+#include "BWFieldCache.h"
+#include "BWSpawnTable.h"
 
 @implementation BWGrid (build)
 
@@ -48,6 +52,30 @@
 }
 
 
+/** Install a newly built field as the only field
+    @param field  The field, or NULL if it couldn't be built
+    @return true on success, false on failure
+ */
+- (bool) useField: (cl_float2*) field
+{
+    if (!field)
+    {
+        return false;
+    }
+    // The step in flight may still be reading the fields
+    [self finishStep];
+    [self retireField: self.vectorField];
+    [self retireField: self.nextField];
+    self.vectorField = field;
+    self.nextField   = NULL;
+    self.fieldTime   = 0.0f;
+
+    // Randomize the position of the particles
+    [self randomizeParticles: _numParticles];
+    return true;
+}
+
+
 /** Load the flow data
     @param data          The flow data.
     @param velocityScale how much to scale the velocity magnitude by
@@ -62,38 +90,368 @@
         NSLog(LogPrefix @"error, could not load: %@", e);
         return false;
     }
-    [self start: data
-  velocityScale: velocityScale];
+    return [self useField: [self fieldFromData: data
+                                 velocityScale: velocityScale]];
+}
+
+
+/** Load the flow data from a binary vector field file (see BWFieldFile.h),
+    or an earth JSON file (see BWEarthJSON.h)
+    @param path          The path to the .bwvf or .json file
+    @param velocityScale how much to scale the velocity magnitude by
+    @return true on success, false on failure
+ */
+- (bool) interpretFile: (NSString*) path
+         velocityScale: (float) velocityScale
+{
+    return [self useField: [self fieldFromFile: path
+                                 velocityScale: velocityScale]];
+}
+
+
+/** Build the field for the next time step in the background
+    @param data          The flow data, as for interpretData:
+    @param velocityScale how much to scale the velocity magnitude by
+ */
+- (void) prefetchData: (NSDictionary*) data
+        velocityScale: (float) velocityScale
+{
+    dispatch_async(prefetchQueue, ^{
+        cl_float2* field = [self fieldFromData: data
+                                 velocityScale: velocityScale];
+        if (!field)
+            return;
+        @synchronized(self)
+        {
+            // A newer field replaces one that was never taken
+            [self retireField: prefetchedField];
+            prefetchedField = field;
+        }
+    });
+}
+
+
+/** Make the prefetched field the next time step; the old next one (if any) becomes the current
+    @return true if the fields moved on, false if there was nothing to take
+ */
+- (bool) advanceField
+{
+    cl_float2* field;
+    @synchronized(self)
+    {
+        field = prefetchedField;
+        prefetchedField = NULL;
+    }
+    if (!field)
+    {
+        return false;
+    }
+    if (!self.vectorField)
+    {
+        // There isn't anything to blend from
+        return [self useField: field];
+    }
+    if (self.nextField)
+    {
+        // The step in flight may still be reading the field
+        [self finishStep];
+        [self retireField: self.vectorField];
+        self.vectorField = self.nextField;
+    }
+    self.nextField = field;
+    self.fieldTime = 0.0f;
     return true;
 }
 
 
-/** Load the data in the JSON file
-    @param path  The path to the JSON file.
+/** The blend has reached the next time step: make it the only field
+ */
+- (void) finishBlend
+{
+    if (self.nextField)
+    {
+        // The step in flight may still be reading the field
+        [self finishStep];
+        [self releaseField: self.vectorField];
+        self.vectorField = self.nextField;
+        self.nextField   = NULL;
+    }
+    self.fieldTime = 0.0f;
+}
+
+
+/** Replace the field of the live grid, keeping the particles, buffers and shaders
+    @param data          The flow data, as for interpretData:
+    @param velocityScale how much to scale the velocity magnitude by
+ */
+- (void) replaceData: (NSDictionary*) data
+       velocityScale: (float) velocityScale
+{
+    dispatch_async(prefetchQueue, ^{
+        cl_float2* field = [self fieldFromData: data
+                                 velocityScale: velocityScale];
+        if (!field)
+            return;
+        @synchronized(self)
+        {
+            // A newer field replaces one that was never swapped in
+            [self retireField: replacementField];
+            replacementField = field;
+        }
+    });
+}
+
+
+/** Swap in the replacement field, if one is ready.  This is called at the
+    start of animationStep, so the swap always falls between frames.
+ */
+- (void) swapReplacementField
+{
+    cl_float2* field;
+    @synchronized(self)
+    {
+        field = replacementField;
+        replacementField = NULL;
+    }
+    if (!field)
+    {
+        return;
+    }
+    if (!self.vectorField)
+    {
+        // There were no particles moving yet
+        [self useField: field];
+        return;
+    }
+    // The step in flight may still be reading the fields
+    [self finishStep];
+    [self retireField: self.vectorField];
+    [self retireField: self.nextField];
+    self.vectorField = field;
+    self.nextField   = NULL;
+    self.fieldTime   = 0.0f;
+}
+
+
+/** Keep a field buffer that is no longer used, for the next build
+    @param field  The field buffer; may be NULL
+ */
+- (void) retireField: (cl_float2*) field
+{
+    if (!field)
+        return;
+    @synchronized(self)
+    {
+        if (cachedFields[[NSValue valueWithPointer: field]])
+        {
+            // The cache's fields may be in use elsewhere, so they are never written again
+            [self releaseField: field];
+            return;
+        }
+        // One spare is enough; the builds happen one at a time
+        [self forgetSpawnTable: spareField];
+        BW_gcl_free(spareField);
+        spareField = field;
+    }
+}
+
+
+/** Let go of a field that is no longer used: free its buffer, or, if it came from the
+    cache, the reference to it
+    @param field  The field buffer; may be NULL
+ */
+- (void) releaseField: (cl_float2*) field
+{
+    if (!field)
+        return;
+    [self forgetSpawnTable: field];
+    BWCachedField* ref = NULL;
+    @synchronized(self)
+    {
+        NSValue* key = [NSValue valueWithPointer: field];
+        ref = [cachedFields[key] pointerValue];
+        [cachedFields removeObjectForKey: key];
+    }
+    if (ref)
+        BWCachedFieldRelease(ref);
+    else
+        gcl_free(field);
+}
+
+
+/** Build the alias table that the particle streams are spawned from, for a field.
+    The field is read back, and each cell of bins weighed by their speed and area (see BWSpawnTable.h)
+    @param field  The field buffer (numXBins * numYBins)
+    @return The table (NSData of BWSpawnEntry), or nil to spawn the particles uniformly
+ */
+- (NSData*) spawnTableForField: (cl_float2*) field
+{
+    size_t numBins = (size_t) numXBins*numYBins;
+    size_t count   = spawnTableCount(numXBins, numYBins);
+    BWFloat2* vectors = malloc(sizeof(*vectors)*numBins);
+    float*    weights = calloc(count, sizeof(*weights));
+    NSMutableData* table = [NSMutableData dataWithLength: sizeof(BWSpawnEntry)*count];
+    if (!vectors || !weights || !table)
+    {
+        BW_free(vectors);
+        BW_free(weights);
+        return nil;
+    }
+    dispatch_sync(_queue, ^{
+        gcl_memcpy(vectors, field, sizeof(*vectors)*numBins);
+    });
+    spawnWeights(vectors, numXBins, numYBins, weights, 0, numYBins);
+    // If nowhere will do, the particles are spawned uniformly
+    bool ok = spawnTableBuild(weights, (uint32_t) count, [table mutableBytes]);
+    BW_free(vectors);
+    BW_free(weights);
+    return ok ? table : nil;
+}
+
+
+/** Keep the alias table of a field, until updateSpawnTable uploads it
+    @param table  The table, or nil to spawn the particles uniformly
+    @param field  The field buffer
+ */
+- (void) keepSpawnTable: (NSData*) table
+               forField: (cl_float2*) field
+{
+    @synchronized(self)
+    {
+        NSValue* key = [NSValue valueWithPointer: field];
+        if (table)
+            spawnTables[key] = table;
+        else
+            [spawnTables removeObjectForKey: key];
+        // The buffer may have been used for an older field, whose table was uploaded
+        if (spawnField == field)
+            spawnField = NULL;
+    }
+}
+
+
+/** Drop the alias table of a field that is being freed
+    @param field  The field buffer; may be NULL
+ */
+- (void) forgetSpawnTable: (cl_float2*) field
+{
+    if (!field)
+        return;
+    @synchronized(self)
+    {
+        [spawnTables removeObjectForKey: [NSValue valueWithPointer: field]];
+        if (spawnField == field)
+            spawnField = NULL;
+    }
+}
+
+
+/** A field buffer (numXBins * numYBins) for a build to fill in
+    @return The buffer; a retired one if there is one
+ */
+- (cl_float2*) takeSpareField
+{
+    cl_float2* field;
+    @synchronized(self)
+    {
+        field = spareField;
+        spareField = NULL;
+    }
+    if (!field)
+    {
+        field = gcl_malloc(sizeof(*field)*numXBins*numYBins, 0, CL_MEM_READ_WRITE);
+    }
+    return field;
+}
+
+
+/** Build a field from the flow data
+    @param data          The flow data: the earth JSON records, or a "file" key with the path
+    @param velocityScale how much to scale the velocity magnitude by
+    @return The field, or NULL on failure
+ */
+- (cl_float2*) fieldFromData: (NSDictionary*) data
+               velocityScale: (float) velocityScale
+{
+    // The structure may just name a vector field file
+    NSObject* path = data[@"file"];
+    if ([path isKindOfClass: [NSString class]])
+    {
+        return [self fieldFromFile: (NSString*) path
+                     velocityScale: velocityScale];
+    }
+    return [self fieldFromDictionary: data
+                       velocityScale: velocityScale];
+}
+
+
+/** Build a field from a binary vector field file, or an earth JSON file
+    @param path          The path to the .bwvf or .json file
+    @param velocityScale how much to scale the velocity magnitude by
+    @return The field, or NULL on failure
+ */
+- (cl_float2*) fieldFromFile: (NSString*) path
+               velocityScale: (float) velocityScale
+{
+    if (![[path pathExtension] isEqualToString: @BWFieldFileExtension])
+    {
+        // Stream the JSON straight into the u/v arrays, without building the dictionaries
+        BWFieldHeader header;
+        float* uary;
+        float* vary;
+        if (!BWEarthJSONRead([path fileSystemRepresentation], &header, &uary, &vary))
+        {
+            return NULL;
+        }
+        cl_float2* ret = [self fieldWithHeader: header
+                                         uData: uary
+                                         vData: vary
+                                 velocityScale: velocityScale];
+        BW_free(uary);
+        BW_free(vary);
+        return ret;
+    }
+
+    BWFieldFile file;
+    if (!BWFieldFileOpen([path fileSystemRepresentation], &file))
+    {
+        return NULL;
+    }
+    // The planes in the mapping are handed straight to gridBuild
+    cl_float2* ret = [self fieldWithHeader: file.header
+                                     uData: file.uData
+                                     vData: file.vData
+                             velocityScale: velocityScale];
+    BWFieldFileClose(&file);
+    return ret;
+}
+
+
+/** Build a field from the earth JSON records
+    @param jsonArray     The records
     @param velocityScale how much to scale the velocity magnitude by
+    @return The field, or NULL on failure
  */
-- (void) start: (NSDictionary*) jsonArray
- velocityScale: (float) velocityScale
+- (cl_float2*) fieldFromDictionary: (NSDictionary*) jsonArray
+                     velocityScale: (float) velocityScale
 {
     // There will be 2 objects in the JSON aray
     cl_float* uary = NULL;  // The host c-array of the u components
     cl_float* vary = NULL;  // The host c-array of the u components
-    NSUInteger count;
-    cl_float2 delta;    // distance between grid points (e.g., 2.5 deg lon, 2.5 deg lat)
-    cl_uint2  srcSize;  // number of grid points W-E and N-S (e.g., 144 x 73) in the original data
-    cl_float2 origin;   // the grid's origin (e.g., 0.0E, 90.0N)
+    NSUInteger count = 0;
+    BWFieldHeader fieldHeader = {{0,0},{0,0},{0,0}};
     for (NSObject* key in jsonArray)
     {
         NSDictionary* vector = jsonArray[key];
         // There are two keys: header, data
         NSDictionary* header          = vector[@"header"];
         // Copy the header info.. this is often duplicationed, so don't wory about it
-        delta.x = [header[@"dx"] floatValue];
-        delta.y = [header[@"dy"] floatValue];
-        origin.x= [header[@"lo1"] floatValue];
-        origin.y= [header[@"la1"] floatValue];
-        srcSize .x = [header[@"nx"] unsignedIntegerValue];
-        srcSize .y = [header[@"ny"] unsignedIntegerValue];
+        fieldHeader.delta.x  = [header[@"dx"] floatValue];
+        fieldHeader.delta.y  = [header[@"dy"] floatValue];
+        fieldHeader.origin.x = [header[@"lo1"] floatValue];
+        fieldHeader.origin.y = [header[@"la1"] floatValue];
+        fieldHeader.srcSize.x = [header[@"nx"] unsignedIntegerValue];
+        fieldHeader.srcSize.y = [header[@"ny"] unsignedIntegerValue];
 
         count = [vector[@"data"] count];
 
@@ -122,6 +480,158 @@
     {
         NSLog(LogPrefix @"The u / v array had zero count");
     }
+#endif
+    cl_float2* ret = NULL;
+    if (vary && uary && count == fieldHeader.srcSize.x*fieldHeader.srcSize.y)
+    {
+        ret = [self fieldWithHeader: fieldHeader
+                              uData: uary
+                              vData: vary
+                      velocityScale: velocityScale];
+    }
+    BW_free(uary);
+    BW_free(vary);
+    return ret;
+}
+
+
+/// What buildCachedField needs to build a field for the cache
+typedef struct BWGridFieldSource
+{
+    __unsafe_unretained BWGrid* grid;
+    BWFieldHeader header;
+    float const*  uData;
+    float const*  vData;
+    float         velocityScale;
+    /// The number of bytes of the field buffer
+    size_t        fieldBytes;
+} BWGridFieldSource;
+
+/// A field in the cache (see BWFieldCache.h): the buffer, and the alias table built with it
+typedef struct BWGridCachedField
+{
+    cl_float2*  vectors;
+    /// The NSData of BWSpawnEntry (retained), or NULL to spawn the particles uniformly
+    void const* table;
+} BWGridCachedField;
+
+
+/** Build a field for the cache
+    @param context  The BWGridFieldSource
+    @param bytes    Receives the number of bytes the field takes
+    @return The BWGridCachedField, or NULL on failure
+ */
+static void* buildCachedField(void* context, size_t* bytes)
+{
+    BWGridFieldSource* source = context;
+    NSData* table = nil;
+    cl_float2* vectors = [source->grid buildFieldWithHeader: source->header
+                                                      uData: source->uData
+                                                      vData: source->vData
+                                              velocityScale: source->velocityScale
+                                                 spawnTable: &table];
+    if (!vectors)
+        return NULL;
+    BWGridCachedField* field = malloc(sizeof(*field));
+    field->vectors = vectors;
+    field->table   = table ? CFBridgingRetain(table) : NULL;
+    *bytes = source->fieldBytes + [table length];
+    return field;
+}
+
+
+/** Free a field that the cache no longer has, and nothing uses
+    @param field  The BWGridCachedField
+ */
+static void destroyCachedField(void* field)
+{
+    BWGridCachedField* cached = field;
+    BW_gcl_free(cached->vectors);
+    if (cached->table)
+        CFBridgingRelease(cached->table);
+    free(cached);
+}
+
+
+/** Find the vector field in the cache, or build it from the u/v components (and keep it
+    there).  The other grids in the process, fed the same data at the same size, share the
+    one buffer; it is released, rather than freed or reused, when this grid is done with it.
+    @param header        The size, origin and spacing of the u/v grids
+    @param uData         The u components of the vectors
+    @param vData         The v components of the vectors
+    @param velocityScale how much to scale the velocity magnitude by
+    @return The field (numXBins * numYBins), or NULL on failure
+ */
+- (cl_float2*) fieldWithHeader: (BWFieldHeader) header
+                         uData: (float const*) uary
+                         vData: (float const*) vary
+                 velocityScale: (float) velocityScale
+{
+    NSData* table = nil;
+#if FIELD_CACHE_EN
+#if STATS_EN
+    double start = BWStatsNow();
+#endif
+    // The buffers can only be shared within the one openCL context
+    BWFieldKey key = {BWFieldHash(&header, uary, vary), (uint64_t)(uintptr_t) gcl_get_context()
+                      , numXBins, numYBins, velocityScale, PARTICLE_STREAMS_EN && SPAWN_TABLE_EN};
+    BWGridFieldSource source = {self, header, uary, vary, velocityScale, sizeof(cl_float2)*numXBins*numYBins};
+    bool hit = false;
+    BWCachedField* ref = BWFieldCacheAcquire(&key, buildCachedField, destroyCachedField, &source, &hit);
+    if (!ref)
+        return NULL;
+    BWGridCachedField* cached = BWCachedFieldGet(ref);
+    cl_float2* field = cached->vectors;
+    table = (__bridge NSData*) cached->table;
+    @synchronized(self)
+    {
+        cachedFields[[NSValue valueWithPointer: field]] = [NSValue valueWithPointer: ref];
+#if STATS_EN
+        // A build notes its own time
+        if (hit)
+            BWStatsAddTime(&stats, BWStageFieldBuild, BWStatsNow() - start);
+#endif
+    }
+#else
+    cl_float2* field = [self buildFieldWithHeader: header
+                                            uData: uary
+                                            vData: vary
+                                    velocityScale: velocityScale
+                                       spawnTable: &table];
+    if (!field)
+        return NULL;
+#endif
+#if PARTICLE_STREAMS_EN && SPAWN_TABLE_EN
+    [self keepSpawnTable: table
+                forField: field];
+#endif
+    return field;
+}
+
+
+/** Build the vector field from the u/v components
+    @param header        The size, origin and spacing of the u/v grids
+    @param uData         The u components of the vectors
+    @param vData         The v components of the vectors
+    @param velocityScale how much to scale the velocity magnitude by
+    @param table         Receives the alias table the particles are spawned from (see
+                         spawnTableForField:), or nil to spawn them uniformly
+    @return The field (numXBins * numYBins), or NULL on failure
+
+    The u/v arrays are used in place (CL_MEM_USE_HOST_PTR), and are not freed
+ */
+- (cl_float2*) buildFieldWithHeader: (BWFieldHeader) header
+                              uData: (float const*) uary
+                              vData: (float const*) vary
+                      velocityScale: (float) velocityScale
+                         spawnTable: (NSData* __autoreleasing*) table
+{
+    *table = nil;
+    cl_float2 delta  = {{header.delta.x,  header.delta.y}};   // distance between grid points (e.g., 2.5 deg lon, 2.5 deg lat)
+    cl_uint2 srcSize = {{header.srcSize.x, header.srcSize.y}}; // number of grid points W-E and N-S (e.g., 144 x 73) in the original data
+    cl_float2 origin = {{header.origin.x, header.origin.y}};  // the grid's origin (e.g., 0.0E, 90.0N)
+    NSUInteger count = srcSize.x * srcSize.y;
+#if EXTRA_LOGGING_EN
     if (srcSize .x < 1)
     {
         NSLog(LogPrefix @"The x size is less than 1");
@@ -131,83 +641,37 @@
         NSLog(LogPrefix @"The y size is less than 1");
     }
 #endif
-    if (!vary || !uary)
-        return;
-    
+    if (!count)
+        return NULL;
+
 
 #if EXTRA_LOGGING_EN
     NSLog(LogPrefix @"%s,%d: allocating grid", __FILE__, __LINE__);
 #endif
     // Build the GCL local versions of the array
-    cl_float* cl_uary = gcl_malloc(sizeof(*cl_uary)* count, uary, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
-    cl_float* cl_vary = gcl_malloc(sizeof(*cl_vary)* count, vary, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+    cl_float* cl_uary = gcl_malloc(sizeof(*cl_uary)* count, (void*) uary, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+    cl_float* cl_vary = gcl_malloc(sizeof(*cl_vary)* count, (void*) vary, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
 
-    // Allocate enough for the temporary data grid
-    bool isContinuous = floor(srcSize.x * delta.x) >= 360;
-    int srcStride = srcSize.x+(isContinuous? 1:0);
-    
     // Continuous grids wrap around and have an extra column
-    // BUG: see the 1+srcSize.y?  that means I'm going off the edge
-    cl_float2* srcField = gcl_malloc(sizeof(*srcField)*srcStride*(1+srcSize.y), NULL, CL_MEM_READ_WRITE);
+    bool isContinuous = floor(srcSize.x * delta.x) >= 360;
+    cl_uint srcStride = srcSize.x+(isContinuous? 1:0);
 
-    // Creating the first stage grid
-    // Dispatch the kernel block using one of the dispatch_ commands and the
-    // queue created earlier.                                            // 5
+    // Allocate the memory for the vector field
+    cl_float2* myVectorField = [self takeSpareField];
+
+#if STATS_EN
+    __block double buildSeconds = 0.0;
+#endif
+    // Build the field straight from the u/v arrays, rotating, wrapping and flipping them as
+    // they are read; there is no first stage grid
 #if EXTRA_LOGGING_EN
-    NSLog(LogPrefix @"%s,%d: preparing grid", __FILE__, __LINE__);
+    NSLog(LogPrefix @"%s,%d: building the field", __FILE__, __LINE__);
 #endif
     dispatch_sync(_queue, ^{
         // The N-Dimensional Range over which we'd like to execute our
-        // kernel.  In this case, we're operating on a 1D buffer, so
-        // it makes sense that the range is 1D.
+        // kernel: one work item per bin
         cl_ndrange range =
         {                                              // 6
-            1,                     // The number of dimensions to use.
-            
-            {0, 0, 0},             // The offset in each dimension.  To specify
-            // that all the data is processed, this is 0
-            // in the test case.                   // 7
-            
-            {srcSize.y, 0, 0},    // The global range—this is how many items
-            // IN TOTAL in each dimension you want to
-            // process.
-            
-            {0, 0, 0}            // The local size of each workgroup.  This
-            // determines the number of work items per
-            // workgroup.  It indirectly affects the
-            // number of workgroups, since the global
-            // size / local size yields the number of
-            // workgroups.  In this test case, there are
-            // NUM_VALUE / wgs workgroups.
-        };
-
-        // Call to build the source grid
-        gridBuild_kernel(&range
-                   , cl_uary, cl_vary
-                   // The number of source grid points W-E and N-S (e.g., 144 x 73)
-                   , srcSize
-                   , delta
-                   , isContinuous
-                   , srcField
-                   );
-    });
-    
-
-    // We need to update the origin now, as we have rotated the view
-    origin.x += 90.0;
-    // Update the number of columns that are actually in the grid at this time
-    srcSize.x = srcStride;
-
-    // Allocate the memory for the vector field
-    cl_float2* myVectorField = gcl_malloc(sizeof(*myVectorField)*numXBins*numYBins, 0, CL_MEM_READ_WRITE);
-
-    // Interpolate to the target field size
-#if EXTRA_LOGGING_EN
-    NSLog(LogPrefix @"%s,%d: interpolating", __FILE__, __LINE__);
-#endif
-    dispatch_sync(_queue, ^{
-        // Call to build the interpolated / metric-distance grid
-        cl_ndrange range2 = {                                              // 6
             2,                     // The number of dimensions to use.
             
             {0, 0, 0},             // The offset in each dimension.  To specify
@@ -227,25 +691,43 @@
             // NUM_VALUE / wgs workgroups.
         };
 
-        cl_uint2 tgtSize = {numXBins, numYBins};
-        gridInterpolate_kernel(&range2, srcSize, srcField,
-                               origin, delta, velocityScale,
-                               tgtSize, numXBins, myVectorField);
+        cl_uint2 tgtSize = {{numXBins, numYBins}};
+#if STATS_EN
+        cl_timer timer = gcl_start_timer();
+#endif
+        gridBuildField_kernel(&range
+                              , cl_uary, cl_vary
+                              , srcSize, srcStride
+                              , origin, velocityScale
+                              , tgtSize, numXBins, myVectorField);
+#if STATS_EN
+        buildSeconds += gcl_stop_timer(timer);
+#endif
     });
+#if PARTICLE_STREAMS_EN && SPAWN_TABLE_EN
+    // The table the particles are spawned from goes along with the field
+#if STATS_EN
+    double tableStart = BWStatsNow();
+#endif
+    *table = [self spawnTableForField: myVectorField];
+#if STATS_EN
+    buildSeconds += BWStatsNow() - tableStart;
+#endif
+#endif
+#if STATS_EN
+    // The prefetches build on a queue of their own
+    @synchronized(self)
+    {
+        BWStatsAddTime(&stats, BWStageFieldBuild, buildSeconds);
+    }
+#endif
 
-    self.vectorField = myVectorField;
-    
 #if EXTRA_LOGGING_EN
     NSLog(LogPrefix @"%s,%d: freeing resources", __FILE__, __LINE__);
 #endif
     // Release the resources
-    BW_gcl_free(srcField);
     BW_gcl_free(cl_uary);
     BW_gcl_free(cl_vary);
-    BW_free(uary);
-    BW_free(vary);
-    
-    // Randomize the position of the particles
-    [self randomizeParticles: _numParticles];
+    return myVectorField;
 }
 @end
@@ -44,6 +44,23 @@
 - (void) randomizeParticles: (int) numParticles
                            ;
 
+/** Wait for the step in flight (with PIPELINE_EN), and make the vertex buffer it wrote the
+    one that is drawn.  The steps are otherwise run in the background, a frame ahead of what
+    is drawn; this is called before anything else touches the particles or the fields.
+ */
+- (void) finishStep;
+
 /// Update the animation
 - (void) animationStep;
+
+/** Update the animation by a number of steps, in one dispatch
+    @param numSteps  The number of steps to take
+ */
+- (void) animationSteps: (int) numSteps;
+
+/** Update the animation for the time that has passed, at a fixed STEPS_PER_SECOND
+    @param seconds  The time since the last call
+    @returns The number of steps taken; 0 if not a whole step has passed yet
+ */
+- (int) advanceTime: (double) seconds;
 @end
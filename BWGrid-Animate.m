@@ -23,7 +23,9 @@
 */
 
 #import "BWGrid-Animate.h"
+#import "BWGrid+build.h"
 #include "particleMove.cl.h"
+#include "BWSpawnTable.h"
 #import "BWGLVertexBuffer.h"
 #import "glErrorLogging.h"
 
@@ -31,19 +33,120 @@
 
 /** This creates the vertiex array to hold the beginning and ending point of each line
     @param logger  The object to log with
+    @returns The vertex array
+
+    With TRAILS_EN, it holds the ring of positions of each particle, and the static indices
+    that join them into the segments of the trails.  The segments are in blocks: block j joins
+    slot j of each particle's ring to slot j+1, so that the one block where the rings wrap --
+    from the newest position back to the oldest -- can be left out of the draw (skipElements).
+    The segments are GL_LINES pairs, rather than a strip for each particle, as the legacy
+    context has no primitive restart to break the strips with.
 */
-- (void) createVertexArray: (id<Logging>)     logger
+- (BWGLVertexArray*) createVertexArray: (id<Logging>)     logger
 {
-    // Put the vertex array into the fold
-    shader.vertices = [BWGLVertexArray vertexArray: cgl_ctx
-                                            logger: logger];
+    BWGLVertexArray* array = [BWGLVertexArray vertexArray: cgl_ctx
+                                                   logger: logger];
     // Tell it about the vertices
-    [shader.vertices setPositions: (GLubyte*) hostVertices
-                         dataType: GL_FLOAT
-                             size: 2
-                        arraySize: sizeof(*hostVertices)*_numAllocatedParticles*numVerticesPerParticle
-                           logger: logger];
+    [array setPositions: (GLubyte*) hostVertices
+               dataType: GL_FLOAT
+                   size: 2
+              arraySize: sizeof(*hostVertices)*_numAllocatedParticles*numVerticesPerParticle
+                 logger: logger];
+#if TRAILS_EN
+    GLuint numParticles = _numAllocatedParticles;
+    unsigned numElements = 2*numVerticesPerParticle*numParticles;
+    GLuint* elements = malloc(sizeof(*elements)*numElements);
+    GLuint* element  = elements;
+    for (GLuint slot = 0; slot < numVerticesPerParticle; slot++)
+    {
+        for (GLuint idx = 0; idx < numParticles; idx++)
+        {
+            *element++ = numVerticesPerParticle*idx + slot;
+            *element++ = numVerticesPerParticle*idx + (slot+1) % numVerticesPerParticle;
+        }
+    }
+    if ([array setElements: (GLubyte*) elements
+               numElements: numElements
+                  dataType: GL_UNSIGNED_INT
+                 arraySize: sizeof(*elements)*numElements
+                    logger: logger])
+        free(elements);
+#endif
+    return array;
+}
+
+
+#if PARTICLE_STREAMS_EN
+/** Grow the particle streams to hold a number of particles, keeping the particles there are
+    @param numParticles  The number of particles to allocate
+ */
+- (void) reserveStreams: (int) numParticles
+{
+    size_t n = numParticles;
+    cl_float2* newPositions     = gcl_malloc(sizeof(*newPositions)    *n, NULL, CL_MEM_READ_WRITE);
+    cl_float2* newPrevPositions = gcl_malloc(sizeof(*newPrevPositions)*n, NULL, CL_MEM_READ_WRITE);
+    cl_ushort* newAges          = gcl_malloc(sizeof(*newAges)         *n, NULL, CL_MEM_READ_WRITE);
+    cl_ushort* newMaxAges       = gcl_malloc(sizeof(*newMaxAges)      *n, NULL, CL_MEM_READ_WRITE);
+    cl_uint*   newExpired       = gcl_malloc(sizeof(*newExpired)      *n, NULL, CL_MEM_READ_WRITE);
+    if (!numExpired)
+    {
+        numExpired = gcl_malloc(sizeof(*numExpired), NULL, CL_MEM_READ_WRITE);
+    }
+    size_t keep = _numParticles;
+    if (positions && keep)
+    {
+        // Bring the particles there are over
+        dispatch_sync(_queue, ^{
+            gcl_memcpy(newPositions,     positions,     sizeof(*positions)    *keep);
+            gcl_memcpy(newPrevPositions, prevPositions, sizeof(*prevPositions)*keep);
+            gcl_memcpy(newAges,          ages,          sizeof(*ages)         *keep);
+            gcl_memcpy(newMaxAges,       maxAges,       sizeof(*maxAges)      *keep);
+        });
+    }
+    BW_gcl_free(positions);
+    BW_gcl_free(prevPositions);
+    BW_gcl_free(ages);
+    BW_gcl_free(maxAges);
+    BW_gcl_free(expired);
+    positions     = newPositions;
+    prevPositions = newPrevPositions;
+    ages          = newAges;
+    maxAges       = newMaxAges;
+    expired       = newExpired;
+}
+
+
+/** Upload the alias table of whichever field the time is nearer, if it isn't already.
+    This is called at the frame boundary, where the fields change.
+ */
+- (void) updateSpawnTable
+{
+    cl_float2* field = self.nextField && self.fieldTime >= 0.5f ? self.nextField : self.vectorField;
+    NSData* table;
+    @synchronized(self)
+    {
+        if (field == spawnField)
+            return;
+        spawnField = field;
+        table = field ? spawnTables[[NSValue valueWithPointer: field]] : nil;
+    }
+    size_t count = [table length] / sizeof(BWSpawnEntry);
+    if (count > spawnCapacity)
+    {
+        BW_gcl_free(spawnTable);
+        spawnTable    = gcl_malloc(sizeof(*spawnTable)*count, NULL, CL_MEM_READ_ONLY);
+        spawnCapacity = count;
+    }
+    if (count)
+    {
+        dispatch_sync(_queue, ^{
+            gcl_memcpy(spawnTable, [table bytes], sizeof(*spawnTable)*count);
+        });
+    }
+    // Without a table (or before it is ready), the particles are spawned uniformly
+    spawnCount = (cl_uint) count;
 }
+#endif
 
 
 /** This is used to change the number of particles in the animation
@@ -56,6 +159,8 @@
 - (void) setNumParticles : (int) numParticles
                    logger: (id<Logging>)     logger
 {
+    // The step in flight is moving the particles there are
+    [self finishStep];
     // Check for the easiest case first
     if (numParticles <= _numParticles)
     {
@@ -80,11 +185,19 @@
     }
     
     // Okay we have to allocate them them
+#if PIPELINE_EN
+    BW_gcl_free(drawVertices[0]);
+    BW_gcl_free(drawVertices[1]);
+#else
     if (vertices)
     {
         BW_gcl_free(vertices);
     }
+#endif
 
+#if PARTICLE_STREAMS_EN
+    [self reserveStreams: numParticles];
+#endif
     // Allocate the array of particle positions
     if (!hostVertices)
     {
@@ -107,11 +220,23 @@
     // The number of particles that
     _numParticles= _numAllocatedParticles;
 
+#if PIPELINE_EN
+    // First, create the openGL vertex arrays, one to draw while a step writes the other;
+    // next, map them into fit within openCL
+    for (int I = 0; I < 2; I++)
+    {
+        vertexArrays[I] = [self createVertexArray: logger];
+        drawVertices[I] = [vertexArrays[I] openCLBufferForPositions];
+    }
+    shader.vertices = vertexArrays[drawFront];
+    vertices        = drawVertices[drawFront];
+#else
     // First, create the openGL vertex array
-    [self createVertexArray:logger];
+    shader.vertices = [self createVertexArray:logger];
     
     // Next, map it into fit within openCL
     vertices = [shader.vertices openCLBufferForPositions];
+#endif
 
     // Randomize the new particles
     [self randomizeParticles: count];
@@ -123,6 +248,9 @@
  */
 - (void) randomizeParticles: (int) numParticles
 {
+    // The new particles are written to the buffer that is drawn, once the step writing
+    // the other has finished with the particles
+    [self finishStep];
     int maxNumParticles = _numParticles - nextParticleInit;
     if (maxNumParticles < numParticles)
     {
@@ -131,6 +259,10 @@
     
     // Dispatch the kernel block using one of the dispatch_ commands and the
     // queue created earlier.                                            // 5
+#if PARTICLE_STREAMS_EN
+    // The particles are spawned from the table of the field they will move in
+    [self updateSpawnTable];
+#endif
     if (numParticles > 0)
     dispatch_sync(_queue, ^{
         // The N-Dimensional Range over which we'd like to execute our
@@ -163,26 +295,235 @@
         }
         
         
+#if STATS_EN
+        cl_timer timer = gcl_start_timer();
+#endif
+#if PARTICLE_STREAMS_EN
+        // Spawn the particles, and draw them where they start
+        particleSpawn_kernel(&range
+                             , positions, prevPositions, ages, maxAges
+                             , numXBins, numYBins
+                             , self.seed, frame
+                             , PARTICLE_MIN_AGE, PARTICLE_MAX_AGE
+                             , spawnTable, spawnCount
+                             );
+#if TRAILS_EN
+        particleTrailStart_kernel(&range, positions, vertices, numVerticesPerParticle);
+#else
+        particleVertices_kernel(&range, positions, prevPositions, vertices);
+#endif
+#else
         // Perform the particle movement
         particleInit_kernel(&range
                            , vertices
-                           , numXBins, numYBins,
-                            seed
+                           , numXBins, numYBins
+                           , self.seed, frame
                             );
-        
+#endif
+#if STATS_EN
+        BWStatsAddTime(&stats, BWStageRespawn, gcl_stop_timer(timer));
+#endif
     });
+    BWStatsCount(&stats, frameInit, numParticles);
 }
 
 
-/// Update the animation
-- (void) animationStep
+/** Wait for the step in flight, if there is one, and make the buffer it wrote the one that
+    is drawn.  This is the fence between the steps running in the background and everything
+    else that touches the particles, the vertex buffers or the fields.
+
+    gcl has completed the openCL commands of a block by the time the block has finished, so
+    once the group is done the lines are in the buffer, ready to draw.  The other way, the
+    plugin flushes the GL commands each frame, so openCL waits for the draw reading a buffer
+    to finish before the next step writes it.
+ */
+- (void) finishStep
 {
-    if (!self.vectorField)
+#if PIPELINE_EN
+    if (!stepPending)
         return;
-    [self randomizeParticles: 100];
-    // Dispatch the kernel block using one of the dispatch_ commands and the
-    // queue created earlier.                                            // 5
+    dispatch_group_wait(stepGroup, DISPATCH_TIME_FOREVER);
+    stepPending = false;
+    drawFront       = 1 - drawFront;
+    vertices        = drawVertices[drawFront];
+    shader.vertices = vertexArrays[drawFront];
+#if TRAILS_EN
+    ringHead        = stepRingHead;
+#endif
+    [self noteStep];
+#endif
+}
+
+
+/// Add the times and count of the step that finished to the statistics
+- (void) noteStep
+{
+#if STATS_EN
+    BWStatsAddTime(&stats, BWStageStep, stepSeconds);
+    if (stepRespawnSeconds > 0.0)
+        BWStatsAddTime(&stats, BWStageRespawn, stepRespawnSeconds);
+    BWStatsCount(&stats, frameMove, stepRespawned);
+#endif
+    stepSeconds        = 0.0;
+    stepRespawnSeconds = 0.0;
+    stepRespawned      = 0;
+}
+
+
+/** Run a step on _queue
+    @param step  The step; it is given the vertex buffer to write the lines to
+
+    With PIPELINE_EN, the step is run in the background, writing the vertex buffer that
+    isn't being drawn, and this returns straight away; finishStep waits for it.  Otherwise
+    it is run in the foreground, writing the one vertex buffer.
+ */
+- (void) dispatchStep: (void (^)(cl_float2* target)) step
+{
+#if PIPELINE_EN
+    cl_float2* target = drawVertices[1 - drawFront];
+    stepPending = true;
+    dispatch_group_async(stepGroup, _queue, ^{
+        step(target);
+    });
+#else
+    cl_float2* target = vertices;
     dispatch_sync(_queue, ^{
+        step(target);
+    });
+    [self noteStep];
+#endif
+}
+
+
+/// Update the animation
+- (void) animationStep
+{
+    [self animationSteps: 1];
+}
+
+
+/** Update the animation for the time that has passed, at a fixed STEPS_PER_SECOND
+    @param seconds  The time since the last call
+    @returns The number of steps taken; 0 if not a whole step has passed yet
+
+    The steps are worked out by BWStepsForTime() (BWCPUTypes.h), the same as BWCPUGrid,
+    and taken in the one dispatch.
+ */
+- (int) advanceTime: (double) seconds
+{
+    int numSteps = BWStepsForTime(&stepBacklog, seconds);
+    if (numSteps)
+        [self animationSteps: numSteps];
+    return numSteps;
+}
+
+
+#if PARTICLE_STREAMS_EN
+/** Move the particle streams by a number of steps, respawning the ones that expire, and
+    write the lines to the vertex buffer
+    @param numSteps  The number of steps to take
+
+    Each step is particleAdvance over all of the particles, which lists the ones that
+    expired, and particleRespawn over just those; the count is read back between them to
+    size the second dispatch.  With TRAILS_EN, each step then writes its slot of the rings
+    with particleTrail; otherwise the lines are written once, after the last step.
+ */
+- (void) advanceStreams: (int) numSteps
+{
+    // What the step reads is taken now, so that the fields can move on while it is in flight
+    cl_uint    numParticles = _numParticles;
+    cl_float2* field        = self.vectorField;
+    // With only the one field, blend it with itself
+    cl_float2* next         = self.nextField ? self.nextField : self.vectorField;
+    float      time         = self.nextField ? self.fieldTime : 0.0f;
+    cl_uint    first        = frame;
+    cl_uint2*  table        = spawnTable;
+    cl_uint    tableCount   = spawnCount;
+#if TRAILS_EN
+    cl_float2* front        = vertices;
+#endif
+    [self dispatchStep: ^(cl_float2* target) {
+        cl_ndrange range = {1, {0, 0, 0}, {numParticles, 0, 0}, {0, 0, 0}};
+#if TRAILS_EN
+        // The steps add to the rings, so they carry on from the buffer being drawn
+        if (target != front)
+            gcl_memcpy(target, front, sizeof(*target)*numVerticesPerParticle*numParticles);
+#endif
+        for (int step = 0; step < numSteps; step++)
+        {
+            cl_uint count = 0;
+            gcl_memcpy(numExpired, &count, sizeof(count));
+#if STATS_EN
+            cl_timer timer = gcl_start_timer();
+#endif
+            particleAdvance_kernel(&range
+                                   , positions, prevPositions, ages, maxAges
+                                   , STEP_DT
+                                   , numXBins, numYBins
+                                   , field, next, time
+                                   , expired, numExpired
+                                   );
+#if STATS_EN
+            stepSeconds += gcl_stop_timer(timer);
+#endif
+            gcl_memcpy(&count, numExpired, sizeof(count));
+            if (count)
+            {
+#if STATS_EN
+                timer = gcl_start_timer();
+#endif
+                cl_ndrange respawnRange = {1, {0, 0, 0}, {count, 0, 0}, {0, 0, 0}};
+                particleRespawn_kernel(&respawnRange
+                                       , expired
+                                       , positions, prevPositions, ages, maxAges
+                                       , numXBins, numYBins
+                                       , self.seed, first + step
+                                       , PARTICLE_MIN_AGE, PARTICLE_MAX_AGE
+                                       , table, tableCount
+                                       );
+#if STATS_EN
+                stepRespawnSeconds += gcl_stop_timer(timer);
+#endif
+                stepRespawned += count;
+            }
+#if TRAILS_EN
+            // Add the step to the rings; the respawned (or wrapped) particles start theirs over
+            particleTrail_kernel(&range, positions, prevPositions, target
+                                 , numVerticesPerParticle, (first + step) % numVerticesPerParticle);
+#endif
+        }
+#if !TRAILS_EN
+        // Write the lines to the vertex buffer, once the particles have taken all of the steps
+        particleVertices_kernel(&range, positions, prevPositions, target);
+#endif
+    }];
+#if TRAILS_EN
+    // The slot of the rings that the last of the steps writes, and so where they wrap
+    cl_uint head = (first + numSteps - 1) % numVerticesPerParticle;
+#if PIPELINE_EN
+    stepRingHead = head;
+#else
+    ringHead     = head;
+#endif
+#endif
+}
+#else
+
+
+/** Move the particles by a number of steps, respawning a few of them, in one dispatch
+    @param numSteps  The number of steps to take
+ */
+- (void) moveParticles: (int) numSteps
+{
+    // What the step reads is taken now, so that the fields can move on while it is in flight
+    cl_uint    numParticles = _numParticles;
+    cl_float2* field        = self.vectorField;
+    // With only the one field, blend it with itself
+    cl_float2* next         = self.nextField ? self.nextField : self.vectorField;
+    float      time         = self.nextField ? self.fieldTime : 0.0f;
+    cl_uint    first        = frame;
+    cl_float2* front        = vertices;
+    [self dispatchStep: ^(cl_float2* target) {
         // The N-Dimensional Range over which we'd like to execute our
         // kernel.  In this case, we're operating on a 1D buffer, so
         // it makes sense that the range is 1D.
@@ -193,7 +534,7 @@
             // that all the data is processed, this is 0
             // in the test case.                   // 7
             
-            {_numParticles, 0, 0},    // The global range—this is how many items
+            {numParticles, 0, 0},    // The global range—this is how many items
             // IN TOTAL in each dimension you want to
             // process.
             
@@ -206,15 +547,56 @@
             // NUM_VALUE / wgs workgroups.
         };
 
+        // The tail/head pairs are the particles, so they carry on from the buffer being drawn
+        if (target != front)
+            gcl_memcpy(target, front, sizeof(*target)*numVerticesPerParticle*numParticles);
+#if STATS_EN
+        cl_timer timer = gcl_start_timer();
+#endif
         // Perform the particle movement
         particleMove_kernel(&range
-                            , vertices
-                            , 0.0900f
+                            , target
+                            , STEP_DT
                             , numXBins, numYBins
-                            , self.vectorField
-                            , seed
+                            , field, next, time
+                            , self.seed, first
+                            , numSteps
+                            , respawnCount
                             );
-    });
+#if STATS_EN
+        stepSeconds += gcl_stop_timer(timer);
+        // Read back the count of the respawned particles, and clear it for the next step
+        cl_uint numRespawned = 0;
+        gcl_memcpy(&numRespawned, respawnCount, sizeof(numRespawned));
+        cl_uint zero = 0;
+        gcl_memcpy(respawnCount, &zero, sizeof(zero));
+        stepRespawned += numRespawned;
+#endif
+    }];
+}
+#endif
+
+
+/** Update the animation by a number of steps, in one dispatch
+    @param numSteps  The number of steps to take
+ */
+- (void) animationSteps: (int) numSteps
+{
+    // The step in flight has to finish before the next one is started from where it left off
+    [self finishStep];
+    // This is the frame boundary, where a replacement field can be swapped in
+    [self swapReplacementField];
+    if (!self.vectorField || numSteps < 1)
+        return;
+#if PARTICLE_STREAMS_EN
+    // The particles are respawned as they expire, rather than a few each step
+    [self updateSpawnTable];
+    [self advanceStreams: numSteps];
+#else
+    [self randomizeParticles: 100*numSteps];
+    [self moveParticles: numSteps];
+#endif
+    frame += numSteps;
 }
 
 @end
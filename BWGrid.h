@@ -28,9 +28,18 @@
 #import <OpenCL/opencl.h>
 #import "BWGLVertexArray.h"
 #import "BWGLShader.h"
+#import "AppConfig.h"
+#include "BWStats.h"
+@class BWGLTexturePool;
 
 #define FormatCL CL_BGRA
+/// The particle streams keep a ring of TRAIL_LENGTH positions each, drawn as a trail
+#define TRAILS_EN (PARTICLE_STREAMS_EN && TRAIL_LENGTH > 2)
+#if TRAILS_EN
+#define numVerticesPerParticle (TRAIL_LENGTH)
+#else
 #define numVerticesPerParticle (2)
+#endif
 
 @interface BWGrid: NSObject
 {
@@ -52,6 +61,51 @@
     /// The CPU accessible vertices
     cl_float2* hostVertices;
 
+#if PIPELINE_EN
+    /// The two vertex buffers (openCL) and their GL vertex arrays: a step writes the one
+    /// that isn't drawFront while drawFront is drawn.  vertices is always drawFront
+    cl_float2*       drawVertices[2];
+    BWGLVertexArray* vertexArrays[2];
+    int              drawFront;
+    /// The step in flight is dispatched to _queue in this group; waiting on it is the fence
+    /// before its buffer is drawn, or the particles or fields are touched again
+    dispatch_group_t stepGroup;
+    bool             stepPending;
+#endif
+    /// The time the last step took moving and respawning the particles, and the number it
+    /// respawned: written on _queue, and added to stats once the step has finished
+    double     stepSeconds;
+    double     stepRespawnSeconds;
+    cl_uint    stepRespawned;
+
+    /// The particle streams, with PARTICLE_STREAMS_EN: where each particle is, where it was
+    /// a step ago, its age and its lifetime (accessible in openCL only).  vertices is then
+    /// only the draw buffer, written from these after they move
+    cl_float2* positions;
+    cl_float2* prevPositions;
+    cl_ushort* ages;
+    cl_ushort* maxAges;
+    /// The particles that expired in a step, and the number of them (openCL only)
+    cl_uint*   expired;
+    cl_uint*   numExpired;
+#if TRAILS_EN
+    /// With TRAILS_EN, vertices is a ring of numVerticesPerParticle positions for each particle,
+    /// and step f writes slot f % numVerticesPerParticle of it.  This is the slot that the last
+    /// step to write the buffer being drawn wrote; the step in flight's is stepRingHead
+    cl_uint    ringHead;
+    cl_uint    stepRingHead;
+#endif
+
+    /// The alias tables the particle streams are spawned from, built along with each field:
+    /// NSData of BWSpawnEntry, by the field's buffer (guarded by @synchronized)
+    NSMutableDictionary* spawnTables;
+    /// The alias table in use (openCL only), the number of entries in it (0 to spawn
+    /// uniformly), the number it has room for, and the field it was built with
+    cl_uint2*  spawnTable;
+    cl_uint    spawnCount;
+    size_t     spawnCapacity;
+    cl_float2* spawnField;
+
     /// The GL vertex and fragment shader that shades the particles
     BWGLShader* shader;
     /// The parameter access to the shader input variables
@@ -67,8 +121,35 @@
     /// The next particle to initialize
     int nextParticleInit;
 
-    /// The seed for the random steps
-    cl_ulong* seed;
+    /// The number of animation steps; this and the seed select the random numbers
+    cl_uint frame;
+
+    /// The time passed that hasn't been stepped yet, in seconds
+    double stepBacklog;
+
+    /// The queue that the next time step's field is built on, in the background
+    dispatch_queue_t prefetchQueue;
+    /// The field built in the background, waiting for advanceField (guarded by @synchronized)
+    cl_float2* prefetchedField;
+    /// The field built in the background, to be swapped in at the next frame (guarded by @synchronized)
+    cl_float2* replacementField;
+    /// A retired field buffer, kept for the next build (guarded by @synchronized)
+    cl_float2* spareField;
+    /// The references (BWCachedField*) to the fields that came from the cache, by their
+    /// buffers, which are shared and so never reused (guarded by @synchronized)
+    NSMutableDictionary* cachedFields;
+
+    /// The two textures the trails are accumulated in, from one frame to the next (0 until used)
+    GLuint trailTextures[2];
+    /// The pool the trail textures were taken from
+    BWGLTexturePool* trailPool;
+    /// Which of trailTextures holds the last frame
+    int trailFront;
+
+    /// The timings of the stages, and the respawn counts
+    BWStats stats;
+    /// The number of particles particleMove respawned, read back and cleared each step (openCL only)
+    cl_uint* respawnCount;
 }
 
 /// The width of the texture.  This may be smaller than numXBins.
@@ -76,10 +157,33 @@
 /// The height of the texture.  This may be smaller than numYBins.
 @property int height;
 
+/// The seed for the random steps.  A given seed always produces the same particles
+@property cl_ulong seed;
+
 /// The vectors in space, organized as bins in a rectilinear grid
 /// Each vector is represented as unit direction, and magnitude.
 @property cl_float2* vectorField;
 
+/// The vectors at the next time step; NULL if there is only the one field
+@property cl_float2* nextField;
+
+/// How far from vectorField to nextField the particles are moved, from 0 to 1
+@property float fieldTime;
+
+/// The pool that the frames are drawn into; one is made if this is nil or the wrong size
+@property BWGLTexturePool* texturePool;
+
+/// The fraction of the last frame that is kept under the new one, from 0 to 1.  0 (the default)
+/// clears each frame; otherwise the frames are accumulated into trails that fade by this much
+@property float trailFade;
+
+/** The timings of the stages, and the respawn counts.  The plugin adds the draw, flush
+    and frame times, and closes off each frame with BWStatsEndFrame
+    @returns The statistics.  The field builds add to them from the prefetch queue while
+             holding @synchronized on the grid, so hold that too when reading them
+ */
+- (BWStats*) stats;
+
 /** Initialize the simuluation with a gien number of particles
     @param numParticles  The number of particles in the simulations
     @param width         The number of bins wide
@@ -25,6 +25,7 @@
 
 #import "BWGrid.h"
 #import "BWGrid-Animate.h"
+#import "BWGrid+build.h"
 #import "BWGrid+GLRender.h"
 #import "BWGLParameter.h"
 
@@ -80,6 +81,31 @@ unsigned long upper_power_of_two(unsigned long v)
         return nil;
     }
 
+    // The next time step is built on a queue of its own, so it doesn't hold up the frames
+    prefetchQueue = dispatch_queue_create("BWGrid.prefetch", DISPATCH_QUEUE_SERIAL);
+#if PIPELINE_EN
+    // The steps are run in the background, a frame ahead of the drawing
+    stepGroup     = dispatch_group_create();
+#endif
+    cachedFields  = [NSMutableDictionary dictionary];
+
+    BWStatsInit(&stats);
+#if PARTICLE_STREAMS_EN
+    // Until a field's table is uploaded, the particles are spawned uniformly
+    spawnTables   = [NSMutableDictionary dictionary];
+    spawnTable    = gcl_malloc(sizeof(*spawnTable), NULL, CL_MEM_READ_ONLY);
+    spawnCapacity = 1;
+    spawnCount    = 0;
+#endif
+#if STATS_EN && !PARTICLE_STREAMS_EN
+    // particleMove counts the particles it respawns into this
+    respawnCount = gcl_malloc(sizeof(*respawnCount), NULL, CL_MEM_READ_WRITE);
+    cl_uint zero = 0;
+    dispatch_sync(_queue, ^{
+        gcl_memcpy(respawnCount, &zero, sizeof(zero));
+    });
+#endif
+
 #if 0
     // Print the openCL device name and vendor
     char name_buf[128];
@@ -106,9 +132,6 @@ unsigned long upper_power_of_two(unsigned long v)
     [logger logMessage:LogPrefix @"%d x %d w/ %d particles", width, height, numParticles];
 #endif
 
-    // Allocate the seed
-    seed =gcl_malloc(sizeof(*seed), NULL, CL_MEM_READ_WRITE);
-
     // Load the shader program
     [self loadShaders: logger];
     
@@ -125,18 +148,55 @@ unsigned long upper_power_of_two(unsigned long v)
 }
 
 
+- (BWStats*) stats
+{
+    return &stats;
+}
+
+
 - (void)dealloc
 {
+    // Let the step in flight finish with the buffers
+    [self finishStep];
+    [self deleteTrails];
     BW_free(hostVertices);
-    BW_gcl_free(seed);
-    BW_gcl_free(self.vectorField);
+    // The fields from the cache are released to it, rather than freed
+    [self releaseField: self.vectorField];
+    [self releaseField: self.nextField];
+    [self releaseField: prefetchedField];
+    [self releaseField: replacementField];
+    BW_gcl_free(spareField);
+#if PIPELINE_EN
+    // vertices is one of these
+    BW_gcl_free(drawVertices[0]);
+    BW_gcl_free(drawVertices[1]);
+#else
     BW_gcl_free(vertices);
+#endif
+    BW_gcl_free(respawnCount);
+    BW_gcl_free(positions);
+    BW_gcl_free(prevPositions);
+    BW_gcl_free(ages);
+    BW_gcl_free(maxAges);
+    BW_gcl_free(expired);
+    BW_gcl_free(numExpired);
+    BW_gcl_free(spawnTable);
 #if !defined(OS_OBJECT_USE_OBJC_RETAIN_RELEASE) || !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
     // Finally, release your queue just as you would any GCD queue.
     if (_queue)
     {
         dispatch_release(_queue);
     }
+    if (prefetchQueue)
+    {
+        dispatch_release(prefetchQueue);
+    }
+#if PIPELINE_EN
+    if (stepGroup)
+    {
+        dispatch_release(stepGroup);
+    }
+#endif
 #endif
 }
 
@@ -0,0 +1,154 @@
+/*
+    BWAdvectBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Measures the throughput of each version of particleMove, in particles per second,
+    with one field, and blending between two time steps; and of the particle streams
+    (particleAdvance, the batched particleRespawn, and particleWriteVertices), with how
+    many particles they respawn each step, spawned uniformly and from the alias table.
+
+    usage: BWAdvectBench [numParticles [width height [numSteps]]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWParticleMove.h"
+
+
+int main(int argc, char** argv)
+{
+    int numParticles = argc > 1 ? atoi(argv[1]) : 256000;
+    int width        = argc > 3 ? atoi(argv[2]) : 1440;
+    int height       = argc > 3 ? atoi(argv[3]) : 1440;
+    int numSteps     = argc > 4 ? atoi(argv[4]) : 200;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    syntheticField(header, u, v);
+    BWCPUGrid grid(numParticles, width, height, 1);
+    if (!grid.interpretData(header, u.data(), v.data(), width / 5000.0f))
+    {
+        return 1;
+    }
+    // A second time step, for the blended runs: the same winds turned around
+    std::vector<float> u1(u.size()), v1(v.size());
+    for (size_t i = 0; i < u.size(); i++)
+    {
+        u1[i] = -v[i];
+        v1[i] =  u[i];
+    }
+    if (!grid.prefetchData(header, u1.data(), v1.data(), width / 5000.0f) || !grid.advanceField(true))
+    {
+        return 1;
+    }
+    std::vector<BWFloat2> start(grid.vertices(), grid.vertices() + numVerticesPerParticle*numParticles);
+
+    printf("%d particles, %d x %d field, %d steps\n", numParticles, width, height, numSteps);
+    BWParticleMoveISA best = particleMoveBestISA();
+    for (int blended = 0; blended < 2; blended++)
+    {
+        // The blended runs sweep the time from t0 to t1
+        BWFloat2 const* nextField = blended ? grid.nextField() : NULL;
+        std::vector<BWFloat2> reference;
+        for (int isa = BWParticleMoveScalar; isa <= best; isa++)
+        {
+            std::vector<BWFloat2> vertices(start);
+            double t0 = benchSeconds();
+            for (int step = 0; step < numSteps; step++)
+            {
+                particleMoveISA((BWParticleMoveISA) isa, vertices.data(), STEP_DT
+                                , width, height, grid.vectorField(), nextField, (float) step / numSteps
+                                , 1, step, 0, numParticles);
+            }
+            double seconds = benchSeconds() - t0;
+
+            // Each version should get exactly the same answer as the scalar one
+            char const* check = "reference";
+            if (reference.empty())
+                reference = vertices;
+            else
+                check = memcmp(reference.data(), vertices.data(), sizeof(BWFloat2)*vertices.size()) ? "MISMATCH" : "matches scalar";
+            printf("%-8s %-7s %10.1f Mparticles/s  %s\n", particleMoveISAName((BWParticleMoveISA) isa)
+                   , blended ? "blended" : "", (double) numParticles*numSteps/seconds/1e6, check);
+        }
+
+        // The particle streams: each step moves them, respawns the ones that expired, and
+        // writes the draw buffer
+        BWPackedField field = {BWFieldStorageFloat, grid.vectorField(), NULL, BWFieldLayoutRows, 0};
+        BWPackedField next  = {BWFieldStorageFloat, grid.nextField(),   NULL, BWFieldLayoutRows, 0};
+        // The spawns from the alias table should respawn fewer of them each step
+        BWSpawnTable table = grid.spawnTable();
+        for (int weighted = 0; weighted < 2; weighted++)
+        {
+            BWSpawnTable const* spawn = weighted ? &table : NULL;
+            reference.clear();
+            for (int isa = BWParticleMoveScalar; isa <= best; isa++)
+            {
+                std::vector<BWFloat2> position(numParticles), prevPosition(numParticles), vertices(start.size());
+                std::vector<uint16_t> age(numParticles), maxAge(numParticles);
+                std::vector<uint32_t> expired(numParticles);
+                BWParticleStreams particles = {position.data(), prevPosition.data(), age.data(), maxAge.data()};
+                particleSpawn(&particles, width, height, 1, 0, PARTICLE_MIN_AGE, PARTICLE_MAX_AGE, spawn, 0, numParticles);
+                std::vector<int> respawned;
+                double t0 = benchSeconds();
+                for (int step = 0; step < numSteps; step++)
+                {
+                    int count = particleAdvanceISA((BWParticleMoveISA) isa, &particles, STEP_DT, width, height
+                                                   , &field, blended ? &next : NULL, (float) step / numSteps
+                                                   , expired.data(), 0, numParticles);
+                    particleRespawn(&particles, expired.data(), count, width, height, 1, step
+                                    , PARTICLE_MIN_AGE, PARTICLE_MAX_AGE, spawn);
+                    particleWriteVertices(&particles, vertices.data(), 0, numParticles);
+                    respawned.push_back(count);
+                }
+                double seconds = benchSeconds() - t0;
+
+                char const* check = "reference";
+                if (reference.empty())
+                    reference = vertices;
+                else
+                    check = memcmp(reference.data(), vertices.data(), sizeof(BWFloat2)*vertices.size()) ? "MISMATCH" : "matches scalar";
+                // How even the respawns are, after the first step (which culls the slow ones)
+                double mean = 0.0, var = 0.0;
+                for (int step = 1; step < numSteps; step++)
+                    mean += respawned[step];
+                mean /= std::max(numSteps-1, 1);
+                for (int step = 1; step < numSteps; step++)
+                    var += (respawned[step] - mean)*(respawned[step] - mean);
+                printf("%-8s %-7s %10.1f Mparticles/s  %s  streams, %-7s spawn, respawned/step %.0f sd %.0f\n"
+                       , particleMoveISAName((BWParticleMoveISA) isa), blended ? "blended" : ""
+                       , (double) numParticles*numSteps/seconds/1e6, check
+                       , spawn ? "table" : "uniform", mean, sqrt(var / std::max(numSteps-1, 1)));
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+    BWBenchCounters.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <string.h>
+#include "BWBenchCounters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** Open a counter for this thread, and the threads it starts
+    @param type    The type of event (PERF_TYPE_*)
+    @param config  The event
+    @returns The file descriptor of the counter, or -1 if it isn't there
+ */
+static int openCounter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.inherit        = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/// The config of a read miss in one of the caches
+#define CacheReadMiss(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+
+BWBenchCounters::BWBenchCounters()
+{
+    for (int i = 0; i < NumEvents; i++)
+    {
+        fds[i]     = -1;
+        counted[i] = false;
+        values[i]  = 0;
+    }
+}
+
+
+BWBenchCounters::~BWBenchCounters()
+{
+    stop();
+}
+
+
+/// Open the counters, and start counting from zero
+void BWBenchCounters::start()
+{
+    stop();
+#if defined(__linux__)
+    fds[L1DMisses]  = openCounter(PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_L1D));
+    fds[LLCMisses]  = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[DTLBMisses] = openCounter(PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_DTLB));
+    fds[PageFaults] = openCounter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+#endif
+    for (int i = 0; i < NumEvents; i++)
+    {
+        counted[i] = false;
+        values[i]  = 0;
+    }
+}
+
+
+/// Stop counting, and read the counts
+void BWBenchCounters::stop()
+{
+#if defined(__linux__)
+    for (int i = 0; i < NumEvents; i++)
+    {
+        if (fds[i] < 0)
+            continue;
+        uint64_t value = 0;
+        if (sizeof(value) == read(fds[i], &value, sizeof(value)))
+        {
+            values[i]  = value;
+            counted[i] = true;
+        }
+        close(fds[i]);
+        fds[i] = -1;
+    }
+#endif
+}
+
+
+/** The short name of the event, for the reports
+    @param event  The event
+    @returns The name
+ */
+char const* BWBenchCounters::name(Event event)
+{
+    switch (event)
+    {
+        case L1DMisses : return "L1D miss";
+        case LLCMisses : return "LLC miss";
+        case DTLBMisses: return "dTLB miss";
+        case PageFaults: return "faults";
+        default        : return "";
+    }
+}
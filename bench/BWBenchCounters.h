@@ -0,0 +1,76 @@
+/*
+    BWBenchCounters.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWBenchCounters_h
+#define BWBenchCounters_h
+
+#include <stdint.h>
+
+/** Counts the cache and TLB misses of a stretch of the benchmark, with the kernel's
+    performance counters (perf_event_open; Linux only).
+
+    The counts cover the thread that calls start(), and the threads it starts after
+    that -- so a benchmark should make its thread pool after start(), and let it go
+    before stop().  A counter the CPU (or virtual machine) doesn't have is left out.
+ */
+class BWBenchCounters
+{
+public:
+    /// The events that are counted
+    enum Event
+    {
+        /// Reads that missed the L1 data cache
+        L1DMisses,
+        /// Accesses that missed the last level cache
+        LLCMisses,
+        /// Reads that missed the data TLB
+        DTLBMisses,
+        /// Page faults (a software event, so always there)
+        PageFaults,
+        NumEvents
+    };
+
+    BWBenchCounters();
+    ~BWBenchCounters();
+
+    /// Open the counters, and start counting from zero
+    void start();
+    /// Stop counting, and read the counts
+    void stop();
+
+    /// True if the event could be counted
+    bool available(Event event) const { return fds[event] >= 0 || counted[event]; }
+    /// The count, from the last start() to stop()
+    uint64_t value(Event event) const { return values[event]; }
+    /// The short name of the event, for the reports
+    static char const* name(Event event);
+
+private:
+    int      fds[NumEvents];
+    bool     counted[NumEvents];
+    uint64_t values[NumEvents];
+};
+
+#endif
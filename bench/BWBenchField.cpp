@@ -0,0 +1,103 @@
+/*
+    BWBenchField.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "BWBenchField.h"
+#include "BWEarthJSON.h"
+#include "BWFieldFile.h"
+
+/** Make a synthetic u/v field for the benchmarks
+    @param header  Receives the size and spacing of the grid
+    @param u       Receives the u components
+    @param v       Receives the v components
+    @param nx      The number of grid points W-E
+    @param ny      The number of grid points N-S
+ */
+void syntheticField(BWFieldHeader& header, std::vector<float>& u, std::vector<float>& v
+                    , uint32_t nx, uint32_t ny)
+{
+    header.delta.x  = 360.0f / nx;
+    header.delta.y  = 180.0f / (ny-1);
+    header.origin.x = 0.0f;
+    header.origin.y = 90.0f;
+    header.srcSize.x = nx;
+    header.srcSize.y = ny;
+    u.resize(nx*ny);
+    v.resize(nx*ny);
+    for (uint32_t j = 0; j < ny; j++)
+    {
+        for (uint32_t i = 0; i < nx; i++)
+        {
+            float lon = i * header.delta.x * 0.0174533f, lat = (90.0f - j * header.delta.y) * 0.0174533f;
+            u[j*nx+i] = 12.0f*cosf(3.0f*lat) + 6.0f*sinf(4.0f*lon)*cosf(lat);
+            v[j*nx+i] =  8.0f*sinf(3.0f*lon)*cosf(2.0f*lat);
+        }
+    }
+}
+
+
+/** Read a recorded u/v field for the benchmarks
+    @param path    The .bwvf or earth JSON file
+    @param header  Receives the size and spacing of the grid
+    @param u       Receives the u components
+    @param v       Receives the v components
+    @returns true on success, false on failure (logged)
+ */
+bool loadField(char const* path, BWFieldHeader& header, std::vector<float>& u, std::vector<float>& v)
+{
+    size_t length = strlen(path), extLength = strlen(BWFieldFileExtension);
+    if (length > extLength && !strcmp(path + length - extLength, BWFieldFileExtension))
+    {
+        BWFieldFile file;
+        if (!BWFieldFileOpen(path, &file))
+            return false;
+        size_t count = (size_t) file.header.srcSize.x*file.header.srcSize.y;
+        header = file.header;
+        u.assign(file.uData, file.uData + count);
+        v.assign(file.vData, file.vData + count);
+        BWFieldFileClose(&file);
+        return true;
+    }
+
+    float* uData = NULL, *vData = NULL;
+    if (!BWEarthJSONRead(path, &header, &uData, &vData))
+        return false;
+    size_t count = (size_t) header.srcSize.x*header.srcSize.y;
+    u.assign(uData, uData + count);
+    v.assign(vData, vData + count);
+    free(uData);
+    free(vData);
+    return true;
+}
+
+
+/// The time, in seconds, since some fixed point
+double benchSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
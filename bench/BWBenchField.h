@@ -0,0 +1,57 @@
+/*
+    BWBenchField.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWBenchField_h
+#define BWBenchField_h
+
+#include <vector>
+#include "BWCPUTypes.h"
+
+/** Make a synthetic u/v field for the benchmarks
+    @param header  Receives the size and spacing of the grid
+    @param u       Receives the u components
+    @param v       Receives the v components
+    @param nx      The number of grid points W-E
+    @param ny      The number of grid points N-S
+
+    This is a global grid (1 degree by default) with a few vortices in it, so that
+    the particles wrap, respawn and go out of bounds like they do with real data.
+ */
+void syntheticField(BWFieldHeader& header, std::vector<float>& u, std::vector<float>& v
+                    , uint32_t nx = 360, uint32_t ny = 181);
+
+/** Read a recorded u/v field for the benchmarks
+    @param path    The .bwvf or earth JSON file
+    @param header  Receives the size and spacing of the grid
+    @param u       Receives the u components
+    @param v       Receives the v components
+    @returns true on success, false on failure (logged)
+ */
+bool loadField(char const* path, BWFieldHeader& header, std::vector<float>& u, std::vector<float>& v);
+
+/// The time, in seconds, since some fixed point
+double benchSeconds();
+
+#endif
@@ -0,0 +1,412 @@
+/*
+    BWBenchSuite.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Times each stage of the pipeline -- gridBuild, gridInterpolate, the two fused as
+    gridBuildField, particleInit, particleMove and drawing the frame -- on its own, across the particle counts and
+    image sizes the plug-in allows (up to 256000 particles and 2048 x 2048), with the
+    synthetic field and any recorded fields given.  The results are written as JSON,
+    with the percentiles of the times; given the results of an earlier run, it flags
+    the stages that have got slower.
+
+    usage: BWBenchSuite [-quick] [-reps n] [-o results.json] [-compare baseline.json
+                        [-threshold 0.1]] [field.bwvf | field.json ...]
+
+    The exit status is 1 if any stage regressed against the baseline.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWGridBuild.h"
+#include "BWParticleMove.h"
+#include "BWRaster.h"
+
+/// The number of rows each piece of the field build does
+#define ROW_CHUNK (16)
+/// The number of particles each piece of particleInit does
+#define INIT_CHUNK (16384)
+
+
+/// The times of one stage, for one field, size and particle count
+struct Result
+{
+    std::string field;
+    std::string stage;
+    int    width;
+    int    height;
+    int    particles;
+    int    samples;
+    double mean, min, p50, p90, p99;
+};
+
+
+/** Summarize the times of a stage
+    @param result  Receives the statistics, in milliseconds
+    @param times   The times, in seconds
+ */
+static void summarize(Result& result, std::vector<double> times)
+{
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (double t : times)
+        sum += t;
+    // The nearest rank
+    auto percentile = [&](double p)
+    {
+        size_t rank = (size_t) ceil(p/100.0 * times.size());
+        return 1e3*times[rank ? rank-1 : 0];
+    };
+    result.samples = (int) times.size();
+    result.mean = 1e3*sum/times.size();
+    result.min  = 1e3*times.front();
+    result.p50  = percentile(50);
+    result.p90  = percentile(90);
+    result.p99  = percentile(99);
+}
+
+
+/** Add a result, and note it on stderr as it goes
+    @param results  The results so far
+    @param result   The new one
+ */
+static void add(std::vector<Result>& results, Result const& result)
+{
+    fprintf(stderr, "%-10s %-16s %5d x %-5d %7d  p50 %9.3f ms  p99 %9.3f ms\n"
+            , result.field.c_str(), result.stage.c_str(), result.width, result.height
+            , result.particles, result.p50, result.p99);
+    results.push_back(result);
+}
+
+
+/** Time the stages for a field
+    @param results     The results to add to
+    @param name        The name of the field
+    @param header      The size and spacing of the grid
+    @param u           The u components
+    @param v           The v components
+    @param sizes       The image sizes (the same wide and high)
+    @param counts      The particle counts
+    @param reps        The number of times to time each stage
+ */
+static void benchField(std::vector<Result>& results, std::string const& name
+                       , BWFieldHeader const& header, std::vector<float> const& u, std::vector<float> const& v
+                       , std::vector<int> const& sizes, std::vector<int> const& counts, int reps)
+{
+    BWThreadPool& pool = *BWThreadPool::shared();
+    BWUInt2 srcSize = header.srcSize;
+    bool isContinuous = floor(srcSize.x * header.delta.x) >= 360;
+    uint32_t srcStride = srcSize.x + (isContinuous ? 1 : 0);
+    std::vector<BWFloat2> srcField((size_t) srcStride*srcSize.y);
+
+    // gridBuild only depends on the data
+    std::vector<double> times;
+    for (int rep = 0; rep < reps; rep++)
+    {
+        double t0 = benchSeconds();
+        pool.parallelFor(srcSize.y, ROW_CHUNK, [&](size_t begin, size_t end)
+        {
+            gridBuild(u.data(), v.data(), srcSize, isContinuous, srcField.data(), (uint32_t) begin, (uint32_t) end);
+        });
+        times.push_back(benchSeconds() - t0);
+    }
+    Result result = {name, "gridBuild", (int) srcSize.x, (int) srcSize.y, 0, 0, 0, 0, 0, 0, 0};
+    summarize(result, times);
+    add(results, result);
+
+    BWUInt2  rotatedSize = {srcStride, srcSize.y};
+    BWFloat2 origin      = {header.origin.x + 90.0f, header.origin.y};
+    for (int size : sizes)
+    {
+        float velocityScale = size / 5000.0f;
+        BWUInt2 tgtSize = {(uint32_t) size, (uint32_t) size};
+        std::vector<BWFloat2> tgtField((size_t) size*size);
+        times.clear();
+        for (int rep = 0; rep < reps; rep++)
+        {
+            double t0 = benchSeconds();
+            pool.parallelFor(size, ROW_CHUNK, [&](size_t begin, size_t end)
+            {
+                gridInterpolate(rotatedSize, srcField.data(), origin, velocityScale, tgtSize, tgtSize.x
+                                , BWFieldLayoutRows, tgtField.data(), (uint32_t) begin, (uint32_t) end);
+            });
+            times.push_back(benchSeconds() - t0);
+        }
+        result = {name, "gridInterpolate", size, size, 0, 0, 0, 0, 0, 0, 0};
+        summarize(result, times);
+        add(results, result);
+
+        // The fused build, straight from the u/v arrays; it should give the same field
+        std::vector<BWFloat2> fusedField((size_t) size*size);
+        times.clear();
+        for (int rep = 0; rep < reps; rep++)
+        {
+            double t0 = benchSeconds();
+            pool.parallelFor(size, ROW_CHUNK, [&](size_t begin, size_t end)
+            {
+                gridBuildField(u.data(), v.data(), srcSize, isContinuous, header.origin, velocityScale, tgtSize, tgtSize.x
+                               , BWFieldLayoutRows, BWFieldStorageFloat, fusedField.data(), nullptr
+                               , (uint32_t) begin, (uint32_t) end);
+            });
+            times.push_back(benchSeconds() - t0);
+        }
+        if (memcmp(fusedField.data(), tgtField.data(), sizeof(BWFloat2)*tgtField.size()))
+            fprintf(stderr, "%s: gridBuildField doesn't match gridBuild and gridInterpolate at %d x %d\n"
+                    , name.c_str(), size, size);
+        result = {name, "gridBuildField", size, size, 0, 0, 0, 0, 0, 0, 0};
+        summarize(result, times);
+        add(results, result);
+
+        for (int numParticles : counts)
+        {
+            // particleInit, of all of the particles
+            std::vector<BWFloat2> vertices(numVerticesPerParticle*numParticles);
+            times.clear();
+            for (int rep = 0; rep < reps; rep++)
+            {
+                double t0 = benchSeconds();
+                pool.parallelFor(numParticles, INIT_CHUNK, [&](size_t begin, size_t end)
+                {
+                    particleInit(vertices.data(), size, size, 1, rep, (int) begin, (int) end);
+                });
+                times.push_back(benchSeconds() - t0);
+            }
+            result = {name, "particleInit", size, size, numParticles, 0, 0, 0, 0, 0, 0};
+            summarize(result, times);
+            add(results, result);
+
+            // particleMove and the frame, as the grid does them
+            BWCPUGrid grid(numParticles, size, size, 1);
+            if (!grid.interpretData(header, u.data(), v.data(), velocityScale))
+                continue;
+            BWRaster raster(size, size);
+            for (int i = 0; i < 10; i++)
+                grid.animationStep();
+            std::vector<double> renderTimes;
+            times.clear();
+            for (int rep = 0; rep < reps; rep++)
+            {
+                double t0 = benchSeconds();
+                grid.animationStep();
+                double t1 = benchSeconds();
+                raster.clear();
+                raster.drawSegments(grid.vertices(), grid.numParticles());
+                times.push_back(t1 - t0);
+                renderTimes.push_back(benchSeconds() - t1);
+            }
+            result = {name, "particleMove", size, size, numParticles, 0, 0, 0, 0, 0, 0};
+            summarize(result, times);
+            add(results, result);
+            result = {name, "render", size, size, numParticles, 0, 0, 0, 0, 0, 0};
+            summarize(result, renderTimes);
+            add(results, result);
+        }
+    }
+}
+
+
+/** Write the results as JSON, one result to a line (which is what readResults expects)
+    @param file     Where to write
+    @param results  The results
+    @param reps     The number of times each stage was timed
+ */
+static void writeResults(FILE* file, std::vector<Result> const& results, int reps)
+{
+    fprintf(file, "{\n  \"benchmark\": \"BWBenchSuite\",\n  \"workers\": %d,\n  \"isa\": \"%s\",\n  \"reps\": %d,\n"
+            , BWThreadPool::shared()->numWorkers(), particleMoveISAName(particleMoveBestISA()), reps);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        Result const& r = results[i];
+        fprintf(file, "    {\"field\": \"%s\", \"stage\": \"%s\", \"width\": %d, \"height\": %d, \"particles\": %d"
+                      ", \"samples\": %d, \"mean_ms\": %.4f, \"min_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f"
+                      ", \"p99_ms\": %.4f}%s\n"
+                , r.field.c_str(), r.stage.c_str(), r.width, r.height, r.particles
+                , r.samples, r.mean, r.min, r.p50, r.p90, r.p99, i+1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+
+/** Find a member of a result line
+    @param line  The line
+    @param key   The name of the member
+    @returns Where its value starts, NULL if it isn't there
+ */
+static char const* member(char const* line, char const* key)
+{
+    std::string quoted = std::string("\"") + key + "\":";
+    char const* at = strstr(line, quoted.c_str());
+    if (!at)
+        return NULL;
+    at += quoted.size();
+    while (' ' == *at)
+        at++;
+    return at;
+}
+
+
+/** Read the results of an earlier run, as written by writeResults
+    @param path     The file
+    @param results  Receives the results
+    @returns true on success, false on error
+ */
+static bool readResults(char const* path, std::vector<Result>& results)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        BWLog("could not open %s", path);
+        return false;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        char const* field = member(line, "field"), *stage = member(line, "stage");
+        char const* width = member(line, "width"), *height = member(line, "height");
+        char const* particles = member(line, "particles"), *p50 = member(line, "p50_ms");
+        char const* p99 = member(line, "p99_ms");
+        if (!field || !stage || !width || !height || !particles || !p50 || !p99 || '"' != *field || '"' != *stage)
+            continue;
+        Result r = {};
+        r.field = std::string(field+1, strcspn(field+1, "\""));
+        r.stage = std::string(stage+1, strcspn(stage+1, "\""));
+        r.width     = atoi(width);
+        r.height    = atoi(height);
+        r.particles = atoi(particles);
+        r.p50 = atof(p50);
+        r.p99 = atof(p99);
+        results.push_back(r);
+    }
+    fclose(file);
+    return true;
+}
+
+
+/** Compare the results with a baseline, and print the changes
+    @param results    The results of this run
+    @param baseline   The results of the earlier run
+    @param threshold  How much slower (as a fraction) the median must be to count as a regression
+    @returns the number of regressions
+ */
+static int compare(std::vector<Result> const& results, std::vector<Result> const& baseline, double threshold)
+{
+    int numRegressions = 0;
+    printf("%-10s %-16s %11s %7s %10s %10s %8s\n", "field", "stage", "size", "count", "base p50", "p50", "change");
+    for (Result const& r : results)
+    {
+        auto base = std::find_if(baseline.begin(), baseline.end(), [&](Result const& b)
+        {
+            return b.field == r.field && b.stage == r.stage && b.width == r.width
+                && b.height == r.height && b.particles == r.particles;
+        });
+        if (base == baseline.end() || !(base->p50 > 0.0))
+            continue;
+        double change = r.p50/base->p50 - 1.0;
+        bool regressed = change > threshold;
+        numRegressions += regressed;
+        printf("%-10s %-16s %5d x %-5d %7d %10.3f %10.3f %+7.1f%%%s\n", r.field.c_str(), r.stage.c_str()
+               , r.width, r.height, r.particles, base->p50, r.p50, 100.0*change
+               , regressed ? "  REGRESSION" : change < -threshold ? "  faster" : "");
+    }
+    printf("%d regression%s (threshold %.0f%%)\n", numRegressions, 1 == numRegressions ? "" : "s", 100.0*threshold);
+    return numRegressions;
+}
+
+
+int main(int argc, char** argv)
+{
+    bool quick = false;
+    int  reps  = 0;
+    double threshold = 0.10;
+    char const* outPath = NULL, *baselinePath = NULL;
+    std::vector<char const*> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-quick"))
+            quick = true;
+        else if (!strcmp(argv[i], "-reps") && i+1 < argc)
+            reps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o") && i+1 < argc)
+            outPath = argv[++i];
+        else if (!strcmp(argv[i], "-compare") && i+1 < argc)
+            baselinePath = argv[++i];
+        else if (!strcmp(argv[i], "-threshold") && i+1 < argc)
+            threshold = atof(argv[++i]);
+        else if ('-' == argv[i][0])
+        {
+            fprintf(stderr, "usage: %s [-quick] [-reps n] [-o results.json] [-compare baseline.json [-threshold 0.1]]"
+                            " [field.bwvf | field.json ...]\n", argv[0]);
+            return 2;
+        }
+        else
+            paths.push_back(argv[i]);
+    }
+    if (reps < 1)
+        reps = quick ? 5 : 20;
+
+    // The plug-in's range: 32768 particles by default up to 256000, and images up to 2048 x 2048
+    std::vector<int> counts = quick ? std::vector<int>{32768, 256000} : std::vector<int>{32768, 65536, 131072, 256000};
+    std::vector<int> sizes  = quick ? std::vector<int>{512, 1440} : std::vector<int>{512, 1024, 1440, 2048};
+
+    std::vector<Result> results;
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    syntheticField(header, u, v);
+    benchField(results, "synthetic", header, u, v, sizes, counts, reps);
+    for (char const* path : paths)
+    {
+        if (!loadField(path, header, u, v))
+            return 1;
+        // Name it by the file, without the directory
+        char const* name = strrchr(path, '/');
+        benchField(results, name ? name+1 : path, header, u, v, sizes, counts, reps);
+    }
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out)
+    {
+        BWLog("could not create %s", outPath);
+        return 1;
+    }
+    writeResults(out, results, reps);
+    if (outPath)
+        fclose(out);
+
+    if (baselinePath)
+    {
+        std::vector<Result> baseline;
+        if (!readResults(baselinePath, baseline))
+            return 1;
+        return compare(results, baseline, threshold) ? 1 : 0;
+    }
+    return 0;
+}
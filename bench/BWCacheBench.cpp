@@ -0,0 +1,120 @@
+/*
+    BWCacheBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Measures what the field cache saves a composition with several instances of the
+    plugin fed the same data: the time to load the field into each instance, the time
+    to load it again (as a restart from time 0 does), and the memory the fields take,
+    with the cache and without it.
+
+    usage: BWCacheBench [numInstances [size [file]]]
+
+    Half of the instances are size x size, and half twice that.  The field is a
+    synthetic one, unless a .bwvf or .json file is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <set>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+
+
+/** Load the field into each of the grids
+    @param grids   The grids
+    @param path    The .bwvf or .json file; null for the synthetic field
+    @param header  The synthetic field's header
+    @param u       The synthetic field's u components
+    @param v       The synthetic field's v components
+    @returns The time it took, in seconds; negative on failure
+ */
+static double loadAll(std::vector<std::unique_ptr<BWCPUGrid>>& grids, char const* path
+                      , BWFieldHeader const& header, std::vector<float> const& u, std::vector<float> const& v)
+{
+    double t0 = benchSeconds();
+    for (auto& grid : grids)
+    {
+        float velocityScale = grid->width() / 5000.0f;
+        if (path ? !grid->interpretFile(path, velocityScale)
+                 : !grid->interpretData(header, u.data(), v.data(), velocityScale))
+        {
+            return -1.0;
+        }
+    }
+    return benchSeconds() - t0;
+}
+
+
+int main(int argc, char** argv)
+{
+    int numInstances = argc > 1 ? atoi(argv[1]) : 8;
+    int size         = argc > 2 ? atoi(argv[2]) : 1024;
+    char const* path = argc > 3 ? argv[3] : NULL;
+    if (numInstances < 1)
+        numInstances = 1;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    if (!path)
+        syntheticField(header, u, v);
+
+    printf("%d instances, %d of %d x %d and %d of %d x %d\n", numInstances
+           , (numInstances+1)/2, size, size, numInstances/2, 2*size, 2*size);
+    printf("cache   load ms  reload ms  fields  field MB  hits  misses\n");
+    for (int cached = 0; cached < 2; cached++)
+    {
+        // A cache of its own, so that the runs don't find each other's fields
+        std::shared_ptr<BWFieldCache> cache = cached ? std::make_shared<BWFieldCache>() : nullptr;
+        std::vector<std::unique_ptr<BWCPUGrid>> grids;
+        for (int i = 0; i < numInstances; i++)
+        {
+            int side = i & 1 ? 2*size : size;
+            grids.emplace_back(new BWCPUGrid(1000, side, side, 1));
+            grids.back()->setFieldCache(cache);
+        }
+        double load   = loadAll(grids, path, header, u, v);
+        double reload = loadAll(grids, path, header, u, v);
+        if (load < 0 || reload < 0)
+            return 1;
+
+        // The fields the grids hold, counting each shared one once
+        std::set<void const*> fields;
+        size_t bytes = 0;
+        for (auto& grid : grids)
+        {
+            if (fields.insert(grid->packedField().vectors).second)
+                bytes += grid->fieldBytes() + grid->spawnTableBytes();
+        }
+        BWFieldCacheStats stats = {};
+        if (cache)
+            stats = cache->statistics();
+        printf("%-5s %9.1f %10.1f %7zu %9.1f %5llu %7llu\n", cached ? "on" : "off"
+               , load*1e3, reload*1e3, fields.size(), bytes/1e6
+               , (unsigned long long) stats.hits, (unsigned long long) stats.misses);
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+    BWIngestBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Measures how fast the earth JSON files are read by the streaming parser.
+
+    usage: BWIngestBench [file.json]
+
+    Without a file, a 1440 x 721 (0.25 degree) u/v file is made up to read.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWEarthJSON.h"
+
+
+/** Write one of the records of an earth JSON file
+    @param text       The text to append to
+    @param header     The size, origin and spacing of the grid
+    @param parameter  The parameter number (2 for u, 3 for v)
+    @param data       The components
+ */
+static void appendRecord(std::string& text, BWFieldHeader const& header, int parameter, std::vector<float> const& data)
+{
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer)
+             , "{\"header\":{\"discipline\":0,\"refTime\":\"2014-01-31T00:00:00.000Z\",\"parameterCategory\":2,"
+               "\"parameterNumber\":%d,\"parameterNumberName\":\"%s\",\"parameterUnit\":\"m.s-1\","
+               "\"nx\":%u,\"ny\":%u,\"lo1\":%g,\"la1\":%g,\"lo2\":359.75,\"la2\":-90,\"dx\":%g,\"dy\":%g},\"data\":["
+             , parameter, 2 == parameter ? "U-component_of_wind" : "V-component_of_wind"
+             , header.srcSize.x, header.srcSize.y, header.origin.x, header.origin.y, header.delta.x, header.delta.y);
+    text += buffer;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        snprintf(buffer, sizeof(buffer), i ? ",%.2f" : "%.2f", data[i]);
+        text += buffer;
+    }
+    text += "]}";
+}
+
+
+int main(int argc, char** argv)
+{
+    // Get the text of the file
+    std::string text;
+    std::vector<float> u, v;
+    BWFieldHeader header;
+    if (argc > 1)
+    {
+        FILE* fp = fopen(argv[1], "rb");
+        if (!fp)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+        char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+            text.append(buffer, n);
+        fclose(fp);
+    }
+    else
+    {
+        syntheticField(header, u, v, 1440, 721);
+        text = "[";
+        appendRecord(text, header, 2, u);
+        text += ",";
+        appendRecord(text, header, 3, v);
+        text += "]";
+    }
+    printf("%.1f MB of JSON\n", text.size() / 1e6);
+
+    // Feed the text in pieces of different sizes
+    size_t const pieceSizes[] = {4096, 65536, 1048576};
+    for (size_t i = 0; i < sizeof(pieceSizes)/sizeof(*pieceSizes); i++)
+    {
+        size_t pieceSize = pieceSizes[i];
+        double best = 1e30;
+        float* uData = NULL;
+        float* vData = NULL;
+        for (int rep = 0; rep < 5; rep++)
+        {
+            free(uData);
+            free(vData);
+            double t0 = benchSeconds();
+            BWEarthJSONParser parser;
+            bool ok = true;
+            for (size_t at = 0; ok && at < text.size(); at += pieceSize)
+            {
+                ok = parser.feed(text.data() + at, std::min(pieceSize, text.size() - at));
+            }
+            if (!ok || !parser.finish())
+            {
+                fprintf(stderr, "parse failed: %s\n", parser.error());
+                return 1;
+            }
+            parser.takeData(&uData, &vData);
+            double seconds = benchSeconds() - t0;
+            if (seconds < best) best = seconds;
+            header = parser.header();
+        }
+        size_t count = (size_t) header.srcSize.x * header.srcSize.y;
+
+        // The made up file should read back as it was written (to 2 decimals)
+        float maxError = 0;
+        for (size_t j = 0; j < u.size(); j++)
+        {
+            maxError = fmaxf(maxError, fabsf(uData[j] - u[j]));
+            maxError = fmaxf(maxError, fabsf(vData[j] - v[j]));
+        }
+        printf("%8zu byte pieces: %7.1f ms  %7.1f MB/s  %6.1f Mvalues/s"
+               , pieceSize, best*1e3, text.size()/best/1e6, 2*count/best/1e6);
+        if (!u.empty())
+            printf("  max error %.4f", maxError);
+        printf("\n");
+        free(uData);
+        free(vData);
+    }
+    printf("%u x %u grid; the parser holds the u/v arrays (%.1f MB) and a piece at a time\n"
+           , header.srcSize.x, header.srcSize.y, 2.0*sizeof(float)*header.srcSize.x*header.srcSize.y/1e6);
+    return 0;
+}
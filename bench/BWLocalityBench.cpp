@@ -0,0 +1,109 @@
+/*
+    BWLocalityBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Measures the particle step with the field laid out in rows and in tiles, with
+    and without sorting the particles every few frames: the time per step, and the
+    cache and TLB misses per step (where the CPU lets us count them).
+
+    usage: BWLocalityBench [numParticles [width height [numSteps [sortInterval [file]]]]]
+
+    The field is a synthetic one, unless a .bwvf or .json file is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <vector>
+#include "BWBenchCounters.h"
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+
+
+int main(int argc, char** argv)
+{
+    int numParticles = argc > 1 ? atoi(argv[1]) : 256000;
+    int width        = argc > 3 ? atoi(argv[2]) : 4096;
+    int height       = argc > 3 ? atoi(argv[3]) : 2048;
+    int numSteps     = argc > 4 ? atoi(argv[4]) : 100;
+    int sortInterval = argc > 5 ? atoi(argv[5]) : 10;
+    char const* path = argc > 6 ? argv[6] : NULL;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    if (!path)
+        syntheticField(header, u, v);
+
+    printf("%d particles, %d x %d field (%s), %d steps\n", numParticles, width, height
+           , path ? path : "synthetic", numSteps);
+    printf("%-6s %-6s %9s %14s", "layout", "sort", "step ms", "Mparticles/s");
+    for (int e = 0; e < BWBenchCounters::NumEvents; e++)
+        printf(" %12s", BWBenchCounters::name((BWBenchCounters::Event) e));
+    printf("   (per step)\n");
+
+    for (int tiled = 0; tiled < 2; tiled++)
+    {
+        for (int sorted = 0; sorted < 2; sorted++)
+        {
+            BWCPUGrid grid(numParticles, width, height, 1);
+            grid.setLayout(tiled ? BWFieldLayoutTiled : BWFieldLayoutRows);
+            grid.setSortInterval(sorted ? sortInterval : 0);
+            float velocityScale = width / 5000.0f;
+            if (path ? !grid.interpretFile(path, velocityScale)
+                     : !grid.interpretData(header, u.data(), v.data(), velocityScale))
+            {
+                return 1;
+            }
+            // Let the particles spread out from where they were randomized
+            for (int i = 0; i < 10; i++)
+                grid.animationStep();
+
+            // The pool is made inside the counted stretch, so that its threads are counted
+            BWBenchCounters counters;
+            counters.start();
+            grid.setThreadPool(std::make_shared<BWThreadPool>());
+            double t0 = benchSeconds();
+            for (int i = 0; i < numSteps; i++)
+                grid.animationStep();
+            double seconds = benchSeconds() - t0;
+            grid.setThreadPool(NULL);
+            counters.stop();
+
+            char sort[16];
+            snprintf(sort, sizeof(sort), sorted ? "/%d" : "none", sortInterval);
+            printf("%-6s %-6s %9.2f %14.1f", tiled ? "tiled" : "rows", sort
+                   , seconds*1e3/numSteps, (double) numParticles*numSteps/seconds/1e6);
+            for (int e = 0; e < BWBenchCounters::NumEvents; e++)
+            {
+                if (counters.available((BWBenchCounters::Event) e))
+                    printf(" %12.0f", (double) counters.value((BWBenchCounters::Event) e)/numSteps);
+                else
+                    printf(" %12s", "n/a");
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
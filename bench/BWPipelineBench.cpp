@@ -0,0 +1,139 @@
+/*
+    BWPipelineBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Compares stepping and then drawing each frame, one after the other, with the
+    pipelined grid, which steps in the background while the last step is drawn.
+
+    usage: BWPipelineBench [numParticles [width height [numFrames [stepsPerFrame [file]]]]]
+
+    Each frame is what the plugin does: take the steps, fade the last frame and draw
+    the particles' segments.  The frame time is from the start of the steps to the end
+    of the drawing, as the host sees it; the steps and the drawing are timed on their
+    own as well, so that the frame can be compared with both their sum and the longer
+    of the two.  The field is a synthetic one, unless a .bwvf or .json file is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWRaster.h"
+
+/// The times of the frames, and of the stages in them
+struct Times
+{
+    std::vector<double> frame;
+    double step;
+    double draw;
+};
+
+
+/** Run the frames
+    @param grid          The grid, with the field loaded
+    @param raster        The image to draw in
+    @param numFrames     The number of frames
+    @param stepsPerFrame The number of steps each frame takes
+    @returns The times
+ */
+static Times run(BWCPUGrid& grid, BWRaster& raster, int numFrames, int stepsPerFrame)
+{
+    Times times;
+    times.step = 0;
+    times.draw = 0;
+    for (int i = 0; i < numFrames; i++)
+    {
+        double t0 = benchSeconds();
+        grid.animationSteps(stepsPerFrame);
+        double t1 = benchSeconds();
+        raster.fade(0.9f);
+        raster.drawSegments(grid.vertices(), grid.numParticles());
+        double t2 = benchSeconds();
+        times.frame.push_back(t2 - t0);
+        times.step += t1 - t0;
+        times.draw += t2 - t1;
+    }
+    grid.finishStep();
+    std::sort(times.frame.begin(), times.frame.end());
+    return times;
+}
+
+
+/** Print the times of a run
+    @param name   What the run was
+    @param times  The times
+ */
+static void report(char const* name, Times const& times)
+{
+    size_t n = times.frame.size();
+    double sum = 0;
+    for (double t : times.frame)
+        sum += t;
+    printf("%-9s frame ms: mean %6.2f  median %6.2f  p99 %6.2f  (%.1f fps)   step %6.2f  draw %6.2f\n"
+           , name, sum*1e3/n, times.frame[n/2]*1e3, times.frame[std::min(n-1, n*99/100)]*1e3
+           , n/sum, times.step*1e3/n, times.draw*1e3/n);
+}
+
+
+int main(int argc, char** argv)
+{
+    int numParticles  = argc > 1 ? atoi(argv[1]) : 256000;
+    int width         = argc > 3 ? atoi(argv[2]) : 2048;
+    int height        = argc > 3 ? atoi(argv[3]) : 2048;
+    int numFrames     = argc > 4 ? atoi(argv[4]) : 100;
+    int stepsPerFrame = argc > 5 ? atoi(argv[5]) : 1;
+    char const* path  = argc > 6 ? argv[6] : NULL;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    if (!path)
+        syntheticField(header, u, v);
+    else if (!loadField(path, header, u, v))
+        return 1;
+    printf("%d particles, %d x %d (%s), %d frames of %d steps, %d workers\n", numParticles, width, height
+           , path ? path : "synthetic", numFrames, stepsPerFrame, BWThreadPool::shared()->numWorkers());
+
+    for (int pipelined = 0; pipelined < 2; pipelined++)
+    {
+        // Each starts from the same particles
+        BWCPUGrid grid(numParticles, width, height, 1);
+        if (!grid.interpretData(header, u.data(), v.data(), width / 5000.0f))
+            return 1;
+        grid.setPipelined(pipelined);
+        BWRaster raster(width, height);
+        // Warm up
+        run(grid, raster, 5, stepsPerFrame);
+        Times times = run(grid, raster, numFrames, stepsPerFrame);
+        report(pipelined ? "pipelined" : "serial", times);
+#if STATS_EN
+        // In the pipeline, the host only sees the part of the steps it waits for
+        printf("          the steps themselves: %.2f ms mean\n", BWRollingAverage(&grid.stats().stage[BWStageStep]));
+#endif
+    }
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+    BWQuantizeBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Compares the half float and 16 bit fixed point fields with the float one: the
+    memory each takes, the throughput of each version of particleMovePacked, and how
+    far the particles drift from where the float field moves them.
+
+    usage: BWQuantizeBench [numParticles [width height [numSteps [file]]]]
+
+    The field is a synthetic one, unless a .bwvf or .json file is given.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWParticleMove.h"
+
+
+/// A field built in each of the storage forms
+struct Storage
+{
+    BWFieldStorage storage;
+    char const*    name;
+};
+
+static Storage const storages[] =
+{
+    {BWFieldStorageFloat, "float32"},
+    {BWFieldStorageHalf,  "fp16"},
+    {BWFieldStorageInt16, "int16"},
+};
+
+
+/** Load the field into the grid
+    @param grid    The grid
+    @param path    The .bwvf or .json file; null for the synthetic field
+    @param header  The synthetic field's header
+    @param u       The synthetic field's u components
+    @param v       The synthetic field's v components
+    @returns true on success
+ */
+static bool loadField(BWCPUGrid& grid, char const* path
+                      , BWFieldHeader const& header, std::vector<float> const& u, std::vector<float> const& v)
+{
+    float velocityScale = grid.width() / 5000.0f;
+    if (path)
+        return grid.interpretFile(path, velocityScale);
+    return grid.interpretData(header, u.data(), v.data(), velocityScale);
+}
+
+
+/** How far apart two particles are, going the short way around the world
+    @param a      One particle
+    @param b      The other particle
+    @param width  The width of the world
+    @returns The distance, in bins
+ */
+static double distance(BWFloat2 a, BWFloat2 b, int width)
+{
+    double dx = fabs((double) a.x - b.x);
+    if (dx > 0.5*width)
+        dx = width - dx;
+    return hypot(dx, (double) a.y - b.y);
+}
+
+
+int main(int argc, char** argv)
+{
+    int numParticles = argc > 1 ? atoi(argv[1]) : 256000;
+    int width        = argc > 3 ? atoi(argv[2]) : 1440;
+    int height       = argc > 3 ? atoi(argv[3]) : 1440;
+    int numSteps     = argc > 4 ? atoi(argv[4]) : 200;
+    char const* path = argc > 5 ? argv[5] : NULL;
+    // atoi gives 0 for anything that isn't a number (--help, say), and the width comes with a height
+    if (argc > 6 || 3 == argc || numParticles < 1 || width < 1 || height < 1 || numSteps < 1)
+    {
+        fprintf(stderr, "usage: %s [numParticles [width height [numSteps [file]]]]\n", argv[0]);
+        return 2;
+    }
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    if (!path)
+        syntheticField(header, u, v);
+
+    // The same particles, over each form of the same field
+    std::vector<BWCPUGrid*> grids;
+    for (size_t s = 0; s < sizeof(storages)/sizeof(storages[0]); s++)
+    {
+        BWCPUGrid* grid = new BWCPUGrid(numParticles, width, height, 1);
+        grid->setStorage(storages[s].storage);
+        if (!loadField(*grid, path, header, u, v))
+            return 1;
+        grids.push_back(grid);
+    }
+    std::vector<BWFloat2> start(grids[0]->vertices(), grids[0]->vertices() + numVerticesPerParticle*numParticles);
+
+    printf("%d particles, %d x %d field (%s), %d steps\n", numParticles, width, height
+           , path ? path : "synthetic", numSteps);
+    printf("%-8s %-7s %9s %9s %14s  %s\n", "storage", "isa", "field MB", "table MB", "Mparticles/s", "check");
+    BWParticleMoveISA best = particleMoveBestISA();
+    for (size_t s = 0; s < grids.size(); s++)
+    {
+        BWPackedField field = grids[s]->packedField();
+        std::vector<BWFloat2> reference;
+        for (int isa = BWParticleMoveScalar; isa <= best; isa++)
+        {
+            std::vector<BWFloat2> vertices(start);
+            double t0 = benchSeconds();
+            for (int step = 0; step < numSteps; step++)
+            {
+                particleMovePackedISA((BWParticleMoveISA) isa, vertices.data(), STEP_DT
+                                      , width, height, &field, NULL, 0.0f
+                                      , 1, step, 0, numParticles);
+            }
+            double seconds = benchSeconds() - t0;
+
+            // Each version should get exactly the same answer as the scalar one
+            char const* check = "reference";
+            if (reference.empty())
+                reference = vertices;
+            else
+                check = memcmp(reference.data(), vertices.data(), sizeof(BWFloat2)*vertices.size()) ? "MISMATCH" : "matches scalar";
+            printf("%-8s %-7s %9.1f %9.1f %14.1f  %s\n", storages[s].name, particleMoveISAName((BWParticleMoveISA) isa)
+                   , grids[s]->fieldBytes()/1e6, grids[s]->spawnTableBytes()/1e6, (double) numParticles*numSteps/seconds/1e6, check);
+        }
+    }
+
+    /* Step the float field and each packed one side by side.  A particle that respawns
+       with one field but not the other has gone somewhere else entirely, and isn't a
+       measure of the precision; it is counted, and left out until both respawn at the
+       same step again (when the random numbers put them back in the same place).
+       The rows where the projection's stretch blows up throw the particles (with any
+       field) hundreds of bins a step, so the worst particles are there; the 99.9th
+       percentile of each particle's worst error shows the rest.
+     */
+    printf("\n%-8s %14s %14s %14s %14s %12s\n", "storage", "max err 1 step", "max err", "p99.9 err", "mean err", "diverged %");
+    BWPackedField floatField = grids[0]->packedField();
+    for (size_t s = 1; s < grids.size(); s++)
+    {
+        BWPackedField field = grids[s]->packedField();
+        std::vector<BWFloat2> a(start), b(start);
+        std::vector<bool> tracked(numParticles, true);
+        std::vector<double> worst(numParticles, 0.0);
+        double firstMax = 0, maxError = 0, sumError = 0;
+        long   numError = 0, numDiverged = 0;
+        for (int step = 0; step < numSteps; step++)
+        {
+            particleMovePacked(a.data(), STEP_DT, width, height, &floatField, NULL, 0.0f, 1, step, 0, numParticles);
+            particleMovePacked(b.data(), STEP_DT, width, height, &field,      NULL, 0.0f, 1, step, 0, numParticles);
+            for (int i = 0; i < numParticles; i++)
+            {
+                // A respawned particle has its head at its tail
+                bool respawnA = a[2*i].x == a[2*i+1].x && a[2*i].y == a[2*i+1].y;
+                bool respawnB = b[2*i].x == b[2*i+1].x && b[2*i].y == b[2*i+1].y;
+                if (respawnA != respawnB)
+                {
+                    numDiverged++;
+                    tracked[i] = false;
+                    continue;
+                }
+                if (respawnA)
+                    tracked[i] = true;
+                if (!tracked[i])
+                    continue;
+                double d = distance(a[2*i], b[2*i], width);
+                if (0 == step && d > firstMax)
+                    firstMax = d;
+                if (d > maxError)
+                    maxError = d;
+                if (d > worst[i])
+                    worst[i] = d;
+                sumError += d;
+                numError++;
+            }
+        }
+        std::sort(worst.begin(), worst.end());
+        size_t p999 = std::min(worst.size() - 1, (size_t) numParticles*999/1000);
+        printf("%-8s %14.3g %14.3g %14.3g %14.3g %12.3f\n", storages[s].name, firstMax, maxError
+               , worst[p999], numError ? sumError/numError : 0.0
+               , 100.0*numDiverged/((double) numParticles*numSteps));
+    }
+
+    for (size_t s = 0; s < grids.size(); s++)
+        delete grids[s];
+    return 0;
+}
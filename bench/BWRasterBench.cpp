@@ -0,0 +1,140 @@
+/*
+    BWRasterBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Measures drawing the particle trails with the CPU rasterizer: the time to clear
+    (or fade) the image and draw every particle's segment, per frame.
+
+    usage: BWRasterBench [numParticles [width height [numFrames [file [image.ppm [fade]]]]]]
+
+    The field is a synthetic one, unless a .bwvf or .json file is given.  The last
+    frame can be written out as a PPM image, to look at.  With a fade, each frame
+    is drawn over the faded last one, building up trails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWRaster.h"
+
+
+/** Write the image as a binary PPM, top row first
+    @param raster  The image
+    @param path    The file to write
+    @returns true on success, false on error
+ */
+static bool writePPM(BWRaster const& raster, char const* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        BWLog("could not create %s", path);
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", raster.width(), raster.height());
+    std::vector<uint8_t> row(3*raster.width());
+    for (int y = raster.height()-1; y >= 0; y--)
+    {
+        uint8_t const* p = raster.pixels() + (size_t) y*raster.rowBytes();
+        for (int x = 0; x < raster.width(); x++, p += 4)
+        {
+            row[3*x+0] = p[2];
+            row[3*x+1] = p[1];
+            row[3*x+2] = p[0];
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    return 0 == fclose(file);
+}
+
+
+int main(int argc, char** argv)
+{
+    int numParticles = argc > 1 ? atoi(argv[1]) : 256000;
+    int width        = argc > 3 ? atoi(argv[2]) : 1440;
+    int height       = argc > 3 ? atoi(argv[3]) : 1440;
+    int numFrames    = argc > 4 ? atoi(argv[4]) : 50;
+    char const* path = argc > 5 && strcmp(argv[5], "-") ? argv[5] : NULL;
+    char const* out  = argc > 6 && strcmp(argv[6], "-") ? argv[6] : NULL;
+    float fade       = argc > 7 ? (float) atof(argv[7]) : 0.0f;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    if (!path)
+        syntheticField(header, u, v);
+
+    BWCPUGrid grid(numParticles, width, height, 1);
+    float velocityScale = width / 5000.0f;
+    if (path ? !grid.interpretFile(path, velocityScale)
+             : !grid.interpretData(header, u.data(), v.data(), velocityScale))
+    {
+        return 1;
+    }
+    for (int i = 0; i < 10; i++)
+        grid.animationStep();
+
+    BWRaster raster(width, height);
+    std::vector<double> times;
+    double fadeSeconds = 0;
+    for (int i = 0; i < numFrames; i++)
+    {
+        grid.animationStep();
+        double t0 = benchSeconds();
+        if (fade > 0.0f)
+            raster.fade(fade);
+        else
+            raster.clear();
+        double t1 = benchSeconds();
+        raster.drawSegments(grid.vertices(), grid.numParticles());
+        times.push_back(benchSeconds() - t0);
+        fadeSeconds += t1 - t0;
+        BWStatsAddTime(&grid.stats(), BWStageDraw, times.back());
+    }
+    std::sort(times.begin(), times.end());
+
+    double sum = 0;
+    for (double t : times)
+        sum += t;
+    printf("%d particles, %d x %d (%s), %d frames, %d workers\n", numParticles, width, height
+           , path ? path : "synthetic", numFrames, BWThreadPool::shared()->numWorkers());
+    printf("%s ms: %.2f\n", fade > 0.0f ? "fade" : "clear", fadeSeconds*1e3/numFrames);
+    printf("draw ms: mean %.2f  median %.2f  p99 %.2f  (%.1f fps)\n"
+           , sum*1e3/times.size(), times[times.size()/2]*1e3
+           , times[std::min(times.size()-1, times.size()*99/100)]*1e3, times.size()/sum);
+
+#if STATS_EN
+    char line[512];
+    BWStatsFormat(&grid.stats(), line, sizeof(line));
+    printf("%s\n", line);
+#endif
+
+    if (out && !writePPM(raster, out))
+        return 1;
+    return 0;
+}
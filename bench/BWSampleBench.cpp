@@ -0,0 +1,151 @@
+/*
+    BWSampleBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Compares the per-bin (nearest) field with the compact, bilinearly sampled one:
+    the memory the field takes, the time to build it, the particles per second,
+    and how far a step is from the true path (RK4 with 16 sub-steps).
+
+    usage: BWSampleBench [numParticles [numSteps]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWParticleMove.h"
+
+
+/** How far, in bins, each particle moved from where the reference moved it
+    @param vertices   The tail/head pairs after the step
+    @param reference  The tail/head pairs after the reference step
+    @param start      The tail/head pairs before the step
+    @param numParticles The number of particles
+    @param median     Receives the median distance
+    @param p99        Receives the 99th percentile distance
+
+    The particles that wrapped around or respawned in either are left out; the
+    few that are clamped at the edges are why the percentiles are used.
+ */
+static void stepError(std::vector<BWFloat2> const& vertices, std::vector<BWFloat2> const& reference
+                      , std::vector<BWFloat2> const& start, int numParticles
+                      , double& median, double& p99)
+{
+    std::vector<double> errors;
+    for (int i = 0; i < numParticles; i++)
+    {
+        BWFloat2 s = start[2*i], a = vertices[2*i], b = reference[2*i];
+        if (fabsf(a.x-s.x) + fabsf(a.y-s.y) > 10.0f || fabsf(b.x-s.x) + fabsf(b.y-s.y) > 10.0f)
+            continue;
+        errors.push_back(hypot(a.x-b.x, a.y-b.y));
+    }
+    median = p99 = 0;
+    if (errors.empty())
+        return;
+    std::sort(errors.begin(), errors.end());
+    median = errors[errors.size()/2];
+    p99    = errors[errors.size()*99/100];
+}
+
+
+int main(int argc, char** argv)
+{
+    int numParticles = argc > 1 ? atoi(argv[1]) : 256000;
+    int numSteps     = argc > 2 ? atoi(argv[2]) : 50;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    syntheticField(header, u, v, 1440, 721);
+    printf("%u x %u data, %d particles\n", header.srcSize.x, header.srcSize.y, numParticles);
+    printf("%5s  %-8s %-6s %9s %9s %9s %12s %10s %10s\n", "size", "sampling", "step", "field MB", "table MB", "build ms"
+           , "Mparticles/s", "median err", "p99 err");
+
+    int const sizes[] = {1440, 2048};
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(*sizes); s++)
+    {
+        int size = sizes[s];
+        float velocityScale = size / 5000.0f;
+
+        // The reference: the compact field, with 16 small RK4 steps per step
+        BWCPUGrid reference(numParticles, size, size, 1);
+        reference.setSampling(BWFieldSampleBilinear);
+        reference.interpretData(header, u.data(), v.data(), velocityScale);
+        BWSourceField source = reference.sourceField();
+        std::vector<BWFloat2> start(reference.vertices(), reference.vertices() + 2*numParticles);
+        std::vector<BWFloat2> truth(start);
+        for (int i = 0; i < 16; i++)
+        {
+            // Each small step starts where the last one left the particle (the tail)
+            particleMoveSampled(truth.data(), STEP_DT/16, size, size, &source, NULL, 0.0f, BWIntegratorRK4
+                                , 1, 0, 0, numParticles);
+        }
+
+        struct { BWFieldSampling sampling; BWIntegrator integrator; char const* name; char const* step; } const modes[] =
+        {
+            {BWFieldSampleNearest,  BWIntegratorEuler, "nearest",  "euler"},
+            {BWFieldSampleBilinear, BWIntegratorEuler, "bilinear", "euler"},
+            {BWFieldSampleBilinear, BWIntegratorRK2,   "bilinear", "rk2"},
+            {BWFieldSampleBilinear, BWIntegratorRK4,   "bilinear", "rk4"},
+        };
+        for (size_t m = 0; m < sizeof(modes)/sizeof(*modes); m++)
+        {
+            BWCPUGrid grid(numParticles, size, size, 1);
+            grid.setSampling(modes[m].sampling);
+            grid.setIntegrator(modes[m].integrator);
+            // The build is timed, so it isn't to be found in the cache
+            grid.setFieldCache(nullptr);
+            double t0 = benchSeconds();
+            grid.interpretData(header, u.data(), v.data(), velocityScale);
+            double buildSeconds = benchSeconds() - t0;
+
+            // One step from the same start as the reference
+            std::vector<BWFloat2> step(start);
+            if (BWFieldSampleNearest == modes[m].sampling)
+            {
+                particleMove(step.data(), STEP_DT, size, size, grid.vectorField(), NULL, 0.0f, 1, 0, 0, numParticles);
+            }
+            else
+            {
+                BWSourceField field = grid.sourceField();
+                particleMoveSampled(step.data(), STEP_DT, size, size, &field, NULL, 0.0f, modes[m].integrator
+                                    , 1, 0, 0, numParticles);
+            }
+
+            t0 = benchSeconds();
+            for (int i = 0; i < numSteps; i++)
+                grid.animationStep();
+            double seconds = benchSeconds() - t0;
+            double median, p99;
+            stepError(step, truth, start, numParticles, median, p99);
+            printf("%5d  %-8s %-6s %9.1f %9.1f %9.1f %12.1f %10.2e %10.2e\n", size, modes[m].name, modes[m].step
+                   , grid.fieldBytes()/1e6, grid.spawnTableBytes()/1e6, buildSeconds*1e3, (double) numParticles*numSteps/seconds/1e6
+                   , median, p99);
+        }
+    }
+    return 0;
+}
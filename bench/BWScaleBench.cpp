@@ -0,0 +1,92 @@
+/*
+    BWScaleBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Measures how the field build and the particle step scale with the number of
+    worker threads.
+
+    usage: BWScaleBench [numParticles [width height [maxWorkers]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+
+
+int main(int argc, char** argv)
+{
+    int numParticles = argc > 1 ? atoi(argv[1]) : 256000;
+    int width        = argc > 3 ? atoi(argv[2]) : 2048;
+    int height       = argc > 3 ? atoi(argv[3]) : 2048;
+    int maxWorkers   = argc > 4 ? atoi(argv[4]) : (int) std::thread::hardware_concurrency();
+    if (maxWorkers < 1)
+        maxWorkers = 1;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    syntheticField(header, u, v);
+
+    printf("%d particles, %d x %d field\n", numParticles, width, height);
+    printf("workers    build ms  speedup     step ms  speedup\n");
+    double buildBase = 0, stepBase = 0;
+    for (int numWorkers = 1; ; numWorkers = numWorkers*2 > maxWorkers && numWorkers < maxWorkers ? maxWorkers : numWorkers*2)
+    {
+        BWCPUGrid grid(numParticles, width, height, 1);
+        grid.setThreadPool(std::make_shared<BWThreadPool>(numWorkers));
+        // Each rebuild really builds, rather than finding the last one in the cache
+        grid.setFieldCache(nullptr);
+
+        // Rebuild the field a few times, and keep the best
+        double build = 1e30;
+        for (int i = 0; i < 3; i++)
+        {
+            double t0 = benchSeconds();
+            grid.interpretData(header, u.data(), v.data(), width / 5000.0f);
+            build = std::min(build, benchSeconds() - t0);
+        }
+
+        int numSteps = 100;
+        double t0 = benchSeconds();
+        for (int i = 0; i < numSteps; i++)
+        {
+            grid.animationStep();
+        }
+        double step = (benchSeconds() - t0) / numSteps;
+
+        if (1 == numWorkers)
+        {
+            buildBase = build;
+            stepBase  = step;
+        }
+        printf("%7d  %10.2f  %7.2fx  %10.3f  %7.2fx\n", numWorkers
+               , build*1e3, buildBase/build, step*1e3, stepBase/step);
+        if (numWorkers >= maxWorkers)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+    BWTileBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Measures the out of core fields (see BWTileStore.h) at an output size whose whole
+    field is too big to want in memory: the time to load the field, the time of the
+    first steps (which build the tiles the particles reach) and of the steps after,
+    and the memory the process keeps, with the whole field and with a few budgets.
+
+    usage: BWTileBench [numParticles [width height [numFrames [file]]]]
+
+    The default is 8K output (7680 x 4320), and a synthetic 0.25 degree field, unless
+    a .bwvf or .json file is given.  The resident memory is read from /proc, where
+    there is one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+
+
+/// The memory the process has resident, in MB; negative if it can't be told
+static double residentMB()
+{
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return -1.0;
+    unsigned long size = 0, resident = 0;
+    int n = fscanf(fp, "%lu %lu", &size, &resident);
+    fclose(fp);
+    return 2 == n ? resident * (double) sysconf(_SC_PAGESIZE) / 1e6 : -1.0;
+}
+
+
+int main(int argc, char** argv)
+{
+    int numParticles = argc > 1 ? atoi(argv[1]) : 256*1024;
+    int width        = argc > 3 ? atoi(argv[2]) : 7680;
+    int height       = argc > 3 ? atoi(argv[3]) : 4320;
+    int numFrames    = argc > 4 ? atoi(argv[4]) : 120;
+    char const* path = argc > 5 ? argv[5] : NULL;
+    if (numFrames < 2)
+        numFrames = 2;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    if (!path)
+        syntheticField(header, u, v, 1440, 721);
+    else if (!loadField(path, header, u, v))
+        return 1;
+
+    printf("%d particles, %d x %d, %d frames\n", numParticles, width, height, numFrames);
+    printf("budget MB  load ms  first ms  step ms  rss MB  tiles MB  builds  evictions\n");
+    // The whole field first, and then smaller and smaller budgets
+    size_t const budgets[] = {0, 256u<<20, 64u<<20, 16u<<20, 4u<<20};
+    for (size_t budget : budgets)
+    {
+        double load, first, steps;
+        BWTileStoreStats stats;
+        double rss;
+        {
+            BWCPUGrid grid(numParticles, width, height, 1);
+            // A cache of none, so that each run builds its own field
+            grid.setFieldCache(nullptr);
+            grid.setLayout(BWFieldLayoutTiled);
+            grid.setSortInterval(16);
+            grid.setTileBudget(budget);
+            double t0 = benchSeconds();
+            if (!grid.interpretData(header, u.data(), v.data(), width / 5000.0f))
+                return 1;
+            double t1 = benchSeconds();
+            // The first frames find most of the tiles the particles will use
+            int numFirst = numFrames / 4 > 0 ? numFrames / 4 : 1;
+            for (int frame = 0; frame < numFirst; frame++)
+                grid.animationStep();
+            double t2 = benchSeconds();
+            for (int frame = numFirst; frame < numFrames; frame++)
+                grid.animationStep();
+            double t3 = benchSeconds();
+            load  = t1 - t0;
+            first = (t2 - t1) / numFirst;
+            steps = (t3 - t2) / (numFrames - numFirst);
+            stats = grid.tileStatistics();
+            rss   = residentMB();
+        }
+        if (budget)
+            printf("%9.0f", budget / 1e6);
+        else
+            printf("%9s", "whole");
+        printf(" %8.1f %9.2f %8.2f %7.0f %9.1f %7llu %10llu\n", load*1e3, first*1e3, steps*1e3, rss
+               , stats.residentBytes / 1e6, (unsigned long long) stats.builds, (unsigned long long) stats.evictions);
+        if (stats.memoryBacked)
+            printf("          (the tile store is in a tmpfs: the budget only bounds the rss)\n");
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+    BWTrailBench.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Measures the particle streams drawn as trails against as many more of them drawn as
+    tail/head pairs: the time to step and to draw each frame, and how much of the image
+    they cover.
+
+    usage: BWTrailBench [numPairs [numTrails [trailLength [width height [numFrames [file]]]]]]
+
+    By default, 262144 particles with pairs are set against 32768 with trails of 16
+    positions.  Each frame is one step, and is drawn over a cleared image.  The field is
+    a synthetic one, unless a .bwvf or .json file is given.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWRaster.h"
+
+
+/// The times and coverage of one run
+struct TrailRun
+{
+    double stepSeconds;
+    double drawSeconds;
+    double covered;
+};
+
+
+/** Step and draw the particles, a frame at a time
+    @param grid         The grid, with the field loaded
+    @param trailLength  The number of positions in each particle's trail; 2 for pairs
+    @param numFrames    The number of frames
+    @returns The times per frame, in seconds, and the fraction of pixels drawn in the last frame
+ */
+static TrailRun runTrails(BWCPUGrid& grid, int trailLength, int numFrames)
+{
+    grid.setTrailLength(trailLength);
+    // Let the trails fill in
+    for (int i = 0; i < trailLength + 10; i++)
+        grid.animationStep();
+
+    BWRaster raster(grid.width(), grid.height());
+    TrailRun run = {0, 0, 0};
+    for (int i = 0; i < numFrames; i++)
+    {
+        double t0 = benchSeconds();
+        grid.animationStep();
+        double t1 = benchSeconds();
+        raster.clear();
+        raster.drawTrails(grid.vertices(), grid.numParticles(), grid.verticesPerParticle(), grid.trailHead());
+        double t2 = benchSeconds();
+        run.stepSeconds += t1 - t0;
+        run.drawSeconds += t2 - t1;
+    }
+    run.stepSeconds /= numFrames;
+    run.drawSeconds /= numFrames;
+
+    size_t covered = 0;
+    size_t numPixels = (size_t) raster.width()*raster.height();
+    for (size_t i = 0; i < numPixels; i++)
+        covered += 0 != raster.pixels()[4*i+3];
+    run.covered = (double) covered / numPixels;
+    return run;
+}
+
+
+int main(int argc, char** argv)
+{
+    int numPairs     = argc > 1 ? atoi(argv[1]) : 262144;
+    int numTrails    = argc > 2 ? atoi(argv[2]) : 32768;
+    int trailLength  = argc > 3 ? atoi(argv[3]) : TRAIL_LENGTH;
+    int width        = argc > 5 ? atoi(argv[4]) : 1440;
+    int height       = argc > 5 ? atoi(argv[5]) : 720;
+    int numFrames    = argc > 6 ? atoi(argv[6]) : 50;
+    char const* path = argc > 7 ? argv[7] : NULL;
+
+    BWFieldHeader header;
+    std::vector<float> u, v;
+    if (!path)
+        syntheticField(header, u, v);
+
+    int    counts[2]  = {numPairs, numTrails};
+    int    lengths[2] = {2, std::max(trailLength, 2)};
+    TrailRun runs[2];
+    for (int r = 0; r < 2; r++)
+    {
+        BWCPUGrid grid(counts[r], width, height, 1);
+        float velocityScale = width / 5000.0f;
+        if (path ? !grid.interpretFile(path, velocityScale)
+                 : !grid.interpretData(header, u.data(), v.data(), velocityScale))
+        {
+            return 1;
+        }
+        runs[r] = runTrails(grid, lengths[r], numFrames);
+    }
+
+    printf("%d x %d (%s), %d frames, %d workers\n", width, height
+           , path ? path : "synthetic", numFrames, BWThreadPool::shared()->numWorkers());
+    for (int r = 0; r < 2; r++)
+    {
+        printf("%7d particles x %2d positions: %8d segments  step ms %6.2f  draw ms %6.2f  covered %5.1f%%\n"
+               , counts[r], lengths[r], counts[r]*(lengths[r]-1)
+               , runs[r].stepSeconds*1e3, runs[r].drawSeconds*1e3, runs[r].covered*100);
+    }
+    printf("the trails step %.1fx faster\n", runs[0].stepSeconds / runs[1].stepSeconds);
+    return 0;
+}
@@ -0,0 +1,1258 @@
+/*
+    BWCPUGrid.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "BWCPUGrid.h"
+#include "BWEarthJSON.h"
+#include "BWFieldFile.h"
+#include "BWGridBuild.h"
+#include "BWParticleMove.h"
+
+/// The number of particles in each chunk of work.
+/// 4096 tail/head pairs is 64KB, which sits comfortably in the L2 cache
+#define PARTICLE_CHUNK (4096)
+
+/// The number of bytes of the target field in each row tile of gridInterpolate
+#define FIELD_TILE_BYTES (65536)
+
+
+/** Initialize the simuluation with a given number of particles
+    @param numParticles  The number of particles in the simulations
+    @param width         The number of bins wide
+    @param height        The number of bins high
+    @param seed          The seed for the random steps
+ */
+BWCPUGrid::BWCPUGrid(int numParticles, int width, int height, uint64_t _seed)
+    : numXBins(width)
+    , numYBins(height)
+    , trailLength(numVerticesPerParticle)
+    , drawnFrame(0)
+    , stepFrame(0)
+    , pipelined(false)
+    , drawFront(0)
+    , stepInFlight(false)
+    , stepBusy(false)
+    , stepStopping(false)
+    , stepSeconds(0.0)
+    , stepRespawned(0)
+    , store(PARTICLE_STREAMS_EN ? BWParticleStoreStreams : BWParticleStoreVertices)
+    , minLifetime(PARTICLE_MIN_AGE)
+    , maxLifetime(PARTICLE_MAX_AGE)
+    , _vectorField(emptyField())
+    , _nextField(emptyField())
+    , fieldTime(0.0f)
+    , _numParticles(0)
+    , nextParticleInit(0)
+    , seed(_seed)
+    , frame(0)
+    , stepBacklog(0.0)
+    , moveISA(particleMoveBestISA())
+    , sampling(BWFieldSampleNearest)
+    , storage(BWFieldStorageFloat)
+    , layout(BWFieldLayoutRows)
+    , importanceSpawn(SPAWN_TABLE_EN)
+    , fieldCache(FIELD_CACHE_EN ? BWFieldCache::shared() : nullptr)
+    , tileBudget(0)
+    , sortInterval(0)
+    , integrator(BWIntegratorEuler)
+    , pool(BWThreadPool::shared())
+{
+#if EXTRA_LOGGING_EN
+    BWLog("%d x %d w/ %d particles, %s", width, height, numParticles, particleMoveISAName(moveISA));
+#endif
+    BWStatsInit(&_stats);
+    // Allocate the particles in the system
+    setNumParticles(numParticles);
+}
+
+
+BWCPUGrid::~BWCPUGrid()
+{
+    // Let the step in flight finish, and stop the thread it ran on
+    setPipelined(false);
+    {
+        // Nothing queued is wanted any more
+        std::lock_guard<std::mutex> hold(prefetchLock);
+        prefetch   .queued = nullptr;
+        replacement.queued = nullptr;
+    }
+    joinPrefetch(prefetch);
+    joinPrefetch(replacement);
+}
+
+
+/// The field with nothing in it, which stands in when there is no field
+BWCPUGrid::FieldRef const& BWCPUGrid::emptyField()
+{
+    static FieldRef const empty = std::make_shared<Field>();
+    return empty;
+}
+
+
+/** Build a field from the u/v arrays
+    @param header        The size, origin and spacing of the u/v grids
+    @param uData         The u components of the vectors
+    @param vData         The v components of the vectors
+    @param velocityScale How much to scale the velocity magnitude by
+    @param compact       True to keep the field at the resolution of the data
+    @param storage       How the vectors of a (not compact) field are stored
+    @param layout        How the bins of a (not compact) field are ordered
+    @param importanceSpawn True to build the alias table that the particles are spawned from
+    @param outOfCore     True to make a (not compact) field a tile store, built as it is used
+    @param owner         Keeps uData and vData for as long as a tile store reads them
+    @param field         Receives the field
+    @param threads       The threads to build it on
+    @return true on success, false on failure
+ */
+bool BWCPUGrid::buildField(BWFieldHeader const& header
+                           , float const* uData, float const* vData
+                           , float velocityScale
+                           , bool compact
+                           , BWFieldStorage storage
+                           , BWFieldLayout layout
+                           , bool importanceSpawn
+                           , bool outOfCore
+                           , std::shared_ptr<void const> const& owner
+                           , Field& field
+                           , BWThreadPool& threads
+                           ) const
+{
+    if (!uData || !vData || header.srcSize.x < 1 || header.srcSize.y < 1)
+    {
+        BWLog("error, could not load: missing u/v data");
+        return false;
+    }
+    BWUInt2  srcSize = header.srcSize;
+    BWFloat2 origin  = header.origin;
+
+    // Continuous grids wrap around and have an extra column
+    bool isContinuous = floor(srcSize.x * header.delta.x) >= 360;
+    uint32_t srcStride = srcSize.x+(isContinuous? 1:0);
+
+    field.compact = compact;
+    field.storage = compact ? BWFieldStorageFloat : storage;
+    field.layout  = compact ? BWFieldLayoutRows   : layout;
+    field.source.srcField = nullptr;
+    // The origin is rotated, and the columns include the wrap around one
+    field.source.srcSize  = {srcStride, srcSize.y};
+    field.source.origin   = {origin.x + 90.0f, origin.y};
+    field.source.velocityScale = velocityScale;
+    if (compact)
+    {
+        // A compact field is the first stage grid itself, which the particles sample as it is.
+        // It is made a few rows at a time
+        field.packed.clear();
+        field.rowScale.clear();
+        field.vectors.resize((size_t) srcStride*srcSize.y);
+        size_t srcTile = std::max<size_t>(1, FIELD_TILE_BYTES / (sizeof(BWFloat2)*srcStride));
+        threads.parallelFor(srcSize.y, srcTile, [&](size_t begin, size_t end)
+        {
+            gridBuild(uData, vData, srcSize, isContinuous, field.vectors.data(), (uint32_t) begin, (uint32_t) end);
+        });
+        buildSpawnTable(field, importanceSpawn, threads);
+        return true;
+    }
+
+    BWUInt2 tgtSize = {(uint32_t) numXBins, (uint32_t) numYBins};
+    if (outOfCore)
+    {
+        // Nothing is built yet: the tiles are built as the particles reach them, from the
+        // u/v arrays, which are copied unless something already keeps them
+        std::shared_ptr<void const> source = owner;
+        if (!source)
+        {
+            size_t count = (size_t) srcSize.x*srcSize.y;
+            std::shared_ptr<std::vector<float> > planes = std::make_shared<std::vector<float> >(uData, uData + count);
+            planes->insert(planes->end(), vData, vData + count);
+            uData  = planes->data();
+            vData  = planes->data() + count;
+            source = planes;
+        }
+        field.tiles = BWTileStore::create(header, uData, vData, source, velocityScale, tgtSize, storage);
+        if (!field.tiles)
+            return false;
+        BWPackedField packed = field.tiles->packedField();
+        field.storage   = packed.storage;
+        field.layout    = packed.layout;
+        field.numXTiles = packed.numXTiles;
+        field.vectors.clear();
+        field.packed.clear();
+        field.rowScale.clear();
+        // Weighing the bins would build the whole field
+        buildSpawnTable(field, false, threads);
+        return true;
+    }
+
+    // The per-bin field is built straight from the u/v arrays, in the form it is stored in, a
+    // band of rows at a time; the tiled field is padded out to whole tiles
+    bool tiled = BWFieldLayoutTiled == field.layout;
+    field.numXTiles = tiled ? gridNumTiles(tgtSize.x) : 0;
+    uint32_t tgtStride = tiled ? field.numXTiles : tgtSize.x;
+    size_t count = tiled ? (size_t) field.numXTiles*gridNumTiles(tgtSize.y)*BWFieldTileSize*BWFieldTileSize
+                         : (size_t) numXBins*numYBins;
+    void* tgtField;
+    if (BWFieldStorageFloat == field.storage)
+    {
+        field.packed.clear();
+        field.vectors.resize(count);
+        tgtField = field.vectors.data();
+    }
+    else
+    {
+        field.vectors.clear();
+        field.packed.resize(count);
+        tgtField = field.packed.data();
+    }
+    if (BWFieldStorageInt16 == field.storage)
+        field.rowScale.resize(numYBins);
+    else
+        field.rowScale.clear();
+    // A tiled field is built a band of whole tiles at a time
+    size_t tgtTile = std::max<size_t>(1, FIELD_TILE_BYTES / (sizeof(BWFloat2)*numXBins));
+    if (tiled)
+        tgtTile = (tgtTile + BWFieldTileSize-1) & ~(size_t)(BWFieldTileSize-1);
+    threads.parallelFor(numYBins, tgtTile, [&](size_t begin, size_t end)
+    {
+        gridBuildField(uData, vData, srcSize, isContinuous, origin, velocityScale
+                       , tgtSize, tgtStride, field.layout, field.storage, tgtField, field.rowScale.data()
+                       , (uint32_t) begin, (uint32_t) end);
+    });
+    buildSpawnTable(field, importanceSpawn, threads);
+    return true;
+}
+
+
+/** Build the alias table that the particle streams are spawned from
+    @param field     The field
+    @param enable    False to leave the table empty, so the particles are spawned uniformly
+    @param threads   The threads to weigh the bins on
+ */
+void BWCPUGrid::buildSpawnTable(Field& field, bool enable, BWThreadPool& threads) const
+{
+    if (!enable)
+    {
+        field.spawnEntries.clear();
+        return;
+    }
+    // The compact grid is looked up as gridInterpolate would have; the per-bin fields
+    // are read a row at a time, as floats.  Each chunk is whole rows of cells, which
+    // its bins are added to
+    BWSourceField source = field.sourceField();
+    BWPackedField packed = field.packedField();
+    size_t count = spawnTableCount(numXBins, numYBins);
+    std::vector<float> weights(count, 0.0f);
+    size_t numYCells = (numYBins + BWSpawnCellSize-1) / BWSpawnCellSize;
+    size_t cellTile  = std::max<size_t>(1, FIELD_TILE_BYTES / (sizeof(BWFloat2)*numXBins*BWSpawnCellSize));
+    threads.parallelFor(numYCells, cellTile, [&](size_t beginCell, size_t endCell)
+    {
+        size_t begin = beginCell*BWSpawnCellSize;
+        size_t end   = std::min<size_t>(endCell*BWSpawnCellSize, numYBins);
+        if (field.compact)
+        {
+            spawnWeightsSampled(&source, numXBins, numYBins, weights.data(), (int) begin, (int) end);
+            return;
+        }
+        if (BWFieldStorageFloat == field.storage && BWFieldLayoutRows == field.layout)
+        {
+            spawnWeights(field.vectors.data() + begin*numXBins, numXBins, numYBins, weights.data(), (int) begin, (int) end);
+            return;
+        }
+        std::vector<BWFloat2> row(numXBins);
+        for (size_t y = begin; y < end; y++)
+        {
+            particleFieldRow(&packed, numXBins, (int) y, row.data());
+            spawnWeights(row.data(), numXBins, numYBins, weights.data(), (int) y, (int) y+1);
+        }
+    });
+    field.spawnEntries.resize(count);
+    if (!spawnTableBuild(weights.data(), (uint32_t) count, field.spawnEntries.data()))
+    {
+        // Nowhere will do; the particles are spawned uniformly, and respawned on the next step
+        field.spawnEntries.clear();
+    }
+}
+
+
+/** Find the field in the cache, or build it from the u/v arrays (and keep it there)
+    @param cache    The cache, as it was when the build was asked for; null builds it unshared
+    @param seconds  Receives how long that took, in seconds
+    See buildField() for the other parameters
+    @return The field, or null on failure
+ */
+BWCPUGrid::FieldRef BWCPUGrid::acquireField(BWFieldHeader const& header
+                                            , float const* uData, float const* vData
+                                            , float velocityScale
+                                            , bool compact
+                                            , BWFieldStorage storage
+                                            , BWFieldLayout layout
+                                            , bool importanceSpawn
+                                            , bool outOfCore
+                                            , std::shared_ptr<BWFieldCache> const& cache
+                                            , BWThreadPool& threads
+                                            , double& seconds
+                                            , std::shared_ptr<void const> const& owner
+                                            ) const
+{
+    double start = BWStatsNow();
+    outOfCore = outOfCore && !compact;
+    auto build = [&](size_t& bytes)
+    {
+        std::shared_ptr<Field> field = std::make_shared<Field>();
+        if (!buildField(header, uData, vData, velocityScale, compact, storage, layout, importanceSpawn
+                        , outOfCore, owner, *field, threads))
+            return FieldRef();
+        bytes = field->bytes();
+        return FieldRef(field);
+    };
+    FieldRef ret;
+    // An out of core field isn't shared: the grid using it trims it between its own steps,
+    // which would drop the blocks from under another grid's step
+    if (!cache || outOfCore || !uData || !vData)
+    {
+        size_t bytes;
+        ret = build(bytes);
+    }
+    else
+    {
+        // The key is what the field is made from, and every setting that changes how it is made
+        BWFieldKey key = {BWFieldHash(&header, uData, vData), 0, (uint32_t) numXBins, (uint32_t) numYBins, velocityScale
+                          , (uint32_t) storage | (uint32_t) layout << 4 | (uint32_t) compact << 8 | (uint32_t) importanceSpawn << 9};
+        ret = std::static_pointer_cast<Field const>(cache->acquire(key, build));
+    }
+    seconds = BWStatsNow() - start;
+    return ret;
+}
+
+
+/** Read a .bwvf or .json file, and find or build the field from it
+    See acquireField() for the parameters
+ */
+BWCPUGrid::FieldRef BWCPUGrid::acquireFieldFromFile(char const* path, float velocityScale
+                                                    , bool compact
+                                                    , BWFieldStorage storage
+                                                    , BWFieldLayout layout
+                                                    , bool importanceSpawn
+                                                    , bool outOfCore
+                                                    , std::shared_ptr<BWFieldCache> const& cache
+                                                    , BWThreadPool& threads
+                                                    , double& seconds
+                                                    ) const
+{
+    char const* extension = strrchr(path, '.');
+    if (!extension || strcmp(extension+1, BWFieldFileExtension))
+    {
+        // Stream the JSON straight into the u/v arrays
+        BWFieldHeader header;
+        float* uData;
+        float* vData;
+        if (!BWEarthJSONRead(path, &header, &uData, &vData))
+        {
+            return FieldRef();
+        }
+        FieldRef ret = acquireField(header, uData, vData, velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache, threads, seconds);
+        free(uData);
+        free(vData);
+        return ret;
+    }
+
+    std::shared_ptr<BWFieldFile> file(new BWFieldFile, [](BWFieldFile* file)
+    {
+        BWFieldFileClose(file);
+        delete file;
+    });
+    if (!BWFieldFileOpen(path, file.get()))
+    {
+        return FieldRef();
+    }
+    // The planes are hashed and built straight from the mapping, which an out of core field
+    // keeps, to build its tiles from as they are used
+    return acquireField(file->header, file->uData, file->vData, velocityScale, compact, storage, layout, importanceSpawn, outOfCore
+                        , cache, threads, seconds, file);
+}
+
+
+/** Load the flow data
+    @param header        The size, origin and spacing of the u/v grids
+    @param uData         The u components of the vectors
+    @param vData         The v components of the vectors
+    @param velocityScale How much to scale the velocity magnitude by
+    @return true on success, false on failure
+ */
+bool BWCPUGrid::interpretData(BWFieldHeader const& header
+                              , float const* uData, float const* vData
+                              , float velocityScale
+                              )
+{
+    double seconds;
+    FieldRef field = acquireField(header, uData, vData, velocityScale, sampling == BWFieldSampleBilinear, storage, layout, importanceSpawn, 0 != tileBudget, fieldCache, *pool, seconds);
+    if (!field)
+    {
+        return false;
+    }
+    _vectorField = field;
+    _nextField   = emptyField();
+    fieldTime = 0.0f;
+    noteFieldBuilt(seconds);
+
+    // Randomize the position of the particles
+    randomizeParticles(_numParticles);
+    return true;
+}
+
+
+/** Load the flow data from a binary vector field file, or an earth JSON file
+    @param path          The path to the .bwvf or .json file
+    @param velocityScale How much to scale the velocity magnitude by
+    @return true on success, false on failure
+ */
+bool BWCPUGrid::interpretFile(char const* path, float velocityScale)
+{
+    double seconds;
+    FieldRef field = acquireFieldFromFile(path, velocityScale, sampling == BWFieldSampleBilinear, storage, layout, importanceSpawn, 0 != tileBudget, fieldCache, *pool, seconds);
+    if (!field)
+    {
+        return false;
+    }
+    _vectorField = field;
+    _nextField   = emptyField();
+    fieldTime = 0.0f;
+    noteFieldBuilt(seconds);
+
+    // Randomize the position of the particles
+    randomizeParticles(_numParticles);
+    return true;
+}
+
+
+/** Start building a field in the background
+    @param build    Builds the field
+    @param replace  True if the field replaces the current ones, rather than being blended to
+    @return true
+
+    The t1 fields and the replacements are built apart, so neither overtakes the other.
+    A build asked for while another of the same kind is pending wins over it: if that
+    build is still running, this one is queued to run when it finishes, and that field
+    is dropped; if it has finished, but not been taken, the field is dropped and this
+    is started.
+ */
+bool BWCPUGrid::startPrefetch(Builder build, bool replace)
+{
+    Prefetch& slot = replace ? replacement : prefetch;
+    if (slot.thread.joinable())
+    {
+        std::lock_guard<std::mutex> hold(prefetchLock);
+        if (!slot.done)
+        {
+            // Only the newest of those waiting is built
+            slot.queued = build;
+            return true;
+        }
+    }
+    joinPrefetch(slot);
+    slot.field.reset();
+    slot.done   = false;
+    slot.thread = std::thread([this, &slot, build]()
+    {
+        // The build gets a thread of its own, rather than competing with the particle step for the pool
+        BWThreadPool serial(1);
+        Builder next = build;
+        for (;;)
+        {
+            double seconds = 0.0;
+            FieldRef field = next(serial, seconds);
+            std::lock_guard<std::mutex> hold(prefetchLock);
+            if (!slot.queued)
+            {
+                slot.field   = field;
+                slot.seconds = seconds;
+                slot.ok      = field != nullptr;
+                slot.done    = true;
+                return;
+            }
+            // Newer data came while this was built; the field is let go (after the lock)
+            next = slot.queued;
+            slot.queued = nullptr;
+        }
+    });
+    return true;
+}
+
+
+/** Build the field for the next time step (t1) in the background
+    @param path          The path to the .bwvf or .json file
+    @param velocityScale How much to scale the velocity magnitude by
+    @return true; a build still pending is overtaken by this one
+ */
+bool BWCPUGrid::prefetchFile(char const* path, float velocityScale)
+{
+    std::string file(path);
+    bool compact = sampling == BWFieldSampleBilinear;
+    BWFieldStorage storage = this->storage;
+    BWFieldLayout  layout  = this->layout;
+    bool importanceSpawn   = this->importanceSpawn;
+    bool outOfCore         = 0 != tileBudget;
+    std::shared_ptr<BWFieldCache> cache = fieldCache;
+    return startPrefetch([this, file, velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache](BWThreadPool& threads, double& seconds)
+    {
+        return acquireFieldFromFile(file.c_str(), velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache, threads, seconds);
+    }, false);
+}
+
+
+/** Build the field for the next time step (t1) in the background
+    @param header        The size, origin and spacing of the u/v grids
+    @param uData         The u components of the vectors; these are copied
+    @param vData         The v components of the vectors
+    @param velocityScale How much to scale the velocity magnitude by
+    @return true; a build still pending is overtaken by this one
+ */
+bool BWCPUGrid::prefetchData(BWFieldHeader const& header
+                             , float const* uData, float const* vData
+                             , float velocityScale
+                             )
+{
+    size_t count = (size_t) header.srcSize.x * header.srcSize.y;
+    std::vector<float> u(uData, uData + (uData ? count : 0));
+    std::vector<float> v(vData, vData + (vData ? count : 0));
+    bool compact = sampling == BWFieldSampleBilinear;
+    BWFieldStorage storage = this->storage;
+    BWFieldLayout  layout  = this->layout;
+    bool importanceSpawn   = this->importanceSpawn;
+    bool outOfCore         = 0 != tileBudget;
+    std::shared_ptr<BWFieldCache> cache = fieldCache;
+    return startPrefetch([this, header, u, v, velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache](BWThreadPool& threads, double& seconds)
+    {
+        return acquireField(header, u.empty() ? nullptr : u.data(), v.empty() ? nullptr : v.data()
+                            , velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache, threads, seconds);
+    }, false);
+}
+
+
+/** Replace the field of the live grid, keeping the particles where they are
+    @param path          The path to the .bwvf or .json file
+    @param velocityScale How much to scale the velocity magnitude by
+    @return true; a build still pending is overtaken by this one
+ */
+bool BWCPUGrid::replaceFile(char const* path, float velocityScale)
+{
+    std::string file(path);
+    bool compact = sampling == BWFieldSampleBilinear;
+    BWFieldStorage storage = this->storage;
+    BWFieldLayout  layout  = this->layout;
+    bool importanceSpawn   = this->importanceSpawn;
+    bool outOfCore         = 0 != tileBudget;
+    std::shared_ptr<BWFieldCache> cache = fieldCache;
+    return startPrefetch([this, file, velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache](BWThreadPool& threads, double& seconds)
+    {
+        return acquireFieldFromFile(file.c_str(), velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache, threads, seconds);
+    }, true);
+}
+
+
+/** Replace the field of the live grid, keeping the particles where they are
+    @param header        The size, origin and spacing of the u/v grids
+    @param uData         The u components of the vectors; these are copied
+    @param vData         The v components of the vectors
+    @param velocityScale How much to scale the velocity magnitude by
+    @return true; a build still pending is overtaken by this one
+ */
+bool BWCPUGrid::replaceData(BWFieldHeader const& header
+                            , float const* uData, float const* vData
+                            , float velocityScale
+                            )
+{
+    size_t count = (size_t) header.srcSize.x * header.srcSize.y;
+    std::vector<float> u(uData, uData + (uData ? count : 0));
+    std::vector<float> v(vData, vData + (vData ? count : 0));
+    bool compact = sampling == BWFieldSampleBilinear;
+    BWFieldStorage storage = this->storage;
+    BWFieldLayout  layout  = this->layout;
+    bool importanceSpawn   = this->importanceSpawn;
+    bool outOfCore         = 0 != tileBudget;
+    std::shared_ptr<BWFieldCache> cache = fieldCache;
+    return startPrefetch([this, header, u, v, velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache](BWThreadPool& threads, double& seconds)
+    {
+        return acquireField(header, u.empty() ? nullptr : u.data(), v.empty() ? nullptr : v.data()
+                            , velocityScale, compact, storage, layout, importanceSpawn, outOfCore, cache, threads, seconds);
+    }, true);
+}
+
+
+/** Wait for a background build, if there is one
+    @param slot  The t1 field's, or the replacement's
+ */
+void BWCPUGrid::joinPrefetch(Prefetch& slot)
+{
+    if (slot.thread.joinable())
+        slot.thread.join();
+}
+
+
+/** Make the prefetched field t1; the old t1 (if any) becomes t0
+    @param wait  If true, wait for the background build to finish
+    @return true if the fields moved on, false if there was nothing (good) to take
+ */
+bool BWCPUGrid::advanceField(bool wait)
+{
+    if (!prefetch.thread.joinable() || (!wait && !prefetch.done))
+        return false;
+    joinPrefetch(prefetch);
+    if (!prefetch.ok)
+        return false;
+    noteFieldBuilt(prefetch.seconds);
+    if (_vectorField->empty())
+    {
+        // There isn't anything to blend from
+        _vectorField = prefetch.field;
+        randomizeParticles(_numParticles);
+    }
+    else
+    {
+        if (!_nextField->empty())
+            _vectorField = _nextField;
+        _nextField = prefetch.field;
+    }
+    prefetch.field.reset();
+    fieldTime = 0.0f;
+    return true;
+}
+
+
+/// Swap in the replacement field, if it is ready; called at the start of a frame
+void BWCPUGrid::swapReplacement()
+{
+    if (!replacement.thread.joinable() || !replacement.done)
+        return;
+    joinPrefetch(replacement);
+    if (!replacement.ok)
+        return;
+    noteFieldBuilt(replacement.seconds);
+    bool wasEmpty = _vectorField->empty();
+    _vectorField = replacement.field;
+    _nextField   = emptyField();
+    replacement.field.reset();
+    fieldTime = 0.0f;
+    if (wasEmpty)
+    {
+        // There were no particles moving yet
+        randomizeParticles(_numParticles);
+    }
+}
+
+
+/** The blend has reached t1: make t1 the only field
+ */
+void BWCPUGrid::finishBlend()
+{
+    if (!_nextField->empty())
+    {
+        _vectorField = _nextField;
+        _nextField   = emptyField();
+    }
+    fieldTime = 0.0f;
+}
+
+
+/** This is used to change the number of particles in the animation
+    @param numParticles  The number particles that should be in the system
+ */
+void BWCPUGrid::setNumParticles(int numParticles)
+{
+    // The step in flight is moving the particles there are
+    finishStep();
+    // Check for the easiest case first
+    if (numParticles <= _numParticles)
+    {
+        // Just reduce the number of particles in the system
+        _numParticles = numParticles < 0 ? 0 : numParticles;
+        return;
+    }
+
+    // count the number of new particles
+    int count = numParticles - _numParticles;
+    // Set up the starting point of what to allocate
+    nextParticleInit = _numParticles;
+
+    // Grow the array of particle positions, if needed
+    reserveParticles(numParticles);
+    _numParticles = numParticles;
+
+    // Randomize the new particles
+    randomizeParticles(count);
+}
+
+
+/// Grow the particle streams (or the vertices) to hold numParticles
+void BWCPUGrid::reserveParticles(int numParticles)
+{
+    size_t numVertices = (size_t) numParticles*verticesPerParticle();
+    if (numVertices > hostVertices.size())
+    {
+        hostVertices.resize(numVertices);
+        if (pipelined)
+        {
+            drawVertices[0].resize(hostVertices.size());
+            drawVertices[1].resize(hostVertices.size());
+        }
+    }
+    if (BWParticleStoreStreams == store && (size_t) numParticles > position.size())
+    {
+        position    .resize(numParticles);
+        prevPosition.resize(numParticles);
+        age         .resize(numParticles);
+        maxAge      .resize(numParticles);
+        expired     .resize(numParticles);
+    }
+}
+
+
+/** Select how the particles are kept
+    @param store  How the particles are kept
+ */
+void BWCPUGrid::setParticleStore(BWParticleStore store)
+{
+    if (store == this->store)
+        return;
+    finishStep();
+    this->store = store;
+    reserveParticles(_numParticles);
+    nextParticleInit = 0;
+    randomizeParticles(_numParticles);
+}
+
+
+/** Draw the particle streams as trails of the positions they have been at
+    @param length  The number of positions each particle keeps; 2 or less for the tail/head pairs
+ */
+void BWCPUGrid::setTrailLength(int length)
+{
+    length = std::max(length, numVerticesPerParticle);
+    if (length == trailLength)
+        return;
+    finishStep();
+    trailLength = length;
+    if (BWParticleStoreStreams != store)
+        return;
+    // The buffers are laid out afresh, with the lines (or trails) starting where the particles are
+    reserveParticles(_numParticles);
+    BWParticleStreams particles = particleStreams();
+    pool->parallelFor(_numParticles, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+    {
+        startVertices(&particles, (int) begin, (int) end);
+    });
+    if (pipelined)
+        std::copy(hostVertices.begin(), hostVertices.begin() + (size_t) trailLength*_numParticles
+                  , drawVertices[drawFront].begin());
+}
+
+
+/** Set how long the particles live, with BWParticleStoreStreams
+    @param minAge  The shortest lifetime, in steps
+    @param maxAge  The longest lifetime, in steps
+ */
+void BWCPUGrid::setLifetime(int minAge, int maxAge)
+{
+    // The ages are 16 bits
+    minLifetime = std::min(std::max(minAge, 1), 0xFFFF);
+    maxLifetime = std::min(std::max(maxAge, minLifetime), 0xFFFF);
+}
+
+
+/** This is used to randomize the num next particles
+    @param numParticles The number of particles to initialize
+ */
+void BWCPUGrid::randomizeParticles(int numParticles)
+{
+    int maxNumParticles = _numParticles - nextParticleInit;
+    if (maxNumParticles < numParticles)
+    {
+        numParticles = maxNumParticles;
+    }
+    if (numParticles <= 0)
+        return;
+    // The new particles are written to the buffer that is drawn, once the step writing
+    // the other has finished with the particles
+    finishStep();
+
+    BWStatsStart(start);
+    int first = nextParticleInit;
+    nextParticleInit += numParticles;
+    if (nextParticleInit >= _numParticles)
+    {
+        nextParticleInit = 0;
+    }
+    if (BWParticleStoreStreams == store)
+    {
+        BWParticleStreams particles = particleStreams();
+        BWSpawnTable table = spawnTable();
+        pool->parallelFor(numParticles, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+        {
+            particleSpawn(&particles, numXBins, numYBins, seed, frame, minLifetime, maxLifetime, &table
+                          , first + (int) begin, first + (int) end);
+            startVertices(&particles, first + (int) begin, first + (int) end);
+        });
+    }
+    else
+    {
+        pool->parallelFor(numParticles, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+        {
+            particleInit(hostVertices.data(), numXBins, numYBins, seed, frame, first + (int) begin, first + (int) end);
+        });
+    }
+    if (pipelined)
+    {
+        // They show straight away, rather than after the next step
+        size_t stride = verticesPerParticle();
+        std::copy(hostVertices.begin() + stride*first
+                  , hostVertices.begin() + stride*(first + numParticles)
+                  , drawVertices[drawFront].begin() + stride*first);
+    }
+    BWStatsCount(&_stats, frameInit, numParticles);
+    BWStatsStop(&_stats, BWStageRespawn, start);
+}
+
+
+/** Reorder the particles by the field tile their tail is in
+    Each chunk of particles counts the particles in each tile, the counts are summed
+    (tile by tile, chunk by chunk) into where each chunk's particles in that tile go,
+    and then each chunk moves its particles there.
+ */
+void BWCPUGrid::sortParticles()
+{
+    if (_numParticles < 2)
+        return;
+    finishStep();
+    uint32_t numXTiles = gridNumTiles(numXBins);
+    uint32_t numTiles  = numXTiles * gridNumTiles(numYBins);
+    // A few chunks per thread; each has a count for every tile
+    size_t chunk = std::max<size_t>(PARTICLE_CHUNK, (_numParticles + 4*pool->numWorkers() - 1) / (4*pool->numWorkers()));
+    size_t numChunks = (_numParticles + chunk - 1) / chunk;
+    sortKeys.resize(_numParticles);
+    sortCounts.assign(numChunks*numTiles, 0);
+    bool streams = BWParticleStoreStreams == store;
+    // The trails move with the particles; the tail/head pairs of the streams are written afresh
+    int length = verticesPerParticle();
+    bool trails = length > numVerticesPerParticle;
+    std::vector<BWFloat2>& trailVertices = pipelined ? drawVertices[drawFront] : hostVertices;
+    if (streams)
+    {
+        sortScratch     .resize(position.size());
+        sortPrevScratch .resize(position.size());
+        sortAgeScratch  .resize(position.size());
+        sortMaxAgeScratch.resize(position.size());
+        if (trails)
+            sortTrailScratch.resize(trailVertices.size());
+    }
+    else
+    {
+        sortScratch.resize(hostVertices.size());
+    }
+
+    // The tail of each particle is every other vertex, or the position stream
+    BWFloat2 const* vertex = streams ? position.data() : hostVertices.data();
+    size_t stride = streams ? 1 : 2;
+    pool->parallelFor(numChunks, 1, [&](size_t first, size_t last)
+    {
+        for (size_t c = first; c < last; c++)
+        {
+            uint32_t* counts = sortCounts.data() + c*numTiles;
+            size_t end = std::min<size_t>((c+1)*chunk, _numParticles);
+            for (size_t idx = c*chunk; idx < end; idx++)
+            {
+                // The tile of the tail, clamped as in particleMove
+                BWFloat2 position = vertex[stride*idx];
+                uint32_t x = position.x > 0.0f ? (position.x < numXBins-1 ? (uint32_t) position.x : numXBins-1) : 0;
+                uint32_t y = position.y > 0.0f ? (position.y < numYBins-1 ? (uint32_t) position.y : numYBins-1) : 0;
+                uint32_t key = (y >> BWFieldTileShift)*numXTiles + (x >> BWFieldTileShift);
+                sortKeys[idx] = key;
+                counts[key]++;
+            }
+        }
+    });
+
+    // Turn the counts into where each chunk's first particle in each tile goes
+    uint32_t offset = 0;
+    for (uint32_t key = 0; key < numTiles; key++)
+    {
+        for (size_t c = 0; c < numChunks; c++)
+        {
+            uint32_t& count = sortCounts[c*numTiles + key];
+            uint32_t n = count;
+            count = offset;
+            offset += n;
+        }
+    }
+
+    BWFloat2* sorted = sortScratch.data();
+    pool->parallelFor(numChunks, 1, [&](size_t first, size_t last)
+    {
+        for (size_t c = first; c < last; c++)
+        {
+            uint32_t* offsets = sortCounts.data() + c*numTiles;
+            size_t end = std::min<size_t>((c+1)*chunk, _numParticles);
+            for (size_t idx = c*chunk; idx < end; idx++)
+            {
+                uint32_t to = offsets[sortKeys[idx]]++;
+                if (streams)
+                {
+                    // Each of the streams moves the same way
+                    sorted           [to] = vertex      [idx];
+                    sortPrevScratch  [to] = prevPosition[idx];
+                    sortAgeScratch   [to] = age         [idx];
+                    sortMaxAgeScratch[to] = maxAge      [idx];
+                    if (trails)
+                        std::copy(trailVertices.begin() + (size_t) length*idx, trailVertices.begin() + (size_t) length*(idx+1)
+                                  , sortTrailScratch.begin() + (size_t) length*to);
+                    continue;
+                }
+                sorted[2*to  ] = vertex[2*idx  ];
+                sorted[2*to+1] = vertex[2*idx+1];
+            }
+        }
+    });
+    if (streams)
+    {
+        position    .swap(sortScratch);
+        prevPosition.swap(sortPrevScratch);
+        age         .swap(sortAgeScratch);
+        maxAge      .swap(sortMaxAgeScratch);
+        if (trails)
+            trailVertices.swap(sortTrailScratch);
+        return;
+    }
+    hostVertices.swap(sortScratch);
+}
+
+
+/** Update the animation for the time that has passed, at a fixed STEPS_PER_SECOND
+    @param seconds  The time since the last call
+    @returns The number of steps taken; 0 if not a whole step has passed yet
+
+    The steps are worked out by BWStepsForTime(), and taken in the one pass.
+ */
+int BWCPUGrid::advanceTime(double seconds)
+{
+    int numSteps = BWStepsForTime(&stepBacklog, seconds);
+    if (numSteps)
+        animationSteps(numSteps);
+    return numSteps;
+}
+
+
+/** Overlap the steps with the drawing
+    @param enable  True runs the steps on a thread of their own, into the draw buffer that
+                   isn't being drawn; false steps in the caller
+ */
+void BWCPUGrid::setPipelined(bool enable)
+{
+    if (enable == pipelined)
+        return;
+    if (enable)
+    {
+        // Both start with the lines there are now
+        drawVertices[0] = hostVertices;
+        drawVertices[1].resize(hostVertices.size());
+        drawFront    = 0;
+        stepStopping = false;
+        stepThread   = std::thread(&BWCPUGrid::stepLoop, this);
+        pipelined    = true;
+        return;
+    }
+    finishStep();
+    {
+        std::lock_guard<std::mutex> guard(stepLock);
+        stepStopping = true;
+    }
+    stepSignal.notify_all();
+    stepThread.join();
+    // The streams' lines went to the draw buffers; the tail/head pairs are in hostVertices
+    if (BWParticleStoreStreams == store)
+        hostVertices.swap(drawVertices[drawFront]);
+    drawVertices[0] = std::vector<BWFloat2>();
+    drawVertices[1] = std::vector<BWFloat2>();
+    pipelined = false;
+}
+
+
+/** Wait for the step in flight, if there is one, and make the buffer it wrote the one
+    that vertices() returns
+ */
+void BWCPUGrid::finishStep()
+{
+    if (!stepInFlight)
+        return;
+    {
+        std::unique_lock<std::mutex> guard(stepLock);
+        stepSignal.wait(guard, [this]{ return !stepBusy; });
+    }
+    stepInFlight = false;
+    drawFront    = 1 - drawFront;
+    drawnFrame   = stepFrame;
+    noteStep(stepSeconds, stepRespawned);
+}
+
+
+/// The loop the pipelined steps are run on
+void BWCPUGrid::stepLoop()
+{
+    std::unique_lock<std::mutex> guard(stepLock);
+    for (;;)
+    {
+        stepSignal.wait(guard, [this]{ return stepStopping || stepBusy; });
+        // A step is always finished before the thread is stopped
+        if (!stepBusy)
+            return;
+        guard.unlock();
+        double start = BWStatsNow();
+        uint32_t respawned = moveParticles(stepWork);
+        double seconds = BWStatsNow() - start;
+        guard.lock();
+        stepSeconds   = seconds;
+        stepRespawned = respawned;
+        // Let go of the fields, so that they can be freed once the grid has moved on
+        stepWork.field.reset();
+        stepWork.next .reset();
+        stepBusy = false;
+        stepSignal.notify_all();
+    }
+}
+
+
+/** Move the particle streams, respawning the ones that expire
+    @param step  The steps to take
+    @returns The number of particles respawned
+
+    As with the tail/head pairs, each cache sized chunk takes all of the steps before
+    the next is started.  Each step is three passes over the chunk: particleAdvance moves
+    the particles and lists the ones that expired (in the chunk's own part of the expired
+    list), particleRespawn respawns just those, and, after the last step,
+    particleWriteVertices writes the lines to the draw buffer.  With trails, each step
+    instead writes its slot of the rings, with particleWriteTrail, after the rings are
+    brought over from the buffer being drawn.
+ */
+uint32_t BWCPUGrid::advanceStreams(Step const& step)
+{
+    Field const& field = *step.field;
+    Field const& next  = *step.next;
+    bool blend = !next.empty() && next.compact == field.compact;
+    BWParticleStreams particles = {position.data(), prevPosition.data(), age.data(), maxAge.data()};
+    BWPackedField packed     = field.packedField();
+    BWPackedField nextPacked = next.packedField();
+    BWSourceField source     = field.sourceField();
+    BWSourceField nextSource = next.sourceField();
+    // Spawned from the table of whichever field the time is nearer
+    BWSpawnTable  table      = !next.empty() && step.time >= 0.5f ? next.spawnTable() : field.spawnTable();
+    std::atomic<uint32_t> respawned(0);
+    int  length = step.trailLength;
+    bool trails = length > numVerticesPerParticle;
+    step.pool->parallelFor(step.numParticles, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+    {
+        uint32_t* chunkExpired = expired.data() + begin;
+        uint32_t count = 0;
+        // The steps add to the rings, so they carry on from the buffer being drawn
+        if (trails && step.source != step.target)
+            std::copy(step.source + length*begin, step.source + length*end, step.target + length*begin);
+        for (int s = 0; s < step.numSteps; s++)
+        {
+            int numExpired;
+            touchTiles(step, particles.position, 1, begin, end);
+            if (field.compact)
+                numExpired = particleAdvanceSampled(&particles, STEP_DT, numXBins, numYBins
+                                                    , &source, blend ? &nextSource : nullptr, step.time, step.integrator
+                                                    , chunkExpired, (int) begin, (int) end);
+            else
+                numExpired = particleAdvanceISA(step.moveISA, &particles, STEP_DT, numXBins, numYBins
+                                                , &packed, blend ? &nextPacked : nullptr, step.time
+                                                , chunkExpired, (int) begin, (int) end);
+            particleRespawn(&particles, chunkExpired, numExpired, numXBins, numYBins
+                            , seed, step.frame + s, step.minLifetime, step.maxLifetime, &table);
+            count += numExpired;
+            if (trails)
+                particleWriteTrail(&particles, step.target, length, (int)((step.frame + s) % length)
+                                   , (int) begin, (int) end);
+        }
+        if (!trails)
+            particleWriteVertices(&particles, step.target, (int) begin, (int) end);
+        respawned += count;
+    });
+    trimTiles(step);
+    return respawned;
+}
+
+
+/** Move the particles, in one pass over them
+    @param step  The steps to take
+    @returns The number of particles respawned
+
+    Each cache sized chunk of particles takes all of the steps before the next chunk
+    is started, so the particles are only brought in from memory once.  Step s uses
+    frame number frame+s, just as that many calls of animationStep() would.  The
+    tail/head pairs are moved in place, and then copied to the target, if that is a
+    draw buffer, while they are still in cache.
+ */
+uint32_t BWCPUGrid::moveParticles(Step const& step)
+{
+    if (BWParticleStoreStreams == store)
+        return advanceStreams(step);
+    Field const& field = *step.field;
+    Field const& next  = *step.next;
+    // A field of the other layout (from before setSampling) isn't blended with
+    bool blend = !next.empty() && next.compact == field.compact;
+    BWFloat2* vertex = hostVertices.data();
+    std::atomic<uint32_t> respawned(0);
+    BWSourceField source     = field.sourceField();
+    BWSourceField nextSource = next.sourceField();
+    BWPackedField packed     = field.packedField();
+    BWPackedField nextPacked = next.packedField();
+    step.pool->parallelFor(step.numParticles, PARTICLE_CHUNK, [&](size_t begin, size_t end)
+    {
+        uint32_t count = 0;
+        for (int s = 0; s < step.numSteps; s++)
+        {
+            touchTiles(step, vertex, numVerticesPerParticle, begin, end);
+            if (field.compact)
+                count += particleMoveSampled(vertex, STEP_DT, numXBins, numYBins
+                                             , &source, blend ? &nextSource : nullptr, step.time, step.integrator
+                                             , seed, step.frame + s, (int) begin, (int) end);
+            else
+                // Perform the particle movement, a cache sized chunk at a time
+                count += particleMovePackedISA(step.moveISA, vertex, STEP_DT, numXBins, numYBins
+                                               , &packed, blend ? &nextPacked : nullptr, step.time, seed, step.frame + s
+                                               , (int) begin, (int) end);
+        }
+        if (step.target != vertex)
+            std::copy(vertex + numVerticesPerParticle*begin, vertex + numVerticesPerParticle*end
+                      , step.target + numVerticesPerParticle*begin);
+        respawned += count;
+    });
+    trimTiles(step);
+    return respawned;
+}
+
+
+/** Keep the out of core fields within the budget, once a step has finished with them
+    @param step  The steps that were taken
+
+    When blending, the two fields are read at the same bins, so each keeps half.
+ */
+void BWCPUGrid::trimTiles(Step const& step)
+{
+    BWTileStore* field = step.field->tiles.get();
+    BWTileStore* next  = step.next ->tiles.get();
+    size_t budget = field && next ? step.tileBudget / 2 : step.tileBudget;
+    if (field)
+        field->trim(budget);
+    if (next)
+        next->trim(budget);
+}
+
+
+/// How the out of core fields in use (t0 and t1) have done
+BWTileStoreStats BWCPUGrid::tileStatistics() const
+{
+    BWTileStoreStats ret;
+    memset(&ret, 0, sizeof(ret));
+    Field const* fields[2] = {_vectorField.get(), _nextField.get()};
+    for (Field const* field : fields)
+    {
+        if (!field->tiles)
+            continue;
+        BWTileStoreStats stats = field->tiles->statistics();
+        ret.builds        += stats.builds;
+        ret.evictions     += stats.evictions;
+        ret.blocks        += stats.blocks;
+        ret.built         += stats.built;
+        ret.residentBytes += stats.residentBytes;
+        ret.mappedBytes   += stats.mappedBytes;
+        ret.memoryBacked   = ret.memoryBacked || stats.memoryBacked;
+    }
+    return ret;
+}
+
+
+/** Update the animation by a number of steps, in one pass over the particles
+    @param numSteps  The number of steps to take
+
+    When pipelined, the steps are handed to the step thread, writing the draw buffer that
+    isn't being drawn, and this returns straight away; the next call (or finishStep())
+    waits for them, and draws from what they wrote.
+ */
+void BWCPUGrid::animationSteps(int numSteps)
+{
+    // The step in flight has to finish before the next is started from where it left off
+    finishStep();
+    // This is the frame boundary, where a replacement field can be swapped in
+    swapReplacement();
+    if (_vectorField->empty() || numSteps < 1)
+        return;
+    // The particle streams are respawned as they expire, rather than a few each step
+    if (BWParticleStoreStreams != store)
+        randomizeParticles(100*numSteps);
+    // Sort if one of the steps is due for it
+    if (sortInterval)
+    {
+        int phase = (int)(frame % sortInterval);
+        if (0 == phase || phase + numSteps > sortInterval)
+            sortParticles();
+    }
+    Step step;
+    step.numSteps     = numSteps;
+    step.frame        = frame;
+    step.numParticles = _numParticles;
+    step.field        = _vectorField;
+    step.next         = _nextField;
+    step.time         = fieldTime;
+    step.minLifetime  = minLifetime;
+    step.maxLifetime  = maxLifetime;
+    step.moveISA      = moveISA;
+    step.integrator   = integrator;
+    step.tileBudget   = tileBudget;
+    step.pool         = pool;
+    step.trailLength  = verticesPerParticle();
+    frame += numSteps;
+    if (pipelined)
+    {
+        step.target = drawVertices[1 - drawFront].data();
+        step.source = drawVertices[drawFront].data();
+        stepFrame   = frame;
+        {
+            std::lock_guard<std::mutex> guard(stepLock);
+            stepWork = step;
+            stepBusy = true;
+        }
+        stepInFlight = true;
+        stepSignal.notify_all();
+        return;
+    }
+    step.target = hostVertices.data();
+    step.source = step.target;
+    drawnFrame  = frame;
+    double start = BWStatsNow();
+    uint32_t respawned = moveParticles(step);
+    noteStep(BWStatsNow() - start, respawned);
+}
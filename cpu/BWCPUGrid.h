@@ -0,0 +1,785 @@
+/*
+    BWCPUGrid.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWCPUGrid_h
+#define BWCPUGrid_h
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "BWCPUTypes.h"
+#include "BWFieldCache.h"
+#include "BWParticleMove.h"
+#include "BWStats.h"
+#include "BWThreadPool.h"
+#include "BWTileStore.h"
+
+/** This is the CPU (headless) version of BWGrid.
+    It provides the same operations -- build the field from the u/v arrays,
+    set the number of particles, randomize them, and step the animation --
+    without openCL or a GL context, so that it can run on any machine.
+ */
+class BWCPUGrid
+{
+public:
+    /** Initialize the simuluation with a given number of particles
+        @param numParticles  The number of particles in the simulations
+        @param width         The number of bins wide
+        @param height        The number of bins high
+        @param seed          The seed for the random steps; the same seed gives the same
+                             particle streams, regardless of the number of threads
+     */
+    BWCPUGrid(int numParticles, int width, int height, uint64_t seed = 0);
+    ~BWCPUGrid();
+
+    /** Load the flow data
+        @param header        The size, origin and spacing of the u/v grids
+        @param uData         The u components of the vectors, header.srcSize.x*header.srcSize.y of them
+        @param vData         The v components of the vectors
+        @param velocityScale How much to scale the velocity magnitude by
+        @return true on success, false on failure
+     */
+    bool interpretData(BWFieldHeader const& header
+                       , float const* uData, float const* vData
+                       , float velocityScale
+                       );
+
+    /** Load the flow data from a binary vector field file (see BWFieldFile.h), or an
+        earth JSON file (see BWEarthJSON.h)
+        @param path          The path to the .bwvf or .json file
+        @param velocityScale How much to scale the velocity magnitude by
+        @return true on success, false on failure
+
+        A .bwvf file is memory mapped, and the u/v planes are read in place by gridBuildField.
+     */
+    bool interpretFile(char const* path, float velocityScale);
+
+    /** Build the field for the next time step (t1) in the background
+        @param path          The path to the .bwvf or .json file
+        @param velocityScale How much to scale the velocity magnitude by
+        @return true; a build still pending is overtaken by this one
+
+        The file is read and the field built on a thread of its own, one row tile at a
+        time, so that it doesn't hold up the animation.  As with replaceFile(), the
+        newest of a burst of calls is the one advanceField() takes.
+     */
+    bool prefetchFile(char const* path, float velocityScale);
+
+    /** Build the field for the next time step (t1) in the background
+        @param header        The size, origin and spacing of the u/v grids
+        @param uData         The u components of the vectors; these are copied
+        @param vData         The v components of the vectors
+        @param velocityScale How much to scale the velocity magnitude by
+        @return true; a build still pending is overtaken by this one
+     */
+    bool prefetchData(BWFieldHeader const& header
+                      , float const* uData, float const* vData
+                      , float velocityScale
+                      );
+
+    /** Replace the field of the live grid, keeping the particles where they are
+        @param path          The path to the .bwvf or .json file
+        @param velocityScale How much to scale the velocity magnitude by
+        @return true; a build still pending is overtaken by this one
+
+        The field is built in the background, and swapped in (for both t0 and t1) at
+        the start of the first animationStep() after it is ready.  Of a burst of
+        updates, the newest is the one swapped in: one asked for while another is
+        being built runs when that finishes, and that field is dropped.
+     */
+    bool replaceFile(char const* path, float velocityScale);
+
+    /** Replace the field of the live grid, keeping the particles where they are
+        @param header        The size, origin and spacing of the u/v grids
+        @param uData         The u components of the vectors; these are copied
+        @param vData         The v components of the vectors
+        @param velocityScale How much to scale the velocity magnitude by
+        @return true; a build still pending is overtaken by this one
+     */
+    bool replaceData(BWFieldHeader const& header
+                     , float const* uData, float const* vData
+                     , float velocityScale
+                     );
+
+    /// True if the background build of t1 has finished, and advanceField() won't wait
+    bool prefetchReady() const { return prefetch.done; }
+
+    /** Make the prefetched field t1; the old t1 (if any) becomes t0
+        @param wait  If true, wait for the background build to finish
+        @return true if the fields moved on, false if there was nothing (good) to take
+
+        The replacements (replaceFile(), replaceData()) are built apart from the t1
+        fields, and animationStep() swaps them in.
+     */
+    bool advanceField(bool wait = false);
+
+    /** The blend has reached t1: make t1 the only field
+     */
+    void finishBlend();
+
+    /** Set how far from t0 to t1 the particles are moved
+        @param time  From 0 (all t0) to 1 (all t1)
+     */
+    void setFieldTime(float time) { fieldTime = time < 0.0f ? 0.0f : time > 1.0f ? 1.0f : time; }
+    /// How far from t0 to t1 the particles are moved
+    float getFieldTime() const { return fieldTime; }
+
+    /** This is used to change the number of particles in the animation
+        @param numParticles  The number particles that should be in the system
+     */
+    void setNumParticles(int numParticles);
+
+    /** This is used to randomize the num next particles
+        @param numParticles The number of particles to initialize
+     */
+    void randomizeParticles(int numParticles);
+
+    /// Update the animation
+    void animationStep() { animationSteps(1); }
+
+    /** Update the animation by a number of steps, in one pass over the particles
+        @param numSteps  The number of steps to take
+     */
+    void animationSteps(int numSteps);
+
+    /** Update the animation for the time that has passed, at a fixed STEPS_PER_SECOND
+        @param seconds  The time since the last call
+        @returns The number of steps taken; 0 if not a whole step has passed yet
+     */
+    int advanceTime(double seconds);
+
+    /** Overlap the steps with the drawing
+        @param enable  True runs each animationSteps() on a thread of its own, writing the one
+                       of two vertex buffers that isn't being drawn, and returns straight away;
+                       vertices() is then what the last step to finish wrote, a step behind.
+                       False (the default) steps in the caller, in place, as in AppConfig.h
+                       with PIPELINE_EN 0.
+     */
+    void setPipelined(bool enable);
+    /// True if the steps are run in the background, a step ahead of vertices()
+    bool getPipelined() const { return pipelined; }
+
+    /** Wait for the step in flight, if there is one, and make the buffer it wrote the one
+        that vertices() returns.  This is done before anything else touches the particles;
+        the caller only needs it to see a step's lines before the next animationSteps().
+     */
+    void finishStep();
+
+    /** Select which version of particleMove to use
+        @param isa  The instruction set; by default the widest one the CPU supports
+     */
+    void setMoveISA(BWParticleMoveISA isa) { moveISA = isa; }
+    /// The version of particleMove that is being used
+    BWParticleMoveISA getMoveISA() const { return moveISA; }
+
+    /** Select how the particles look up the field
+        @param sampling  BWFieldSampleNearest (the default) expands the field to one vector
+                         per bin; BWFieldSampleBilinear keeps it at the resolution of the data
+                         and samples it at each particle's position.  This takes effect with
+                         the next field that is built.
+     */
+    void setSampling(BWFieldSampling sampling) { this->sampling = sampling; }
+    /// How the particles look up the fields that are built from now on
+    BWFieldSampling getSampling() const { return sampling; }
+
+    /** Select how the vectors of a (nearest bin) field are stored
+        @param storage  BWFieldStorageFloat (the default), or half floats or 16 bit fixed
+                        point, which take half the memory (and memory traffic) and are
+                        decoded as the particles read them.  This takes effect with the
+                        next field that is built; bilinearly sampled fields are always floats.
+     */
+    void setStorage(BWFieldStorage storage) { this->storage = storage; }
+    /// How the vectors of the fields that are built from now on are stored
+    BWFieldStorage getStorage() const { return storage; }
+
+    /** Select how the bins of a (nearest bin) field are ordered in memory
+        @param layout  BWFieldLayoutRows (the default), or BWFieldLayoutTiled, which keeps the
+                       bins near a particle in the same few cache lines and pages.  This takes
+                       effect with the next field that is built.
+     */
+    void setLayout(BWFieldLayout layout) { this->layout = layout; }
+    /// How the bins of the fields that are built from now on are ordered
+    BWFieldLayout getLayout() const { return layout; }
+
+    /** Sort the particles by where they are every so many frames
+        @param frames  The number of frames between sorts; 0 (the default) never sorts
+
+        Sorted, the particles that are next to each other in the buffer are near each other
+        in the field, so each chunk of them reads the field from a few tiles rather than all
+        over it.  Sorting changes which random numbers each particle gets.
+     */
+    void setSortInterval(int frames) { sortInterval = frames < 0 ? 0 : frames; }
+    /// The number of frames between sorts; 0 if the particles aren't sorted
+    int getSortInterval() const { return sortInterval; }
+
+    /** Reorder the particles by the field tile (see BWFieldTileShift) their tail is in
+        This is a parallel counting sort, and is stable.
+     */
+    void sortParticles();
+
+    /** Select how the particles are kept
+        @param store  BWParticleStoreStreams (the default with PARTICLE_STREAMS_EN) keeps
+                      separate streams with lifetimes; BWParticleStoreVertices keeps only the
+                      tail/head pairs.  Changing it respawns the particles.
+     */
+    void setParticleStore(BWParticleStore store);
+    /// How the particles are kept
+    BWParticleStore getParticleStore() const { return store; }
+
+    /** Set how long the particles live, with BWParticleStoreStreams
+        @param minAge  The shortest lifetime, in steps
+        @param maxAge  The longest lifetime, in steps
+
+        This takes effect as the particles are respawned.
+     */
+    void setLifetime(int minAge, int maxAge);
+
+    /** Draw the particle streams as trails of the positions they have been at
+        @param length  The number of positions each particle keeps; 2 or less (the default)
+                       keeps only the tail/head pair.  Otherwise vertices() is a ring of this
+                       many positions for each particle, which each step writes one slot of
+                       (see trailHead()), drawn as length-1 segments as BWGrid (GLRender) does
+                       with TRAIL_LENGTH.  The trails start over where the particles are.
+
+        This only applies to BWParticleStoreStreams; the tail/head pairs are always pairs.
+     */
+    void setTrailLength(int length);
+    /// The number of positions in each particle's trail; 2 for the tail/head pairs
+    int getTrailLength() const { return trailLength; }
+
+    /// The number of vertices each particle has in vertices(): the ring of getTrailLength()
+    /// positions of the particle streams, or the tail/head pair
+    int verticesPerParticle() const { return BWParticleStoreStreams == store ? trailLength : numVerticesPerParticle; }
+
+    /// The slot of the rings in vertices() that was written last, where the newest position
+    /// joins back to the oldest; for the tail/head pairs, 1, the head
+    int trailHead() const { return verticesPerParticle() > numVerticesPerParticle ? (int)((drawnFrame - 1) % trailLength) : 1; }
+
+    /** Select where the particle streams are spawned
+        @param enable  True (the default with SPAWN_TABLE_EN) spawns them in proportion to the
+                       speed and area of the bins, and not where they would all be respawned
+                       straight away (see BWSpawnTable.h); false spawns them uniformly.  This
+                       takes effect with the next field that is built.
+     */
+    void setImportanceSpawn(bool enable) { importanceSpawn = enable; }
+    /// True if the fields built from now on have the alias table to spawn from
+    bool getImportanceSpawn() const { return importanceSpawn; }
+
+    /** Select the cache that the fields are shared through
+        @param cache  The cache; BWFieldCache::shared() (the default with FIELD_CACHE_EN) shares
+                      them with every grid in the process.  Null builds each field afresh.
+                      This takes effect with the next field that is built.
+     */
+    void setFieldCache(std::shared_ptr<BWFieldCache> cache) { fieldCache = cache; }
+    /// The cache the fields built from now on are shared through; null if they aren't
+    std::shared_ptr<BWFieldCache> getFieldCache() const { return fieldCache; }
+
+    /** Keep the (nearest bin) fields out of core, for output sizes too big to build whole
+        @param bytes  0 (the default) builds each field whole, in memory.  Otherwise the fields
+                      built from now on are tile stores (see BWTileStore.h): tiled, in memory
+                      mapped files, and built a block of tiles at a time as the particles reach
+                      them.  After each step, the blocks used longest ago are dropped until the
+                      fields in use keep no more than this many bytes in memory.  These fields
+                      are stored as floats or half floats (BWFieldStorageInt16 is taken as half
+                      floats), and the particles are spawned uniformly on them.  Each grid builds
+                      its own, rather than sharing them through the field cache, since it trims
+                      them between its steps.
+     */
+    void setTileBudget(size_t bytes) { tileBudget = bytes; }
+    /// The bytes the out of core fields may keep in memory; 0 if the fields are built whole
+    size_t getTileBudget() const { return tileBudget; }
+
+    /// How the out of core fields in use (t0 and t1) have done; all zero if they are built whole
+    BWTileStoreStats tileStatistics() const;
+
+    /** Select how the particles are moved along a bilinearly sampled field
+        @param integrator  Euler (the default), RK2 or RK4
+     */
+    void setIntegrator(BWIntegrator integrator) { this->integrator = integrator; }
+    /// How the particles are moved along a bilinearly sampled field
+    BWIntegrator getIntegrator() const { return integrator; }
+
+    /** Select the threads that the kernels are run on
+        @param pool  The pool of threads; by default BWThreadPool::shared()
+     */
+    void setThreadPool(std::shared_ptr<BWThreadPool> pool) { this->pool = pool ? pool : BWThreadPool::shared(); }
+
+    /// The width of the field
+    int width() const { return numXBins; }
+    /// The height of the field
+    int height() const { return numYBins; }
+    /// The number if particles being simulated
+    int numParticles() const { return _numParticles; }
+    /// The number of animation steps taken
+    uint32_t frameNumber() const { return frame; }
+
+    /** The timings of the field builds, respawns and steps, and the respawn counts
+        (always empty with STATS_EN 0).  The caller can add the times of its own stages,
+        such as drawing, to it.
+     */
+    BWStats& stats() { return _stats; }
+
+    /// The tail/head pairs of each particle, or their rings (see setTrailLength());
+    /// verticesPerParticle() * numParticles() of them.  When pipelined, these are what the last step to finish wrote, and aren't written again
+    /// until the animationSteps() after next
+    BWFloat2 const* vertices() const { return pipelined ? drawVertices[drawFront].data() : hostVertices.data(); }
+
+    /// The particle streams; these are empty unless the store is BWParticleStoreStreams.
+    /// This waits for the step in flight
+    BWParticleStreams particleStreams()
+    {
+        finishStep();
+        BWParticleStreams ret = {position.data(), prevPosition.data(), age.data(), maxAge.data()};
+        return ret;
+    }
+
+    /// The alias table the particle streams are spawned from: that of whichever field the
+    /// time is nearer; empty if they are spawned uniformly
+    BWSpawnTable spawnTable() const
+    {
+        bool next = !_nextField->empty() && fieldTime >= 0.5f;
+        return next ? _nextField->spawnTable() : _vectorField->spawnTable();
+    }
+
+    /// The vectors in space, organized as bins in a rectilinear grid; null until data is loaded,
+    /// or if the field is stored packed or tiled (see packedField()).
+    /// For a bilinearly sampled field, these are the vectors of the compact grid
+    BWFloat2 const* vectorField() const { return _vectorField->floatRows(); }
+
+    /// The vectors at the next time step (t1); null if there is only the one field
+    BWFloat2 const* nextField() const { return _nextField->floatRows(); }
+
+    /// The per-bin field at t0, in whichever form it is stored
+    BWPackedField packedField() const { return _vectorField->packedField(); }
+
+    /// The compact form of the field at t0; only meaningful if it was built with BWFieldSampleBilinear
+    BWSourceField sourceField() const { return _vectorField->sourceField(); }
+
+    /// The number of bytes the vectors of the field(s) take
+    size_t fieldBytes() const { return _vectorField->vectorBytes() + _nextField->vectorBytes(); }
+
+    /// The number of bytes the alias tables of the field(s) take
+    size_t spawnTableBytes() const { return _vectorField->spawnBytes() + _nextField->spawnBytes(); }
+
+private:
+    /// A built field, and how it is laid out.  Once built, a field is shared (see BWFieldCache.h)
+    /// and never changed
+    struct Field
+    {
+        /// numXBins * numYBins vectors, or the compact grid; empty if the field is packed
+        std::vector<BWFloat2> vectors;
+        /// numXBins * numYBins BWHalf2 or BWShort2, for the packed forms
+        std::vector<uint32_t> packed;
+        /// The scales of each row, for BWFieldStorageInt16
+        std::vector<BWFloat2> rowScale;
+        /// How the vectors are stored
+        BWFieldStorage storage;
+        /// How the bins are ordered
+        BWFieldLayout layout;
+        /// The number of tiles across, for BWFieldLayoutTiled
+        uint32_t      numXTiles;
+        /// True if this is the compact grid
+        bool          compact;
+        /// The size, origin and scale of the compact grid (srcField is set when it is used)
+        BWSourceField source;
+        /// The alias table the particle streams are spawned from; empty to spawn them uniformly
+        std::vector<BWSpawnEntry> spawnEntries;
+        /// The out of core field, in place of vectors and packed (see setTileBudget)
+        std::shared_ptr<BWTileStore> tiles;
+
+        Field() : storage(BWFieldStorageFloat), layout(BWFieldLayoutRows), numXTiles(0), compact(false) { source = BWSourceField(); }
+        bool empty() const { return vectors.empty() && packed.empty() && !tiles; }
+        /// The number of bytes the vectors take; for an out of core field, those in memory now
+        size_t vectorBytes() const
+        {
+            return sizeof(BWFloat2)*(vectors.size() + rowScale.size()) + sizeof(uint32_t)*packed.size()
+                 + (tiles ? tiles->residentBytes() : 0);
+        }
+        /// The number of bytes the alias table takes
+        size_t spawnBytes() const { return sizeof(BWSpawnEntry)*spawnEntries.size(); }
+        /// The number of bytes the field takes, all told
+        size_t bytes() const { return vectorBytes() + spawnBytes(); }
+        /// The per-bin field, ready to read
+        BWPackedField packedField() const
+        {
+            if (tiles)
+                return tiles->packedField();
+            BWPackedField ret = {storage, nullptr, rowScale.data(), layout, numXTiles};
+            ret.vectors = BWFieldStorageFloat == storage ? (void const*) vectors.data() : (void const*) packed.data();
+            return ret;
+        }
+        /// The vectors, if they are floats laid out in rows (or the compact grid); otherwise null
+        BWFloat2 const* floatRows() const
+        {
+            return vectors.empty() || BWFieldLayoutRows != layout ? nullptr : vectors.data();
+        }
+        /// The alias table, ready to spawn from
+        BWSpawnTable spawnTable() const
+        {
+            BWSpawnTable ret = {spawnEntries.data(), (uint32_t) spawnEntries.size()};
+            return ret;
+        }
+        /// The compact grid, ready to sample
+        BWSourceField sourceField() const
+        {
+            BWSourceField ret = source;
+            ret.srcField = vectors.data();
+            return ret;
+        }
+    };
+    /// A built field, shared with whatever else uses it
+    typedef std::shared_ptr<Field const> FieldRef;
+
+    /// The field with nothing in it, which stands in when there is no field
+    static FieldRef const& emptyField();
+
+    /** Build a field from the u/v arrays
+        @param header        The size, origin and spacing of the u/v grids
+        @param uData         The u components of the vectors
+        @param vData         The v components of the vectors
+        @param velocityScale How much to scale the velocity magnitude by
+        @param compact       True to keep the field at the resolution of the data
+        @param storage       How the vectors of a (not compact) field are stored
+        @param layout        How the bins of a (not compact) field are ordered
+        @param importanceSpawn True to build the alias table that the particles are spawned from
+        @param outOfCore     True to make a (not compact) field a tile store, built as it is used
+        @param owner         Keeps uData and vData for as long as a tile store reads them; if
+                             null, the tile store is given a copy of them
+        @param field         Receives the field
+        @param threads       The threads to build it on
+        @return true on success, false on failure
+     */
+    bool buildField(BWFieldHeader const& header
+                    , float const* uData, float const* vData
+                    , float velocityScale
+                    , bool compact
+                    , BWFieldStorage storage
+                    , BWFieldLayout layout
+                    , bool importanceSpawn
+                    , bool outOfCore
+                    , std::shared_ptr<void const> const& owner
+                    , Field& field
+                    , BWThreadPool& threads
+                    ) const;
+
+    /** Find the field in the cache, or build it from the u/v arrays (and keep it there)
+        @param cache    The cache, as it was when the build was asked for; null builds it unshared
+        @param seconds  Receives how long that took, in seconds
+        See buildField() for the other parameters
+        @return The field, or null on failure
+     */
+    FieldRef acquireField(BWFieldHeader const& header
+                          , float const* uData, float const* vData
+                          , float velocityScale
+                          , bool compact
+                          , BWFieldStorage storage
+                          , BWFieldLayout layout
+                          , bool importanceSpawn
+                          , bool outOfCore
+                          , std::shared_ptr<BWFieldCache> const& cache
+                          , BWThreadPool& threads
+                          , double& seconds
+                          , std::shared_ptr<void const> const& owner = nullptr
+                          ) const;
+
+    /** Read a .bwvf or .json file, and find or build the field from it
+        See acquireField() for the parameters
+     */
+    FieldRef acquireFieldFromFile(char const* path, float velocityScale
+                                  , bool compact
+                                  , BWFieldStorage storage
+                                  , BWFieldLayout layout
+                                  , bool importanceSpawn
+                                  , bool outOfCore
+                                  , std::shared_ptr<BWFieldCache> const& cache
+                                  , BWThreadPool& threads
+                                  , double& seconds
+                                  ) const;
+
+    /** Build the alias table that the particle streams are spawned from
+        @param field     The field
+        @param enable    False to leave the table empty, so the particles are spawned uniformly
+        @param threads   The threads to weigh the bins on
+     */
+    void buildSpawnTable(Field& field, bool enable, BWThreadPool& threads) const;
+
+    /// Finds or builds a field on the threads given, noting how long it took; null on failure
+    typedef std::function<FieldRef(BWThreadPool&, double&)> Builder;
+
+    /// A field built in the background, on a thread of its own
+    struct Prefetch
+    {
+        std::thread       thread;
+        /// What was built, once done
+        FieldRef          field;
+        double            seconds;
+        std::atomic<bool> done;
+        bool              ok;
+        /// The build asked for while the thread was busy, run when it finishes; guarded by prefetchLock
+        Builder           queued;
+
+        Prefetch() : seconds(0.0), done(false), ok(false) {}
+    };
+
+    /** Start building a field in the background
+        @param build    Builds the field
+        @param replace  True if the field replaces the current ones, rather than being blended to
+        @return true; a build of the same kind still pending is overtaken by this one
+     */
+    bool startPrefetch(Builder build, bool replace);
+
+    /** Wait for a background build, if there is one
+        @param slot  The t1 field's, or the replacement's
+     */
+    void joinPrefetch(Prefetch& slot);
+
+    /// Swap in the replacement field, if it is ready; called at the start of a frame
+    void swapReplacement();
+
+    /// Grow the particle streams (or the vertices) to hold numParticles
+    void reserveParticles(int numParticles);
+
+    /** Write the lines of the particle streams [begin, end) as they are, to hostVertices:
+        the tail/head pairs, or the start of the trails
+        @param particles  The particle streams
+        @param begin      The first particle
+        @param end        One past the last particle
+     */
+    void startVertices(BWParticleStreams const* particles, int begin, int end)
+    {
+        if (trailLength > numVerticesPerParticle)
+            particleTrailStart(particles, hostVertices.data(), trailLength, begin, end);
+        else
+            particleWriteVertices(particles, hostVertices.data(), begin, end);
+    }
+
+    /// What a step reads, other than the particles.  It is taken as the step is started, so
+    /// that the fields and settings can change while a pipelined step is in flight
+    struct Step
+    {
+        /// The number of steps to take, and the frame number of the first
+        int               numSteps;
+        uint32_t          frame;
+        /// The number of particles
+        int               numParticles;
+        /// The fields at t0 and t1, and how far from one to the other the particles are moved
+        FieldRef          field;
+        FieldRef          next;
+        float             time;
+        /// The shortest and longest lifetimes, in steps
+        int               minLifetime;
+        int               maxLifetime;
+        BWParticleMoveISA moveISA;
+        BWIntegrator      integrator;
+        /// The bytes the out of core fields may keep in memory after the step
+        size_t            tileBudget;
+        std::shared_ptr<BWThreadPool> pool;
+        /// Where the lines are written: hostVertices, or the draw buffer that isn't being drawn
+        BWFloat2*         target;
+        /// The number of positions in each particle's ring, and where the rings carry on from
+        /// (target, or the draw buffer being drawn); 2 for the tail/head pairs
+        int               trailLength;
+        BWFloat2 const*   source;
+    };
+
+    /** Move the particles, in one pass over them
+        @param step  The steps to take
+        @returns The number of particles respawned (only counted with STATS_EN, unless
+                 they are particle streams)
+     */
+    uint32_t moveParticles(Step const& step);
+
+    /** Move the particle streams, respawning the ones that expire
+        @param step  The steps to take
+        @returns The number of particles respawned
+     */
+    uint32_t advanceStreams(Step const& step);
+
+    /// The loop the pipelined steps are run on
+    void stepLoop();
+
+    /** Build the blocks of the out of core fields that the particles [begin, end) are in
+        @param step      The steps being taken
+        @param position  The position of each particle
+        @param stride    The number of BWFloat2 from one particle's position to the next
+        @param begin     The first particle
+        @param end       One past the last particle
+     */
+    static void touchTiles(Step const& step, BWFloat2 const* position, size_t stride, size_t begin, size_t end)
+    {
+        if (step.field->tiles)
+            step.field->tiles->touch(position, stride, begin, end);
+        if (step.next->tiles)
+            step.next->tiles->touch(position, stride, begin, end);
+    }
+
+    /// Keep the out of core fields within the budget, once a step has finished with them
+    static void trimTiles(Step const& step);
+
+    /** Add the time a field took to build (or find) to the statistics, as it is put to use
+        @param seconds  The time, in seconds
+     */
+    void noteFieldBuilt(double seconds)
+    {
+#if STATS_EN
+        BWStatsAddTime(&_stats, BWStageFieldBuild, seconds);
+#else
+        (void) seconds;
+#endif
+    }
+
+    /** Add a step to the statistics, as its lines are put to use, and close off the frame
+        @param seconds    How long the step took, in seconds
+        @param respawned  The number of particles it respawned
+     */
+    void noteStep(double seconds, uint32_t respawned)
+    {
+#if STATS_EN
+        BWStatsAddTime(&_stats, BWStageStep, seconds);
+        BWStatsCount(&_stats, frameMove, respawned);
+        BWStatsEndFrame(&_stats);
+#else
+        (void) seconds;
+        (void) respawned;
+#endif
+    }
+
+    /// The number of the number of columns in the velocity field.
+    int numXBins;
+    /// The number of the number of rows in the velocity field.
+    int numYBins;
+
+    /// The particle positions, as tail/head pairs; with BWParticleStoreStreams, this is
+    /// only the draw buffer, written from the streams after they move
+    std::vector<BWFloat2> hostVertices;
+    /// The number of positions in each particle's trail, with BWParticleStoreStreams
+    int                   trailLength;
+    /// The frame number after the step that wrote vertices(), and after the step in flight
+    uint32_t              drawnFrame;
+    uint32_t              stepFrame;
+
+    /// True if the steps are run on stepThread
+    bool                  pipelined;
+    /// When pipelined, the two buffers the lines are drawn from: a step writes the one that
+    /// isn't drawFront while drawFront is drawn
+    std::vector<BWFloat2> drawVertices[2];
+    int                   drawFront;
+    /// True from starting a pipelined step until finishStep() has drawn from its buffer
+    bool                    stepInFlight;
+    /// The thread the pipelined steps are run on, and the step it has been given (guarded by
+    /// stepLock); the condition is signalled both ways, as a step is given and as it finishes
+    std::thread             stepThread;
+    std::mutex              stepLock;
+    std::condition_variable stepSignal;
+    Step                    stepWork;
+    bool                    stepBusy;
+    bool                    stepStopping;
+    /// How long the last pipelined step took, and the number of particles it respawned
+    double                  stepSeconds;
+    uint32_t                stepRespawned;
+
+    /// How the particles are kept
+    BWParticleStore       store;
+    /// The particle streams, for BWParticleStoreStreams
+    std::vector<BWFloat2> position;
+    std::vector<BWFloat2> prevPosition;
+    std::vector<uint16_t> age;
+    std::vector<uint16_t> maxAge;
+    /// The indices of the particles that expired in a step; each chunk lists its own in its
+    /// own part of this, so the chunks don't have to share a count
+    std::vector<uint32_t> expired;
+    /// The shortest and longest lifetimes, in steps
+    int                   minLifetime;
+    int                   maxLifetime;
+    /// The vectors in space, at t0
+    FieldRef _vectorField;
+    /// The vectors in space, at t1; empty if there is only the one field
+    FieldRef _nextField;
+    /// How far from t0 to t1 the particles are moved
+    float fieldTime;
+
+    /// The field for t1 built in the background, and the one that replaces t0 and t1;
+    /// each kind keeps the newest of its own builds
+    Prefetch              prefetch;
+    Prefetch              replacement;
+    /// Guards the builds queued on them
+    std::mutex            prefetchLock;
+
+    /// The number if particles to simulate
+    int _numParticles;
+    /// The next particle to initialize
+    int nextParticleInit;
+
+    /// The seed for the random steps
+    uint64_t seed;
+    /// The number of steps taken; this and the seed select the random numbers
+    uint32_t frame;
+    /// The time passed that hasn't been stepped yet, in seconds
+    double stepBacklog;
+
+    /// The version of particleMove to use
+    BWParticleMoveISA moveISA;
+    /// How the particles look up the fields built from now on
+    BWFieldSampling   sampling;
+    /// How the vectors of the fields built from now on are stored
+    BWFieldStorage    storage;
+    /// How the bins of the fields built from now on are ordered
+    BWFieldLayout     layout;
+    /// True if the fields built from now on have the alias table to spawn from
+    bool              importanceSpawn;
+    /// The cache the fields built from now on are shared through; null if they aren't
+    std::shared_ptr<BWFieldCache> fieldCache;
+    /// The bytes the out of core fields may keep in memory; 0 to build the fields whole
+    size_t            tileBudget;
+
+    /// The number of frames between sorts of the particles; 0 for never
+    int sortInterval;
+    /// The tile each particle is in, the counts of each tile in each chunk, and
+    /// the space the particles are sorted into; kept from one sort to the next
+    std::vector<uint32_t> sortKeys;
+    std::vector<uint32_t> sortCounts;
+    std::vector<BWFloat2> sortScratch;
+    /// The space the other particle streams are sorted into
+    std::vector<BWFloat2> sortPrevScratch;
+    std::vector<uint16_t> sortAgeScratch;
+    std::vector<uint16_t> sortMaxAgeScratch;
+    /// The space the trails are sorted into
+    std::vector<BWFloat2> sortTrailScratch;
+    /// How the particles are moved along a bilinearly sampled field
+    BWIntegrator      integrator;
+
+    /// The threads that the kernels are run on
+    std::shared_ptr<BWThreadPool> pool;
+
+    /// The timings and counts of the stages
+    BWStats _stats;
+
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+    BWCPUTypes.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWCPUTypes_h
+#define BWCPUTypes_h
+
+#include <math.h>
+#include <stdint.h>
+
+/* The types here are plain C, so that the openCL / Objective-C side can share them */
+
+/// The prefix that entries will appear in the log with
+#define LogPrefixC "BWAnimateVectorField: "
+
+/// Setting this to 1 will enable more logging info to help me track down problems
+#ifndef EXTRA_LOGGING_EN
+#define EXTRA_LOGGING_EN    (0)
+#endif
+
+/// How thick to make the lines, in pixels (as in AppConfig.h)
+#ifndef LINE_WIDTH
+#define LINE_WIDTH (2.0)
+#endif
+
+/// The fraction of the field vector that each step moves the particles (as in AppConfig.h)
+#ifndef STEP_DT
+#define STEP_DT (0.0900f)
+#endif
+
+/// The number of simulation steps a second (as in AppConfig.h)
+#ifndef STEPS_PER_SECOND
+#define STEPS_PER_SECOND (60.0)
+#endif
+
+/// The most steps taken in one frame to catch up with the time (as in AppConfig.h)
+#ifndef MAX_CATCHUP_STEPS
+#define MAX_CATCHUP_STEPS (4)
+#endif
+
+/** Work out the steps to take for the time that has passed, at a fixed STEPS_PER_SECOND
+    @param backlog  The time not yet stepped; updated for the steps taken
+    @param seconds  The time since the last call
+    @returns The number of steps to take; 0 if not a whole step has passed yet
+
+    The steps are the same size whatever the frame rate: when frames are fast, some
+    don't step at all, and when they are slow, several steps are taken at once.  At most
+    MAX_CATCHUP_STEPS are taken, so a stall doesn't turn into a burst of work that makes
+    the next frame late too; the rest of the time is dropped.  BWCPUGrid and the plugin's
+    BWGrid both step by this.
+ */
+static inline int BWStepsForTime(double* backlog, double seconds)
+{
+    double stepTime = 1.0 / STEPS_PER_SECOND;
+    if (seconds > 0.0)
+        *backlog += seconds;
+    int numSteps = (int) floor(*backlog / stepTime);
+    if (numSteps > MAX_CATCHUP_STEPS)
+    {
+        numSteps = MAX_CATCHUP_STEPS;
+        *backlog = 0.0;
+    }
+    else
+    {
+        *backlog -= numSteps * stepTime;
+    }
+    return numSteps;
+}
+
+/// Setting this to 1 keeps the particles in separate streams, with lifetimes (as in AppConfig.h)
+#ifndef PARTICLE_STREAMS_EN
+#define PARTICLE_STREAMS_EN (1)
+#endif
+
+/// The shortest and longest that a particle lives, in steps (as in AppConfig.h)
+#ifndef PARTICLE_MIN_AGE
+#define PARTICLE_MIN_AGE (64)
+#endif
+#ifndef PARTICLE_MAX_AGE
+#define PARTICLE_MAX_AGE (192)
+#endif
+
+/// The number of positions in the trail of each particle (as in AppConfig.h)
+#ifndef TRAIL_LENGTH
+#define TRAIL_LENGTH (16)
+#endif
+
+/// Log a message to stderr, in the same spirit as NSLog(LogPrefix ...)
+#define BWLog(...) BWLogMessage(__VA_ARGS__)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/** Writes a printf style message to the log
+    @param format  The printf style format string
+ */
+void BWLogMessage(char const* format, ...)
+#if defined(__GNUC__)
+    __attribute__((format(printf, 1, 2)))
+#endif
+    ;
+#ifdef __cplusplus
+}
+#endif
+
+/// A pair of floats; this has the same layout as cl_float2
+typedef struct BWFloat2
+{
+    float x;
+    float y;
+} BWFloat2;
+
+/// A pair of unsigned ints; this has the same layout as cl_uint2
+typedef struct BWUInt2
+{
+    uint32_t x;
+    uint32_t y;
+} BWUInt2;
+
+/// The number of vertices (tail and head) that each particle has
+#define numVerticesPerParticle (2)
+
+/** The header of a u or v component, as it appears in the earth JSON files
+ */
+typedef struct BWFieldHeader
+{
+    /// The distance between grid points (e.g., 2.5 deg lon, 2.5 deg lat)
+    BWFloat2 delta;
+    /// The grid's origin (e.g., 0.0E, 90.0N)
+    BWFloat2 origin;
+    /// The number of grid points W-E and N-S (e.g., 144 x 73)
+    BWUInt2  srcSize;
+} BWFieldHeader;
+
+#endif
@@ -0,0 +1,511 @@
+/*
+    BWEarthJSON.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "BWEarthJSON.h"
+
+/// The size of the pieces that the file is read in
+#define EARTH_JSON_READ_BYTES (65536)
+
+/// The powers of 10 that are exact in a double
+static double const pow10Table[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/** Is this a character that can be in a number?
+ */
+static inline bool isNumberChar(char c)
+{
+    return (c >= '0' && c <= '9') || '-' == c || '.' == c || 'e' == c || 'E' == c || '+' == c;
+}
+
+
+/** Convert the text of a number
+    @param begin  The start of the number
+    @param end    Just past the end of the number
+    @param value  Receives the number
+    @returns true on success, false if it isn't a number
+
+    The numbers in the files are short decimals (e.g. -3.27), which have an exact
+    mantissa and power of 10, so most can be done with one multiply or divide, which
+    rounds the same as strtod.  The rest are handed to strtod.
+ */
+static bool parseNumber(char const* begin, char const* end, double& value)
+{
+    char const* p = begin;
+    bool negative = p < end && '-' == *p;
+    if (negative) p++;
+    uint64_t mantissa = 0;
+    int numDigits = 0, scale = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, numDigits++)
+        mantissa = 10*mantissa + (*p - '0');
+    if (p < end && '.' == *p)
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, numDigits++, scale--)
+            mantissa = 10*mantissa + (*p - '0');
+    }
+    if (p == end && numDigits > 0 && numDigits <= 15 && scale >= -22)
+    {
+        value = scale ? (double) mantissa / pow10Table[-scale] : (double) mantissa;
+        if (negative) value = -value;
+        return true;
+    }
+
+    // Exponents, long mantissas and the like
+    char text[64];
+    size_t length = end - begin;
+    if (length >= sizeof(text))
+        return false;
+    memcpy(text, begin, length);
+    text[length] = 0;
+    char* after;
+    value = strtod(text, &after);
+    return length && after == text + length;
+}
+
+
+BWEarthJSONParser::BWEarthJSONParser()
+: lexer(Between), tokenLength(0), expectKey(false)
+, section(OtherSection), parameter(-1), target(NULL), count(0), keepData(false)
+, uData(NULL), vData(NULL), capacity(0), haveU(false), haveV(false)
+{
+    memset(&_header, 0, sizeof(_header));
+}
+
+
+BWEarthJSONParser::~BWEarthJSONParser()
+{
+    free(uData);
+    free(vData);
+}
+
+
+/** Note why the parse failed
+    @param why  The reason
+    @returns false
+ */
+bool BWEarthJSONParser::fail(char const* why)
+{
+    if (_error.empty())
+        _error = why;
+    return false;
+}
+
+
+/** Parse the next piece of the text
+    @param text   The text
+    @param length The number of bytes
+    @returns true if all is well so far, false if the text is not a u/v file
+ */
+bool BWEarthJSONParser::feed(char const* text, size_t length)
+{
+    if (!_error.empty())
+        return false;
+    char const* end = text + length;
+    for (char const* p = text; p < end; p++)
+    {
+        char c = *p;
+        switch (lexer)
+        {
+            case InString:
+                if ('"' == c)
+                {
+                    if (!endToken())
+                        return false;
+                }
+                else
+                {
+                    if ('\\' == c)
+                        lexer = InEscape;
+                    // Long strings are cut short; none of the keys we want are long
+                    if (tokenLength < sizeof(token)-1)
+                        token[tokenLength++] = c;
+                }
+                continue;
+
+            case InEscape:
+                if (tokenLength < sizeof(token)-1)
+                    token[tokenLength++] = c;
+                lexer = InString;
+                continue;
+
+            case InNumber:
+            case InLiteral:
+                if (InNumber == lexer ? isNumberChar(c) : (c >= 'a' && c <= 'z'))
+                {
+                    if (tokenLength >= sizeof(token)-1)
+                        return fail("a number is too long");
+                    token[tokenLength++] = c;
+                    continue;
+                }
+                if (!endToken())
+                    return false;
+                // The character after the token is handled below
+                break;
+
+            case Between:
+                break;
+        }
+
+        switch (c)
+        {
+            case ' ': case '\t': case '\r': case '\n':
+                break;
+            case '{': case '[':
+                if (!beginContainer(c))
+                    return false;
+                break;
+            case '}': case ']':
+                if (!endContainer('}' == c ? '{' : '['))
+                    return false;
+                break;
+            case ',':
+                expectKey = !stack.empty() && '{' == stack.back();
+                break;
+            case ':':
+                expectKey = false;
+                break;
+            case '"':
+                lexer = InString;
+                tokenLength = 0;
+                break;
+            default:
+                if ('-' == c || (c >= '0' && c <= '9'))
+                {
+                    // Most numbers are wholly in this piece; convert them in place
+                    char const* q = p+1;
+                    while (q < end && isNumberChar(*q)) q++;
+                    if (q < end)
+                    {
+                        double value;
+                        if (!parseNumber(p, q, value))
+                            return fail("bad number");
+                        if (!number(value))
+                            return false;
+                        p = q-1;
+                        break;
+                    }
+                    lexer = InNumber;
+                }
+                else if (c >= 'a' && c <= 'z')
+                {
+                    lexer = InLiteral;
+                }
+                else
+                {
+                    return fail("unexpected character");
+                }
+                token[0] = c;
+                tokenLength = 1;
+                break;
+        }
+    }
+    return true;
+}
+
+
+/** Called after the last piece of the text
+    @returns true if both the u and v components were read, false otherwise
+ */
+bool BWEarthJSONParser::finish()
+{
+    if (!_error.empty())
+        return false;
+    if (Between != lexer && !endToken())
+        return false;
+    if (!stack.empty())
+        return fail("the text ends early");
+    if (!haveU || !haveV)
+        return fail("need both a u (parameterNumber 2) and a v (parameterNumber 3) record");
+    return true;
+}
+
+
+/** Hand over the u/v components
+    @param u  Receives the u components, nx*ny of them; release with free()
+    @param v  Receives the v components; release with free()
+ */
+void BWEarthJSONParser::takeData(float** u, float** v)
+{
+    *u = uData;
+    *v = vData;
+    uData = vData = NULL;
+    capacity = 0;
+}
+
+
+/** The token that the text was in the middle of has ended
+ */
+bool BWEarthJSONParser::endToken()
+{
+    Lexer was = lexer;
+    lexer = Between;
+    if (InString == was || InEscape == was)
+    {
+        if (expectKey)
+            return key(std::string(token, tokenLength));
+        // String values are not needed
+        return true;
+    }
+    if (InNumber == was)
+    {
+        double value;
+        if (!parseNumber(token, token + tokenLength, value))
+            return fail("bad number");
+        return number(value);
+    }
+    if (4 == tokenLength && !memcmp(token, "null", 4))
+        return number(0);
+    if ((4 == tokenLength && !memcmp(token, "true", 4)) || (5 == tokenLength && !memcmp(token, "false", 5)))
+        return true;
+    return fail("unknown literal");
+}
+
+
+/** An object or array starts
+    @param type  '{' or '['
+ */
+bool BWEarthJSONParser::beginContainer(char type)
+{
+    if (stack.empty() && '[' != type)
+        return fail("expected an array of records");
+    if (stack.size() >= 32)
+        return fail("nested too deeply");
+    stack.push_back(type);
+    expectKey = '{' == type;
+    if (2 == stack.size())
+    {
+        // A new record
+        section   = OtherSection;
+        parameter = -1;
+        target    = NULL;
+        count     = 0;
+        keepData  = false;
+    }
+    if (3 == stack.size() && DataSection == section)
+        return beginData();
+    return true;
+}
+
+
+/** An object or array ends
+    @param type  '{' or '['
+ */
+bool BWEarthJSONParser::endContainer(char type)
+{
+    if (stack.empty() || stack.back() != type)
+        return fail("mismatched brackets");
+    stack.pop_back();
+    expectKey = false;
+    if (1 == stack.size() && '{' == type)
+        return endRecord();
+    return true;
+}
+
+
+/** A key in an object
+    @param name  The key
+ */
+bool BWEarthJSONParser::key(std::string const& name)
+{
+    if (2 == stack.size())
+    {
+        section = "header" == name ? HeaderSection
+                : "data"   == name ? DataSection
+                : OtherSection;
+    }
+    else if (3 == stack.size() && HeaderSection == section)
+    {
+        headerKey = name;
+    }
+    return true;
+}
+
+
+/** A number
+    @param value  The number
+ */
+bool BWEarthJSONParser::number(double value)
+{
+    if (3 != stack.size())
+        return true;
+    if (DataSection == section && '[' == stack.back())
+    {
+        if (target)
+        {
+            if (count >= capacity)
+                return fail("more data than nx * ny");
+            target[count++] = (float) value;
+        }
+        else if (keepData)
+        {
+            pending.push_back((float) value);
+        }
+        return true;
+    }
+    if (HeaderSection == section && '{' == stack.back())
+    {
+        if      ("dx"  == headerKey) _header.delta.x  = (float) value;
+        else if ("dy"  == headerKey) _header.delta.y  = (float) value;
+        else if ("lo1" == headerKey) _header.origin.x = (float) value;
+        else if ("la1" == headerKey) _header.origin.y = (float) value;
+        else if ("nx"  == headerKey) _header.srcSize.x = (uint32_t) value;
+        else if ("ny"  == headerKey) _header.srcSize.y = (uint32_t) value;
+        else if ("parameterNumber" == headerKey) parameter = (long) value;
+    }
+    return true;
+}
+
+
+/** The u or v buffer for the parameter
+    @param parameter  The parameter number: 2 for u, 3 for v
+    @returns The buffer, or NULL if the parameter is neither
+ */
+float** BWEarthJSONParser::buffer(long parameter)
+{
+    return 2 == parameter ? &uData : 3 == parameter ? &vData : NULL;
+}
+
+
+/** Allocate the u/v buffers, if they aren't already that size
+    @param size  The number of components in each, nx*ny
+ */
+bool BWEarthJSONParser::allocate(size_t size)
+{
+    if (uData && size == capacity)
+        return true;
+    // Both buffers are allocated up front, once
+    free(uData);
+    free(vData);
+    uData = (float*) malloc(sizeof(float)*size);
+    vData = (float*) malloc(sizeof(float)*size);
+    capacity = size;
+    haveU = haveV = false;
+    if (!uData || !vData)
+        return fail("out of memory");
+    return true;
+}
+
+
+/** The data array of a record starts
+ */
+bool BWEarthJSONParser::beginData()
+{
+    count = 0;
+    size_t size = (size_t) _header.srcSize.x * _header.srcSize.y;
+    if (parameter < 0 || !size)
+    {
+        // The header comes after the data; hold on to it until then
+        pending.clear();
+        keepData = true;
+        return true;
+    }
+    float** data = buffer(parameter);
+    if (!data)
+        return true;
+    if (!allocate(size))
+        return false;
+    target = *data;
+    return true;
+}
+
+
+/** A record ends
+ */
+bool BWEarthJSONParser::endRecord()
+{
+    float** data = buffer(parameter);
+    if (!data)
+        return true;
+    size_t size = (size_t) _header.srcSize.x * _header.srcSize.y;
+    if (keepData)
+    {
+        if (pending.size() != size)
+            return fail("the number of data is not nx * ny");
+        if (!allocate(size))
+            return false;
+        memcpy(*data, pending.data(), sizeof(float)*size);
+        pending.clear();
+        count = size;
+    }
+    if (count != size || size != capacity)
+        return fail("the number of data is not nx * ny");
+    (2 == parameter ? haveU : haveV) = true;
+    return true;
+}
+
+
+/** Read an earth JSON file, in bounded pieces
+    @param path    The path to the file
+    @param header  Receives the size, origin and spacing of the grid
+    @param uData   Receives the u components; release with free()
+    @param vData   Receives the v components; release with free()
+    @returns true on success, false on failure (logged)
+ */
+bool BWEarthJSONRead(char const* path, BWFieldHeader* header, float** uData, float** vData)
+{
+    *uData = *vData = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        BWLog("could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    BWEarthJSONParser parser;
+    std::vector<char> buffer(EARTH_JSON_READ_BYTES);
+    ssize_t n;
+    bool ok = true;
+    while (ok && (n = read(fd, buffer.data(), buffer.size())) != 0)
+    {
+        if (n < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            BWLog("could not read %s: %s", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+        ok = parser.feed(buffer.data(), n);
+    }
+    close(fd);
+    if (!ok || !parser.finish())
+    {
+        BWLog("%s is not an earth u/v file: %s", path, parser.error());
+        return false;
+    }
+    *header = parser.header();
+    parser.takeData(uData, vData);
+    return true;
+}
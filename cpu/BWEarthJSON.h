@@ -0,0 +1,147 @@
+/*
+    BWEarthJSON.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWEarthJSON_h
+#define BWEarthJSON_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "BWCPUTypes.h"
+
+/*
+    A streaming reader for the earth style JSON files (as produced by grib2json, and
+    used by https://github.com/cambecc/earth).
+
+    The file is an array of records, each with a "header" and a "data" array.  The
+    record with parameterNumber 2 is the u component, and 3 is the v component.  The
+    reader is fed the text a piece at a time; it picks the dx/dy/lo1/la1/nx/ny and
+    parameterNumber out of the header as they go by, and writes the numbers in the data
+    arrays straight into the u/v buffers, which are allocated once, nx*ny floats each,
+    when the header is seen.  No tree of the document is built: besides the u/v buffers,
+    the reader only keeps a few bytes of the token it is in the middle of.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Read an earth JSON file, in bounded pieces
+    @param path    The path to the file
+    @param header  Receives the size, origin and spacing of the grid
+    @param uData   Receives the u components; release with free()
+    @param vData   Receives the v components; release with free()
+    @returns true on success, false on failure (logged)
+ */
+bool BWEarthJSONRead(char const* path, BWFieldHeader* header, float** uData, float** vData);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <vector>
+
+/** The incremental parser behind BWEarthJSONRead
+ */
+class BWEarthJSONParser
+{
+public:
+    BWEarthJSONParser();
+    ~BWEarthJSONParser();
+
+    /** Parse the next piece of the text; the piece may end anywhere, even in a number
+        @param text   The text
+        @param length The number of bytes
+        @returns true if all is well so far, false if the text is not a u/v file (see error())
+     */
+    bool feed(char const* text, size_t length);
+
+    /** Called after the last piece of the text
+        @returns true if both the u and v components were read, false otherwise
+     */
+    bool finish();
+
+    /// Why the parse failed
+    char const* error() const { return _error.c_str(); }
+
+    /// The size, origin and spacing of the grid
+    BWFieldHeader const& header() const { return _header; }
+
+    /** Hand over the u/v components (after finish())
+        @param u  Receives the u components, nx*ny of them; release with free()
+        @param v  Receives the v components; release with free()
+     */
+    void takeData(float** u, float** v);
+
+private:
+    BWEarthJSONParser(BWEarthJSONParser const&);
+    BWEarthJSONParser& operator=(BWEarthJSONParser const&);
+
+    /// What part of a token the text ended in
+    enum Lexer { Between, InString, InEscape, InNumber, InLiteral };
+    /// Which value of the record the parser is in
+    enum Section { OtherSection, HeaderSection, DataSection };
+
+    bool fail(char const* why);
+    bool endToken();
+    bool beginContainer(char type);
+    bool endContainer(char type);
+    bool key(std::string const& name);
+    bool number(double value);
+    bool beginData();
+    bool endRecord();
+    float** buffer(long parameter);
+    bool allocate(size_t size);
+
+    /// The lexer state, and the bytes of the current token
+    Lexer             lexer;
+    char              token[64];
+    size_t            tokenLength;
+    /// The open objects ('{') and arrays ('[')
+    std::vector<char> stack;
+    /// True if the next string in the object is a key
+    bool              expectKey;
+
+    /// Where the parser is in the current record
+    Section           section;
+    std::string       headerKey;
+    long              parameter;
+    /// Where the data goes (null if it goes to pending, or nowhere), and how many have gone
+    float*            target;
+    size_t            count;
+    bool              keepData;
+    /// The data of a record whose header comes after it
+    std::vector<float> pending;
+
+    BWFieldHeader     _header;
+    /// The u/v components, nx*ny each, allocated when the first data array starts
+    float*            uData;
+    float*            vData;
+    size_t            capacity;
+    bool              haveU, haveV;
+    std::string       _error;
+};
+#endif
+
+#endif
@@ -0,0 +1,391 @@
+/*
+    BWFieldCache.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <string.h>
+#include <condition_variable>
+#include "BWFieldCache.h"
+
+/// The primes of the hash rounds (those of xxHash64)
+#define HASH_P1 (0x9E3779B185EBCA87ull)
+#define HASH_P2 (0xC2B2AE3D27D4EB4Full)
+#define HASH_P3 (0x165667B19E3779F9ull)
+
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/// Mix one 64 bit word into a lane of the hash
+static inline uint64_t hashRound(uint64_t acc, uint64_t word)
+{
+    return rotl64(acc + word * HASH_P2, 31) * HASH_P1;
+}
+
+/// Spread the bits of the hash (the splitmix64 finalizer)
+static inline uint64_t hashMix(uint64_t h)
+{
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27; h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+
+/** Hash the components, continuing from a hash so far
+    @param seed   The hash so far
+    @param data   The components; may be NULL
+    @param count  The number of components
+    @returns The hash
+
+    The components are taken as 64 bit words, in four lanes so that the multiplies
+    overlap; this runs at several bytes a cycle, well ahead of the field build.
+ */
+static uint64_t hashFloats(uint64_t seed, float const* data, size_t count)
+{
+    if (!data)
+        return hashMix(seed ^ HASH_P3);
+    unsigned char const* bytes = (unsigned char const*) data;
+    size_t numWords = count / 2;
+    uint64_t lane[4] = {seed + HASH_P1 + HASH_P2, seed + HASH_P2, seed, seed - HASH_P1};
+    size_t i = 0;
+    for (; i + 4 <= numWords; i += 4)
+    {
+        uint64_t word[4];
+        memcpy(word, bytes + 8*i, sizeof(word));
+        lane[0] = hashRound(lane[0], word[0]);
+        lane[1] = hashRound(lane[1], word[1]);
+        lane[2] = hashRound(lane[2], word[2]);
+        lane[3] = hashRound(lane[3], word[3]);
+    }
+    uint64_t h = rotl64(lane[0], 1) + rotl64(lane[1], 7) + rotl64(lane[2], 12) + rotl64(lane[3], 18);
+    for (; i < numWords; i++)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + 8*i, sizeof(word));
+        h = hashRound(h, word);
+    }
+    if (count & 1)
+    {
+        uint32_t last;
+        memcpy(&last, bytes + 8*numWords, sizeof(last));
+        h = hashRound(h, last);
+    }
+    return hashMix(h + count);
+}
+
+
+/** The hash of the u/v data a field is built from
+    @param header  The size, origin and spacing of the u/v grids
+    @param uData   The u components; may be NULL
+    @param vData   The v components; may be NULL
+    @returns A 64 bit hash of the header and every component
+ */
+uint64_t BWFieldHash(BWFieldHeader const* header, float const* uData, float const* vData)
+{
+    size_t count = (size_t) header->srcSize.x * header->srcSize.y;
+    float words[6] = {header->origin.x, header->origin.y, header->delta.x, header->delta.y};
+    memcpy(words+4, &header->srcSize, sizeof(header->srcSize));
+    uint64_t h = hashFloats(0, words, 6);
+    h = hashFloats(h, uData, count);
+    return hashFloats(h, vData, count);
+}
+
+
+// --- The cache ---------------------------------------------
+size_t BWFieldCache::KeyHash::operator()(BWFieldKey const& key) const
+{
+    uint32_t scale;
+    memcpy(&scale, &key.velocityScale, sizeof(scale));
+    uint64_t h = key.dataHash ^ hashMix(key.domain);
+    h = hashRound(h, ((uint64_t) key.numXBins << 32) | key.numYBins);
+    h = hashRound(h, ((uint64_t) scale << 32) | key.form);
+    return (size_t) hashMix(h);
+}
+
+
+bool BWFieldCache::KeyEqual::operator()(BWFieldKey const& a, BWFieldKey const& b) const
+{
+    // The scales are compared bit for bit, so that a NaN finds itself
+    return a.dataHash == b.dataHash && a.domain == b.domain
+        && a.numXBins == b.numXBins && a.numYBins == b.numYBins
+        && !memcmp(&a.velocityScale, &b.velocityScale, sizeof(a.velocityScale))
+        && a.form == b.form;
+}
+
+
+/// A build under way; the others asking for its key wait on it
+struct BWFieldCache::Build
+{
+    std::condition_variable done;
+    bool  finished;
+    Field field;
+    Build() : finished(false) {}
+};
+
+
+/** Create a cache
+    @param budget  The number of bytes of fields it keeps
+ */
+BWFieldCache::BWFieldCache(size_t budget) : _budget(budget), bytes(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+
+/// The cache shared by everything in the process
+std::shared_ptr<BWFieldCache> BWFieldCache::shared()
+{
+    static std::shared_ptr<BWFieldCache> cache = std::make_shared<BWFieldCache>();
+    return cache;
+}
+
+
+/** Find a field, or build it and keep it
+    @param key    What the field is built from
+    @param build  Builds the field if it isn't found
+    @param hit    Receives true if the field was found, rather than built; may be null
+    @returns The field, or null if it couldn't be built
+ */
+BWFieldCache::Field BWFieldCache::acquire(BWFieldKey const& key, Builder const& build, bool* hit)
+{
+    std::unique_lock<std::mutex> hold(lock);
+    if (hit)
+        *hit = true;
+
+    // Kept in the cache
+    auto found = entries.find(key);
+    if (found != entries.end())
+    {
+        lru.splice(lru.begin(), lru, found->second);
+        stats.hits++;
+        return found->second->field;
+    }
+
+    // Dropped from the cache, but another grid still has it; it is kept again
+    auto alive = inUse.find(key);
+    if (alive != inUse.end())
+    {
+        Field field = alive->second.field.lock();
+        size_t size = alive->second.bytes;
+        inUse.erase(alive);
+        if (field)
+        {
+            stats.hits++;
+            keep(key, field, size);
+            return field;
+        }
+    }
+
+    // Being built by another grid
+    auto pending = building.find(key);
+    if (pending != building.end())
+    {
+        std::shared_ptr<Build> other = pending->second;
+        stats.waits++;
+        other->done.wait(hold, [&]() { return other->finished; });
+        if (other->field)
+            stats.hits++;
+        else if (hit)
+            *hit = false;
+        return other->field;
+    }
+
+    // Build it, without holding the lock
+    if (hit)
+        *hit = false;
+    std::shared_ptr<Build> mine = std::make_shared<Build>();
+    building[key] = mine;
+    stats.misses++;
+    hold.unlock();
+    size_t size = 0;
+    Field field;
+    try
+    {
+        field = build(size);
+    }
+    catch (...)
+    {
+        // The grids waiting on it are let go without it, and the next one to ask builds it afresh
+        hold.lock();
+        building.erase(key);
+        mine->finished = true;
+        mine->done.notify_all();
+        throw;
+    }
+    hold.lock();
+
+    building.erase(key);
+    mine->field    = field;
+    mine->finished = true;
+    mine->done.notify_all();
+    if (field)
+        keep(key, field, size);
+    return field;
+}
+
+
+/** Keep a field in the cache, as the most recently used (lock held)
+    @param key    What the field is built from
+    @param field  The field
+    @param size   The number of bytes it takes
+ */
+void BWFieldCache::keep(BWFieldKey const& key, Field const& field, size_t size)
+{
+    if (size > _budget)
+    {
+        // It will never fit; it is only shared while it is in use
+        Alive alive = {field, size};
+        inUse[key] = alive;
+        return;
+    }
+    Entry entry = {key, field, size};
+    lru.push_front(entry);
+    entries[key] = lru.begin();
+    bytes += size;
+    trim();
+}
+
+
+/// Drop the least recently used fields until the rest fit the budget (lock held)
+void BWFieldCache::trim()
+{
+    while (bytes > _budget && !lru.empty())
+    {
+        Entry& entry = lru.back();
+        Alive alive = {entry.field, entry.bytes};
+        inUse[entry.key] = alive;
+        bytes -= entry.bytes;
+        entries.erase(entry.key);
+        lru.pop_back();
+        stats.evictions++;
+    }
+    // Forget the dropped fields that have since been freed
+    for (auto i = inUse.begin(); i != inUse.end(); )
+    {
+        if (i->second.field.expired())
+            i = inUse.erase(i);
+        else
+            ++i;
+    }
+}
+
+
+/// Set the number of bytes of fields that the cache keeps, dropping what no longer fits
+void BWFieldCache::setBudget(size_t budget)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    _budget = budget;
+    trim();
+}
+
+
+size_t BWFieldCache::budget() const
+{
+    std::lock_guard<std::mutex> hold(lock);
+    return _budget;
+}
+
+
+/// Drop all of the fields the cache keeps (the ones in use live on)
+void BWFieldCache::clear()
+{
+    std::lock_guard<std::mutex> hold(lock);
+    size_t budget = _budget;
+    _budget = 0;
+    trim();
+    _budget = budget;
+}
+
+
+/// How the cache has done so far
+BWFieldCacheStats BWFieldCache::statistics() const
+{
+    std::lock_guard<std::mutex> hold(lock);
+    BWFieldCacheStats ret = stats;
+    ret.entries = (uint32_t) entries.size();
+    ret.bytes   = bytes;
+    return ret;
+}
+
+
+// --- The C functions ---------------------------------------
+/// A reference to a field in the cache
+struct BWCachedField
+{
+    BWFieldCache::Field field;
+};
+
+
+/** Find a field in the cache, or build it and put it there
+    See BWFieldCache.h for the parameters
+ */
+BWCachedField* BWFieldCacheAcquire(BWFieldKey const* key
+                                   , BWFieldCacheBuild build
+                                   , void (*destroy)(void* field)
+                                   , void* context
+                                   , bool* hit)
+{
+    BWFieldCache::Field field = BWFieldCache::shared()->acquire(*key, [&](size_t& bytes)
+    {
+        void* built = build(context, &bytes);
+        if (!built)
+            return BWFieldCache::Field();
+        return BWFieldCache::Field(built, [destroy](void const* f) { destroy((void*) f); });
+    }, hit);
+    if (!field)
+        return NULL;
+    BWCachedField* ref = new BWCachedField;
+    ref->field = field;
+    return ref;
+}
+
+
+/// The field a reference is to; this must not be changed
+void* BWCachedFieldGet(BWCachedField const* ref)
+{
+    return ref ? (void*) ref->field.get() : NULL;
+}
+
+
+/// Let go of a reference to a field
+void BWCachedFieldRelease(BWCachedField* ref)
+{
+    delete ref;
+}
+
+
+/// Set the number of bytes of fields that the cache keeps
+void BWFieldCacheSetBudget(size_t bytes)
+{
+    BWFieldCache::shared()->setBudget(bytes);
+}
+
+
+/// How the cache has done so far
+BWFieldCacheStats BWFieldCacheStatistics(void)
+{
+    return BWFieldCache::shared()->statistics();
+}
@@ -0,0 +1,232 @@
+/*
+    BWFieldCache.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWFieldCache_h
+#define BWFieldCache_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "BWCPUTypes.h"
+
+/*
+    A process wide cache of the built fields.  A composition often has several
+    instances of the plugin fed the same u/v data, and each one (and each restart
+    from time 0) would otherwise build an identical field of its own.  So the built
+    fields are kept by the content they were built from: a hash of the u/v data and
+    its header, the number of bins, the velocity scale, and the form the field is
+    built in.  A field in the cache is never written again; the grids that use it
+    hold references to it, and it is freed when the last of them lets go.
+
+    The cache keeps the fields it holds under a memory budget, dropping the least
+    recently used first.  A field that is dropped while a grid still uses it is
+    remembered until it is freed, so that it is found again rather than built twice;
+    a grid asking for a field that another is still building waits for that build.
+
+    The C functions are for the openCL / Objective-C side, whose fields are openCL
+    buffers; BWCPUGrid uses the C++ class.
+ */
+
+/// Setting this to 1 shares the built fields between the grids (as in AppConfig.h)
+#ifndef FIELD_CACHE_EN
+#define FIELD_CACHE_EN (1)
+#endif
+
+/// The number of bytes of fields that the cache keeps, besides the ones in use
+#ifndef FIELD_CACHE_BYTES
+#define FIELD_CACHE_BYTES (256u*1024u*1024u)
+#endif
+
+/// What a field is built from, and how
+typedef struct BWFieldKey
+{
+    /// The hash of the u/v data and its header (BWFieldHash)
+    uint64_t dataHash;
+    /// Which fields can be shared: 0 for the C++ fields, or the openCL context of the buffers
+    uint64_t domain;
+    /// The number of bins wide and high
+    uint32_t numXBins;
+    uint32_t numYBins;
+    /// How much the velocity magnitude is scaled by
+    float    velocityScale;
+    /// The storage, layout, sampling and such of the field, as the builder codes them
+    uint32_t form;
+} BWFieldKey;
+
+/// How the cache has done
+typedef struct BWFieldCacheStats
+{
+    /// The fields found, in the cache or still in use
+    uint64_t hits;
+    /// The fields built
+    uint64_t misses;
+    /// The fields found while they were still being built, and waited for
+    uint64_t waits;
+    /// The fields dropped to stay within the budget
+    uint64_t evictions;
+    /// The number of fields, and their bytes, that the cache holds
+    uint32_t entries;
+    size_t   bytes;
+} BWFieldCacheStats;
+
+/// A reference to a field in the cache
+typedef struct BWCachedField BWCachedField;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The hash of the u/v data a field is built from
+    @param header  The size, origin and spacing of the u/v grids
+    @param uData   The u components; may be NULL
+    @param vData   The v components; may be NULL
+    @returns A 64 bit hash of the header and every component
+ */
+uint64_t BWFieldHash(BWFieldHeader const* header, float const* uData, float const* vData);
+
+/** Build a field that wasn't in the cache
+    @param context  The context given to BWFieldCacheAcquire
+    @param bytes    Receives the number of bytes the field takes
+    @returns The field, or NULL if it couldn't be built
+ */
+typedef void* (*BWFieldCacheBuild)(void* context, size_t* bytes);
+
+/** Find a field in the cache, or build it and put it there
+    @param key      What the field is built from
+    @param build    Builds the field, if it isn't found
+    @param destroy  Frees a field that build made, once nothing uses it
+    @param context  Passed to build
+    @param hit      Receives true if the field was found, rather than built; may be NULL
+    @returns A reference to the field (release it with BWCachedFieldRelease), or NULL if
+             it couldn't be built
+ */
+BWCachedField* BWFieldCacheAcquire(BWFieldKey const* key
+                                   , BWFieldCacheBuild build
+                                   , void (*destroy)(void* field)
+                                   , void* context
+                                   , bool* hit);
+
+/// The field a reference is to; this must not be changed
+void* BWCachedFieldGet(BWCachedField const* ref);
+
+/// Let go of a reference to a field
+void BWCachedFieldRelease(BWCachedField* ref);
+
+/// Set the number of bytes of fields that the cache keeps
+void BWFieldCacheSetBudget(size_t bytes);
+
+/// How the cache has done so far
+BWFieldCacheStats BWFieldCacheStatistics(void);
+
+#ifdef __cplusplus
+}
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/** The cache behind the C functions; BWFieldCache::shared() is the process wide one
+ */
+class BWFieldCache
+{
+public:
+    /// A field; the cache doesn't know what is in it
+    typedef std::shared_ptr<void const> Field;
+    /// Builds a field that wasn't in the cache, giving the number of bytes it takes; null on failure
+    typedef std::function<Field(size_t& bytes)> Builder;
+
+    /** Create a cache
+        @param budget  The number of bytes of fields it keeps
+     */
+    explicit BWFieldCache(size_t budget = FIELD_CACHE_BYTES);
+
+    /// The cache shared by everything in the process
+    static std::shared_ptr<BWFieldCache> shared();
+
+    /** Find a field, or build it and keep it
+        @param key    What the field is built from
+        @param build  Builds the field if it isn't found.  Only one build of a key runs at a
+                      time; the others asking for it wait, and are given the same field.  If
+                      it throws, the exception is passed on, and those waiting are given null
+        @param hit    Receives true if the field was found, rather than built; may be null
+        @returns The field, or null if it couldn't be built
+     */
+    Field acquire(BWFieldKey const& key, Builder const& build, bool* hit = nullptr);
+
+    /// Set the number of bytes of fields that the cache keeps, dropping what no longer fits
+    void setBudget(size_t bytes);
+    size_t budget() const;
+
+    /// Drop all of the fields the cache keeps (the ones in use live on)
+    void clear();
+
+    /// How the cache has done so far
+    BWFieldCacheStats statistics() const;
+
+private:
+    BWFieldCache(BWFieldCache const&);
+    BWFieldCache& operator=(BWFieldCache const&);
+
+    struct KeyHash  { size_t operator()(BWFieldKey const& key) const; };
+    struct KeyEqual { bool operator()(BWFieldKey const& a, BWFieldKey const& b) const; };
+    struct Build;
+
+    /// A field the cache keeps, most recently used at the front
+    struct Entry
+    {
+        BWFieldKey key;
+        Field      field;
+        size_t     bytes;
+    };
+    typedef std::list<Entry> LRU;
+
+    /// A field that isn't kept, but may still be in use, and the bytes it takes
+    struct Alive
+    {
+        std::weak_ptr<void const> field;
+        size_t bytes;
+    };
+
+    /// Keep a field, as the most recently used (lock held)
+    void keep(BWFieldKey const& key, Field const& field, size_t size);
+    /// Drop the least recently used fields until the rest fit the budget (lock held)
+    void trim();
+
+    mutable std::mutex lock;
+    size_t   _budget;
+    size_t   bytes;
+    LRU      lru;
+    std::unordered_map<BWFieldKey, LRU::iterator, KeyHash, KeyEqual> entries;
+    /// The fields that were dropped, or never kept, but may still be in use
+    std::unordered_map<BWFieldKey, Alive, KeyHash, KeyEqual> inUse;
+    /// The builds under way
+    std::unordered_map<BWFieldKey, std::shared_ptr<Build>, KeyHash, KeyEqual> building;
+    BWFieldCacheStats stats;
+};
+#endif
+
+#endif
@@ -0,0 +1,187 @@
+/*
+    BWFieldFile.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "BWFieldFile.h"
+
+/// The version of the file layout
+#define BWFieldFileVersion (1)
+
+/// The planes start on this boundary
+#define BWFieldFileAlign   (64)
+
+/// The header, as it is on disk
+struct BWFieldFileHeader
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t nx, ny;
+    float    dx, dy, lo1, la1;
+    uint64_t uOffset;
+    uint64_t vOffset;
+    uint8_t  reserved[16];
+};
+static_assert(sizeof(BWFieldFileHeader) == 64, "the header is 64 bytes on disk");
+
+
+/** Round up to the plane alignment
+    @param size  The size in bytes
+    @returns The size, rounded up
+ */
+static inline uint64_t alignUp(uint64_t size)
+{
+    return (size + BWFieldFileAlign-1) & ~(uint64_t)(BWFieldFileAlign-1);
+}
+
+
+/** Memory map a vector field file
+    @param path  The path to the file
+    @param file  Receives the header and the pointers to the u/v planes
+    @returns true on success, false on failure (logged)
+ */
+bool BWFieldFileOpen(char const* path, BWFieldFile* file)
+{
+    memset(file, 0, sizeof(*file));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        BWLog("could not open %s: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) || (size_t) info.st_size < sizeof(BWFieldFileHeader))
+    {
+        BWLog("%s is too small to be a vector field", path);
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t) info.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping holds its own reference to the file
+    close(fd);
+    if (MAP_FAILED == mapping)
+    {
+        BWLog("could not map %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    // Check that the header is sane, and the planes are inside of the file.  The number of
+    // bins is checked against the size of the file before it is multiplied out, and the
+    // offsets against the size before the plane is added, so a corrupt one can't wrap around
+    BWFieldFileHeader const* header = (BWFieldFileHeader const*) mapping;
+    uint64_t numBins = (uint64_t) header->nx * header->ny;
+    uint64_t planeSize = numBins * sizeof(float);
+    if (memcmp(header->magic, "BWVF", 4) || BWFieldFileVersion != header->version
+        || !header->nx || !header->ny
+        || numBins > (size - sizeof(BWFieldFileHeader)) / sizeof(float)
+        || header->uOffset % BWFieldFileAlign || header->vOffset % BWFieldFileAlign
+        || header->uOffset > size || planeSize > size - header->uOffset
+        || header->vOffset > size || planeSize > size - header->vOffset
+        || !isfinite(header->dx) || !isfinite(header->dy) || 0.0f == header->dx || 0.0f == header->dy)
+    {
+        BWLog("%s is not a version %d vector field", path, BWFieldFileVersion);
+        munmap(mapping, size);
+        return false;
+    }
+    // The whole of both planes is going to be read by gridBuild
+    madvise(mapping, size, MADV_WILLNEED);
+
+    file->header.delta.x   = header->dx;
+    file->header.delta.y   = header->dy;
+    file->header.origin.x  = header->lo1;
+    file->header.origin.y  = header->la1;
+    file->header.srcSize.x = header->nx;
+    file->header.srcSize.y = header->ny;
+    file->uData = (float const*)((char const*) mapping + header->uOffset);
+    file->vData = (float const*)((char const*) mapping + header->vOffset);
+    file->mapping     = mapping;
+    file->mappingSize = size;
+    return true;
+}
+
+
+/** Unmap the file
+    @param file  The file opened with BWFieldFileOpen
+ */
+void BWFieldFileClose(BWFieldFile* file)
+{
+    if (file->mapping)
+    {
+        munmap(file->mapping, file->mappingSize);
+    }
+    memset(file, 0, sizeof(*file));
+}
+
+
+/** Write a vector field file
+    @param path    The path to the file
+    @param header  The size, origin and spacing of the grid
+    @param uData   The u components, header->srcSize.x*header->srcSize.y of them
+    @param vData   The v components
+    @returns true on success, false on failure (logged)
+ */
+bool BWFieldFileWrite(char const* path, BWFieldHeader const* header
+                      , float const* uData, float const* vData)
+{
+    size_t count = (size_t) header->srcSize.x * header->srcSize.y;
+    BWFieldFileHeader out;
+    memset(&out, 0, sizeof(out));
+    memcpy(out.magic, "BWVF", 4);
+    out.version = BWFieldFileVersion;
+    out.nx  = header->srcSize.x;
+    out.ny  = header->srcSize.y;
+    out.dx  = header->delta.x;
+    out.dy  = header->delta.y;
+    out.lo1 = header->origin.x;
+    out.la1 = header->origin.y;
+    out.uOffset = sizeof(out);
+    out.vOffset = alignUp(out.uOffset + count*sizeof(float));
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp)
+    {
+        BWLog("could not create %s: %s", path, strerror(errno));
+        return false;
+    }
+    static char const padding[BWFieldFileAlign] = {0};
+    size_t pad = (size_t)(out.vOffset - out.uOffset - count*sizeof(float));
+    bool ok = 1 == fwrite(&out, sizeof(out), 1, fp)
+           && count == fwrite(uData, sizeof(float), count, fp)
+           && pad == fwrite(padding, 1, pad, fp)
+           && count == fwrite(vData, sizeof(float), count, fp);
+    ok = !fclose(fp) && ok;
+    if (!ok)
+    {
+        BWLog("could not write %s", path);
+    }
+    return ok;
+}
@@ -0,0 +1,103 @@
+/*
+    BWFieldFile.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWFieldFile_h
+#define BWFieldFile_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "BWCPUTypes.h"
+
+/*
+    The binary vector field file (.bwvf).
+
+    This holds the same information as the earth JSON files -- the dx/dy/lo1/la1/nx/ny
+    header and the u and v components -- but the components are stored as contiguous
+    planes of floats, so that the file can be memory mapped and the planes handed
+    straight to the field build, without parsing or copying.
+
+    The layout (all little endian):
+        0   "BWVF"
+        4   uint32  version (1)
+        8   uint32  nx, ny
+        16  float   dx, dy, lo1, la1
+        32  uint64  byte offset of the u plane
+        40  uint64  byte offset of the v plane
+        48  reserved, zero, up to 64 bytes
+    The planes are nx*ny floats each, row major, starting on a 64 byte boundary.
+
+    The functions are plain C so that the plugin can use them as well.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// The file extension
+#define BWFieldFileExtension "bwvf"
+
+/** An opened (memory mapped) vector field file
+ */
+typedef struct BWFieldFile
+{
+    /// The size, origin and spacing of the grid
+    BWFieldHeader header;
+    /// The u components; these point into the mapping
+    float const* uData;
+    /// The v components
+    float const* vData;
+    /// The mapping of the whole file
+    void*        mapping;
+    size_t       mappingSize;
+} BWFieldFile;
+
+
+/** Memory map a vector field file
+    @param path  The path to the file
+    @param file  Receives the header and the pointers to the u/v planes
+    @returns true on success, false on failure (logged)
+ */
+bool BWFieldFileOpen(char const* path, BWFieldFile* file);
+
+/** Unmap the file
+    @param file  The file opened with BWFieldFileOpen
+ */
+void BWFieldFileClose(BWFieldFile* file);
+
+/** Write a vector field file
+    @param path    The path to the file
+    @param header  The size, origin and spacing of the grid
+    @param uData   The u components, header->srcSize.x*header->srcSize.y of them
+    @param vData   The v components
+    @returns true on success, false on failure (logged)
+ */
+bool BWFieldFileWrite(char const* path, BWFieldHeader const* header
+                      , float const* uData, float const* vData);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
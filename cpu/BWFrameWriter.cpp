@@ -0,0 +1,508 @@
+/*
+    BWFrameWriter.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include "BWFrameWriter.h"
+#include "BWStats.h"
+#if ZLIB_EN
+#include <zlib.h>
+#endif
+
+
+/// The CRC-32 of the PNG chunks (that of zlib and ISO 3309), a byte at a time
+static uint32_t crc32Update(uint32_t crc, uint8_t const* data, size_t count)
+{
+    struct Table
+    {
+        uint32_t entry[256];
+        Table()
+        {
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entry[n] = c;
+            }
+        }
+    };
+    static Table const table;
+    crc = ~crc;
+    for (size_t i = 0; i < count; i++)
+        crc = table.entry[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+/// Append a 32 bit number, most significant byte first, as PNG has them
+static void putBE32(std::vector<uint8_t>& out, uint32_t value)
+{
+    uint8_t bytes[4] = {(uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t) value};
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+
+/** Append a PNG chunk
+    @param out    The file so far
+    @param type   The 4 letter type
+    @param data   The contents
+    @param count  The number of bytes of contents
+ */
+static void putChunk(std::vector<uint8_t>& out, char const* type, uint8_t const* data, size_t count)
+{
+    putBE32(out, (uint32_t) count);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + count);
+    putBE32(out, crc32Update(0, out.data() + start, 4 + count));
+}
+
+
+/** The zlib stream of the data, in stored (uncompressed) blocks
+    @param data   The data
+    @param count  The number of bytes
+    @param out    Receives the stream
+ */
+static void deflateStored(uint8_t const* data, size_t count, std::vector<uint8_t>& out)
+{
+    out.clear();
+    out.reserve(count + count/65535*5 + 16);
+    // Deflate, with a 32K window, and no preset dictionary
+    out.push_back(0x78);
+    out.push_back(0x01);
+    size_t done = 0;
+    do
+    {
+        size_t n = count - done < 65535 ? count - done : 65535;
+        out.push_back(done + n == count ? 1 : 0);
+        out.push_back((uint8_t) n);
+        out.push_back((uint8_t)(n >> 8));
+        out.push_back((uint8_t) ~n);
+        out.push_back((uint8_t)(~n >> 8));
+        out.insert(out.end(), data + done, data + done + n);
+        done += n;
+    } while (done < count);
+    // The Adler-32 of the data, a few thousand bytes at a time before the sums would overflow
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < count; )
+    {
+        size_t end = count - i < 5552 ? count : i + 5552;
+        for (; i < end; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    putBE32(out, b << 16 | a);
+}
+
+
+BWFrameWriter::BWFrameWriter(BWFrameFormat format, int width, int height)
+    : format(format)
+    , width(width)
+    , height(height)
+    , stream(nullptr)
+    , nextFrame(0)
+    , nextTake(0)
+    , nextStore(0)
+    , closing(false)
+    , failed(false)
+    , _numWriters(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+
+/// Waits for the frames given, and stops the writers
+BWFrameWriter::~BWFrameWriter()
+{
+    close();
+}
+
+
+/** The format that a path's extension names: .png, .y4m, or .rgba / .raw
+    @param path    The path
+    @param format  Receives the format
+    @returns false if the extension isn't one of those
+ */
+bool BWFrameWriter::formatForPath(char const* path, BWFrameFormat& format)
+{
+    char const* extension = strrchr(path, '.');
+    if (!extension || strchr(extension, '/'))
+        return false;
+    extension++;
+    if (!strcasecmp(extension, "png"))
+        format = BWFrameFormatPNG;
+    else if (!strcasecmp(extension, "y4m"))
+        format = BWFrameFormatY4M;
+    else if (!strcasecmp(extension, "rgba") || !strcasecmp(extension, "raw"))
+        format = BWFrameFormatRGBA;
+    else
+        return false;
+    return true;
+}
+
+
+/** Start writing
+    @param path        The path pattern of the PNGs, or the stream
+    @param format      How the frames are written
+    @param width       The number of pixels wide
+    @param height      The number of pixels high
+    @param fps         The frame rate, for the Y4M header
+    @param numWriters  The number of writer threads; 0 for one per core
+    @param numSlots    The number of frames in the ring; 0 for two more than the writers
+    @returns The writer, or null on failure
+ */
+std::unique_ptr<BWFrameWriter> BWFrameWriter::create(char const* path, BWFrameFormat format
+                                                     , int width, int height, int fps
+                                                     , int numWriters, int numSlots)
+{
+    if (width < 1 || height < 1 || fps < 1)
+    {
+        BWLog("error, can't write %d x %d frames at %d fps", width, height, fps);
+        return nullptr;
+    }
+    std::unique_ptr<BWFrameWriter> ret(new BWFrameWriter(format, width, height));
+    if (BWFrameFormatPNG == format)
+    {
+        // The pattern has one %d, which may have a width, and nothing else taken as a conversion
+        std::string pattern(path);
+        size_t percent = pattern.find('%');
+        if (std::string::npos == percent)
+        {
+            size_t dot   = pattern.rfind('.');
+            size_t slash = pattern.rfind('/');
+            if (std::string::npos == dot || (std::string::npos != slash && dot < slash))
+                dot = pattern.size();
+            pattern.insert(dot, "%05d");
+            percent = dot;
+        }
+        size_t conversion = pattern.find_first_not_of("0123456789", percent+1);
+        if (std::string::npos == conversion || 'd' != pattern[conversion]
+            || std::string::npos != pattern.find('%', conversion))
+        {
+            BWLog("error, %s should have one %%d for the frame number", path);
+            return nullptr;
+        }
+        ret->pattern = pattern;
+    }
+    else
+    {
+        ret->stream = fopen(path, "wb");
+        if (!ret->stream)
+        {
+            BWLog("could not create %s: %s", path, strerror(errno));
+            return nullptr;
+        }
+        if (BWFrameFormatY4M == format
+            && fprintf(ret->stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps) < 0)
+        {
+            BWLog("could not write %s: %s", path, strerror(errno));
+            return nullptr;
+        }
+    }
+
+    if (numWriters < 1)
+        numWriters = std::max(1u, std::thread::hardware_concurrency());
+    if (numSlots < 1)
+        numSlots = numWriters + 2;
+    ret->slots.resize(numSlots);
+    for (Slot& slot : ret->slots)
+    {
+        slot.pixels.resize((size_t) 4*width*height);
+        slot.full = false;
+    }
+    ret->_numWriters = numWriters;
+    for (int i = 0; i < numWriters; i++)
+        ret->writers.emplace_back(&BWFrameWriter::writerLoop, ret.get());
+    return ret;
+}
+
+
+/** Add the next frame, waiting for a free slot if the ring is full
+    @param pixels    The image, as BWRaster has it: B, G, R, A, bottom row first
+    @param rowBytes  The number of bytes from one row to the next
+    @returns false if a frame couldn't be written; the rest are then dropped
+ */
+bool BWFrameWriter::write(uint8_t const* pixels, size_t rowBytes)
+{
+    Slot* slot;
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (failed || closing)
+            return false;
+        slot = &slots[nextFrame % slots.size()];
+        if (slot->full)
+        {
+            double start = BWStatsNow();
+            freed.wait(guard, [slot]{ return !slot->full; });
+            stats.waitSeconds += BWStatsNow() - start;
+        }
+    }
+    // The slot is the caller's until the frame is counted, as the writers only take
+    // the frames before nextFrame
+    size_t frameRowBytes = (size_t) 4*width;
+    for (int y = 0; y < height; y++)
+        memcpy(slot->pixels.data() + y*frameRowBytes, pixels + y*rowBytes, frameRowBytes);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        slot->full = true;
+        nextFrame++;
+    }
+    filled.notify_one();
+    return true;
+}
+
+
+/// The loop each writer thread runs
+void BWFrameWriter::writerLoop()
+{
+    std::vector<uint8_t> out, scratch;
+    for (;;)
+    {
+        uint64_t frame;
+        Slot*    slot;
+        bool     skip;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            filled.wait(guard, [this]{ return nextTake < nextFrame || closing; });
+            if (nextTake >= nextFrame)
+                return;
+            frame = nextTake++;
+            slot  = &slots[frame % slots.size()];
+            skip  = failed;
+        }
+        // Encoded into the writer's own buffer, so the slot can be filled again while it is written
+        double start = BWStatsNow();
+        if (!skip)
+            encode(slot->pixels.data(), out, scratch);
+        double encoded = BWStatsNow();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            slot->full = false;
+            stats.encodeSeconds += encoded - start;
+        }
+        freed.notify_all();
+        bool ok = store(frame, skip ? std::vector<uint8_t>() : out);
+        std::lock_guard<std::mutex> guard(lock);
+        stats.writeSeconds += BWStatsNow() - encoded;
+        if (ok && !skip)
+        {
+            stats.frames++;
+            stats.bytes += out.size();
+        }
+        failed = failed || !ok;
+    }
+}
+
+
+/** Write a frame's bytes: to a file of its own, or (in order) to the stream
+    @param frame  The frame number
+    @param bytes  The encoded frame; empty if it is being dropped
+    @returns false on failure (logged)
+ */
+bool BWFrameWriter::store(uint64_t frame, std::vector<uint8_t> const& bytes)
+{
+    if (BWFrameFormatPNG == format)
+    {
+        if (bytes.empty())
+            return true;
+        char path[1024];
+        snprintf(path, sizeof(path), pattern.c_str(), (int) frame);
+        FILE* file = fopen(path, "wb");
+        if (!file)
+        {
+            BWLog("could not create %s: %s", path, strerror(errno));
+            return false;
+        }
+        bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        ok = 0 == fclose(file) && ok;
+        if (!ok)
+            BWLog("could not write %s", path);
+        return ok;
+    }
+
+    // The stream takes the frames in order; each writer waits for the one before its frame
+    std::unique_lock<std::mutex> guard(lock);
+    stored.wait(guard, [this, frame]{ return nextStore == frame; });
+    guard.unlock();
+    bool ok = bytes.empty() || fwrite(bytes.data(), 1, bytes.size(), stream) == bytes.size();
+    if (!ok)
+        BWLog("could not write frame %llu: %s", (unsigned long long) frame, strerror(errno));
+    guard.lock();
+    nextStore++;
+    guard.unlock();
+    stored.notify_all();
+    return ok;
+}
+
+
+/** Encode a frame
+    @param pixels   The frame, as given to write(): B, G, R, A, bottom row first
+    @param out      Receives the bytes to write
+    @param scratch  Space for the PNG rows before they are compressed
+ */
+void BWFrameWriter::encode(uint8_t const* pixels, std::vector<uint8_t>& out, std::vector<uint8_t>& scratch) const
+{
+    size_t rowBytes = (size_t) 4*width;
+    out.clear();
+    if (BWFrameFormatRGBA == format)
+    {
+        out.resize(rowBytes*height);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t const* p = pixels + (size_t)(height-1-y)*rowBytes;
+            uint8_t*       q = out.data() + (size_t) y*rowBytes;
+            for (int x = 0; x < width; x++, p += 4, q += 4)
+            {
+                q[0] = p[2];
+                q[1] = p[1];
+                q[2] = p[0];
+                q[3] = p[3];
+            }
+        }
+        return;
+    }
+
+    if (BWFrameFormatY4M == format)
+    {
+        // BT.601, studio range; the chroma is the average of each 2x2 block
+        int chromaWidth = (width+1)/2, chromaHeight = (height+1)/2;
+        size_t lumaSize = (size_t) width*height, chromaSize = (size_t) chromaWidth*chromaHeight;
+        static char const frameHeader[] = "FRAME\n";
+        out.resize(sizeof(frameHeader)-1 + lumaSize + 2*chromaSize);
+        memcpy(out.data(), frameHeader, sizeof(frameHeader)-1);
+        uint8_t* luma = out.data() + sizeof(frameHeader)-1;
+        uint8_t* cb   = luma + lumaSize;
+        uint8_t* cr   = cb + chromaSize;
+        for (int cy = 0; cy < chromaHeight; cy++)
+        {
+            for (int cx = 0; cx < chromaWidth; cx++)
+            {
+                int r = 0, g = 0, b = 0, n = 0;
+                for (int y = 2*cy; y < 2*cy+2 && y < height; y++)
+                {
+                    uint8_t const* row = pixels + (size_t)(height-1-y)*rowBytes;
+                    for (int x = 2*cx; x < 2*cx+2 && x < width; x++, n++)
+                    {
+                        uint8_t const* p = row + 4*x;
+                        luma[(size_t) y*width + x] = (uint8_t)(((66*p[2] + 129*p[1] + 25*p[0] + 128) >> 8) + 16);
+                        r += p[2];
+                        g += p[1];
+                        b += p[0];
+                    }
+                }
+                r /= n;
+                g /= n;
+                b /= n;
+                cb[(size_t) cy*chromaWidth + cx] = (uint8_t)(((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+                cr[(size_t) cy*chromaWidth + cx] = (uint8_t)(((112*r - 94*g - 18*b + 128) >> 8) + 128);
+            }
+        }
+        return;
+    }
+
+    // PNG: the rows top first, RGBA, each with the Sub filter (the difference from the pixel
+    // to the left), which turns the runs of the background and the trails into zeros
+    size_t lineBytes = 1 + rowBytes;
+    scratch.resize(lineBytes*height);
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t const* p = pixels + (size_t)(height-1-y)*rowBytes;
+        uint8_t*       q = scratch.data() + (size_t) y*lineBytes;
+        *q++ = 1;
+        uint8_t left[4] = {0, 0, 0, 0};
+        for (int x = 0; x < width; x++, p += 4, q += 4)
+        {
+            uint8_t rgba[4] = {p[2], p[1], p[0], p[3]};
+            for (int c = 0; c < 4; c++)
+            {
+                q[c]    = (uint8_t)(rgba[c] - left[c]);
+                left[c] = rgba[c];
+            }
+        }
+    }
+    std::vector<uint8_t> compressed;
+#if ZLIB_EN
+    uLongf compressedSize = compressBound((uLong) scratch.size());
+    compressed.resize(compressedSize);
+    if (Z_OK == compress2(compressed.data(), &compressedSize, scratch.data(), (uLong) scratch.size(), Z_BEST_SPEED))
+        compressed.resize(compressedSize);
+    else
+        deflateStored(scratch.data(), scratch.size(), compressed);
+#else
+    deflateStored(scratch.data(), scratch.size(), compressed);
+#endif
+    static uint8_t const signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.insert(out.end(), signature, signature + 8);
+    // 8 bits a component, RGBA, deflate, adaptive filtering, not interlaced
+    uint8_t header[13] = {(uint8_t)(width >> 24), (uint8_t)(width >> 16), (uint8_t)(width >> 8), (uint8_t) width
+                          , (uint8_t)(height >> 24), (uint8_t)(height >> 16), (uint8_t)(height >> 8), (uint8_t) height
+                          , 8, 6, 0, 0, 0};
+    putChunk(out, "IHDR", header, sizeof(header));
+    putChunk(out, "IDAT", compressed.data(), compressed.size());
+    putChunk(out, "IEND", nullptr, 0);
+}
+
+
+/** Wait for the frames given to be written, and close the stream
+    @returns false if any of them couldn't be written
+ */
+bool BWFrameWriter::close()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    filled.notify_all();
+    for (std::thread& writer : writers)
+        writer.join();
+    writers.clear();
+    std::lock_guard<std::mutex> guard(lock);
+    if (stream)
+    {
+        if (fclose(stream))
+        {
+            BWLog("could not finish writing the frames: %s", strerror(errno));
+            failed = true;
+        }
+        stream = nullptr;
+    }
+    return !failed;
+}
+
+
+/// How the writer has done so far
+BWFrameWriterStats BWFrameWriter::statistics() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
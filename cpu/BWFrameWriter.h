@@ -0,0 +1,188 @@
+/*
+    BWFrameWriter.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWFrameWriter_h
+#define BWFrameWriter_h
+
+#include <stdint.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BWCPUTypes.h"
+
+/*
+    Writes the frames of an offline render out to disk, as a PNG sequence, a Y4M
+    stream or a raw RGBA stream, without holding up the render.
+
+    The frames are copied into a ring of slots as they are drawn; the writer threads
+    take them in order, each encoding a frame of its own (so the encoding is never on
+    one thread), and let go of the slot before writing the file.  A PNG is written to
+    a file of its own straight away; the frames of a stream are appended in order, each
+    writer waiting for the frame before it.  When every slot is full, write() waits for
+    one to be free, so the render runs no further ahead than the ring.
+
+    The frames are BWRaster's images: B, G, R, A bytes, with row 0 at the bottom.  They
+    are written top row first, as RGBA (PNG, raw) or BT.601 4:2:0 (Y4M).
+ */
+
+/// Setting this to 1 compresses the PNGs with zlib; 0 writes them with stored (uncompressed)
+/// deflate blocks.  The CMake build sets it when it finds zlib
+#ifndef ZLIB_EN
+#define ZLIB_EN (0)
+#endif
+
+/// How the frames are written
+enum BWFrameFormat
+{
+    /// A PNG file per frame, RGBA
+    BWFrameFormatPNG,
+    /// One YUV4MPEG2 stream, 4:2:0, which video encoders read
+    BWFrameFormatY4M,
+    /// One stream of the RGBA frames, one after the other, with no header
+    BWFrameFormatRGBA
+};
+
+/// How the writer has done
+typedef struct BWFrameWriterStats
+{
+    /// The frames written, and the bytes written for them
+    uint64_t frames;
+    uint64_t bytes;
+    /// The time write() waited for a free slot, in seconds
+    double   waitSeconds;
+    /// The time the writers spent encoding, and writing (and waiting for their turn to
+    /// write a stream), summed over the writers, in seconds
+    double   encodeSeconds;
+    double   writeSeconds;
+} BWFrameWriterStats;
+
+
+/** Encodes and writes the frames on threads of its own, through a bounded ring of frames
+ */
+class BWFrameWriter
+{
+public:
+    /** Start writing
+        @param path        For a PNG sequence, the path of each file, with one %d (e.g.,
+                           frames/wind%05d.png) for the frame number; without one, "%05d"
+                           is put before the extension.  For a stream, the file.
+        @param format      How the frames are written
+        @param width       The number of pixels wide
+        @param height      The number of pixels high
+        @param fps         The frame rate, for the Y4M header
+        @param numWriters  The number of writer threads; 0 for one per core
+        @param numSlots    The number of frames in the ring, each width*height*4 bytes; 0 for
+                           two more than the writers, which is enough to keep them all busy
+        @returns The writer, or null if the path isn't usable or the stream couldn't be
+                 created (logged)
+     */
+    static std::unique_ptr<BWFrameWriter> create(char const* path, BWFrameFormat format
+                                                 , int width, int height, int fps
+                                                 , int numWriters = 0, int numSlots = 0);
+
+    /** The format that a path's extension names: .png, .y4m, or .rgba / .raw
+        @param path    The path
+        @param format  Receives the format
+        @returns false if the extension isn't one of those
+     */
+    static bool formatForPath(char const* path, BWFrameFormat& format);
+
+    /// Waits for the frames given, and stops the writers
+    ~BWFrameWriter();
+
+    /** Add the next frame, waiting for a free slot if the ring is full
+        @param pixels    The image, as BWRaster has it: B, G, R, A, bottom row first
+        @param rowBytes  The number of bytes from one row to the next
+        @returns false if a frame couldn't be written (logged); the rest are then dropped
+     */
+    bool write(uint8_t const* pixels, size_t rowBytes);
+
+    /** Wait for the frames given to be written, and close the stream
+        @returns false if any of them couldn't be written
+     */
+    bool close();
+
+    /// How the writer has done so far
+    BWFrameWriterStats statistics() const;
+
+    /// The number of writer threads
+    int numWriters() const { return _numWriters; }
+    /// The number of frames in the ring
+    int numSlots() const { return (int) slots.size(); }
+
+private:
+    BWFrameWriter(BWFrameFormat format, int width, int height);
+    BWFrameWriter(BWFrameWriter const&);
+    BWFrameWriter& operator=(BWFrameWriter const&);
+
+    /// The loop each writer thread runs
+    void writerLoop();
+
+    /** Encode a frame
+        @param pixels   The frame, as given to write()
+        @param out      Receives the bytes to write
+        @param scratch  Space for the PNG rows before they are compressed
+     */
+    void encode(uint8_t const* pixels, std::vector<uint8_t>& out, std::vector<uint8_t>& scratch) const;
+
+    /// Write a frame's bytes: to a file of its own, or (in order) to the stream
+    bool store(uint64_t frame, std::vector<uint8_t> const& bytes);
+
+    BWFrameFormat format;
+    int           width;
+    int           height;
+    /// The path (pattern) of the PNGs, and the stream
+    std::string   pattern;
+    FILE*         stream;
+
+    /// The ring: the frame in each slot, and whether it is waiting to be encoded.  Frame f
+    /// goes in slot f % numSlots; nextFrame is the next to be given, nextTake the next to be
+    /// encoded, and nextStore the next to go into the stream (all guarded by lock)
+    struct Slot
+    {
+        std::vector<uint8_t> pixels;
+        bool                 full;
+    };
+    std::vector<Slot>        slots;
+    uint64_t                 nextFrame;
+    uint64_t                 nextTake;
+    uint64_t                 nextStore;
+    bool                     closing;
+    bool                     failed;
+    /// Signalled as a slot is filled, as one is freed, and as a frame goes into the stream
+    mutable std::mutex       lock;
+    std::condition_variable  filled;
+    std::condition_variable  freed;
+    std::condition_variable  stored;
+    std::vector<std::thread> writers;
+    int                      _numWriters;
+
+    BWFrameWriterStats       stats;
+};
+
+#endif
@@ -0,0 +1,681 @@
+/*
+    BWGridBuild.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Translated from gridBuild.cl, which was in turn translated from
+    https://github.com/cambecc/earth
+    Copyright (c) 2013 Cameron Beccario
+    The MIT License - http://opensource.org/licenses/MIT
+ */
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "BWGridBuild.h"
+
+#define BW_PI   3.1415926535897932384626433832795f
+
+/** Bilinear interpolation
+    @param x    The fractional distance in x between the g?0 and g?1 points
+    @param y    The fractional distance in y between the g0? and g1? points
+    @returns The interpolated vector
+ */
+static inline BWFloat2 bilinear(float x, float y, BWFloat2 g00, BWFloat2 g10, BWFloat2 g01, BWFloat2 g11)
+{
+    float a = (1.0f - x) * (1.0f - y);
+    float b = x * (1.0f - y);
+    float c = (1.0f - x) * y;
+    float d = x * y;
+    BWFloat2 ret;
+    ret.x = g00.x * a + g10.x * b + g01.x * c + g11.x * d;
+    ret.y = g00.y * a + g10.y * b + g01.y * c + g11.y * d;
+    return ret;
+}
+
+
+/** Bilinear lookup of the source field
+    @param coord    The (fractional) column and row within the source field
+    @param srcSize  The number of uv vectors wide and high
+    @param srcField The internal representation of the u-v grid
+    @returns vector
+
+    For wrapped grids, the first column is duplicated as the last column, so the
+    index ci can be used without taking a modulo.
+ */
+BWFloat2 gridSample(BWFloat2 coord, BWUInt2 srcSize, BWFloat2 const* srcField)
+{
+    // Calculate the longitude (x) and latitude (y) index within the source field
+    int fi = (int) floorf(coord.x);
+    int fj = (int) floorf(coord.y);
+
+    uint32_t ci = std::min((uint32_t)fi+1u, srcSize.x-1u);
+    uint32_t cj = std::min((uint32_t)fj+1u, srcSize.y-1u);
+
+    // The starting spot of the row
+    size_t rowOfs = (size_t)fj*srcSize.x;
+    BWFloat2 g00 = srcField[rowOfs+fi];
+    BWFloat2 g10 = srcField[rowOfs+ci];
+
+    rowOfs = (size_t)cj*srcSize.x;
+    BWFloat2 g01 = srcField[rowOfs+fi];
+    BWFloat2 g11 = srcField[rowOfs+ci];
+
+    // All four points found, so use bilinear interpolation to calculate the wind vector.
+    return bilinear(coord.x - fi, coord.y - fj, g00, g10, g01, g11);
+}
+
+
+/** Calculate distortion of the wind vector caused by the shape of the projection
+    @param latlon  The coordinate of the point of discussion
+    @param scale   How much to scale the velocity magnitude by
+    @param wind    The wind vector at that point
+    @returns distorted vector
+
+    See distortion() in gridBuild.cl for the finite difference explanation
+ */
+BWFloat2 gridDistort(BWFloat2 latlon, float scale, BWFloat2 wind)
+{
+    float H  = 0.0000630957344f; // pow(10, -5.2);
+    float hu = latlon.x < 0 ? H : -H;
+    float hv = latlon.y < 0 ? H : -H;
+    BWFloat2 pu = {latlon.x + hu, latlon.y};
+    BWFloat2 pv = {latlon.x,      latlon.y + hv};
+
+    // Meridian scale factor (see Snyder, equation 4-3), where R = 1. This handles issue where length of 1º λ
+    // changes depending on v. Without this, there is a pinching effect at the poles.
+    float k = cosf(latlon.y * BW_PI *2.0f / 360.0f);
+
+    // The scaled derivatives [dx/du, dy/du, dx/dv, dy/dv]
+    float dxdu = (pu.x - latlon.x) / hu / k;
+    float dydu = (pu.y - latlon.y) / hu / k;
+    float dxdv = (pv.x - latlon.x) / hv;
+    float dydv = (pv.y - latlon.y) / hv;
+
+    // Scale distortion vectors by u and v, then add.
+    float u = wind.x * scale;
+    float v = wind.y * scale;
+    BWFloat2 ret;
+    ret.x = dxdu * u + dxdv * v;
+    ret.y = dydu * u + dydv * v;
+    return ret;
+}
+
+
+/** Where a bin goes in the target field
+    @param layout  How the bins are ordered
+    @param x       The column of the bin
+    @param y       The row of the bin
+    @param stride  The number of entries per row, or for BWFieldLayoutTiled, the number of tiles across
+    @returns The index of the bin
+ */
+static inline size_t binIndex(BWFieldLayout layout, uint32_t x, uint32_t y, uint32_t stride)
+{
+    return BWFieldLayoutRows == layout ? x + (size_t) y * stride : gridTiledIndex(x, y, stride);
+}
+
+
+/// Samples the internal u-v grid that gridBuild made
+struct GridSource
+{
+    BWUInt2         srcSize;
+    BWFloat2 const* srcField;
+    BWFloat2 operator()(BWFloat2 coord) const { return gridSample(coord, srcSize, srcField); }
+};
+
+
+/** Samples the u/v planes as they are, as if they had been through gridBuild: the
+    columns are rotated by 180, the first is repeated as the wrap around column, and the
+    v component is flipped.  The rotation and wrap around are looked up in column[].
+ */
+struct DataSource
+{
+    float const*    uData;
+    float const*    vData;
+    /// The number of columns in the planes
+    uint32_t        width;
+    /// The size of the grid gridBuild would have made, including the wrap around column
+    BWUInt2         srcSize;
+    /// The column of the planes that each column of that grid comes from
+    uint32_t const* column;
+
+    /// The vector at a point of the grid gridBuild would have made
+    BWFloat2 fetch(uint32_t i, uint32_t j) const
+    {
+        size_t p = (size_t) j*width + column[i];
+        // Note: because the latitude decreases, the direction of the y component is flipped (as in gridBuild)
+        BWFloat2 uv = {uData[p], (j<360?-1.0f:0.0f)*vData[p]};
+        return uv;
+    }
+
+    /// Bilinear lookup, as gridSample
+    BWFloat2 operator()(BWFloat2 coord) const
+    {
+        int fi = (int) floorf(coord.x);
+        int fj = (int) floorf(coord.y);
+        uint32_t ci = std::min((uint32_t)fi+1u, srcSize.x-1u);
+        uint32_t cj = std::min((uint32_t)fj+1u, srcSize.y-1u);
+        return bilinear(coord.x - fi, coord.y - fj
+                        , fetch(fi, fj), fetch(ci, fj), fetch(fi, cj), fetch(ci, cj));
+    }
+};
+
+
+/** Build one row of the field used for animation, for the columns [xBegin, xEnd)
+    @param sample        Returns the vector at a (fractional) point of the source grid
+    @param srcSize       The number of elements in the (internal) source grid
+    @param origin        The origin of the coordinate space (e.g., 0.0E, 90.0N)
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the target field is
+    @param y             The row
+    @param xBegin        The first column
+    @param xEnd          One past the last column
+    @param tgtRow        Receives the xEnd-xBegin vectors of the row
+ */
+template <class Source>
+static void interpolateRow(Source const&     sample
+                           , BWUInt2         srcSize
+                           , BWFloat2        origin
+                           , float           velocityScale
+                           , BWUInt2         tgtSize
+                           , uint32_t        y
+                           , uint32_t xBegin, uint32_t xEnd
+                           , BWFloat2*       tgtRow
+                           )
+{
+    // The row within the source field is the same across the whole target row
+    float srcY = std::min(std::max((float)(y*srcSize.y)/(float)tgtSize.y, 0.0f), (float)srcSize.y-0.1f);
+    for (uint32_t x = xBegin; x < xEnd; x++)
+    {
+        // First, calculate the point within the source field
+        // We use the srcSize (which may be longer than the original) so that the right hand size gets wrap around info
+        BWFloat2 srcPoint;
+        srcPoint.x = std::min(std::max((float)(x*srcSize.x)/(float)tgtSize.x, 0.0f), (float)srcSize.x-0.1f);
+        srcPoint.y = srcY;
+        BWFloat2 wind = sample(srcPoint);
+
+        // Second, calculate the lat/lon of the wind vector
+        BWFloat2 latlon;
+        latlon.x = srcPoint.x - origin.x;
+        latlon.y = origin.y - srcPoint.y;
+
+        // Calculate the distortion from the particular projection onto the grid
+        tgtRow[x - xBegin] = gridDistort(latlon, velocityScale, wind);
+    }
+}
+
+
+/** Build the field used for animation as floats, for the rows [rowBegin, rowEnd)
+    @param sample  Returns the vector at a (fractional) point of the source grid
+    See gridInterpolate() for the other parameters
+ */
+template <class Source>
+static void interpolateFloat(Source const&     sample
+                             , BWUInt2         srcSize
+                             , BWFloat2        origin
+                             , float           velocityScale
+                             , BWUInt2         tgtSize
+                             , uint32_t        tgtStride
+                             , BWFieldLayout   layout
+                             , BWFloat2*       tgtField
+                             , uint32_t rowBegin, uint32_t rowEnd
+                             )
+{
+    if (BWFieldLayoutRows == layout)
+    {
+        for (uint32_t y = rowBegin; y < rowEnd; y++)
+        {
+            interpolateRow(sample, srcSize, origin, velocityScale, tgtSize, y, 0, tgtSize.x, tgtField + (size_t) y * tgtStride);
+        }
+        return;
+    }
+
+    // Each row is made, then dealt out to the tiles it crosses
+    std::vector<BWFloat2> row(tgtSize.x);
+    for (uint32_t y = rowBegin; y < rowEnd; y++)
+    {
+        interpolateRow(sample, srcSize, origin, velocityScale, tgtSize, y, 0, tgtSize.x, row.data());
+        for (uint32_t x = 0; x < tgtSize.x; x++)
+        {
+            tgtField[binIndex(layout, x, y, tgtStride)] = row[x];
+        }
+    }
+}
+
+
+/** Build the field used for animation, for the rows [rowBegin, rowEnd)
+    @param srcSize       The number of elements in the (internal) source grid
+    @param srcField      The internal representation of the u-v grid
+    @param origin        The origin of the coordinate space (e.g., 0.0E, 90.0N)
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the tgtField is
+    @param tgtStride     The number of entries per row (there may be more than in tgtSize);
+                         for BWFieldLayoutTiled, the number of tiles across
+    @param layout        How the bins are ordered in tgtField
+    @param tgtField      The field modified for animation
+ */
+void gridInterpolate(BWUInt2          srcSize
+                     , BWFloat2 const* srcField
+                     , BWFloat2        origin
+                     , float           velocityScale
+                     , BWUInt2         tgtSize
+                     , uint32_t        tgtStride
+                     , BWFieldLayout   layout
+                     , BWFloat2*       tgtField
+                     , uint32_t rowBegin, uint32_t rowEnd
+                     )
+{
+    if (tgtSize.x == 0 || tgtSize.y == 0)
+        return;
+    GridSource sample = {srcSize, srcField};
+    interpolateFloat(sample, srcSize, origin, velocityScale, tgtSize, tgtStride, layout, tgtField, rowBegin, rowEnd);
+}
+
+
+/** Convert a float to the nearest half float
+    @param f  The float
+    @returns The half float; magnitudes too large for it are clamped to 65504
+ */
+uint16_t gridEncodeHalf(float f)
+{
+    union { float f; uint32_t u; } bits;
+    bits.f = f;
+    uint32_t sign = (bits.u >> 16) & 0x8000u;
+    uint32_t abs  = bits.u & 0x7fffffffu;
+    if (abs > 0x7f800000u)
+    {
+        // NaN stays NaN
+        return (uint16_t)(sign | 0x7e00u);
+    }
+    if (abs >= 0x477ff000u)
+    {
+        // Rounds to 65520 or more (or is infinite): clamp to the largest half float
+        return (uint16_t)(sign | 0x7bffu);
+    }
+    if (abs < 0x38800000u)
+    {
+        // A denormal half (or zero): round mant * 2^-24 to the nearest integer, ties to even
+        bits.u = abs;
+        float    scaled = bits.f * 16777216.0f;
+        uint32_t mant   = (uint32_t) scaled;
+        float    frac   = scaled - (float) mant;
+        if (frac > 0.5f || (frac == 0.5f && (mant & 1u)))
+            mant++;
+        return (uint16_t)(sign | mant);
+    }
+    // Rebias the exponent, and round the 13 bits dropped from the mantissa to nearest even;
+    // a carry out of the mantissa correctly bumps the exponent
+    uint32_t h = ((abs - (112u << 23)) >> 13);
+    uint32_t rest = abs & 0x1fffu;
+    if (rest > 0x1000u || (rest == 0x1000u && (h & 1u)))
+        h++;
+    return (uint16_t)(sign | h);
+}
+
+
+/** Build the field used for animation as half floats, for the rows [rowBegin, rowEnd)
+    @param sample  Returns the vector at a (fractional) point of the source grid
+    See gridInterpolate() for the other parameters
+ */
+template <class Source>
+static void interpolateHalf(Source const&     sample
+                            , BWUInt2         srcSize
+                            , BWFloat2        origin
+                            , float           velocityScale
+                            , BWUInt2         tgtSize
+                            , uint32_t        tgtStride
+                            , BWFieldLayout   layout
+                            , BWHalf2*        tgtField
+                            , uint32_t rowBegin, uint32_t rowEnd
+                            )
+{
+    // Each row is made as floats, then packed
+    std::vector<BWFloat2> row(tgtSize.x);
+    for (uint32_t y = rowBegin; y < rowEnd; y++)
+    {
+        interpolateRow(sample, srcSize, origin, velocityScale, tgtSize, y, 0, tgtSize.x, row.data());
+        for (uint32_t x = 0; x < tgtSize.x; x++)
+        {
+            BWHalf2& bin = tgtField[binIndex(layout, x, y, tgtStride)];
+            bin.x = gridEncodeHalf(row[x].x);
+            bin.y = gridEncodeHalf(row[x].y);
+        }
+    }
+}
+
+
+/** Build the field used for animation as half floats, for the rows [rowBegin, rowEnd)
+    @param srcSize       The number of elements in the (internal) source grid
+    @param srcField      The internal representation of the u-v grid
+    @param origin        The origin of the coordinate space (e.g., 0.0E, 90.0N)
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the tgtField is
+    @param tgtStride     The number of entries per row (there may be more than in tgtSize);
+                         for BWFieldLayoutTiled, the number of tiles across
+    @param layout        How the bins are ordered in tgtField
+    @param tgtField      The field modified for animation
+ */
+void gridInterpolateHalf(BWUInt2          srcSize
+                         , BWFloat2 const* srcField
+                         , BWFloat2        origin
+                         , float           velocityScale
+                         , BWUInt2         tgtSize
+                         , uint32_t        tgtStride
+                         , BWFieldLayout   layout
+                         , BWHalf2*        tgtField
+                         , uint32_t rowBegin, uint32_t rowEnd
+                         )
+{
+    if (tgtSize.x == 0 || tgtSize.y == 0)
+        return;
+    GridSource sample = {srcSize, srcField};
+    interpolateHalf(sample, srcSize, origin, velocityScale, tgtSize, tgtStride, layout, tgtField, rowBegin, rowEnd);
+}
+
+
+/** Convert a float to fixed point
+    @param f      The float
+    @param scale  The reciprocal of the scale of the fixed point number
+    @returns The nearest fixed point number; out of range values (and NaN) are clamped
+ */
+static inline int16_t encodeFixed(float f, float scale)
+{
+    float q = f * scale;
+    if (!(q > -32767.0f))
+        return q != q ? 0 : -32767;
+    if (q > 32767.0f)
+        return 32767;
+    return (int16_t) lrintf(q);
+}
+
+
+/** Build the field used for animation as 16 bit fixed point, for the rows [rowBegin, rowEnd)
+    @param sample  Returns the vector at a (fractional) point of the source grid
+    See gridInterpolateInt16() for the other parameters
+ */
+template <class Source>
+static void interpolateInt16(Source const&     sample
+                             , BWUInt2         srcSize
+                             , BWFloat2        origin
+                             , float           velocityScale
+                             , BWUInt2         tgtSize
+                             , uint32_t        tgtStride
+                             , BWFieldLayout   layout
+                             , BWShort2*       tgtField
+                             , BWFloat2*       rowScale
+                             , uint32_t rowBegin, uint32_t rowEnd
+                             )
+{
+    std::vector<BWFloat2> row(tgtSize.x);
+    for (uint32_t y = rowBegin; y < rowEnd; y++)
+    {
+        interpolateRow(sample, srcSize, origin, velocityScale, tgtSize, y, 0, tgtSize.x, row.data());
+
+        // The largest (finite) magnitude of each component sets the row's scale
+        float xMax = 0.0f, yMax = 0.0f;
+        for (uint32_t x = 0; x < tgtSize.x; x++)
+        {
+            float ax = fabsf(row[x].x), ay = fabsf(row[x].y);
+            if (ax > xMax && ax <= FLT_MAX) xMax = ax;
+            if (ay > yMax && ay <= FLT_MAX) yMax = ay;
+        }
+        BWFloat2 scale = {xMax / 32767.0f, yMax / 32767.0f};
+        rowScale[y] = scale;
+        float xInv = xMax > 0.0f ? 32767.0f / xMax : 0.0f;
+        float yInv = yMax > 0.0f ? 32767.0f / yMax : 0.0f;
+
+        for (uint32_t x = 0; x < tgtSize.x; x++)
+        {
+            BWShort2& bin = tgtField[binIndex(layout, x, y, tgtStride)];
+            bin.x = encodeFixed(row[x].x, xInv);
+            bin.y = encodeFixed(row[x].y, yInv);
+        }
+    }
+}
+
+
+/** Build the field used for animation as 16 bit fixed point, for the rows [rowBegin, rowEnd)
+    @param srcSize       The number of elements in the (internal) source grid
+    @param srcField      The internal representation of the u-v grid
+    @param origin        The origin of the coordinate space (e.g., 0.0E, 90.0N)
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the tgtField is
+    @param tgtStride     The number of entries per row (there may be more than in tgtSize);
+                         for BWFieldLayoutTiled, the number of tiles across
+    @param layout        How the bins are ordered in tgtField
+    @param tgtField      The field modified for animation
+    @param rowScale      Receives, for each row, the scale of the x and y components
+ */
+void gridInterpolateInt16(BWUInt2          srcSize
+                          , BWFloat2 const* srcField
+                          , BWFloat2        origin
+                          , float           velocityScale
+                          , BWUInt2         tgtSize
+                          , uint32_t        tgtStride
+                          , BWFieldLayout   layout
+                          , BWShort2*       tgtField
+                          , BWFloat2*       rowScale
+                          , uint32_t rowBegin, uint32_t rowEnd
+                          )
+{
+    if (tgtSize.x == 0 || tgtSize.y == 0)
+        return;
+    GridSource sample = {srcSize, srcField};
+    interpolateInt16(sample, srcSize, origin, velocityScale, tgtSize, tgtStride, layout, tgtField, rowScale, rowBegin, rowEnd);
+}
+
+
+/** Build the field used for animation straight from the u/v planes, for the rows [rowBegin, rowEnd)
+    @param uData         The grid of the u component's of the vector
+    @param vData         The grid of the v component's of the vector
+    @param srcGridSize   The number of elements in the original grid
+    @param isContinuous  True if the grid wraps around the globe
+    @param origin        The grid's origin (e.g., 0.0E, 90.0N), before the rotation
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the tgtField is
+    @param tgtStride     The number of entries per row (there may be more than in tgtSize);
+                         for BWFieldLayoutTiled, the number of tiles across
+    @param layout        How the bins are ordered in tgtField
+    @param storage       How the vectors are stored
+    @param tgtField      The field modified for animation: BWFloat2, BWHalf2 or BWShort2
+    @param rowScale      For BWFieldStorageInt16, receives the scale of each row
+ */
+void gridBuildField(float const* uData, float const* vData
+                    , BWUInt2         srcGridSize
+                    , bool            isContinuous
+                    , BWFloat2        origin
+                    , float           velocityScale
+                    , BWUInt2         tgtSize
+                    , uint32_t        tgtStride
+                    , BWFieldLayout   layout
+                    , BWFieldStorage  storage
+                    , void*           tgtField
+                    , BWFloat2*       rowScale
+                    , uint32_t rowBegin, uint32_t rowEnd
+                    )
+{
+    if (tgtSize.x == 0 || tgtSize.y == 0 || srcGridSize.x == 0 || srcGridSize.y == 0)
+        return;
+
+    // The grid that gridBuild would have made: it has the wrap around column, and
+    // (HACK, as there) its origin is rotated by 180 degrees
+    BWUInt2 srcSize = {srcGridSize.x + (isContinuous?1u:0u), srcGridSize.y};
+    origin.x += 90.0f;
+    std::vector<uint32_t> column(srcSize.x);
+    gridBuildColumns(srcGridSize, isContinuous, column.data());
+    DataSource sample = {uData, vData, srcGridSize.x, srcSize, column.data()};
+
+    switch (storage)
+    {
+        case BWFieldStorageHalf:
+            interpolateHalf(sample, srcSize, origin, velocityScale, tgtSize, tgtStride, layout
+                            , (BWHalf2*) tgtField, rowBegin, rowEnd);
+            break;
+        case BWFieldStorageInt16:
+            interpolateInt16(sample, srcSize, origin, velocityScale, tgtSize, tgtStride, layout
+                             , (BWShort2*) tgtField, rowScale, rowBegin, rowEnd);
+            break;
+        default:
+            interpolateFloat(sample, srcSize, origin, velocityScale, tgtSize, tgtStride, layout
+                             , (BWFloat2*) tgtField, rowBegin, rowEnd);
+            break;
+    }
+}
+
+
+/** The column of the u/v planes that each column of the grid gridBuild makes comes from
+    @param srcGridSize  The number of elements in the original grid
+    @param isContinuous True if the grid wraps around the globe
+    @param column       Receives srcGridSize.x (+1 if isContinuous) columns
+ */
+void gridBuildColumns(BWUInt2 srcGridSize, bool isContinuous, uint32_t* column)
+{
+    uint32_t numColumns = srcGridSize.x + (isContinuous?1u:0u);
+    uint32_t shift = 180u % srcGridSize.x;
+    for (uint32_t i = 0; i < numColumns; i++)
+    {
+        // gridBuild puts column i at (i+180) % width, and repeats its first column at the end
+        column[i] = (i % srcGridSize.x + srcGridSize.x - shift) % srcGridSize.x;
+    }
+}
+
+
+/** Build one tile of a BWFieldLayoutTiled field straight from the u/v planes
+    @param column        The columns from gridBuildColumns()
+    @param tileX         The tile's column of tiles
+    @param tileY         The tile's row of tiles
+    @param tile          Receives the tile's BWFieldTileSize x BWFieldTileSize vectors
+    See gridBuildField() for the other parameters
+ */
+void gridBuildTile(float const* uData, float const* vData
+                   , BWUInt2         srcGridSize
+                   , bool            isContinuous
+                   , uint32_t const* column
+                   , BWFloat2        origin
+                   , float           velocityScale
+                   , BWUInt2         tgtSize
+                   , BWFieldStorage  storage
+                   , uint32_t tileX, uint32_t tileY
+                   , void*           tile
+                   )
+{
+    if (tgtSize.x == 0 || tgtSize.y == 0 || srcGridSize.x == 0 || srcGridSize.y == 0)
+        return;
+    BWUInt2 srcSize = {srcGridSize.x + (isContinuous?1u:0u), srcGridSize.y};
+    origin.x += 90.0f;
+    DataSource sample = {uData, vData, srcGridSize.x, srcSize, column};
+
+    // The part of the tile that is within the field; the rest is left alone
+    uint32_t xBegin = tileX << BWFieldTileShift;
+    uint32_t yBegin = tileY << BWFieldTileShift;
+    uint32_t xEnd   = std::min(xBegin + BWFieldTileSize, tgtSize.x);
+    uint32_t yEnd   = std::min(yBegin + BWFieldTileSize, tgtSize.y);
+    BWFloat2 row[BWFieldTileSize];
+    for (uint32_t y = yBegin; y < yEnd; y++)
+    {
+        interpolateRow(sample, srcSize, origin, velocityScale, tgtSize, y, xBegin, xEnd, row);
+        size_t offset = (size_t)(y - yBegin) << BWFieldTileShift;
+        for (uint32_t x = 0; x < xEnd - xBegin; x++)
+        {
+            if (BWFieldStorageHalf == storage)
+            {
+                BWHalf2& bin = ((BWHalf2*) tile)[offset + x];
+                bin.x = gridEncodeHalf(row[x].x);
+                bin.y = gridEncodeHalf(row[x].y);
+            }
+            else
+            {
+                ((BWFloat2*) tile)[offset + x] = row[x];
+            }
+        }
+    }
+}
+
+
+/** The (distorted) vector at a point in the target field, sampled from the compact field
+    @param field    The compact field
+    @param tgtSize  The number of bins wide and high the target field is
+    @param position The (fractional) position within the target field
+    @returns vector
+ */
+BWFloat2 gridLookup(BWSourceField const* field, BWUInt2 tgtSize, BWFloat2 position)
+{
+    BWUInt2 srcSize = field->srcSize;
+    // The point within the source field, as in gridInterpolate.  The particles may
+    // stray off the edge (or be NaN), so they are clamped rather than trusted
+    float xMax = (float)srcSize.x-0.1f, yMax = (float)srcSize.y-0.1f;
+    BWFloat2 srcPoint;
+    srcPoint.x = position.x*srcSize.x/tgtSize.x;
+    srcPoint.y = position.y*srcSize.y/tgtSize.y;
+    srcPoint.x = srcPoint.x > 0.0f ? (srcPoint.x < xMax ? srcPoint.x : xMax) : 0.0f;
+    srcPoint.y = srcPoint.y > 0.0f ? (srcPoint.y < yMax ? srcPoint.y : yMax) : 0.0f;
+    BWFloat2 wind = gridSample(srcPoint, srcSize, field->srcField);
+
+    // The lat/lon of the wind vector, and the distortion of the projection there
+    BWFloat2 latlon;
+    latlon.x = srcPoint.x - field->origin.x;
+    latlon.y = field->origin.y - srcPoint.y;
+    return gridDistort(latlon, field->velocityScale, wind);
+}
+
+
+/** Build the internal form of the grid, for the rows [rowBegin, rowEnd)
+    @param uData       The grid of the u component's of the vector
+    @param vData       The grid of the v component's of the vector
+    @param srcGridSize The number of elements in the original grid
+    @param isContinuous True if the grid wraps around the globe
+    @param srcGrid     The internal representation of the u-v grid
+ */
+void gridBuild(float const* uData, float const* vData
+               , BWUInt2   srcGridSize
+               , bool      isContinuous
+               , BWFloat2* srcGrid
+               , uint32_t  rowBegin, uint32_t rowEnd
+               )
+{
+    uint32_t stride = srcGridSize.x + (isContinuous?1:0);
+    for (uint32_t j = rowBegin; j < rowEnd; j++)
+    {
+        size_t p = (size_t) j * srcGridSize.x;
+        // Scan mode 0 assumed. Longitude increases from λ0, and latitude decreases from φ0.
+        // http://www.nco.ncep.noaa.gov/pmb/docs/grib2/grib2_table3-4.shtml
+        // Continuous srcGrids have an extra column
+        BWFloat2* row = srcGrid + (size_t) stride * j;
+
+        // HACK, I am shift the x origin by 180degrees; this assumes the origin, spacing, and size
+        for (uint32_t i = 0; i < srcGridSize.x; i++, p++)
+        {
+            // Note: because the latitude decreases, the direction of the y component is flipped
+            // I fix it here
+            BWFloat2 uv = {uData[p], (j<360?-1.0f:0.0f)*vData[p]};
+            row[(i+180)%srcGridSize.x] = uv;
+        }
+        if (isContinuous)
+        {
+            // For wrapped grids, duplicate first column as last column to simplify interpolation logic
+            row[srcGridSize.x] = row[0];
+        }
+    }
+}
@@ -0,0 +1,334 @@
+/*
+    BWGridBuild.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWGridBuild_h
+#define BWGridBuild_h
+
+#include "BWCPUTypes.h"
+
+/* These are the CPU versions of the kernels in gridBuild.cl.
+   They follow the kernels as closely as possible; the work-item id is
+   passed in explicitly instead of coming from get_global_id()
+ */
+
+/** Build the internal form of the grid, for the rows [rowBegin, rowEnd)
+    @param uData       The grid of the u component's of the vector
+    @param vData       The grid of the v component's of the vector
+    @param srcGridSize The number of elements in the original grid
+    @param isContinuous True if the grid wraps around the globe
+    @param srcGrid     The internal representation of the u-v grid
+
+    srcGrid is indexed as x + stride * y, where stride is
+    srcGridSize.x+1 for continuous grids (the first column is duplicated at the end)
+ */
+void gridBuild(float const* uData, float const* vData
+               , BWUInt2   srcGridSize
+               , bool      isContinuous
+               , BWFloat2* srcGrid
+               , uint32_t  rowBegin, uint32_t rowEnd
+               );
+
+
+/// How the bins of a per-bin field are ordered in memory
+enum BWFieldLayout
+{
+    /// Row by row: bin (x, y) is at x + y * stride
+    BWFieldLayoutRows,
+    /// In square tiles of bins, row by row within each tile, and the tiles row by row;
+    /// a particle's neighbours are then in the same few cache lines and pages
+    BWFieldLayoutTiled
+};
+
+/// The tiles of BWFieldLayoutTiled are 2^BWFieldTileShift bins wide and high
+#define BWFieldTileShift (4)
+/// The number of bins wide and high each tile is
+#define BWFieldTileSize  (1u << BWFieldTileShift)
+
+/** The number of tiles needed to cover the bins
+    @param numBins  The number of bins across (or down)
+    @returns The number of tiles across (or down)
+ */
+static inline uint32_t gridNumTiles(uint32_t numBins)
+{
+    return (numBins + BWFieldTileSize-1) >> BWFieldTileShift;
+}
+
+/** The index of a bin in a BWFieldLayoutTiled field
+    @param x         The column of the bin
+    @param y         The row of the bin
+    @param numXTiles The number of tiles across the field (see gridNumTiles)
+    @returns The index of the bin
+ */
+static inline uint32_t gridTiledIndex(uint32_t x, uint32_t y, uint32_t numXTiles)
+{
+    uint32_t const mask = BWFieldTileSize-1;
+    uint32_t tile = (y >> BWFieldTileShift)*numXTiles + (x >> BWFieldTileShift);
+    return (((tile << BWFieldTileShift) | (y & mask)) << BWFieldTileShift) | (x & mask);
+}
+
+
+/** Build the field used for animation, for the rows [rowBegin, rowEnd)
+    @param srcSize       The number of elements in the (internal) source grid
+    @param srcField      The internal representation of the u-v grid
+    @param origin        The origin of the coordinate space (e.g., 0.0E, 90.0N)
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the tgtField is
+    @param tgtStride     The number of entries per row (there may be more than in tgtSize);
+                         for BWFieldLayoutTiled, the number of tiles across
+    @param layout        How the bins are ordered in tgtField
+    @param tgtField      The field modified for animation
+ */
+void gridInterpolate(BWUInt2          srcSize
+                     , BWFloat2 const* srcField
+                     , BWFloat2        origin
+                     , float           velocityScale
+                     , BWUInt2         tgtSize
+                     , uint32_t        tgtStride
+                     , BWFieldLayout   layout
+                     , BWFloat2*       tgtField
+                     , uint32_t rowBegin, uint32_t rowEnd
+                     );
+
+
+/// How the vectors of a per-bin field are stored
+enum BWFieldStorage
+{
+    /// A pair of floats per bin (BWFloat2), as the openCL kernels use
+    BWFieldStorageFloat,
+    /// A pair of IEEE half floats per bin (BWHalf2); magnitudes past 65504 are clamped to it
+    BWFieldStorageHalf,
+    /// A pair of fixed point numbers per bin (BWShort2), scaled by a per-row factor
+    BWFieldStorageInt16
+};
+
+/// A vector stored as two IEEE half floats
+typedef struct BWHalf2
+{
+    uint16_t x;
+    uint16_t y;
+} BWHalf2;
+
+/// A vector stored as two fixed point numbers; the value is the number times the row's scale
+typedef struct BWShort2
+{
+    int16_t x;
+    int16_t y;
+} BWShort2;
+
+
+/** Build the field used for animation as half floats, for the rows [rowBegin, rowEnd)
+    See gridInterpolate() for the parameters.  The vectors are the same as gridInterpolate
+    would make, rounded to the nearest half float.
+ */
+void gridInterpolateHalf(BWUInt2          srcSize
+                         , BWFloat2 const* srcField
+                         , BWFloat2        origin
+                         , float           velocityScale
+                         , BWUInt2         tgtSize
+                         , uint32_t        tgtStride
+                         , BWFieldLayout   layout
+                         , BWHalf2*        tgtField
+                         , uint32_t rowBegin, uint32_t rowEnd
+                         );
+
+
+/** Build the field used for animation as 16 bit fixed point, for the rows [rowBegin, rowEnd)
+    @param rowScale  Receives, for each row, the scale of the x and y components
+
+    See gridInterpolate() for the other parameters.  The scale of each row is set so that
+    the largest x (and y) in the row is 32767.  The projection stretches the x component
+    by a factor that only depends on the row -- and gets very large near the poles -- so a
+    scale per row keeps the precision that a single scale for the field would lose.
+ */
+void gridInterpolateInt16(BWUInt2          srcSize
+                          , BWFloat2 const* srcField
+                          , BWFloat2        origin
+                          , float           velocityScale
+                          , BWUInt2         tgtSize
+                          , uint32_t        tgtStride
+                          , BWFieldLayout   layout
+                          , BWShort2*       tgtField
+                          , BWFloat2*       rowScale
+                          , uint32_t rowBegin, uint32_t rowEnd
+                          );
+
+
+/** Build the field used for animation straight from the u/v planes, for the rows [rowBegin, rowEnd)
+    @param uData         The grid of the u component's of the vector
+    @param vData         The grid of the v component's of the vector
+    @param srcGridSize   The number of elements in the original grid
+    @param isContinuous  True if the grid wraps around the globe
+    @param origin        The grid's origin (e.g., 0.0E, 90.0N), before the rotation
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the tgtField is
+    @param tgtStride     The number of entries per row (there may be more than in tgtSize);
+                         for BWFieldLayoutTiled, the number of tiles across
+    @param layout        How the bins are ordered in tgtField
+    @param storage       How the vectors are stored
+    @param tgtField      The field modified for animation: BWFloat2, BWHalf2 or BWShort2
+    @param rowScale      For BWFieldStorageInt16, receives the scale of each row
+
+    This is gridBuild and then gridInterpolate (or gridInterpolateHalf or gridInterpolateInt16)
+    in one pass, and gives exactly the same field: the 180 degree rotation, the wrap around
+    column and the flip of v are done as each u/v point is read, so the internal grid is
+    never made.  Each band of rows only reads the rows of u/v that it needs.
+ */
+void gridBuildField(float const* uData, float const* vData
+                    , BWUInt2         srcGridSize
+                    , bool            isContinuous
+                    , BWFloat2        origin
+                    , float           velocityScale
+                    , BWUInt2         tgtSize
+                    , uint32_t        tgtStride
+                    , BWFieldLayout   layout
+                    , BWFieldStorage  storage
+                    , void*           tgtField
+                    , BWFloat2*       rowScale
+                    , uint32_t rowBegin, uint32_t rowEnd
+                    );
+
+
+/** The column of the u/v planes that each column of the grid gridBuild makes comes from
+    @param srcGridSize  The number of elements in the original grid
+    @param isContinuous True if the grid wraps around the globe
+    @param column       Receives srcGridSize.x (+1 if isContinuous) columns
+ */
+void gridBuildColumns(BWUInt2 srcGridSize, bool isContinuous, uint32_t* column);
+
+
+/** Build one tile of a BWFieldLayoutTiled field straight from the u/v planes
+    @param uData         The grid of the u component's of the vector
+    @param vData         The grid of the v component's of the vector
+    @param srcGridSize   The number of elements in the original grid
+    @param isContinuous  True if the grid wraps around the globe
+    @param column        The columns from gridBuildColumns(), worked out once for all the tiles
+    @param origin        The grid's origin (e.g., 0.0E, 90.0N), before the rotation
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the field is
+    @param storage       BWFieldStorageFloat or BWFieldStorageHalf; the fixed point form
+                         needs the scale of whole rows, so can't be built a tile at a time
+    @param tileX         The tile's column of tiles
+    @param tileY         The tile's row of tiles
+    @param tile          Receives the BWFieldTileSize x BWFieldTileSize vectors of the tile,
+                         BWFloat2 or BWHalf2, in the order they are in the field.  The bins
+                         past the edge of the field are left alone.
+
+    The vectors are exactly those gridBuildField() puts in the tile; only the u/v rows
+    near the tile are read.  This is how the out-of-core fields (see BWTileStore.h) are
+    built, as the particles reach each part of them.
+ */
+void gridBuildTile(float const* uData, float const* vData
+                   , BWUInt2         srcGridSize
+                   , bool            isContinuous
+                   , uint32_t const* column
+                   , BWFloat2        origin
+                   , float           velocityScale
+                   , BWUInt2         tgtSize
+                   , BWFieldStorage  storage
+                   , uint32_t tileX, uint32_t tileY
+                   , void*           tile
+                   );
+
+
+/** Convert a float to the nearest half float
+    @param f  The float
+    @returns The half float; magnitudes too large for it are clamped to 65504
+ */
+uint16_t gridEncodeHalf(float f);
+
+/** Convert a half float to a float
+    @param h  The half float
+    @returns The float; this is exact
+ */
+static inline float gridDecodeHalf(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+    uint32_t exp  = (h >> 10) & 0x1fu;
+    uint32_t mant = h & 0x3ffu;
+    union { uint32_t u; float f; } bits;
+    if (0 == exp)
+    {
+        // Zero, or a denormal: mant * 2^-24
+        bits.f = (float) mant * (1.0f/16777216.0f);
+        bits.u |= sign;
+    }
+    else if (0x1f == exp)
+    {
+        // Infinity or NaN
+        bits.u = sign | 0x7f800000u | (mant << 13);
+    }
+    else
+    {
+        bits.u = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    return bits.f;
+}
+
+
+/** The compact form of a field: the internal u-v grid from gridBuild, at the
+    resolution of the data, which the particles sample directly (see gridLookup)
+    rather than having it expanded to one vector per bin by gridInterpolate.
+ */
+typedef struct BWSourceField
+{
+    /// The internal representation of the u-v grid, srcSize.x * srcSize.y of them
+    BWFloat2 const* srcField;
+    /// The number of elements in the grid, including the wrap around column
+    BWUInt2  srcSize;
+    /// The origin of the coordinate space, after the rotation in gridBuild
+    BWFloat2 origin;
+    /// How much to scale the velocity magnitude by
+    float    velocityScale;
+} BWSourceField;
+
+
+/** The (distorted) vector at a point in the target field, sampled from the compact field
+    @param field    The compact field
+    @param tgtSize  The number of bins wide and high the target field is
+    @param position The (fractional) position within the target field
+    @returns The vector that gridInterpolate would have given a bin at that position,
+             but bilinearly filtered rather than taken from the bin the position is in
+ */
+BWFloat2 gridLookup(BWSourceField const* field, BWUInt2 tgtSize, BWFloat2 position);
+
+
+/** Bilinear lookup of the source field
+    @param coord    The (fractional) column and row within the source field
+    @param srcSize  The number of uv vectors wide and high
+    @param srcField The internal representation of the u-v grid
+    @returns vector
+ */
+BWFloat2 gridSample(BWFloat2 coord, BWUInt2 srcSize, BWFloat2 const* srcField);
+
+
+/** Calculate distortion of the wind vector caused by the shape of the projection
+    @param latlon  The coordinate of the point of discussion
+    @param scale   How much to scale the velocity magnitude by
+    @param wind    The wind vector at that point
+    @returns distorted vector
+ */
+BWFloat2 gridDistort(BWFloat2 latlon, float scale, BWFloat2 wind);
+
+#endif
@@ -0,0 +1,856 @@
+/*
+    BWParticleMove.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Translated from particleMove.cl
+    Inpsired by Cameron Beccario, https://github.com/cambecc/earth
+ */
+
+#include <math.h>
+#include <algorithm>
+#include "BWGridBuild.h"
+#include "BWParticleMove.h"
+#include "BWRandom.h"
+
+#define BW_PI   3.1415926535897932384626433832795f
+
+
+// --- Randomize particle location -----------------------
+/** Find a random location for a particle
+    @param numXBins The number of bins in the x axis
+    @param numYBins The number of bins in the y axis
+    @param random   32 random bits (see BWRandom.h)
+    @returns A vector
+ */
+BWFloat2 particleRandomize(int numXBins, int numYBins, uint32_t random)
+{
+    float m  = (float) (random % (uint32_t)(numXBins*numYBins));
+    float yy = (float)(int)(m/numXBins);
+    float xx = m - numXBins*yy;
+
+    // Reshape the latitude so that the particles aren't bunched at the poles
+    float c = (cosf(BW_PI*yy/numYBins)+1.0f)*0.5f;
+    c*=c;
+
+    BWFloat2 ret = {xx, (numYBins-1)*(1.0f-c)};
+    return ret;
+}
+
+
+/** This randomizes the particles [begin, end)
+    @param vertex   The tail/head pair of each particle
+    @param numXBins The number of bins in the x axis
+    @param numYBins The number of bins in the y axis
+    @param seed     The random number seed
+    @param frame    The frame number, which selects the random numbers
+ */
+void particleInit(BWFloat2* vertex
+                  , int numXBins, int numYBins
+                  , uint64_t seed, uint32_t frame
+                  , int begin, int end
+                  )
+{
+    for (int idx = begin; idx < end; idx++)
+    {
+        BWFloat2 position = particleRandomize(numXBins, numYBins
+                                              , BWParticleRandom(seed, idx, frame, BWRandomStreamInit));
+        // The positions are actually vertices (2)
+        int idx2 = 2*idx;
+        vertex[idx2  ] = position;  // tail
+        vertex[idx2+1] = position;  // head
+    }
+}
+
+
+/** The index of the bin that the position is in
+    @param position  The position of the particle
+    @param numXBins  The number of bins in the x axis
+    @param numYBins  The number of bins in the y axis
+    @param numXTiles The number of tiles across a BWFieldLayoutTiled field; 0 if it is laid out in rows
+    @param row       Receives the row of the bin
+    @returns The index into the vector field
+
+    The openCL kernel trusts the position; here an out of range read is a crash,
+    so the position is clamped to the field (this also catches NaN).
+ */
+static inline int fieldIndex(BWFloat2 position, int numXBins, int numYBins, uint32_t numXTiles, int& row)
+{
+    int x = position.x > 0.0f ? (position.x < numXBins-1 ? (int) position.x : numXBins-1) : 0;
+    int y = position.y > 0.0f ? (position.y < numYBins-1 ? (int) position.y : numYBins-1) : 0;
+    row = y;
+    if (numXTiles)
+        return (int) gridTiledIndex(x, y, numXTiles);
+    return x + y*numXBins;
+}
+
+
+/** Move one particle by its vector, handling the wrap around and respawns
+    @param vertex      The tail/head pair of each particle
+    @param idx         The index of the particle
+    @param position    The particle position
+    @param _v          The vector at the particle's position (before dT)
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns true if the particle was respawned
+ */
+static inline bool particleStep(BWFloat2* vertex, int idx
+                                , BWFloat2 position, BWFloat2 _v
+                                , float dT
+                                , int numXBins, int numYBins
+                                , uint64_t seed, uint32_t frame
+                                )
+{
+    BWFloat2 v  = {_v.x*dT, _v.y*dT};
+    BWFloat2 origPosition = position;
+    position.x += v.x;
+    position.y += v.y;
+
+    BWFloat2 position_t;
+    bool respawned = false;
+    // This to handle wrap around on either edge as elegantly as possible
+    if (position.x < 0.0f && v.x < 0.0f)
+    {
+        // We wrapped around to the "east end of the world"
+        position.x = numXBins-0.1f;
+
+        // Sanity check the y coordinate (otherwise we can misindex)
+        if (position.y >= numYBins) position.y = numYBins-0.5f;
+        else if (position.y < 0.0f) position.y=0.0f;
+
+        position_t.x = position.x + v.x;
+        position_t.y = position.y + v.y;
+    }
+    else if (position.x > numXBins && v.x > 0.0f)
+    {
+        // We wrapped around to the "west end of the world"
+        position.x = 0.0f;
+        position.y = 0.5f*(position.y+origPosition.y);
+        // Sanity check the y coordinate (otherwise we can misindex)
+        if (position.y >= numYBins) position.y = numYBins-0.5f;
+        else if (position.y < 0.0f) position.y=0.0f;
+        position_t.x = position.x + v.x;
+        position_t.y = position.y + v.y;
+    }
+    // Did the particle go out of bounds?
+    else if (position.y < 0.0f || position.y >= numYBins-1.0f)
+    {
+        // The particle is moving too fast or too slow; get rid of it
+        position_t = particleRandomize(numXBins, numYBins
+                                           , BWParticleRandom(seed, idx, frame, BWRandomStreamMove));
+        position = position_t;
+        respawned = true;
+    }
+    else
+    {
+        // vector at current position
+        float m = _v.x*_v.x + _v.y*_v.y;
+
+        position_t.x = position.x + v.x;
+        position_t.y = position.y + v.y;
+
+        if (m < 2.0f)
+        {
+            // The particle is moving too fast or too slow; get rid of it
+            position_t = particleRandomize(numXBins, numYBins
+                                           , BWParticleRandom(seed, idx, frame, BWRandomStreamMove));
+            position = position_t;
+            respawned = true;
+        }
+    }
+
+    // Path from (x,y) to (xt,yt) is visible
+    int idx2 = 2*idx;
+    vertex[idx2]   = position;
+    vertex[idx2+1] = position_t;
+    return respawned;
+}
+
+
+/// Reads the vectors of a BWFieldStorageFloat field
+struct FloatField
+{
+    BWFloat2 const* vectors;
+    explicit FloatField(void const* v, BWFloat2 const*) : vectors((BWFloat2 const*) v) {}
+    BWFloat2 operator()(int bin, int) const { return vectors[bin]; }
+};
+
+/// Reads the vectors of a BWFieldStorageHalf field
+struct HalfField
+{
+    BWHalf2 const* vectors;
+    explicit HalfField(void const* v, BWFloat2 const*) : vectors((BWHalf2 const*) v) {}
+    BWFloat2 operator()(int bin, int) const
+    {
+        BWHalf2  h = vectors[bin];
+        BWFloat2 ret = {gridDecodeHalf(h.x), gridDecodeHalf(h.y)};
+        return ret;
+    }
+};
+
+/// Reads the vectors of a BWFieldStorageInt16 field
+struct Int16Field
+{
+    BWShort2 const* vectors;
+    BWFloat2 const* rowScale;
+    explicit Int16Field(void const* v, BWFloat2 const* s) : vectors((BWShort2 const*) v), rowScale(s) {}
+    BWFloat2 operator()(int bin, int row) const
+    {
+        BWShort2 q = vectors[bin];
+        BWFloat2 s = rowScale[row];
+        BWFloat2 ret = {(float) q.x * s.x, (float) q.y * s.y};
+        return ret;
+    }
+};
+
+
+/** This moves the particles [begin, end), reading the vectors with a Field
+    @param numXTiles  The number of tiles across a BWFieldLayoutTiled field; 0 if it is laid out in rows
+    See particleMove() for the other parameters
+    @returns The number of particles respawned
+ */
+template <class Field>
+static int particleMoveT(BWFloat2* vertex
+                         , float dT
+                         , int numXBins, int numYBins
+                         , uint32_t numXTiles
+                         , Field const& vectorField
+                         , Field const* nextField, float blend
+                         , uint64_t seed, uint32_t frame
+                         , int begin, int end
+                         )
+{
+    int count = 0;
+    for (int idx = begin; idx < end; idx++)
+    {
+        // Get the particle position
+        BWFloat2 position = vertex[2*idx];
+        int row;
+        int bin = fieldIndex(position, numXBins, numYBins, numXTiles, row);
+        BWFloat2 _v = vectorField(bin, row);
+        if (nextField)
+        {
+            // Blend between the vector at t0 and at t1
+            BWFloat2 _v1 = (*nextField)(bin, row);
+            _v.x = _v.x + blend*(_v1.x - _v.x);
+            _v.y = _v.y + blend*(_v1.y - _v.y);
+        }
+        count += particleStep(vertex, idx, position, _v, dT, numXBins, numYBins, seed, frame);
+    }
+    return count;
+}
+
+
+/** This moves the particles [begin, end)
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param vectorField The field of vectors (mapped to an array), at time t0
+    @param nextField   The field of vectors at time t1; null if there is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned
+ */
+int particleMove(BWFloat2* vertex
+                 , float dT
+                 , int numXBins, int numYBins
+                 , BWFloat2 const* vectorField
+                 , BWFloat2 const* nextField, float blend
+                 , uint64_t seed, uint32_t frame
+                 , int begin, int end
+                 )
+{
+    FloatField field(vectorField, nullptr), next(nextField, nullptr);
+    return particleMoveT(vertex, dT, numXBins, numYBins, 0, field, nextField ? &next : nullptr, blend
+                         , seed, frame, begin, end);
+}
+
+
+/** Moves the particles with the packed fields, read with a Field
+    See particleMovePacked() for the parameters
+ */
+template <class Field>
+static int particleMovePackedT(BWFloat2* vertex
+                               , float dT
+                               , int numXBins, int numYBins
+                               , BWPackedField const* field
+                               , BWPackedField const* nextField, float blend
+                               , uint64_t seed, uint32_t frame
+                               , int begin, int end
+                               )
+{
+    Field f(field->vectors, field->rowScale);
+    Field n(nextField ? nextField->vectors : nullptr, nextField ? nextField->rowScale : nullptr);
+    uint32_t numXTiles = BWFieldLayoutTiled == field->layout ? field->numXTiles : 0;
+    return particleMoveT(vertex, dT, numXBins, numYBins, numXTiles, f, nextField ? &n : nullptr, blend, seed, frame, begin, end);
+}
+
+
+/** This moves the particles [begin, end), decoding the vectors from the packed field
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param field       The field of vectors, at time t0
+    @param nextField   The field of vectors at time t1, stored the same way; null if there
+                       is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned
+ */
+int particleMovePacked(BWFloat2* vertex
+                       , float dT
+                       , int numXBins, int numYBins
+                       , BWPackedField const* field
+                       , BWPackedField const* nextField, float blend
+                       , uint64_t seed, uint32_t frame
+                       , int begin, int end
+                       )
+{
+    // A field stored (or laid out) another way can't be blended with
+    if (nextField && (nextField->storage != field->storage || nextField->layout != field->layout))
+        nextField = nullptr;
+    switch (field->storage)
+    {
+        case BWFieldStorageHalf:
+            return particleMovePackedT<HalfField>(vertex, dT, numXBins, numYBins, field, nextField, blend, seed, frame, begin, end);
+        case BWFieldStorageInt16:
+            return particleMovePackedT<Int16Field>(vertex, dT, numXBins, numYBins, field, nextField, blend, seed, frame, begin, end);
+        default:
+            return particleMovePackedT<FloatField>(vertex, dT, numXBins, numYBins, field, nextField, blend, seed, frame, begin, end);
+    }
+}
+
+
+
+/** Decodes one row of a packed field, reading it with a Field
+    See particleFieldRow() for the parameters
+ */
+template <class Field>
+static void particleFieldRowT(BWPackedField const* field, int numXBins, int y, BWFloat2* row)
+{
+    Field f(field->vectors, field->rowScale);
+    for (int x = 0; x < numXBins; x++)
+    {
+        int bin = BWFieldLayoutTiled == field->layout ? (int) gridTiledIndex(x, y, field->numXTiles) : x + y*numXBins;
+        row[x] = f(bin, y);
+    }
+}
+
+
+/** Decode one row of the packed field to floats
+    @param field     The field of vectors
+    @param numXBins  The number of bins in the x axis
+    @param y         The row
+    @param row       Receives the numXBins vectors of the row, exactly as the particles read them
+ */
+void particleFieldRow(BWPackedField const* field, int numXBins, int y, BWFloat2* row)
+{
+    switch (field->storage)
+    {
+        case BWFieldStorageHalf:
+            particleFieldRowT<HalfField>(field, numXBins, y, row);
+            break;
+        case BWFieldStorageInt16:
+            particleFieldRowT<Int16Field>(field, numXBins, y, row);
+            break;
+        default:
+            particleFieldRowT<FloatField>(field, numXBins, y, row);
+            break;
+    }
+}
+
+/** The vector at a position, sampled from the compact field(s)
+    @param tgtSize   The number of bins wide and high
+    @param field     The compact field at time t0
+    @param nextField The compact field at time t1; null if there is only the one field
+    @param blend     How far from t0 to t1 the time is
+    @param position  The position
+    @returns The vector
+ */
+static inline BWFloat2 sampleField(BWUInt2 tgtSize
+                                   , BWSourceField const* field
+                                   , BWSourceField const* nextField, float blend
+                                   , BWFloat2 position)
+{
+    BWFloat2 _v = gridLookup(field, tgtSize, position);
+    if (nextField)
+    {
+        BWFloat2 _v1 = gridLookup(nextField, tgtSize, position);
+        _v.x = _v.x + blend*(_v1.x - _v.x);
+        _v.y = _v.y + blend*(_v1.y - _v.y);
+    }
+    return _v;
+}
+
+
+/** The vector to move a particle by, sampled from the compact field(s)
+    @param tgtSize     The number of bins wide and high
+    @param field       The compact field at time t0
+    @param nextField   The compact field at time t1; null if there is only the one field
+    @param blend       How far from t0 to t1 the time is
+    @param integrator  How the particle is moved along the field
+    @param dT          The time step
+    @param p           The position of the particle
+    @returns The vector (before dT)
+ */
+static inline BWFloat2 integrateField(BWUInt2 tgtSize
+                                      , BWSourceField const* field
+                                      , BWSourceField const* nextField, float blend
+                                      , BWIntegrator integrator
+                                      , float dT
+                                      , BWFloat2 p)
+{
+    float const h = 0.5f*dT;
+    BWFloat2 k1 = sampleField(tgtSize, field, nextField, blend, p);
+    BWFloat2 _v = k1;
+    if (BWIntegratorRK2 == integrator)
+    {
+        // The midpoint method: the vector half a step along
+        BWFloat2 p2 = {p.x + h*k1.x, p.y + h*k1.y};
+        _v = sampleField(tgtSize, field, nextField, blend, p2);
+    }
+    else if (BWIntegratorRK4 == integrator)
+    {
+        BWFloat2 p2 = {p.x + h*k1.x, p.y + h*k1.y};
+        BWFloat2 k2 = sampleField(tgtSize, field, nextField, blend, p2);
+        BWFloat2 p3 = {p.x + h*k2.x, p.y + h*k2.y};
+        BWFloat2 k3 = sampleField(tgtSize, field, nextField, blend, p3);
+        BWFloat2 p4 = {p.x + dT*k3.x, p.y + dT*k3.y};
+        BWFloat2 k4 = sampleField(tgtSize, field, nextField, blend, p4);
+        _v.x = (k1.x + 2.0f*k2.x + 2.0f*k3.x + k4.x) * (1.0f/6.0f);
+        _v.y = (k1.y + 2.0f*k2.y + 2.0f*k3.y + k4.y) * (1.0f/6.0f);
+    }
+    return _v;
+}
+
+
+/** This moves the particles [begin, end), sampling the compact field
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param field       The compact field, at time t0
+    @param nextField   The compact field at time t1; null if there is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param integrator  How the particles are moved along the field
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned
+ */
+int particleMoveSampled(BWFloat2* vertex
+                        , float dT
+                        , int numXBins, int numYBins
+                        , BWSourceField const* field
+                        , BWSourceField const* nextField, float blend
+                        , BWIntegrator integrator
+                        , uint64_t seed, uint32_t frame
+                        , int begin, int end
+                        )
+{
+    BWUInt2 tgtSize = {(uint32_t) numXBins, (uint32_t) numYBins};
+    int count = 0;
+    for (int idx = begin; idx < end; idx++)
+    {
+        BWFloat2 p  = vertex[2*idx];
+        BWFloat2 _v = integrateField(tgtSize, field, nextField, blend, integrator, dT, p);
+        count += particleStep(vertex, idx, p, _v, dT, numXBins, numYBins, seed, frame);
+    }
+    return count;
+}
+
+
+// --- Particle streams -----------------------------------
+/** A random lifetime
+    @param random  32 random bits
+    @param minAge  The shortest lifetime, in steps
+    @param maxAge  The longest lifetime, in steps
+    @returns The lifetime, from minAge to maxAge
+ */
+static inline uint16_t particleLifetime(uint32_t random, int minAge, int maxAge)
+{
+    // The ages are 16 bits, and a particle lives at least a step
+    minAge = minAge < 1 ? 1 : minAge > 0xFFFF ? 0xFFFF : minAge;
+    maxAge = maxAge > 0xFFFF ? 0xFFFF : maxAge;
+    uint32_t range = maxAge > minAge ? (uint32_t)(maxAge - minAge + 1) : 1u;
+    return (uint16_t)(minAge + (random & 0xFFFFu) % range);
+}
+
+
+/** A random place to spawn a particle
+    @param numXBins The number of bins in the x axis
+    @param numYBins The number of bins in the y axis
+    @param table    The alias table; null or empty for uniformly (particleRandomize)
+    @param seed     The random number seed
+    @param idx      The index of the particle
+    @param frame    The frame number
+    @param stream   Which random stream to use
+    @returns The position
+ */
+static inline BWFloat2 particleSpawnPosition(int numXBins, int numYBins
+                                             , BWSpawnTable const* table
+                                             , uint64_t seed, uint32_t idx, uint32_t frame, uint32_t stream
+                                             )
+{
+    uint32_t random[4];
+    BWParticleRandom4(seed, idx, frame, stream, random);
+    if (table && table->count)
+        return spawnTableSample(table, numXBins, numYBins, random);
+    return particleRandomize(numXBins, numYBins, random[0]);
+}
+
+
+/** This spawns the particles [begin, end) at random places, with random lifetimes
+    @param particles  The particle streams
+    @param numXBins   The number of bins in the x axis
+    @param numYBins   The number of bins in the y axis
+    @param seed       The random number seed
+    @param frame      The frame number, which selects the random numbers
+    @param minAge     The shortest lifetime, in steps
+    @param maxAge     The longest lifetime, in steps
+    @param table      Where to spawn them; null, or an empty table, for uniformly
+ */
+void particleSpawn(BWParticleStreams const* particles
+                   , int numXBins, int numYBins
+                   , uint64_t seed, uint32_t frame
+                   , int minAge, int maxAge
+                   , BWSpawnTable const* table
+                   , int begin, int end
+                   )
+{
+    for (int idx = begin; idx < end; idx++)
+    {
+        BWFloat2 position = particleSpawnPosition(numXBins, numYBins, table, seed, idx, frame, BWRandomStreamInit);
+        uint32_t random   = BWParticleRandom(seed, idx, frame, BWRandomStreamAge);
+        uint16_t lifetime = particleLifetime(random, minAge, maxAge);
+        particles->position[idx]     = position;
+        particles->prevPosition[idx] = position;
+        // Start part way through the life, from the other half of the random bits
+        particles->age[idx]          = (uint16_t)((random >> 16) % lifetime);
+        particles->maxAge[idx]       = lifetime;
+    }
+}
+
+
+/** Move one particle a step by its vector, handling the wrap around
+    @param prev      Receives where the line to the particle starts
+    @param position  The particle position; receives the new one
+    @param _v        The vector at the particle's position (before dT)
+    @param dT        The time step
+    @param numXBins  The number of bins in the x axis
+    @param numYBins  The number of bins in the y axis
+    @returns false if the particle went out of bounds or is moving too slowly
+ */
+static inline bool particleAdvanceStep(BWFloat2& prev, BWFloat2& position, BWFloat2 _v
+                                       , float dT
+                                       , int numXBins, int numYBins
+                                       )
+{
+    BWFloat2 v = {_v.x*dT, _v.y*dT};
+    BWFloat2 p = {position.x + v.x, position.y + v.y};
+    if (p.x < 0.0f && v.x < 0.0f)
+    {
+        // We wrapped around to the "east end of the world"
+        p.x = numXBins-0.1f;
+        // Sanity check the y coordinate (otherwise we can misindex)
+        if (p.y >= numYBins) p.y = numYBins-0.5f;
+        else if (p.y < 0.0f) p.y=0.0f;
+        // The line starts over on this side, rather than crossing the image
+        prev = p;
+        p.x += v.x;
+        p.y += v.y;
+    }
+    else if (p.x > numXBins && v.x > 0.0f)
+    {
+        // We wrapped around to the "west end of the world"
+        p.x = 0.0f;
+        p.y = 0.5f*(p.y+position.y);
+        if (p.y >= numYBins) p.y = numYBins-0.5f;
+        else if (p.y < 0.0f) p.y=0.0f;
+        prev = p;
+        p.x += v.x;
+        p.y += v.y;
+    }
+    // Did the particle go out of bounds, or is it moving too slowly?
+    else if (p.y < 0.0f || p.y >= numYBins-1.0f || _v.x*_v.x + _v.y*_v.y < 2.0f)
+    {
+        return false;
+    }
+    else
+    {
+        prev = position;
+    }
+    position = p;
+    return true;
+}
+
+
+/** This moves the particles [begin, end) a step, with the vectors from a Sampler, and
+    lists the ones that expired
+    @param sample  Returns the vector (before dT) at a position
+    See particleAdvance() for the other parameters
+ */
+template <class Sampler>
+static int particleAdvanceT(BWParticleStreams const* particles
+                            , float dT
+                            , int numXBins, int numYBins
+                            , Sampler const& sample
+                            , uint32_t* expired
+                            , int begin, int end
+                            )
+{
+    BWFloat2* position     = particles->position;
+    BWFloat2* prevPosition = particles->prevPosition;
+    uint16_t* age          = particles->age;
+    uint16_t const* maxAge = particles->maxAge;
+    int count = 0;
+    for (int idx = begin; idx < end; idx++)
+    {
+        BWFloat2 p = position[idx];
+        bool alive = particleAdvanceStep(prevPosition[idx], p, sample(p), dT, numXBins, numYBins);
+        position[idx] = p;
+        uint16_t a = (uint16_t)(age[idx] + 1);
+        age[idx] = a;
+        if (!alive || a >= maxAge[idx])
+            expired[count++] = (uint32_t) idx;
+    }
+    return count;
+}
+
+
+/// Samples the nearest bin of a per-bin field, read with a Field, blending t0 to t1
+template <class Field>
+struct NearestSampler
+{
+    int          numXBins, numYBins;
+    uint32_t     numXTiles;
+    Field        field, next;
+    bool         hasNext;
+    float        blend;
+
+    NearestSampler(int numXBins, int numYBins, BWPackedField const* f, BWPackedField const* n, float blend)
+        : numXBins(numXBins), numYBins(numYBins)
+        , numXTiles(BWFieldLayoutTiled == f->layout ? f->numXTiles : 0)
+        , field(f->vectors, f->rowScale)
+        , next(n ? n->vectors : nullptr, n ? n->rowScale : nullptr)
+        , hasNext(nullptr != n), blend(blend)
+    {
+    }
+
+    BWFloat2 operator()(BWFloat2 position) const
+    {
+        int row;
+        int bin = fieldIndex(position, numXBins, numYBins, numXTiles, row);
+        BWFloat2 _v = field(bin, row);
+        if (hasNext)
+        {
+            BWFloat2 _v1 = next(bin, row);
+            _v.x = _v.x + blend*(_v1.x - _v.x);
+            _v.y = _v.y + blend*(_v1.y - _v.y);
+        }
+        return _v;
+    }
+};
+
+
+/** This moves the particles [begin, end) a step, with the vectors from the packed field,
+    and lists the ones that expired
+    @param particles   The particle streams
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param field       The field of vectors, at time t0
+    @param nextField   The field of vectors at time t1, stored the same way; null if there
+                       is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param expired     Receives the indices of the particles that expired
+    @returns The number of particles that expired
+ */
+int particleAdvance(BWParticleStreams const* particles
+                    , float dT
+                    , int numXBins, int numYBins
+                    , BWPackedField const* field
+                    , BWPackedField const* nextField, float blend
+                    , uint32_t* expired
+                    , int begin, int end
+                    )
+{
+    // A field stored (or laid out) another way can't be blended with
+    if (nextField && (nextField->storage != field->storage || nextField->layout != field->layout))
+        nextField = nullptr;
+    switch (field->storage)
+    {
+        case BWFieldStorageHalf:
+            return particleAdvanceT(particles, dT, numXBins, numYBins
+                                    , NearestSampler<HalfField>(numXBins, numYBins, field, nextField, blend)
+                                    , expired, begin, end);
+        case BWFieldStorageInt16:
+            return particleAdvanceT(particles, dT, numXBins, numYBins
+                                    , NearestSampler<Int16Field>(numXBins, numYBins, field, nextField, blend)
+                                    , expired, begin, end);
+        default:
+            return particleAdvanceT(particles, dT, numXBins, numYBins
+                                    , NearestSampler<FloatField>(numXBins, numYBins, field, nextField, blend)
+                                    , expired, begin, end);
+    }
+}
+
+
+/// Samples the compact field(s) with an integrator
+struct CompactSampler
+{
+    BWUInt2              tgtSize;
+    BWSourceField const* field;
+    BWSourceField const* next;
+    float                blend;
+    BWIntegrator         integrator;
+    float                dT;
+
+    BWFloat2 operator()(BWFloat2 position) const
+    {
+        return integrateField(tgtSize, field, next, blend, integrator, dT, position);
+    }
+};
+
+
+/** This moves the particles [begin, end) a step, sampling the compact field, and lists
+    the ones that expired
+    @param integrator  How the particles are moved along the field
+    See particleAdvance() for the other parameters
+ */
+int particleAdvanceSampled(BWParticleStreams const* particles
+                           , float dT
+                           , int numXBins, int numYBins
+                           , BWSourceField const* field
+                           , BWSourceField const* nextField, float blend
+                           , BWIntegrator integrator
+                           , uint32_t* expired
+                           , int begin, int end
+                           )
+{
+    CompactSampler sample = {{(uint32_t) numXBins, (uint32_t) numYBins}, field, nextField, blend, integrator, dT};
+    return particleAdvanceT(particles, dT, numXBins, numYBins, sample, expired, begin, end);
+}
+
+
+/** This respawns the particles that expired, at random places with new lifetimes
+    @param particles  The particle streams
+    @param expired    The indices of the particles to respawn
+    @param count      The number of them
+    @param numXBins   The number of bins in the x axis
+    @param numYBins   The number of bins in the y axis
+    @param seed       The random number seed
+    @param frame      The frame number, which selects the random numbers
+    @param minAge     The shortest lifetime, in steps
+    @param maxAge     The longest lifetime, in steps
+    @param table      Where to spawn them; null, or an empty table, for uniformly
+ */
+void particleRespawn(BWParticleStreams const* particles
+                     , uint32_t const* expired, int count
+                     , int numXBins, int numYBins
+                     , uint64_t seed, uint32_t frame
+                     , int minAge, int maxAge
+                     , BWSpawnTable const* table
+                     )
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t idx = expired[i];
+        // The random numbers are the particle's own, whatever order they are listed in
+        BWFloat2 position = particleSpawnPosition(numXBins, numYBins, table, seed, idx, frame, BWRandomStreamMove);
+        particles->position[idx]     = position;
+        particles->prevPosition[idx] = position;
+        particles->age[idx]          = 0;
+        particles->maxAge[idx]       = particleLifetime(BWParticleRandom(seed, idx, frame, BWRandomStreamAge), minAge, maxAge);
+    }
+}
+
+
+/** This writes the lines of the particles [begin, end) to the draw buffer
+    @param particles  The particle streams
+    @param vertex     Receives the tail/head pair of each particle
+ */
+void particleWriteVertices(BWParticleStreams const* particles
+                           , BWFloat2* vertex
+                           , int begin, int end
+                           )
+{
+    BWFloat2 const* position     = particles->position;
+    BWFloat2 const* prevPosition = particles->prevPosition;
+    for (int idx = begin; idx < end; idx++)
+    {
+        vertex[2*idx  ] = prevPosition[idx];
+        vertex[2*idx+1] = position[idx];
+    }
+}
+
+
+/** This starts the trails of the particles [begin, end) where they are
+    @param particles    The particle streams
+    @param vertex       Receives the ring of trailLength positions of each particle
+    @param trailLength  The number of positions in each ring
+ */
+void particleTrailStart(BWParticleStreams const* particles
+                        , BWFloat2* vertex, int trailLength
+                        , int begin, int end
+                        )
+{
+    BWFloat2 const* position = particles->position;
+    for (int idx = begin; idx < end; idx++)
+    {
+        BWFloat2* trail = vertex + (size_t) trailLength*idx;
+        std::fill(trail, trail + trailLength, position[idx]);
+    }
+}
+
+
+/** This writes where the particles [begin, end) are to their slot of the rings, for a step
+    @param particles    The particle streams
+    @param vertex       The ring of trailLength positions of each particle
+    @param trailLength  The number of positions in each ring
+    @param slot         The slot the step writes
+ */
+void particleWriteTrail(BWParticleStreams const* particles
+                        , BWFloat2* vertex, int trailLength, int slot
+                        , int begin, int end
+                        )
+{
+    BWFloat2 const* position     = particles->position;
+    BWFloat2 const* prevPosition = particles->prevPosition;
+    int last = (slot + trailLength - 1) % trailLength;
+    for (int idx = begin; idx < end; idx++)
+    {
+        BWFloat2* trail = vertex + (size_t) trailLength*idx;
+        BWFloat2 prev = prevPosition[idx];
+        if (trail[last].x != prev.x || trail[last].y != prev.y)
+            std::fill(trail, trail + trailLength, prev);
+        trail[slot] = position[idx];
+    }
+}
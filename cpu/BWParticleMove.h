@@ -0,0 +1,415 @@
+/*
+    BWParticleMove.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWParticleMove_h
+#define BWParticleMove_h
+
+#include "BWCPUTypes.h"
+#include "BWGridBuild.h"
+#include "BWSpawnTable.h"
+
+/* These are the CPU versions of the kernels in particleMove.cl.
+   Each works on the particles [begin, end); the vertices are stored
+   as tail/head pairs, just like the VBO that the openGL path uses.
+ */
+
+/** Find a random location for a particle
+    @param numXBins The number of bins in the x axis
+    @param numYBins The number of bins in the y axis
+    @param random   32 random bits (see BWRandom.h)
+    @returns A vector
+ */
+BWFloat2 particleRandomize(int numXBins, int numYBins, uint32_t random);
+
+
+/** This randomizes the particles [begin, end)
+    @param vertex   The tail/head pair of each particle
+    @param numXBins The number of bins in the x axis
+    @param numYBins The number of bins in the y axis
+    @param seed     The random number seed
+    @param frame    The frame number, which selects the random numbers
+ */
+void particleInit(BWFloat2* vertex
+                  , int numXBins, int numYBins
+                  , uint64_t seed, uint32_t frame
+                  , int begin, int end
+                  );
+
+
+/** This moves the particles [begin, end)
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param vectorField The field of vectors (mapped to an array), at time t0
+    @param nextField   The field of vectors at time t1; null if there is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned, since they went out of bounds or were too slow
+ */
+int particleMove(BWFloat2* vertex
+                 , float dT
+                 , int numXBins, int numYBins
+                 , BWFloat2 const* vectorField
+                 , BWFloat2 const* nextField, float blend
+                 , uint64_t seed, uint32_t frame
+                 , int begin, int end
+                 );
+
+
+/** A per-bin field, in one of the storage forms and layouts.  The vectors are
+    BWFloat2, BWHalf2 or BWShort2, by storage, ordered by the layout.
+ */
+typedef struct BWPackedField
+{
+    /// How the vectors are stored
+    BWFieldStorage  storage;
+    /// The vectors, organized as bins in a rectilinear grid
+    void const*     vectors;
+    /// For BWFieldStorageInt16, the scale of the x and y components of each row
+    BWFloat2 const* rowScale;
+    /// How the bins are ordered; the rows are numXBins wide
+    BWFieldLayout   layout;
+    /// For BWFieldLayoutTiled, the number of tiles across (see gridNumTiles)
+    uint32_t        numXTiles;
+} BWPackedField;
+
+
+/** This moves the particles [begin, end), decoding the vectors from the packed field
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param field       The field of vectors, at time t0
+    @param nextField   The field of vectors at time t1, stored the same way; null if there
+                       is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned
+
+    Each vector is decoded to floats, and then moved exactly as particleMove() does; with
+    BWFieldStorageFloat the results are identical to it.
+ */
+int particleMovePacked(BWFloat2* vertex
+                       , float dT
+                       , int numXBins, int numYBins
+                       , BWPackedField const* field
+                       , BWPackedField const* nextField, float blend
+                       , uint64_t seed, uint32_t frame
+                       , int begin, int end
+                       );
+
+
+/** Decode one row of the packed field to floats
+    @param field     The field of vectors
+    @param numXBins  The number of bins in the x axis
+    @param y         The row
+    @param row       Receives the numXBins vectors of the row, exactly as the particles read them
+ */
+void particleFieldRow(BWPackedField const* field, int numXBins, int y, BWFloat2* row);
+
+
+/// How the particles look up the vector field
+enum BWFieldSampling
+{
+    /// The field is expanded to one vector per bin (gridInterpolate), and each particle
+    /// takes the vector of the bin it is in; this is what the openCL kernels do
+    BWFieldSampleNearest,
+    /// The field is kept at the resolution of the data (BWSourceField), and sampled
+    /// bilinearly at each particle's position (gridLookup)
+    BWFieldSampleBilinear
+};
+
+/// How the particles are moved along the (sampled) field
+enum BWIntegrator
+{
+    /// One sample per step: the particle moves by the vector where it is
+    BWIntegratorEuler,
+    /// Two samples per step: the midpoint method
+    BWIntegratorRK2,
+    /// Four samples per step: the classic Runge-Kutta method
+    BWIntegratorRK4
+};
+
+/** This moves the particles [begin, end), sampling the compact field
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param field       The compact field, at time t0
+    @param nextField   The compact field at time t1; null if there is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param integrator  How the particles are moved along the field
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned
+
+    The wrap around, bounds and respawn rules are the same as particleMove()
+ */
+int particleMoveSampled(BWFloat2* vertex
+                        , float dT
+                        , int numXBins, int numYBins
+                        , BWSourceField const* field
+                        , BWSourceField const* nextField, float blend
+                        , BWIntegrator integrator
+                        , uint64_t seed, uint32_t frame
+                        , int begin, int end
+                        );
+
+
+/// How the particles are kept
+enum BWParticleStore
+{
+    /// Only the tail/head pair of each particle, which is also what is drawn; particles
+    /// are respawned as they leave the grid or slow down, and a few each frame
+    BWParticleStoreVertices,
+    /// Separate streams of position, previous position, age and lifetime
+    /// (BWParticleStreams); the particles expire by age, are respawned in one pass,
+    /// and the draw buffer is written in a pass of its own
+    BWParticleStoreStreams
+};
+
+/** The particles, as separate streams (a struct of arrays) rather than tail/head pairs.
+    Each particle lives for maxAge steps, and then is respawned somewhere else; one that
+    leaves the grid, or is moving too slowly, expires early.
+ */
+typedef struct BWParticleStreams
+{
+    /// Where each particle is
+    BWFloat2* position;
+    /// Where each particle was a step ago; the line is drawn from here to position
+    BWFloat2* prevPosition;
+    /// The number of steps since each particle was spawned
+    uint16_t* age;
+    /// The number of steps each particle lives
+    uint16_t* maxAge;
+} BWParticleStreams;
+
+/** This spawns the particles [begin, end) at random places, with random lifetimes
+    @param particles  The particle streams
+    @param numXBins   The number of bins in the x axis
+    @param numYBins   The number of bins in the y axis
+    @param seed       The random number seed
+    @param frame      The frame number, which selects the random numbers
+    @param minAge     The shortest lifetime, in steps
+    @param maxAge     The longest lifetime, in steps
+    @param table      Where to spawn them (see BWSpawnTable.h); null, or an empty table,
+                      spreads them uniformly as particleInit() does
+
+    The particles start part way through their lives, so that a whole set of them
+    spawned at once doesn't expire at once.
+ */
+void particleSpawn(BWParticleStreams const* particles
+                   , int numXBins, int numYBins
+                   , uint64_t seed, uint32_t frame
+                   , int minAge, int maxAge
+                   , BWSpawnTable const* table
+                   , int begin, int end
+                   );
+
+/** This moves the particles [begin, end) a step, with the vectors from the packed field,
+    and lists the ones that expired
+    @param particles   The particle streams
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param field       The field of vectors, at time t0
+    @param nextField   The field of vectors at time t1, stored the same way; null if there
+                       is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param expired     Receives the indices of the particles that expired, for particleRespawn
+    @returns The number of particles that expired
+
+    The wrap around and bounds rules are the same as particleMove(), but rather than
+    respawning a particle as it goes, this leaves it for the one batched pass.
+ */
+int particleAdvance(BWParticleStreams const* particles
+                    , float dT
+                    , int numXBins, int numYBins
+                    , BWPackedField const* field
+                    , BWPackedField const* nextField, float blend
+                    , uint32_t* expired
+                    , int begin, int end
+                    );
+
+/** This moves the particles [begin, end) a step, sampling the compact field, and lists
+    the ones that expired
+    @param integrator  How the particles are moved along the field
+    See particleAdvance() for the other parameters
+ */
+int particleAdvanceSampled(BWParticleStreams const* particles
+                           , float dT
+                           , int numXBins, int numYBins
+                           , BWSourceField const* field
+                           , BWSourceField const* nextField, float blend
+                           , BWIntegrator integrator
+                           , uint32_t* expired
+                           , int begin, int end
+                           );
+
+/** This respawns the particles that expired, at random places with new lifetimes
+    @param particles  The particle streams
+    @param expired    The indices of the particles to respawn
+    @param count      The number of them
+    @param numXBins   The number of bins in the x axis
+    @param numYBins   The number of bins in the y axis
+    @param seed       The random number seed
+    @param frame      The frame number, which selects the random numbers
+    @param minAge     The shortest lifetime, in steps
+    @param maxAge     The longest lifetime, in steps
+    @param table      Where to spawn them; null, or an empty table, for uniformly
+ */
+void particleRespawn(BWParticleStreams const* particles
+                     , uint32_t const* expired, int count
+                     , int numXBins, int numYBins
+                     , uint64_t seed, uint32_t frame
+                     , int minAge, int maxAge
+                     , BWSpawnTable const* table
+                     );
+
+/** This writes the lines of the particles [begin, end) to the draw buffer
+    @param particles  The particle streams
+    @param vertex     Receives the tail/head pair of each particle: the previous position
+                      and the position
+ */
+void particleWriteVertices(BWParticleStreams const* particles
+                           , BWFloat2* vertex
+                           , int begin, int end
+                           );
+
+/** This starts the trails of the particles [begin, end) where they are
+    @param particles    The particle streams
+    @param vertex       Receives the ring of trailLength positions of each particle, each of
+                        them its position
+    @param trailLength  The number of positions in each ring
+ */
+void particleTrailStart(BWParticleStreams const* particles
+                        , BWFloat2* vertex, int trailLength
+                        , int begin, int end
+                        );
+
+/** This writes where the particles [begin, end) are to their slot of the rings, for a step
+    @param particles    The particle streams
+    @param vertex       The ring of trailLength positions of each particle
+    @param trailLength  The number of positions in each ring
+    @param slot         The slot the step writes: its frame number modulo trailLength
+
+    The slot before this one holds where a particle was a step ago, unless it was respawned
+    or wrapped around the world; then its trail starts over from its previous position.
+ */
+void particleWriteTrail(BWParticleStreams const* particles
+                        , BWFloat2* vertex, int trailLength, int slot
+                        , int begin, int end
+                        );
+
+
+/// The instruction sets that particleMove has a version for
+enum BWParticleMoveISA
+{
+    /// Plain C++, one particle at a time
+    BWParticleMoveScalar,
+    /// 8 particles at a time
+    BWParticleMoveAVX2,
+    /// 16 particles at a time
+    BWParticleMoveAVX512
+};
+
+/** Checks the CPU (via CPUID) for the widest version of particleMove it can run
+    @returns The instruction set to use
+ */
+BWParticleMoveISA particleMoveBestISA();
+
+/** The name of the instruction set, for logging
+    @param isa  The instruction set
+    @returns The name
+ */
+char const* particleMoveISAName(BWParticleMoveISA isa);
+
+/** This moves the particles [begin, end), using the vectorized version of particleMove
+    @param isa         The instruction set to use; this falls back to the scalar version
+                       if that version isn't supported by the CPU or the compiler
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param vectorField The field of vectors (mapped to an array), at time t0
+    @param nextField   The field of vectors at time t1; null if there is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned
+
+    The results are identical to particleMove()
+ */
+int particleMoveISA(BWParticleMoveISA isa
+                    , BWFloat2* vertex
+                    , float dT
+                    , int numXBins, int numYBins
+                    , BWFloat2 const* vectorField
+                    , BWFloat2 const* nextField, float blend
+                    , uint64_t seed, uint32_t frame
+                    , int begin, int end
+                    );
+
+/** This moves the particles [begin, end), using the vectorized version of particleMovePacked
+    @param isa  The instruction set to use; this falls back to the scalar version if that
+                version isn't supported by the CPU or the compiler
+    @returns The number of particles respawned
+
+    See particleMovePacked() for the other parameters.  The vectors are gathered in their
+    packed form and decoded in the registers; the results are identical to particleMovePacked()
+ */
+int particleMovePackedISA(BWParticleMoveISA isa
+                          , BWFloat2* vertex
+                          , float dT
+                          , int numXBins, int numYBins
+                          , BWPackedField const* field
+                          , BWPackedField const* nextField, float blend
+                          , uint64_t seed, uint32_t frame
+                          , int begin, int end
+                          );
+
+/** This moves the particle streams [begin, end) a step, using the vectorized version of
+    particleAdvance, and lists the ones that expired
+    @param isa  The instruction set to use; this falls back to the scalar version if that
+                version isn't supported by the CPU or the compiler
+
+    See particleAdvance() for the other parameters.  The positions are split into x and y
+    registers as they are loaded, and the ages are counted in the registers; the results
+    are identical to particleAdvance()
+ */
+int particleAdvanceISA(BWParticleMoveISA isa
+                       , BWParticleStreams const* particles
+                       , float dT
+                       , int numXBins, int numYBins
+                       , BWPackedField const* field
+                       , BWPackedField const* nextField, float blend
+                       , uint32_t* expired
+                       , int begin, int end
+                       );
+
+#endif
@@ -0,0 +1,890 @@
+/*
+    BWParticleMoveSIMD.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    The vectorized versions of particleMove, and of particleAdvance.
+
+    The particles are loaded 8 (AVX2) or 16 (AVX-512) at a time, de-interleaved
+    into x and y registers, and the vector field is looked up with a gather; the
+    half float and fixed point fields are gathered packed and decoded in the
+    registers (see the Fetch structs).  The
+    wrap around at the east and west edges is handled with masks and blends.  The
+    particles that need to respawn are marked in a mask, and then handed to
+    particleRandomize(); the random numbers depend only on the particle and the
+    frame, so the results are the same as the scalar version.
+
+    Each version is compiled with a target attribute, so the rest of the library
+    doesn't need to be built with -mavx2; particleMoveBestISA() checks the CPU.
+ */
+
+#include "BWParticleMove.h"
+#include "BWRandom.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BW_X86_SIMD_EN (1)
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC 12 warns about the _mm512_undefined_ps() inside its own permute intrinsics
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#else
+#define BW_X86_SIMD_EN (0)
+#endif
+
+
+#if BW_X86_SIMD_EN
+/** Respawns each of the particles marked in the mask
+    @param vertex   The tail/head pair of each particle
+    @param idx      The index of the first particle in the batch
+    @param mask     Bit n is set if particle idx+n should respawn
+    @param numXBins The number of bins in the x axis
+    @param numYBins The number of bins in the y axis
+    @param seed     The random number seed
+    @param frame    The frame number, which selects the random numbers
+    @returns The number of particles respawned
+ */
+static inline int respawnMasked(BWFloat2* vertex, int idx, unsigned mask
+                                , int numXBins, int numYBins, uint64_t seed, uint32_t frame)
+{
+    int count = 0;
+    while (mask)
+    {
+        int lane = __builtin_ctz(mask);
+        mask &= mask-1;
+        BWFloat2 position = particleRandomize(numXBins, numYBins
+                                              , BWParticleRandom(seed, idx+lane, frame, BWRandomStreamMove));
+        vertex[2*(idx+lane)  ] = position;
+        vertex[2*(idx+lane)+1] = position;
+        count++;
+    }
+    return count;
+}
+
+
+/* The fields are read by a Fetch, which gathers the vectors of the bins of 8 (or 16)
+   particles and decodes them into x and y registers:
+       void avx2(__m256i bin, __m256i row, __m256& x, __m256& y) const
+       void avx512(__m512i bin, __m512i row, __m512& x, __m512& y) const
+   where bin is the index of the bin, and row is the row it is in
+ */
+
+/// Gathers the vectors of a BWFieldStorageFloat field
+struct FloatFetch
+{
+    float const* field;
+    explicit FloatFetch(BWPackedField const* f) : field((float const*) f->vectors) {}
+
+    __attribute__((target("avx2,f16c")))
+    void avx2(__m256i bin, __m256i, __m256& x, __m256& y) const
+    {
+        x = _mm256_i32gather_ps(field,   bin, 8);
+        y = _mm256_i32gather_ps(field+1, bin, 8);
+    }
+
+    __attribute__((target("avx512f")))
+    void avx512(__m512i bin, __m512i, __m512& x, __m512& y) const
+    {
+        x = _mm512_i32gather_ps(bin, field,   8);
+        y = _mm512_i32gather_ps(bin, field+1, 8);
+    }
+};
+
+/// Gathers the vectors of a BWFieldStorageHalf field; each bin is one 32 bit gather
+struct HalfFetch
+{
+    int const* field;
+    explicit HalfFetch(BWPackedField const* f) : field((int const*) f->vectors) {}
+
+    __attribute__((target("avx2,f16c")))
+    void avx2(__m256i bin, __m256i, __m256& x, __m256& y) const
+    {
+        __m256i xy = _mm256_i32gather_epi32(field, bin, 4);
+        // Pack the low (x) halves into the low 128 bits, and the high (y) halves into the high ones
+        __m256i lo = _mm256_and_si256(xy, _mm256_set1_epi32(0xffff));
+        __m256i hi = _mm256_srli_epi32(xy, 16);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3,1,2,0));
+        x = _mm256_cvtph_ps(_mm256_castsi256_si128(packed));
+        y = _mm256_cvtph_ps(_mm256_extracti128_si256(packed, 1));
+    }
+
+    __attribute__((target("avx512f")))
+    void avx512(__m512i bin, __m512i, __m512& x, __m512& y) const
+    {
+        __m512i xy = _mm512_i32gather_epi32(bin, field, 4);
+        x = _mm512_cvtph_ps(_mm512_cvtepi32_epi16(xy));
+        y = _mm512_cvtph_ps(_mm512_cvtepi32_epi16(_mm512_srli_epi32(xy, 16)));
+    }
+};
+
+/// Gathers the vectors of a BWFieldStorageInt16 field, and the scales of their rows
+struct Int16Fetch
+{
+    int const*   field;
+    float const* rowScale;
+    explicit Int16Fetch(BWPackedField const* f) : field((int const*) f->vectors), rowScale((float const*) f->rowScale) {}
+
+    __attribute__((target("avx2,f16c")))
+    void avx2(__m256i bin, __m256i row, __m256& x, __m256& y) const
+    {
+        __m256i xy = _mm256_i32gather_epi32(field, bin, 4);
+        // Sign extend each half
+        __m256 qx = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(xy, 16), 16));
+        __m256 qy = _mm256_cvtepi32_ps(_mm256_srai_epi32(xy, 16));
+        x = _mm256_mul_ps(qx, _mm256_i32gather_ps(rowScale,   row, 8));
+        y = _mm256_mul_ps(qy, _mm256_i32gather_ps(rowScale+1, row, 8));
+    }
+
+    __attribute__((target("avx512f")))
+    void avx512(__m512i bin, __m512i row, __m512& x, __m512& y) const
+    {
+        __m512i xy = _mm512_i32gather_epi32(bin, field, 4);
+        __m512 qx = _mm512_cvtepi32_ps(_mm512_srai_epi32(_mm512_slli_epi32(xy, 16), 16));
+        __m512 qy = _mm512_cvtepi32_ps(_mm512_srai_epi32(xy, 16));
+        x = _mm512_mul_ps(qx, _mm512_i32gather_ps(row, rowScale,   8));
+        y = _mm512_mul_ps(qy, _mm512_i32gather_ps(row, rowScale+1, 8));
+    }
+};
+
+
+/** The index of the bins that 8 particles are in (as fieldIndex())
+    @param xi         The column of each particle, clamped to the field
+    @param yi         The row of each particle, clamped to the field
+    @param numXBins   The number of bins in the x axis
+    @param numXTiles  The number of tiles across a BWFieldLayoutTiled field; 0 if it is laid out in rows
+ */
+__attribute__((target("avx2,f16c")))
+static inline __m256i binIndexAVX2(__m256i xi, __m256i yi, int numXBins, uint32_t numXTiles)
+{
+    if (numXTiles)
+    {
+        // As gridTiledIndex()
+        __m256i const tileMask = _mm256_set1_epi32(BWFieldTileSize-1);
+        __m256i tile = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(yi, BWFieldTileShift), _mm256_set1_epi32((int) numXTiles))
+                                        , _mm256_srli_epi32(xi, BWFieldTileShift));
+        return _mm256_or_si256(_mm256_slli_epi32(tile, 2*BWFieldTileShift)
+                 , _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(yi, tileMask), BWFieldTileShift)
+                                   , _mm256_and_si256(xi, tileMask)));
+    }
+    return _mm256_add_epi32(xi, _mm256_mullo_epi32(yi, _mm256_set1_epi32(numXBins)));
+}
+
+
+/** The index of the bins that 16 particles are in (as fieldIndex())
+    See binIndexAVX2() for the parameters
+ */
+__attribute__((target("avx512f")))
+static inline __m512i binIndexAVX512(__m512i xi, __m512i yi, int numXBins, uint32_t numXTiles)
+{
+    if (numXTiles)
+    {
+        // As gridTiledIndex()
+        __m512i const tileMask = _mm512_set1_epi32(BWFieldTileSize-1);
+        __m512i tile = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_srli_epi32(yi, BWFieldTileShift), _mm512_set1_epi32((int) numXTiles))
+                                        , _mm512_srli_epi32(xi, BWFieldTileShift));
+        return _mm512_or_si512(_mm512_slli_epi32(tile, 2*BWFieldTileShift)
+                 , _mm512_or_si512(_mm512_slli_epi32(_mm512_and_si512(yi, tileMask), BWFieldTileShift)
+                                   , _mm512_and_si512(xi, tileMask)));
+    }
+    return _mm512_add_epi32(xi, _mm512_mullo_epi32(yi, _mm512_set1_epi32(numXBins)));
+}
+
+
+/** This moves the particles [begin, end), 8 at a time
+    @param numXTiles  The number of tiles across a BWFieldLayoutTiled field; 0 if it is laid out in rows
+    @param field  Reads the field at t0
+    @param next   Reads the field at t1; null if there is only the one field
+    @param count  Adds the number of particles respawned
+    See particleMove() for the other parameters
+    @returns The first particle left for the scalar version
+ */
+template <class Fetch>
+__attribute__((target("avx2,f16c")))
+static int particleMoveAVX2(BWFloat2* vertex
+                            , float dT
+                            , int numXBins, int numYBins
+                            , uint32_t numXTiles
+                            , Fetch const& field
+                            , Fetch const* next, float blend
+                            , uint64_t seed, uint32_t frame, int& count
+                            , int begin, int end
+                            )
+{
+    __m256  const zero     = _mm256_setzero_ps();
+    __m256  const vdT      = _mm256_set1_ps(dT);
+    __m256  const xMax     = _mm256_set1_ps((float) numXBins);
+    __m256  const yMax     = _mm256_set1_ps((float) numYBins);
+    __m256  const xLast    = _mm256_set1_ps((float)(numXBins-1));
+    __m256  const yLast    = _mm256_set1_ps((float)(numYBins-1));
+    __m256  const eastX    = _mm256_set1_ps(numXBins-0.1f);
+    __m256  const yEdge    = _mm256_set1_ps(numYBins-0.5f);
+    __m256  const yOOB     = _mm256_set1_ps(numYBins-1.0f);
+    __m256  const half     = _mm256_set1_ps(0.5f);
+    __m256  const minSpeed = _mm256_set1_ps(2.0f);
+    __m256  const vblend   = _mm256_set1_ps(blend);
+
+    int idx = begin;
+    for (; idx + 8 <= end; idx += 8)
+    {
+        float* base = (float*)(vertex + 2*idx);
+        // Load the tail/head pairs of 8 particles, and pull out the tails
+        __m256 in0 = _mm256_loadu_ps(base);       // particles 0,1
+        __m256 in1 = _mm256_loadu_ps(base+8);     // particles 2,3
+        __m256 in2 = _mm256_loadu_ps(base+16);    // particles 4,5
+        __m256 in3 = _mm256_loadu_ps(base+24);    // particles 6,7
+        __m256 r0 = _mm256_permute2f128_ps(in0, in2, 0x20);  // particles 0,4
+        __m256 r1 = _mm256_permute2f128_ps(in0, in2, 0x31);  // particles 1,5
+        __m256 r2 = _mm256_permute2f128_ps(in1, in3, 0x20);  // particles 2,6
+        __m256 r3 = _mm256_permute2f128_ps(in1, in3, 0x31);  // particles 3,7
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+        __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+        __m256 origX = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1,0,1,0));
+        __m256 origY = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3,2,3,2));
+
+        // Look up the vector at the particles bin; clamped, as in fieldIndex()
+        __m256i xi = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(origX, zero), xLast));
+        __m256i yi = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(origY, zero), yLast));
+        __m256i bin = binIndexAVX2(xi, yi, numXBins, numXTiles);
+        __m256 _vx, _vy;
+        field.avx2(bin, yi, _vx, _vy);
+        if (next)
+        {
+            // Blend between the vector at t0 and at t1
+            __m256 _nx, _ny;
+            next->avx2(bin, yi, _nx, _ny);
+            _vx = _mm256_add_ps(_vx, _mm256_mul_ps(vblend, _mm256_sub_ps(_nx, _vx)));
+            _vy = _mm256_add_ps(_vy, _mm256_mul_ps(vblend, _mm256_sub_ps(_ny, _vy)));
+        }
+        __m256 vx = _mm256_mul_ps(_vx, vdT);
+        __m256 vy = _mm256_mul_ps(_vy, vdT);
+        __m256 x = _mm256_add_ps(origX, vx);
+        __m256 y = _mm256_add_ps(origY, vy);
+
+        // Which of the branches in particleMove each particle takes
+        __m256 east = _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_LT_OQ), _mm256_cmp_ps(vx, zero, _CMP_LT_OQ));
+        __m256 west = _mm256_andnot_ps(east,
+                         _mm256_and_ps(_mm256_cmp_ps(x, xMax, _CMP_GT_OQ), _mm256_cmp_ps(vx, zero, _CMP_GT_OQ)));
+        __m256 wrap = _mm256_or_ps(east, west);
+        __m256 oob  = _mm256_andnot_ps(wrap,
+                         _mm256_or_ps(_mm256_cmp_ps(y, zero, _CMP_LT_OQ), _mm256_cmp_ps(y, yOOB, _CMP_GE_OQ)));
+        __m256 m    = _mm256_add_ps(_mm256_mul_ps(_vx, _vx), _mm256_mul_ps(_vy, _vy));
+        __m256 slow = _mm256_andnot_ps(_mm256_or_ps(wrap, oob), _mm256_cmp_ps(m, minSpeed, _CMP_LT_OQ));
+        unsigned respawn = (unsigned) _mm256_movemask_ps(_mm256_or_ps(oob, slow));
+
+        // Wrap around to the other end of the world
+        x = _mm256_blendv_ps(x, eastX, east);
+        x = _mm256_blendv_ps(x, zero,  west);
+        y = _mm256_blendv_ps(y, _mm256_mul_ps(half, _mm256_add_ps(y, origY)), west);
+        // Sanity check the y coordinate of the wrapped particles (otherwise we can misindex)
+        __m256 yClamped = _mm256_blendv_ps(y, zero, _mm256_cmp_ps(y, zero, _CMP_LT_OQ));
+        yClamped = _mm256_blendv_ps(yClamped, yEdge, _mm256_cmp_ps(y, yMax, _CMP_GE_OQ));
+        y = _mm256_blendv_ps(y, yClamped, wrap);
+        __m256 hx = _mm256_add_ps(x, vx);
+        __m256 hy = _mm256_add_ps(y, vy);
+
+        // Interleave back into tail/head pairs
+        __m256 xy0 = _mm256_unpacklo_ps(x,  y);     // 0,1 | 4,5
+        __m256 xy1 = _mm256_unpackhi_ps(x,  y);     // 2,3 | 6,7
+        __m256 h0  = _mm256_unpacklo_ps(hx, hy);
+        __m256 h1  = _mm256_unpackhi_ps(hx, hy);
+        r0 = _mm256_shuffle_ps(xy0, h0, _MM_SHUFFLE(1,0,1,0));   // particles 0,4
+        r1 = _mm256_shuffle_ps(xy0, h0, _MM_SHUFFLE(3,2,3,2));   // particles 1,5
+        r2 = _mm256_shuffle_ps(xy1, h1, _MM_SHUFFLE(1,0,1,0));   // particles 2,6
+        r3 = _mm256_shuffle_ps(xy1, h1, _MM_SHUFFLE(3,2,3,2));   // particles 3,7
+        _mm256_storeu_ps(base,    _mm256_permute2f128_ps(r0, r1, 0x20));
+        _mm256_storeu_ps(base+8,  _mm256_permute2f128_ps(r2, r3, 0x20));
+        _mm256_storeu_ps(base+16, _mm256_permute2f128_ps(r0, r1, 0x31));
+        _mm256_storeu_ps(base+24, _mm256_permute2f128_ps(r2, r3, 0x31));
+
+        // The particle is moving too fast or too slow; get rid of it
+        count += respawnMasked(vertex, idx, respawn, numXBins, numYBins, seed, frame);
+    }
+    return idx;
+}
+
+
+/** This moves the particles [begin, end), 16 at a time
+    @param numXTiles  The number of tiles across a BWFieldLayoutTiled field; 0 if it is laid out in rows
+    @param field  Reads the field at t0
+    @param next   Reads the field at t1; null if there is only the one field
+    @param count  Adds the number of particles respawned
+    See particleMove() for the other parameters
+    @returns The first particle left for the scalar version
+ */
+template <class Fetch>
+__attribute__((target("avx512f")))
+static int particleMoveAVX512(BWFloat2* vertex
+                              , float dT
+                              , int numXBins, int numYBins
+                              , uint32_t numXTiles
+                              , Fetch const& field
+                              , Fetch const* next, float blend
+                              , uint64_t seed, uint32_t frame, int& count
+                              , int begin, int end
+                              )
+{
+    __m512  const zero     = _mm512_setzero_ps();
+    __m512  const vdT      = _mm512_set1_ps(dT);
+    __m512  const xMax     = _mm512_set1_ps((float) numXBins);
+    __m512  const yMax     = _mm512_set1_ps((float) numYBins);
+    __m512  const xLast    = _mm512_set1_ps((float)(numXBins-1));
+    __m512  const yLast    = _mm512_set1_ps((float)(numYBins-1));
+    __m512  const eastX    = _mm512_set1_ps(numXBins-0.1f);
+    __m512  const yEdge    = _mm512_set1_ps(numYBins-0.5f);
+    __m512  const yOOB     = _mm512_set1_ps(numYBins-1.0f);
+    __m512  const half     = _mm512_set1_ps(0.5f);
+    __m512  const minSpeed = _mm512_set1_ps(2.0f);
+    __m512  const vblend   = _mm512_set1_ps(blend);
+    // Pulls the tails (x's then y's) out of 8 tail/head pairs
+    __m512i const tails    = _mm512_setr_epi32(0,4,8,12,16,20,24,28, 1,5,9,13,17,21,25,29);
+    __m512i const lo       = _mm512_setr_epi32(0,1,2,3,4,5,6,7, 16,17,18,19,20,21,22,23);
+    __m512i const hi       = _mm512_setr_epi32(8,9,10,11,12,13,14,15, 24,25,26,27,28,29,30,31);
+    // Interleaves x and y
+    __m512i const zipLo    = _mm512_setr_epi32(0,16,1,17,2,18,3,19, 4,20,5,21,6,22,7,23);
+    __m512i const zipHi    = _mm512_setr_epi32(8,24,9,25,10,26,11,27, 12,28,13,29,14,30,15,31);
+    // Interleaves tail and head pairs
+    __m512i const pair0    = _mm512_setr_epi32(0,1,16,17, 2,3,18,19, 4,5,20,21, 6,7,22,23);
+    __m512i const pair1    = _mm512_setr_epi32(8,9,24,25, 10,11,26,27, 12,13,28,29, 14,15,30,31);
+
+    int idx = begin;
+    for (; idx + 16 <= end; idx += 16)
+    {
+        float* base = (float*)(vertex + 2*idx);
+        // Load the tail/head pairs of 16 particles, and pull out the tails
+        __m512 a = _mm512_permutex2var_ps(_mm512_loadu_ps(base),    tails, _mm512_loadu_ps(base+16));
+        __m512 b = _mm512_permutex2var_ps(_mm512_loadu_ps(base+32), tails, _mm512_loadu_ps(base+48));
+        __m512 origX = _mm512_permutex2var_ps(a, lo, b);
+        __m512 origY = _mm512_permutex2var_ps(a, hi, b);
+
+        // Look up the vector at the particles bin; clamped, as in fieldIndex()
+        __m512i xi = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(origX, zero), xLast));
+        __m512i yi = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(origY, zero), yLast));
+        __m512i bin = binIndexAVX512(xi, yi, numXBins, numXTiles);
+        __m512 _vx, _vy;
+        field.avx512(bin, yi, _vx, _vy);
+        if (next)
+        {
+            // Blend between the vector at t0 and at t1
+            __m512 _nx, _ny;
+            next->avx512(bin, yi, _nx, _ny);
+            _vx = _mm512_add_ps(_vx, _mm512_mul_ps(vblend, _mm512_sub_ps(_nx, _vx)));
+            _vy = _mm512_add_ps(_vy, _mm512_mul_ps(vblend, _mm512_sub_ps(_ny, _vy)));
+        }
+        __m512 vx = _mm512_mul_ps(_vx, vdT);
+        __m512 vy = _mm512_mul_ps(_vy, vdT);
+        __m512 x = _mm512_add_ps(origX, vx);
+        __m512 y = _mm512_add_ps(origY, vy);
+
+        // Which of the branches in particleMove each particle takes
+        __mmask16 east = _mm512_cmp_ps_mask(x, zero, _CMP_LT_OQ) & _mm512_cmp_ps_mask(vx, zero, _CMP_LT_OQ);
+        __mmask16 west = ~east & _mm512_cmp_ps_mask(x, xMax, _CMP_GT_OQ) & _mm512_cmp_ps_mask(vx, zero, _CMP_GT_OQ);
+        __mmask16 wrap = east | west;
+        __mmask16 oob  = ~wrap & (_mm512_cmp_ps_mask(y, zero, _CMP_LT_OQ) | _mm512_cmp_ps_mask(y, yOOB, _CMP_GE_OQ));
+        __m512 m = _mm512_add_ps(_mm512_mul_ps(_vx, _vx), _mm512_mul_ps(_vy, _vy));
+        __mmask16 slow = ~(wrap | oob) & _mm512_cmp_ps_mask(m, minSpeed, _CMP_LT_OQ);
+
+        // Wrap around to the other end of the world
+        x = _mm512_mask_blend_ps(east, x, eastX);
+        x = _mm512_mask_blend_ps(west, x, zero);
+        y = _mm512_mask_blend_ps(west, y, _mm512_mul_ps(half, _mm512_add_ps(y, origY)));
+        // Sanity check the y coordinate of the wrapped particles (otherwise we can misindex)
+        __mmask16 yLow  = wrap & _mm512_cmp_ps_mask(y, zero, _CMP_LT_OQ);
+        __mmask16 yHigh = wrap & _mm512_cmp_ps_mask(y, yMax, _CMP_GE_OQ);
+        y = _mm512_mask_blend_ps(yLow,  y, zero);
+        y = _mm512_mask_blend_ps(yHigh, y, yEdge);
+        __m512 hx = _mm512_add_ps(x, vx);
+        __m512 hy = _mm512_add_ps(y, vy);
+
+        // Interleave back into tail/head pairs
+        __m512 xyLo = _mm512_permutex2var_ps(x,  zipLo, y);
+        __m512 xyHi = _mm512_permutex2var_ps(x,  zipHi, y);
+        __m512 hLo  = _mm512_permutex2var_ps(hx, zipLo, hy);
+        __m512 hHi  = _mm512_permutex2var_ps(hx, zipHi, hy);
+        _mm512_storeu_ps(base,    _mm512_permutex2var_ps(xyLo, pair0, hLo));
+        _mm512_storeu_ps(base+16, _mm512_permutex2var_ps(xyLo, pair1, hLo));
+        _mm512_storeu_ps(base+32, _mm512_permutex2var_ps(xyHi, pair0, hHi));
+        _mm512_storeu_ps(base+48, _mm512_permutex2var_ps(xyHi, pair1, hHi));
+
+        // The particle is moving too fast or too slow; get rid of it
+        count += respawnMasked(vertex, idx, (unsigned)(oob | slow), numXBins, numYBins, seed, frame);
+    }
+    return idx;
+}
+
+
+/** This moves the particle streams [begin, end) a step, 8 at a time, and lists the ones
+    that expired
+    @param numXTiles  The number of tiles across a BWFieldLayoutTiled field; 0 if it is laid out in rows
+    @param field  Reads the field at t0
+    @param next   Reads the field at t1; null if there is only the one field
+    @param count  The number of particles listed in expired so far; receives the new number
+    See particleAdvance() for the other parameters
+    @returns The first particle left for the scalar version
+ */
+template <class Fetch>
+__attribute__((target("avx2,f16c")))
+static int particleAdvanceAVX2(BWParticleStreams const* particles
+                               , float dT
+                               , int numXBins, int numYBins
+                               , uint32_t numXTiles
+                               , Fetch const& field
+                               , Fetch const* next, float blend
+                               , uint32_t* expired, int& count
+                               , int begin, int end
+                               )
+{
+    __m256  const zero     = _mm256_setzero_ps();
+    __m256  const vdT      = _mm256_set1_ps(dT);
+    __m256  const xMax     = _mm256_set1_ps((float) numXBins);
+    __m256  const yMax     = _mm256_set1_ps((float) numYBins);
+    __m256  const xLast    = _mm256_set1_ps((float)(numXBins-1));
+    __m256  const yLast    = _mm256_set1_ps((float)(numYBins-1));
+    __m256  const eastX    = _mm256_set1_ps(numXBins-0.1f);
+    __m256  const yEdge    = _mm256_set1_ps(numYBins-0.5f);
+    __m256  const yOOB     = _mm256_set1_ps(numYBins-1.0f);
+    __m256  const half     = _mm256_set1_ps(0.5f);
+    __m256  const minSpeed = _mm256_set1_ps(2.0f);
+    __m256  const vblend   = _mm256_set1_ps(blend);
+    __m128i const one      = _mm_set1_epi16(1);
+
+    int idx = begin;
+    for (; idx + 8 <= end; idx += 8)
+    {
+        float* base = (float*)(particles->position + idx);
+        // Load the positions of 8 particles, and split them into x and y
+        __m256 in0 = _mm256_loadu_ps(base);       // particles 0-3
+        __m256 in1 = _mm256_loadu_ps(base+8);     // particles 4-7
+        __m256 origX = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(in0, in1, _MM_SHUFFLE(2,0,2,0))), _MM_SHUFFLE(3,1,2,0)));
+        __m256 origY = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(in0, in1, _MM_SHUFFLE(3,1,3,1))), _MM_SHUFFLE(3,1,2,0)));
+
+        // Look up the vector at the particles bin; clamped, as in fieldIndex()
+        __m256i xi = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(origX, zero), xLast));
+        __m256i yi = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(origY, zero), yLast));
+        __m256i bin = binIndexAVX2(xi, yi, numXBins, numXTiles);
+        __m256 _vx, _vy;
+        field.avx2(bin, yi, _vx, _vy);
+        if (next)
+        {
+            // Blend between the vector at t0 and at t1
+            __m256 _nx, _ny;
+            next->avx2(bin, yi, _nx, _ny);
+            _vx = _mm256_add_ps(_vx, _mm256_mul_ps(vblend, _mm256_sub_ps(_nx, _vx)));
+            _vy = _mm256_add_ps(_vy, _mm256_mul_ps(vblend, _mm256_sub_ps(_ny, _vy)));
+        }
+        __m256 vx = _mm256_mul_ps(_vx, vdT);
+        __m256 vy = _mm256_mul_ps(_vy, vdT);
+        __m256 x = _mm256_add_ps(origX, vx);
+        __m256 y = _mm256_add_ps(origY, vy);
+
+        // Which of the branches in particleAdvanceStep each particle takes
+        __m256 east = _mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_LT_OQ), _mm256_cmp_ps(vx, zero, _CMP_LT_OQ));
+        __m256 west = _mm256_andnot_ps(east,
+                         _mm256_and_ps(_mm256_cmp_ps(x, xMax, _CMP_GT_OQ), _mm256_cmp_ps(vx, zero, _CMP_GT_OQ)));
+        __m256 wrap = _mm256_or_ps(east, west);
+        __m256 oob  = _mm256_andnot_ps(wrap,
+                         _mm256_or_ps(_mm256_cmp_ps(y, zero, _CMP_LT_OQ), _mm256_cmp_ps(y, yOOB, _CMP_GE_OQ)));
+        __m256 m    = _mm256_add_ps(_mm256_mul_ps(_vx, _vx), _mm256_mul_ps(_vy, _vy));
+        __m256 slow = _mm256_andnot_ps(_mm256_or_ps(wrap, oob), _mm256_cmp_ps(m, minSpeed, _CMP_LT_OQ));
+        unsigned mask = (unsigned) _mm256_movemask_ps(_mm256_or_ps(oob, slow));
+
+        // Wrap around to the other end of the world; the line starts over there
+        x = _mm256_blendv_ps(x, eastX, east);
+        x = _mm256_blendv_ps(x, zero,  west);
+        y = _mm256_blendv_ps(y, _mm256_mul_ps(half, _mm256_add_ps(y, origY)), west);
+        __m256 yClamped = _mm256_blendv_ps(y, zero, _mm256_cmp_ps(y, zero, _CMP_LT_OQ));
+        yClamped = _mm256_blendv_ps(yClamped, yEdge, _mm256_cmp_ps(y, yMax, _CMP_GE_OQ));
+        y = _mm256_blendv_ps(y, yClamped, wrap);
+        __m256 px = _mm256_blendv_ps(origX, x, wrap);
+        __m256 py = _mm256_blendv_ps(origY, y, wrap);
+        x = _mm256_blendv_ps(x, _mm256_add_ps(x, vx), wrap);
+        y = _mm256_blendv_ps(y, _mm256_add_ps(y, vy), wrap);
+
+        // Put x and y back together; the ones that expired are respawned anyway
+        __m256 lo = _mm256_unpacklo_ps(x, y);     // 0,1 | 4,5
+        __m256 hi = _mm256_unpackhi_ps(x, y);     // 2,3 | 6,7
+        _mm256_storeu_ps(base,   _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(base+8, _mm256_permute2f128_ps(lo, hi, 0x31));
+        float* prev = (float*)(particles->prevPosition + idx);
+        lo = _mm256_unpacklo_ps(px, py);
+        hi = _mm256_unpackhi_ps(px, py);
+        _mm256_storeu_ps(prev,   _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(prev+8, _mm256_permute2f128_ps(lo, hi, 0x31));
+
+        // Age the particles; the ones that reach their lifetime expire
+        __m128i age    = _mm_add_epi16(_mm_loadu_si128((__m128i const*)(particles->age + idx)), one);
+        __m128i maxAge = _mm_loadu_si128((__m128i const*)(particles->maxAge + idx));
+        _mm_storeu_si128((__m128i*)(particles->age + idx), age);
+        __m128i old    = _mm_cmpeq_epi16(_mm_max_epu16(age, maxAge), age);
+        mask |= (unsigned) _mm_movemask_epi8(_mm_packs_epi16(old, _mm_setzero_si128()));
+
+        while (mask)
+        {
+            expired[count++] = (uint32_t)(idx + __builtin_ctz(mask));
+            mask &= mask-1;
+        }
+    }
+    return idx;
+}
+
+
+/** This moves the particle streams [begin, end) a step, 16 at a time, and lists the ones
+    that expired
+    See particleAdvanceAVX2() for the parameters
+ */
+template <class Fetch>
+__attribute__((target("avx512f")))
+static int particleAdvanceAVX512(BWParticleStreams const* particles
+                                 , float dT
+                                 , int numXBins, int numYBins
+                                 , uint32_t numXTiles
+                                 , Fetch const& field
+                                 , Fetch const* next, float blend
+                                 , uint32_t* expired, int& count
+                                 , int begin, int end
+                                 )
+{
+    __m512  const zero     = _mm512_setzero_ps();
+    __m512  const vdT      = _mm512_set1_ps(dT);
+    __m512  const xMax     = _mm512_set1_ps((float) numXBins);
+    __m512  const yMax     = _mm512_set1_ps((float) numYBins);
+    __m512  const xLast    = _mm512_set1_ps((float)(numXBins-1));
+    __m512  const yLast    = _mm512_set1_ps((float)(numYBins-1));
+    __m512  const eastX    = _mm512_set1_ps(numXBins-0.1f);
+    __m512  const yEdge    = _mm512_set1_ps(numYBins-0.5f);
+    __m512  const yOOB     = _mm512_set1_ps(numYBins-1.0f);
+    __m512  const half     = _mm512_set1_ps(0.5f);
+    __m512  const minSpeed = _mm512_set1_ps(2.0f);
+    __m512  const vblend   = _mm512_set1_ps(blend);
+    __m512i const one      = _mm512_set1_epi32(1);
+    // Pulls the x's and the y's out of 16 positions, and puts them back
+    __m512i const evens    = _mm512_setr_epi32(0,2,4,6,8,10,12,14, 16,18,20,22,24,26,28,30);
+    __m512i const odds     = _mm512_setr_epi32(1,3,5,7,9,11,13,15, 17,19,21,23,25,27,29,31);
+    __m512i const zipLo    = _mm512_setr_epi32(0,16,1,17,2,18,3,19, 4,20,5,21,6,22,7,23);
+    __m512i const zipHi    = _mm512_setr_epi32(8,24,9,25,10,26,11,27, 12,28,13,29,14,30,15,31);
+
+    int idx = begin;
+    for (; idx + 16 <= end; idx += 16)
+    {
+        float* base = (float*)(particles->position + idx);
+        __m512 in0 = _mm512_loadu_ps(base);
+        __m512 in1 = _mm512_loadu_ps(base+16);
+        __m512 origX = _mm512_permutex2var_ps(in0, evens, in1);
+        __m512 origY = _mm512_permutex2var_ps(in0, odds,  in1);
+
+        // Look up the vector at the particles bin; clamped, as in fieldIndex()
+        __m512i xi = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(origX, zero), xLast));
+        __m512i yi = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(origY, zero), yLast));
+        __m512i bin = binIndexAVX512(xi, yi, numXBins, numXTiles);
+        __m512 _vx, _vy;
+        field.avx512(bin, yi, _vx, _vy);
+        if (next)
+        {
+            // Blend between the vector at t0 and at t1
+            __m512 _nx, _ny;
+            next->avx512(bin, yi, _nx, _ny);
+            _vx = _mm512_add_ps(_vx, _mm512_mul_ps(vblend, _mm512_sub_ps(_nx, _vx)));
+            _vy = _mm512_add_ps(_vy, _mm512_mul_ps(vblend, _mm512_sub_ps(_ny, _vy)));
+        }
+        __m512 vx = _mm512_mul_ps(_vx, vdT);
+        __m512 vy = _mm512_mul_ps(_vy, vdT);
+        __m512 x = _mm512_add_ps(origX, vx);
+        __m512 y = _mm512_add_ps(origY, vy);
+
+        // Which of the branches in particleAdvanceStep each particle takes
+        __mmask16 east = _mm512_cmp_ps_mask(x, zero, _CMP_LT_OQ) & _mm512_cmp_ps_mask(vx, zero, _CMP_LT_OQ);
+        __mmask16 west = ~east & _mm512_cmp_ps_mask(x, xMax, _CMP_GT_OQ) & _mm512_cmp_ps_mask(vx, zero, _CMP_GT_OQ);
+        __mmask16 wrap = east | west;
+        __mmask16 oob  = ~wrap & (_mm512_cmp_ps_mask(y, zero, _CMP_LT_OQ) | _mm512_cmp_ps_mask(y, yOOB, _CMP_GE_OQ));
+        __m512 m = _mm512_add_ps(_mm512_mul_ps(_vx, _vx), _mm512_mul_ps(_vy, _vy));
+        __mmask16 slow = ~(wrap | oob) & _mm512_cmp_ps_mask(m, minSpeed, _CMP_LT_OQ);
+
+        // Wrap around to the other end of the world; the line starts over there
+        x = _mm512_mask_blend_ps(east, x, eastX);
+        x = _mm512_mask_blend_ps(west, x, zero);
+        y = _mm512_mask_blend_ps(west, y, _mm512_mul_ps(half, _mm512_add_ps(y, origY)));
+        __mmask16 yLow  = wrap & _mm512_cmp_ps_mask(y, zero, _CMP_LT_OQ);
+        __mmask16 yHigh = wrap & _mm512_cmp_ps_mask(y, yMax, _CMP_GE_OQ);
+        y = _mm512_mask_blend_ps(yLow,  y, zero);
+        y = _mm512_mask_blend_ps(yHigh, y, yEdge);
+        __m512 px = _mm512_mask_blend_ps(wrap, origX, x);
+        __m512 py = _mm512_mask_blend_ps(wrap, origY, y);
+        x = _mm512_mask_add_ps(x, wrap, x, vx);
+        y = _mm512_mask_add_ps(y, wrap, y, vy);
+
+        // Put x and y back together; the ones that expired are respawned anyway
+        _mm512_storeu_ps(base,    _mm512_permutex2var_ps(x, zipLo, y));
+        _mm512_storeu_ps(base+16, _mm512_permutex2var_ps(x, zipHi, y));
+        float* prev = (float*)(particles->prevPosition + idx);
+        _mm512_storeu_ps(prev,    _mm512_permutex2var_ps(px, zipLo, py));
+        _mm512_storeu_ps(prev+16, _mm512_permutex2var_ps(px, zipHi, py));
+
+        // Age the particles; the ones that reach their lifetime expire
+        __m512i age    = _mm512_add_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((__m256i const*)(particles->age + idx))), one);
+        __m512i maxAge = _mm512_cvtepu16_epi32(_mm256_loadu_si256((__m256i const*)(particles->maxAge + idx)));
+        _mm256_storeu_si256((__m256i*)(particles->age + idx), _mm512_cvtepi32_epi16(age));
+        unsigned mask  = (unsigned)(oob | slow | _mm512_cmp_epu32_mask(age, maxAge, _MM_CMPINT_NLT));
+
+        while (mask)
+        {
+            expired[count++] = (uint32_t)(idx + __builtin_ctz(mask));
+            mask &= mask-1;
+        }
+    }
+    return idx;
+}
+
+
+/** Runs the widest kernel for the instruction set on as many of the particles as it can
+    @param isa    The instruction set to use
+    @param count  Adds the number of particles respawned
+    See particleMovePacked() for the other parameters
+    @returns The first particle left for the scalar version
+ */
+template <class Fetch>
+static int particleMoveSIMD(BWParticleMoveISA isa
+                            , BWFloat2* vertex
+                            , float dT
+                            , int numXBins, int numYBins
+                            , BWPackedField const* field
+                            , BWPackedField const* nextField, float blend
+                            , uint64_t seed, uint32_t frame, int& count
+                            , int begin, int end
+                            )
+{
+    Fetch f(field);
+    Fetch n(nextField ? nextField : field);
+    Fetch const* next = nextField ? &n : nullptr;
+    uint32_t numXTiles = BWFieldLayoutTiled == field->layout ? field->numXTiles : 0;
+    if (BWParticleMoveAVX512 == isa)
+        return particleMoveAVX512(vertex, dT, numXBins, numYBins, numXTiles, f, next, blend, seed, frame, count, begin, end);
+    if (BWParticleMoveAVX2 == isa)
+        return particleMoveAVX2(vertex, dT, numXBins, numYBins, numXTiles, f, next, blend, seed, frame, count, begin, end);
+    return begin;
+}
+
+
+/** Runs the widest version of particleAdvance for the instruction set on as many of the
+    particles as it can
+    @param isa    The instruction set to use
+    @param count  Receives the number of particles listed in expired
+    See particleAdvance() for the other parameters
+    @returns The first particle left for the scalar version
+ */
+template <class Fetch>
+static int particleAdvanceSIMD(BWParticleMoveISA isa
+                               , BWParticleStreams const* particles
+                               , float dT
+                               , int numXBins, int numYBins
+                               , BWPackedField const* field
+                               , BWPackedField const* nextField, float blend
+                               , uint32_t* expired, int& count
+                               , int begin, int end
+                               )
+{
+    Fetch f(field);
+    Fetch n(nextField ? nextField : field);
+    Fetch const* next = nextField ? &n : nullptr;
+    uint32_t numXTiles = BWFieldLayoutTiled == field->layout ? field->numXTiles : 0;
+    if (BWParticleMoveAVX512 == isa)
+        return particleAdvanceAVX512(particles, dT, numXBins, numYBins, numXTiles, f, next, blend, expired, count, begin, end);
+    if (BWParticleMoveAVX2 == isa)
+        return particleAdvanceAVX2(particles, dT, numXBins, numYBins, numXTiles, f, next, blend, expired, count, begin, end);
+    return begin;
+}
+#endif
+
+
+/** Checks the CPU (via CPUID) for the widest version of particleMove it can run
+    @returns The instruction set to use
+ */
+static BWParticleMoveISA detectISA()
+{
+#if BW_X86_SIMD_EN
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return BWParticleMoveAVX512;
+    // The half float fields are decoded with F16C, which every AVX2 CPU has
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+        return BWParticleMoveAVX2;
+#endif
+    return BWParticleMoveScalar;
+}
+
+BWParticleMoveISA particleMoveBestISA()
+{
+    // The CPU isn't going to change, so only ask once
+    static BWParticleMoveISA const best = detectISA();
+    return best;
+}
+
+
+/** The name of the instruction set, for logging
+    @param isa  The instruction set
+    @returns The name
+ */
+char const* particleMoveISAName(BWParticleMoveISA isa)
+{
+    switch (isa)
+    {
+        case BWParticleMoveAVX2  : return "avx2";
+        case BWParticleMoveAVX512: return "avx512";
+        default                  : return "scalar";
+    }
+}
+
+
+/** This moves the particles [begin, end), using the vectorized version of particleMove
+    @param isa         The instruction set to use
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param vectorField The field of vectors (mapped to an array), at time t0
+    @param nextField   The field of vectors at time t1; null if there is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned
+ */
+int particleMoveISA(BWParticleMoveISA isa
+                    , BWFloat2* vertex
+                    , float dT
+                    , int numXBins, int numYBins
+                    , BWFloat2 const* vectorField
+                    , BWFloat2 const* nextField, float blend
+                    , uint64_t seed, uint32_t frame
+                    , int begin, int end
+                    )
+{
+    // Don't trust the caller to have checked the CPU
+    if (isa > particleMoveBestISA())
+        isa = particleMoveBestISA();
+    int count = 0;
+#if BW_X86_SIMD_EN
+    BWPackedField f = {BWFieldStorageFloat, vectorField, nullptr, BWFieldLayoutRows, 0};
+    BWPackedField n = {BWFieldStorageFloat, nextField,   nullptr, BWFieldLayoutRows, 0};
+    begin = particleMoveSIMD<FloatFetch>(isa, vertex, dT, numXBins, numYBins, &f, nextField ? &n : nullptr, blend
+                                         , seed, frame, count, begin, end);
+#endif
+    // Finish off the rest of the particles
+    return count + particleMove(vertex, dT, numXBins, numYBins, vectorField, nextField, blend, seed, frame, begin, end);
+}
+
+
+/** This moves the particles [begin, end), using the vectorized version of particleMovePacked
+    @param isa         The instruction set to use
+    @param vertex      The tail/head pair of each particle
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param field       The field of vectors, at time t0
+    @param nextField   The field of vectors at time t1, stored the same way; null if there
+                       is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param seed        The random number seed
+    @param frame       The frame number, which selects the random numbers
+    @returns The number of particles respawned
+ */
+int particleMovePackedISA(BWParticleMoveISA isa
+                          , BWFloat2* vertex
+                          , float dT
+                          , int numXBins, int numYBins
+                          , BWPackedField const* field
+                          , BWPackedField const* nextField, float blend
+                          , uint64_t seed, uint32_t frame
+                          , int begin, int end
+                          )
+{
+    if (isa > particleMoveBestISA())
+        isa = particleMoveBestISA();
+    // A field stored (or laid out) another way can't be blended with
+    if (nextField && (nextField->storage != field->storage || nextField->layout != field->layout))
+        nextField = nullptr;
+    int count = 0;
+#if BW_X86_SIMD_EN
+    switch (field->storage)
+    {
+        case BWFieldStorageHalf:
+            begin = particleMoveSIMD<HalfFetch>(isa, vertex, dT, numXBins, numYBins, field, nextField, blend, seed, frame, count, begin, end);
+            break;
+        case BWFieldStorageInt16:
+            begin = particleMoveSIMD<Int16Fetch>(isa, vertex, dT, numXBins, numYBins, field, nextField, blend, seed, frame, count, begin, end);
+            break;
+        default:
+            begin = particleMoveSIMD<FloatFetch>(isa, vertex, dT, numXBins, numYBins, field, nextField, blend, seed, frame, count, begin, end);
+            break;
+    }
+#endif
+    // Finish off the rest of the particles
+    return count + particleMovePacked(vertex, dT, numXBins, numYBins, field, nextField, blend, seed, frame, begin, end);
+}
+
+
+/** This moves the particle streams [begin, end) a step, using the vectorized version of
+    particleAdvance, and lists the ones that expired
+    @param isa         The instruction set to use
+    @param particles   The particle streams
+    @param dT          The time step
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param field       The field of vectors, at time t0
+    @param nextField   The field of vectors at time t1, stored the same way; null if there
+                       is only the one field
+    @param blend       How far from t0 to t1 the time is, from 0 to 1
+    @param expired     Receives the indices of the particles that expired
+    @returns The number of particles that expired
+ */
+int particleAdvanceISA(BWParticleMoveISA isa
+                       , BWParticleStreams const* particles
+                       , float dT
+                       , int numXBins, int numYBins
+                       , BWPackedField const* field
+                       , BWPackedField const* nextField, float blend
+                       , uint32_t* expired
+                       , int begin, int end
+                       )
+{
+    if (isa > particleMoveBestISA())
+        isa = particleMoveBestISA();
+    // A field stored (or laid out) another way can't be blended with
+    if (nextField && (nextField->storage != field->storage || nextField->layout != field->layout))
+        nextField = nullptr;
+    int count = 0;
+#if BW_X86_SIMD_EN
+    switch (field->storage)
+    {
+        case BWFieldStorageHalf:
+            begin = particleAdvanceSIMD<HalfFetch>(isa, particles, dT, numXBins, numYBins, field, nextField, blend, expired, count, begin, end);
+            break;
+        case BWFieldStorageInt16:
+            begin = particleAdvanceSIMD<Int16Fetch>(isa, particles, dT, numXBins, numYBins, field, nextField, blend, expired, count, begin, end);
+            break;
+        default:
+            begin = particleAdvanceSIMD<FloatFetch>(isa, particles, dT, numXBins, numYBins, field, nextField, blend, expired, count, begin, end);
+            break;
+    }
+#endif
+    // Finish off the rest of the particles
+    return count + particleAdvance(particles, dT, numXBins, numYBins, field, nextField, blend, expired + count, begin, end);
+}
@@ -0,0 +1,127 @@
+/*
+    BWRandom.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWRandom_h
+#define BWRandom_h
+
+#include <stdint.h>
+
+/*
+    A stateless, counter based random number generator: Philox4x32-10, from
+    "Parallel Random Numbers: As Easy as 1, 2, 3", Salmon et al, SC11.
+
+    The random number is a function of the key (the user's seed) and the
+    counter (which particle, which frame, and which use), so the particles can be
+    respawned in any order, on any number of threads, and a given seed always
+    produces the same particle streams.  particleMove.cl has the same generator.
+ */
+
+/// The uses of the random numbers; each is a separate stream
+enum
+{
+    /// particleMove: respawning a particle that is too slow or out of bounds
+    BWRandomStreamMove = 0,
+    /// particleInit: randomizing the particles
+    BWRandomStreamInit = 1,
+    /// particleSpawn, particleRespawn: the lifetime of a particle
+    BWRandomStreamAge  = 2
+};
+
+
+/** The high and low halves of the 64-bit product
+    @param a   A 32-bit number
+    @param b   The other 32-bit number
+    @param hi  Receives the high half of the product
+    @returns the low half of the product
+ */
+static inline uint32_t BWMulHiLo(uint32_t a, uint32_t b, uint32_t* hi)
+{
+    uint64_t product = (uint64_t) a * b;
+    *hi = (uint32_t)(product >> 32);
+    return (uint32_t) product;
+}
+
+
+/** Philox4x32-10
+    @param seed     The key
+    @param counter  The four words of the counter; these are replaced with the random bits
+ */
+static inline void BWPhilox4x32(uint64_t seed, uint32_t counter[4])
+{
+    uint32_t k0 = (uint32_t) seed;
+    uint32_t k1 = (uint32_t)(seed >> 32);
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    for (int round = 0; round < 10; round++)
+    {
+        uint32_t hi0, hi1;
+        uint32_t lo0 = BWMulHiLo(0xD2511F53u, c0, &hi0);
+        uint32_t lo1 = BWMulHiLo(0xCD9E8D57u, c2, &hi1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        // Bump the key
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    counter[0] = c0;
+    counter[1] = c1;
+    counter[2] = c2;
+    counter[3] = c3;
+}
+
+
+/** A random number for a particle
+    @param seed    The user's seed
+    @param idx     The index of the particle
+    @param frame   The frame number
+    @param stream  What the number is used for (BWRandomStreamMove, ...)
+    @returns 32 random bits
+ */
+static inline uint32_t BWParticleRandom(uint64_t seed, uint32_t idx, uint32_t frame, uint32_t stream)
+{
+    uint32_t counter[4] = {idx, frame, stream, 0};
+    BWPhilox4x32(seed, counter);
+    return counter[0];
+}
+
+
+/** All four words of a particle's random number; the first is BWParticleRandom()'s
+    @param seed    The user's seed
+    @param idx     The index of the particle
+    @param frame   The frame number
+    @param stream  What the number is used for (BWRandomStreamMove, ...)
+    @param random  Receives 128 random bits
+ */
+static inline void BWParticleRandom4(uint64_t seed, uint32_t idx, uint32_t frame, uint32_t stream, uint32_t random[4])
+{
+    random[0] = idx;
+    random[1] = frame;
+    random[2] = stream;
+    random[3] = 0;
+    BWPhilox4x32(seed, random);
+}
+
+#endif
@@ -0,0 +1,441 @@
+/*
+    BWRaster.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    The CPU version of BWGrid (GLRender) drawParticles:, and particle.vsh / particle.fsh
+ */
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "BWRaster.h"
+
+/// The number of pixels wide and high each tile of the screen is
+#define RASTER_TILE (64)
+
+/// The number of segments in each chunk of the binning
+#define SEGMENT_CHUNK (16384)
+
+
+/// The value of each 8 bit channel, from 0 to 1
+static float const* unorm8()
+{
+    static float table[256];
+    static bool const ready = []()
+    {
+        for (int i = 0; i < 256; i++)
+            table[i] = i / 255.0f;
+        return true;
+    }();
+    (void) ready;
+    return table;
+}
+
+
+/** Narrow [xlo, xhi] to where lo <= a*x + b <= hi
+    @param a    The slope
+    @param b    The offset
+    @param lo   The lower bound
+    @param hi   The upper bound
+    @param xlo  The start of the range
+    @param xhi  The end of the range
+ */
+static inline void clipLinear(float a, float b, float lo, float hi, float& xlo, float& xhi)
+{
+    if (a > 0.0f)
+    {
+        xlo = std::max(xlo, (lo - b)/a);
+        xhi = std::min(xhi, (hi - b)/a);
+    }
+    else if (a < 0.0f)
+    {
+        xlo = std::max(xlo, (hi - b)/a);
+        xhi = std::min(xhi, (lo - b)/a);
+    }
+    else if (b < lo || b > hi)
+    {
+        xhi = xlo - 1.0f;
+    }
+}
+
+
+/** Create the image, cleared to transparent
+    @param width   The number of pixels wide; the same as the number of bins wide
+    @param height  The number of pixels high
+ */
+BWRaster::BWRaster(int width, int height)
+    : _width(width > 0 ? width : 0)
+    , _height(height > 0 ? height : 0)
+    , numXTiles((_width  + RASTER_TILE-1) / RASTER_TILE)
+    , numYTiles((_height + RASTER_TILE-1) / RASTER_TILE)
+    , lineWidth(LINE_WIDTH)
+    , trailParticles(0)
+    , trailLength(2)
+    , trailHead(1)
+    , image(4*(size_t)_width*_height, 0)
+    , pool(BWThreadPool::shared())
+{
+    setColor(1.0f, 1.0f, 1.0f, 1.0f);
+}
+
+
+/** Set the color for the particles (inColor1)
+    @param red    The red component, from 0 to 1
+    @param green  The green component
+    @param blue   The blue component
+    @param alpha  The alpha component
+ */
+void BWRaster::setColor(float red, float green, float blue, float alpha)
+{
+    color[0] = red;
+    color[1] = green;
+    color[2] = blue;
+    color[3] = alpha;
+}
+
+
+/// Clear the image to transparent black
+void BWRaster::clear()
+{
+    memset(image.data(), 0, image.size());
+}
+
+
+/** Fade the image, in place of clearing it, so that the segments build up into trails
+    @param keep  The fraction of each channel kept, from 0 to 1
+ */
+void BWRaster::fade(float keep)
+{
+    if (!(keep > 0.0f))
+    {
+        clear();
+        return;
+    }
+    // Each 8 bit value fades to the same one, so look them up
+    uint8_t table[256];
+    float const* toFloat = unorm8();
+    for (int i = 0; i < 256; i++)
+    {
+        float v = std::max(toFloat[i]*std::min(keep, 1.0f) - 1.0f/255.0f, 0.0f);
+        table[i] = (uint8_t)(v*255.0f + 0.5f);
+    }
+    uint8_t* pixels = image.data();
+    size_t rowBytes = this->rowBytes();
+    pool->parallelFor(_height, 16, [&](size_t begin, size_t end)
+    {
+        for (uint8_t* p = pixels + begin*rowBytes, *last = pixels + end*rowBytes; p < last; p++)
+            *p = table[*p];
+    });
+}
+
+
+/** Clip a segment to a rectangle (Liang-Barsky)
+    @param a     The tail; receives the clipped tail
+    @param b     The head; receives the clipped head
+    @param minX  The left edge of the rectangle
+    @param minY  The bottom edge
+    @param maxX  The right edge
+    @param maxY  The top edge
+    @returns false if none of the segment is in the rectangle
+ */
+static inline bool clipToRect(BWFloat2& a, BWFloat2& b, float minX, float minY, float maxX, float maxY)
+{
+    // Most of the segments are a pixel or so long, and well inside
+    if (std::min(a.x, b.x) >= minX && std::max(a.x, b.x) <= maxX
+        && std::min(a.y, b.y) >= minY && std::max(a.y, b.y) <= maxY)
+    {
+        return true;
+    }
+    float dx = b.x - a.x, dy = b.y - a.y;
+    float p[4] = {-dx, dx, -dy, dy};
+    float q[4] = {a.x - minX, maxX - a.x, a.y - minY, maxY - a.y};
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int i = 0; i < 4; i++)
+    {
+        if (p[i] == 0.0f)
+        {
+            if (q[i] < 0.0f)
+                return false;
+            continue;
+        }
+        float r = q[i] / p[i];
+        if (p[i] < 0.0f)
+            t0 = std::max(t0, r);
+        else
+            t1 = std::min(t1, r);
+    }
+    if (t0 > t1)
+        return false;
+    BWFloat2 tail = a;
+    if (t0 > 0.0f)
+        a = {tail.x + t0*dx, tail.y + t0*dy};
+    if (t1 < 1.0f)
+        b = {tail.x + t1*dx, tail.y + t1*dy};
+    return true;
+}
+
+
+/** Clip a segment to just outside of the image
+    @param a   The tail; receives the clipped tail
+    @param b   The head; receives the clipped head
+    @returns false if it doesn't touch the image (or isn't drawn at all)
+
+    The particles in the rows where the projection blows up move hundreds of thousands
+    of pixels in a step; openGL clips these to the viewport, and so does this.  The
+    margin keeps the clipped ends far enough out that where they are cut doesn't show.
+ */
+bool BWRaster::clipSegment(BWFloat2& a, BWFloat2& b) const
+{
+    // openGL doesn't draw lines of no length -- which is what the respawned particles are --
+    // and the NaN's are left out too
+    float dx = b.x - a.x, dy = b.y - a.y;
+    float length2 = dx*dx + dy*dy;
+    if (!(length2 > 0.0f) || !(length2 < INFINITY) || !(fabsf(a.x) < INFINITY) || !(fabsf(a.y) < INFINITY))
+        return false;
+    float margin = 0.5f*lineWidth + 1.0f;
+    if (!clipToRect(a, b, -margin, -margin, _width + margin, _height + margin))
+        return false;
+    dx = b.x - a.x;
+    dy = b.y - a.y;
+    return dx*dx + dy*dy > 0.0f;
+}
+
+
+/** Call body with the index of each tile that a clipped segment might touch
+    @param a     The clipped tail
+    @param b     The clipped head
+    @param body  Called with each tile's index
+
+    A long diagonal would touch most of the tiles in its bounding box; this goes band
+    by band (each row of tiles), with just the columns of the piece of the segment in it.
+ */
+template <class Body>
+void BWRaster::forEachTile(BWFloat2 a, BWFloat2 b, Body const& body) const
+{
+    float margin = 0.5f*lineWidth + 1.0f;
+    float minY = std::min(a.y, b.y) - margin, maxY = std::max(a.y, b.y) + margin;
+    int ty0 = std::max((int) floorf(minY / RASTER_TILE), 0);
+    int ty1 = std::min((int) floorf(maxY / RASTER_TILE), (int) numYTiles - 1);
+    if (ty0 == ty1)
+    {
+        int tx0 = std::max((int) floorf((std::min(a.x, b.x) - margin) / RASTER_TILE), 0);
+        int tx1 = std::min((int) floorf((std::max(a.x, b.x) + margin) / RASTER_TILE), (int) numXTiles - 1);
+        for (int tx = tx0; tx <= tx1; tx++)
+            body(ty0*numXTiles + tx);
+        return;
+    }
+    for (int ty = ty0; ty <= ty1; ty++)
+    {
+        BWFloat2 tail = a, head = b;
+        float bandX = (float)(2*_width) + 2*margin;
+        if (!clipToRect(tail, head, -bandX, (float)(ty*RASTER_TILE) - margin
+                        , bandX, (float)((ty+1)*RASTER_TILE) + margin))
+        {
+            continue;
+        }
+        int tx0 = std::max((int) floorf((std::min(tail.x, head.x) - margin) / RASTER_TILE), 0);
+        int tx1 = std::min((int) floorf((std::max(tail.x, head.x) + margin) / RASTER_TILE), (int) numXTiles - 1);
+        for (int tx = tx0; tx <= tx1; tx++)
+            body(ty*numXTiles + tx);
+    }
+}
+
+
+/** Sort the segments into the tiles they touch
+    @param vertices     The rings of the trails (see segment())
+    @param numSegments  The number of segments
+
+    Each chunk of segments counts how many touch each tile, the counts are summed
+    (tile by tile, chunk by chunk) into where each chunk's segments go in the tile's
+    list, and then each chunk puts its segments there.  So each tile's list is in the
+    order the segments were given, no matter how the chunks are split among threads.
+ */
+void BWRaster::binSegments(BWFloat2 const* vertices, int numSegments)
+{
+    uint32_t numTiles = numXTiles * numYTiles;
+    size_t chunk = std::max<size_t>(SEGMENT_CHUNK, (numSegments + 4*pool->numWorkers() - 1) / (4*pool->numWorkers()));
+    size_t numChunks = (numSegments + chunk - 1) / chunk;
+    binCounts.assign(numChunks*numTiles, 0);
+    tileStart.resize(numTiles+1);
+
+    pool->parallelFor(numChunks, 1, [&](size_t first, size_t last)
+    {
+        for (size_t c = first; c < last; c++)
+        {
+            uint32_t* counts = binCounts.data() + c*numTiles;
+            size_t end = std::min<size_t>((c+1)*chunk, numSegments);
+            for (size_t idx = c*chunk; idx < end; idx++)
+            {
+                BWFloat2 a, b;
+                segment(vertices, (uint32_t) idx, a, b);
+                if (clipSegment(a, b))
+                    forEachTile(a, b, [&](uint32_t tile) { counts[tile]++; });
+            }
+        }
+    });
+
+    // Turn the counts into where each chunk's first segment in each tile goes
+    uint32_t offset = 0;
+    for (uint32_t tile = 0; tile < numTiles; tile++)
+    {
+        tileStart[tile] = offset;
+        for (size_t c = 0; c < numChunks; c++)
+        {
+            uint32_t& count = binCounts[c*numTiles + tile];
+            uint32_t n = count;
+            count = offset;
+            offset += n;
+        }
+    }
+    tileStart[numTiles] = offset;
+    tileSegments.resize(offset);
+
+    pool->parallelFor(numChunks, 1, [&](size_t first, size_t last)
+    {
+        for (size_t c = first; c < last; c++)
+        {
+            uint32_t* offsets = binCounts.data() + c*numTiles;
+            size_t end = std::min<size_t>((c+1)*chunk, numSegments);
+            for (size_t idx = c*chunk; idx < end; idx++)
+            {
+                BWFloat2 a, b;
+                segment(vertices, (uint32_t) idx, a, b);
+                if (clipSegment(a, b))
+                    forEachTile(a, b, [&](uint32_t tile) { tileSegments[offsets[tile]++] = (uint32_t) idx; });
+            }
+        }
+    });
+}
+
+
+/** Draw the segments that touch a tile, clipped to it
+    @param tile      The index of the tile
+    @param vertices  The rings of the trails
+
+    The line is the rectangle within half the line width of the segment: a pixel is
+    drawn if its center is in it.  The varying Position_coord is interpolated along
+    the line, so the P in particle.fsh is the offset from the line to the pixel center.
+ */
+void BWRaster::drawTile(uint32_t tile, BWFloat2 const* vertices) const
+{
+    int tileX0 = (int)(tile % numXTiles) * RASTER_TILE;
+    int tileY0 = (int)(tile / numXTiles) * RASTER_TILE;
+    int tileX1 = std::min(tileX0 + RASTER_TILE, _width)  - 1;
+    int tileY1 = std::min(tileY0 + RASTER_TILE, _height) - 1;
+    float const* toFloat = unorm8();
+    float h = 0.5f*lineWidth;
+    // The order of the channels in memory
+    float const bgra[4] = {color[2], color[1], color[0], color[3]};
+    uint8_t* pixels = const_cast<uint8_t*>(image.data());
+
+    for (uint32_t i = tileStart[tile]; i < tileStart[tile+1]; i++)
+    {
+        BWFloat2 a, b;
+        segment(vertices, tileSegments[i], a, b);
+        clipSegment(a, b);
+        // The pixel centers (x+0.5) within half the line width of the segment's bounds
+        int x0 = std::max((int) ceilf (std::min(a.x, b.x) - h - 0.5f), tileX0);
+        int x1 = std::min((int) floorf(std::max(a.x, b.x) + h - 0.5f), tileX1);
+        int y0 = std::max((int) ceilf (std::min(a.y, b.y) - h - 0.5f), tileY0);
+        int y1 = std::min((int) floorf(std::max(a.y, b.y) + h - 0.5f), tileY1);
+
+        float dx = b.x - a.x, dy = b.y - a.y;
+        float length2 = dx*dx + dy*dy;
+        float invLength = 1.0f / sqrtf(length2);
+        float invLength2 = 1.0f / length2;
+        for (int py = y0; py <= y1; py++)
+        {
+            // The distance along the line (t) and from it (s) are linear in x; narrow the
+            // row to where they are in range, with a little slack for the rounding
+            float ry = (py + 0.5f) - a.y;
+            float xlo = x0 + 0.5f, xhi = x1 + 0.5f;
+            clipLinear(dx*invLength2, (ry*dy - a.x*dx)*invLength2, -0.01f, 1.01f, xlo, xhi);
+            clipLinear(dy*invLength, -(a.x*dy + ry*dx)*invLength, -h-0.01f, h+0.01f, xlo, xhi);
+            if (!(xlo <= xhi))
+                continue;
+            int px0 = std::max(x0, (int) ceilf(xlo - 0.5f));
+            int px1 = std::min(x1, (int) floorf(xhi - 0.5f));
+
+            uint8_t* p = pixels + 4*((size_t) py*_width + px0);
+            for (int px = px0; px <= px1; px++, p += 4)
+            {
+                float rx = (px + 0.5f) - a.x;
+                float t = (rx*dx + ry*dy) * invLength2;
+                float s = (rx*dy - ry*dx) * invLength;
+                if (t < 0.0f || t >= 1.0f || s < -h || s >= h)
+                    continue;
+
+                // particle.fsh: mix(alphaColor, inColor1, clamp((1.0-R/1.0)+R/8.0,0.0,1.0))
+                float R = s*s;
+                float f = std::min(std::max((1.0f-R/1.0f)+R/8.0f, 0.0f), 1.0f);
+                float srcA = bgra[3]*f;
+                // glAlphaFunc(GL_GREATER, 0.0f)
+                if (!(srcA > 0.0f))
+                    continue;
+                // glBlendFunc(GL_SRC_ALPHA, GL_DST_ALPHA), clamped and stored back as 8 bits
+                float dstA = toFloat[p[3]];
+                for (int c = 0; c < 4; c++)
+                {
+                    float v = bgra[c]*f*srcA + toFloat[p[c]]*dstA;
+                    p[c] = (uint8_t)(std::min(v, 1.0f)*255.0f + 0.5f);
+                }
+            }
+        }
+    }
+}
+
+
+/** Draw the segments over what is in the image
+    @param vertices     The tail/head pair of each segment, in pixels
+    @param numSegments  The number of segments (particles)
+ */
+void BWRaster::drawSegments(BWFloat2 const* vertices, int numSegments)
+{
+    drawTrails(vertices, numSegments, 2, 1);
+}
+
+
+/** Draw the trails of the particles over what is in the image
+    @param vertices      The ring of trailLength positions of each particle, in pixels
+    @param numParticles  The number of particles
+    @param trailLength   The number of positions in each ring
+    @param head          The slot of the rings written last
+ */
+void BWRaster::drawTrails(BWFloat2 const* vertices, int numParticles, int trailLength, int head)
+{
+    if (numParticles <= 0 || trailLength < 2 || image.empty() || !(lineWidth > 0.0f))
+        return;
+    trailParticles = (uint32_t) numParticles;
+    this->trailLength = (uint32_t) trailLength;
+    trailHead      = (uint32_t)(((head % trailLength) + trailLength) % trailLength);
+    int numSegments = (trailLength - 1) * numParticles;
+    binSegments(vertices, numSegments);
+    // Each tile is only touched by the one thread
+    pool->parallelFor(numXTiles*numYTiles, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t tile = begin; tile < end; tile++)
+            drawTile((uint32_t) tile, vertices);
+    });
+}
@@ -0,0 +1,195 @@
+/*
+    BWRaster.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWRaster_h
+#define BWRaster_h
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "BWCPUTypes.h"
+#include "BWThreadPool.h"
+
+/** Draws the particle motions into an image on the CPU, the way BWGrid (GLRender)
+    draws them with openGL: each tail/head pair is a GL_LINES segment LINE_WIDTH
+    pixels thick, shaded as in particle.fsh -- the color fades with the square of
+    the distance from the line, clamp(1 - R + R/8) -- and blended with
+    glBlendFunc(GL_SRC_ALPHA, GL_DST_ALPHA), dropping the fragments with no alpha.
+
+    The segments are first sorted into square tiles of the screen, keeping the
+    order they were given in (the blend depends on it), and then the tiles are
+    drawn in parallel, each by one thread.
+
+    The image is RGBA8, with the bytes in the order of HostFormat on a little
+    endian machine (B, G, R, A), and row 0 at the bottom (y = 0), as in the openGL
+    texture that the plug-in hands to Quartz Composer flipped.
+ */
+class BWRaster
+{
+public:
+    /** Create the image, cleared to transparent
+        @param width   The number of pixels wide; the same as the number of bins wide
+        @param height  The number of pixels high
+     */
+    BWRaster(int width, int height);
+
+    /** Set the color for the particles (inColor1)
+        @param red    The red component, from 0 to 1
+        @param green  The green component
+        @param blue   The blue component
+        @param alpha  The alpha component
+     */
+    void setColor(float red, float green, float blue, float alpha);
+
+    /** Set how thick to draw the lines
+        @param width  The thickness in pixels; LINE_WIDTH by default
+     */
+    void setLineWidth(float width) { lineWidth = width > 0.0f ? width : 0.0f; }
+
+    /** Select the threads that the tiles are drawn on
+        @param pool  The pool of threads; by default BWThreadPool::shared()
+     */
+    void setThreadPool(std::shared_ptr<BWThreadPool> pool) { this->pool = pool ? pool : BWThreadPool::shared(); }
+
+    /// Clear the image to transparent black (CLEAR_BACKGROUND_EN)
+    void clear();
+
+    /** Fade the image, in place of clearing it, so that the segments build up into trails
+        @param keep  The fraction of each channel kept, from 0 to 1
+
+        As BWGrid (GLRender) fadeTrails: does, one step (1/255) is taken off after the
+        multiply, so that the faint trails fade all the way out.
+     */
+    void fade(float keep);
+
+    /** Draw the segments over what is in the image
+        @param vertices     The tail/head pair of each segment, in pixels
+        @param numSegments  The number of segments (particles)
+     */
+    void drawSegments(BWFloat2 const* vertices, int numSegments);
+
+    /** Draw the trails of the particles over what is in the image, as BWGrid (GLRender) draws
+        them with TRAIL_LENGTH (see BWCPUGrid::setTrailLength)
+        @param vertices      The ring of trailLength positions of each particle, in pixels
+        @param numParticles  The number of particles
+        @param trailLength   The number of positions in each ring
+        @param head          The slot of the rings written last; the segment from it to the
+                             next slot, the oldest position, isn't drawn
+
+        The segments are drawn in the order of the plug-in's index buffer: slot j to slot j+1
+        of every particle, for each j in turn.  Pairs, with a trailLength of 2 and a head of 1,
+        are drawn as drawSegments() draws them.
+     */
+    void drawTrails(BWFloat2 const* vertices, int numParticles, int trailLength, int head);
+
+    /// The number of pixels wide
+    int width() const { return _width; }
+    /// The number of pixels high
+    int height() const { return _height; }
+    /// The pixels, bottom row first
+    uint8_t const* pixels() const { return image.data(); }
+    /// The number of bytes in each row of pixels
+    size_t rowBytes() const { return 4*(size_t)_width; }
+
+private:
+    /** The ends of a segment of the trails being drawn
+        @param vertices  The rings of the trails
+        @param idx       The index of the segment: in the block idx / trailParticles, leaving
+                         out the one at trailHead, which joins that slot of each ring to the next
+        @param a         Receives the tail
+        @param b         Receives the head
+     */
+    void segment(BWFloat2 const* vertices, uint32_t idx, BWFloat2& a, BWFloat2& b) const
+    {
+        if (2 == trailLength && 1 == trailHead)
+        {
+            a = vertices[2*idx];
+            b = vertices[2*idx+1];
+            return;
+        }
+        uint32_t block = idx / trailParticles;
+        uint32_t slot  = block < trailHead ? block : block + 1;
+        BWFloat2 const* trail = vertices + (size_t) trailLength*(idx - block*trailParticles);
+        a = trail[slot];
+        b = trail[slot+1 < trailLength ? slot+1 : 0];
+    }
+
+    /** Sort the segments into the tiles they touch
+        @param vertices     The rings of the trails
+        @param numSegments  The number of segments
+     */
+    void binSegments(BWFloat2 const* vertices, int numSegments);
+
+    /** Draw the segments that touch a tile, clipped to it
+        @param tile      The index of the tile
+        @param vertices  The rings of the trails
+     */
+    void drawTile(uint32_t tile, BWFloat2 const* vertices) const;
+
+    /** Clip a segment to just outside of the image
+        @param a   The tail; receives the clipped tail
+        @param b   The head; receives the clipped head
+        @returns false if it doesn't touch the image (or isn't drawn at all)
+     */
+    bool clipSegment(BWFloat2& a, BWFloat2& b) const;
+
+    /** Call body with the index of each tile that a clipped segment might touch
+        @param a     The clipped tail
+        @param b     The clipped head
+        @param body  Called with each tile's index
+     */
+    template <class Body>
+    void forEachTile(BWFloat2 a, BWFloat2 b, Body const& body) const;
+
+    int   _width;
+    int   _height;
+    /// The number of tiles across and down
+    uint32_t numXTiles;
+    uint32_t numYTiles;
+
+    /// The particle color (red, green, blue, alpha)
+    float color[4];
+    /// How thick the lines are, in pixels
+    float lineWidth;
+    /// The trails being drawn: the number of particles, the positions in each one's ring,
+    /// and the slot written last
+    uint32_t trailParticles;
+    uint32_t trailLength;
+    uint32_t trailHead;
+
+    /// The pixels, B G R A
+    std::vector<uint8_t>  image;
+    /// The counts (then offsets) of the segments in each tile, for each chunk of segments
+    std::vector<uint32_t> binCounts;
+    /// Where each tile's segments start in tileSegments; one more than the number of tiles
+    std::vector<uint32_t> tileStart;
+    /// The segments that touch each tile, tile by tile, in the order they were given
+    std::vector<uint32_t> tileSegments;
+
+    /// The threads that the tiles are drawn on
+    std::shared_ptr<BWThreadPool> pool;
+};
+
+#endif
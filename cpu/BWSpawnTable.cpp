@@ -0,0 +1,211 @@
+/*
+    BWSpawnTable.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "BWSpawnTable.h"
+
+#define BW_PI   3.1415926535897932384626433832795f
+
+
+/** The weight of a bin
+    @param v         The vector of the bin
+    @param y         The row of the bin
+    @param numYBins  The number of bins in the y axis
+    @returns The speed (up to BWSpawnMaxSpeed) times the area of the bin, or 0 if a
+             particle spawned there would be respawned straight away
+ */
+static inline float spawnWeight(BWFloat2 v, int y, int numYBins)
+{
+    // Too slow (as in particleMove), or in the last row, which is out of bounds
+    float m = v.x*v.x + v.y*v.y;
+    if (m < 2.0f || y >= numYBins-1)
+        return 0.0f;
+    // The bins are equal steps of latitude, so their area goes with the cosine of it
+    float area = sinf(BW_PI*(y+0.5f)/numYBins);
+    return fminf(sqrtf(m), BWSpawnMaxSpeed) * area;
+}
+
+
+/// The number of cells that cover a number of bins
+static inline uint32_t spawnNumCells(int numBins)
+{
+    return ((uint32_t) numBins + BWSpawnCellSize-1) / BWSpawnCellSize;
+}
+
+
+/** The number of cells in the table of a field
+    @param numXBins  The number of bins in the x axis
+    @param numYBins  The number of bins in the y axis
+    @returns The cells across times the cells down
+ */
+uint32_t spawnTableCount(int numXBins, int numYBins)
+{
+    return spawnNumCells(numXBins) * spawnNumCells(numYBins);
+}
+
+
+/** Add the weight of the bins in the rows [begin, end) to their cells, from a field of
+    floats laid out in rows.  Calls that run at once must not share a row of cells.
+    @param vectors   The vectors of the rows [begin, end), numXBins wide, starting at row begin
+    @param numXBins  The number of bins in the x axis
+    @param numYBins  The number of bins in the y axis
+    @param weights   The weight of each cell, spawnTableCount() of them, added to
+    @param begin     The first row
+    @param end       One past the last row
+ */
+void spawnWeights(BWFloat2 const* vectors
+                  , int numXBins, int numYBins
+                  , float* weights
+                  , int begin, int end
+                  )
+{
+    uint32_t numXCells = spawnNumCells(numXBins);
+    for (int y = begin; y < end; y++)
+    {
+        float* cells = weights + (size_t)(y / BWSpawnCellSize)*numXCells;
+        BWFloat2 const* src = vectors + (size_t)(y-begin)*numXBins;
+        for (int x = 0; x < numXBins; x++)
+            cells[x / BWSpawnCellSize] += spawnWeight(src[x], y, numYBins);
+    }
+}
+
+
+/** Add the weight of the bins in the rows [begin, end) to their cells, sampled from the compact field
+    @param field     The compact field
+    See spawnWeights() for the other parameters
+ */
+void spawnWeightsSampled(BWSourceField const* field
+                         , int numXBins, int numYBins
+                         , float* weights
+                         , int begin, int end
+                         )
+{
+    BWUInt2 tgtSize = {(uint32_t) numXBins, (uint32_t) numYBins};
+    uint32_t numXCells = spawnNumCells(numXBins);
+    for (int y = begin; y < end; y++)
+    {
+        float* cells = weights + (size_t)(y / BWSpawnCellSize)*numXCells;
+        for (int x = 0; x < numXBins; x++)
+        {
+            BWFloat2 position = {(float) x, (float) y};
+            cells[x / BWSpawnCellSize] += spawnWeight(gridLookup(field, tgtSize, position), y, numYBins);
+        }
+    }
+}
+
+
+/** Build the alias table from the weights of the cells
+    @param weights  The weight of each cell
+    @param count    The number of cells
+    @param table    Receives the count entries
+    @returns 0 if none of the cells has any weight (the table is then uniform)
+ */
+int spawnTableBuild(float const* weights, uint32_t count, BWSpawnEntry* table)
+{
+    double sum = 0.0;
+    for (uint32_t idx = 0; idx < count; idx++)
+        sum += weights[idx];
+    if (!(sum > 0.0))
+    {
+        for (uint32_t idx = 0; idx < count; idx++)
+        {
+            table[idx].threshold = 0xFFFFFFFFu;
+            table[idx].alias     = idx;
+        }
+        return 0;
+    }
+
+    // Scale the weights so that the average is 1, and sort the bins into those
+    // under (from the front of the work list) and over (from the back)
+    std::vector<double>   p(count);
+    std::vector<uint32_t> work(count);
+    uint32_t numSmall = 0, numLarge = 0;
+    double scale = count / sum;
+    for (uint32_t idx = 0; idx < count; idx++)
+    {
+        p[idx] = weights[idx] * scale;
+        if (p[idx] < 1.0)
+            work[numSmall++] = idx;
+        else
+            work[count - ++numLarge] = idx;
+    }
+
+    // Each small bin is topped up from a large one, which becomes its alias
+    while (numSmall && numLarge)
+    {
+        uint32_t small = work[--numSmall];
+        uint32_t large = work[count - numLarge--];
+        table[small].threshold = (uint32_t)(p[small] * 4294967296.0);
+        table[small].alias     = large;
+        p[large] = (p[large] + p[small]) - 1.0;
+        if (p[large] < 1.0)
+            work[numSmall++] = large;
+        else
+            work[count - ++numLarge] = large;
+    }
+
+    // What is left is full (or within rounding of it), and always keeps its own bin
+    while (numLarge)
+    {
+        uint32_t idx = work[count - numLarge--];
+        table[idx].threshold = 0xFFFFFFFFu;
+        table[idx].alias     = idx;
+    }
+    while (numSmall)
+    {
+        uint32_t idx = work[--numSmall];
+        table[idx].threshold = 0xFFFFFFFFu;
+        table[idx].alias     = idx;
+    }
+    return 1;
+}
+
+
+/** Draw a spawn position from the table
+    @param table     The alias table
+    @param numXBins  The number of bins in the x axis
+    @param numYBins  The number of bins in the y axis
+    @param random    128 random bits: the cell, the coin, and where in the cell
+    @returns The position, somewhere in the cell (and in the grid)
+ */
+BWFloat2 spawnTableSample(BWSpawnTable const* table, int numXBins, int numYBins, uint32_t const random[4])
+{
+    // The slot, without a divide
+    uint32_t cell = (uint32_t)(((uint64_t) random[0] * table->count) >> 32);
+    BWSpawnEntry entry = table->entries[cell];
+    if (random[1] >= entry.threshold)
+        cell = entry.alias;
+    uint32_t numXCells = spawnNumCells(numXBins);
+    uint32_t y = (cell / numXCells) * BWSpawnCellSize;
+    uint32_t x = (cell - (cell / numXCells)*numXCells) * BWSpawnCellSize;
+    // The cells on the far edges may be cut short by the grid
+    uint32_t width  = std::min<uint32_t>(BWSpawnCellSize, (uint32_t) numXBins - x);
+    uint32_t height = std::min<uint32_t>(BWSpawnCellSize, (uint32_t) numYBins - y);
+    // Somewhere in the cell, in 1/256ths, so that the sum can't round up into the next cell
+    BWFloat2 ret = {x + (random[2] >> 24) * width * (1.0f/256.0f), y + (random[3] >> 24) * height * (1.0f/256.0f)};
+    return ret;
+}
@@ -0,0 +1,138 @@
+/*
+    BWSpawnTable.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWSpawnTable_h
+#define BWSpawnTable_h
+
+#include <stdint.h>
+#include "BWCPUTypes.h"
+#include "BWGridBuild.h"
+
+/*
+    Where the particles are (re)spawned.  Spawned uniformly, a good many particles
+    land in calm bins, and the next step finds them too slow and respawns them again.
+    So that they start where they will live long enough to be seen, each bin is
+    weighted by its speed, its area on the globe, and whether a particle can live
+    there at all, and the bins are drawn from that with an alias table (Walker, with
+    Vose's construction): one random index, one coin toss, O(1) per spawn.
+
+    The table weighs cells of BWSpawnCellSize x BWSpawnCellSize bins, rather than each
+    bin, so that it is a small part of the field's memory (half a byte a bin, against
+    the 4 to 8 of the vectors); a spawn lands anywhere in the cell drawn.
+
+    The probabilities are kept as 32 bit thresholds, compared with 32 random bits, so
+    that the C++ and openCL spawns pick the same bins.  The functions are plain C so
+    that the openCL / Objective-C side can build the table too.
+ */
+
+/// Setting this to 1 spawns the particle streams by the speed of the field (as in AppConfig.h)
+#ifndef SPAWN_TABLE_EN
+#define SPAWN_TABLE_EN (1)
+#endif
+
+/// The speed past which a bin weighs no more: two bins a step (of STEP_DT).  Faster than
+/// that, a trail is no easier to see, and the fastest bins -- near the poles, where
+/// gridDistort blows up -- would otherwise take nearly all of the spawns
+#define BWSpawnMaxSpeed (2.0f / STEP_DT)
+
+/// The bins across (and down) each cell of the table; the same as SPAWN_CELL_SIZE in particleMove.cl
+#define BWSpawnCellSize (4)
+
+/// One cell of the alias table; the same layout as cl_uint2
+typedef struct BWSpawnEntry
+{
+    /// The cell is kept if the coin (32 random bits) is below this, otherwise it is the alias
+    uint32_t threshold;
+    /// The cell that takes the rest of this one's slot
+    uint32_t alias;
+} BWSpawnEntry;
+
+/// The alias table of a field: spawnTableCount() entries, one for each cell in row order
+typedef struct BWSpawnTable
+{
+    BWSpawnEntry const* entries;
+    /// The number of entries; 0 if there is no table and the spawns are uniform
+    uint32_t            count;
+} BWSpawnTable;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The number of cells in the table of a field
+    @param numXBins  The number of bins in the x axis
+    @param numYBins  The number of bins in the y axis
+    @returns The cells across times the cells down
+ */
+uint32_t spawnTableCount(int numXBins, int numYBins);
+
+/** Add the weight of the bins in the rows [begin, end) to their cells, from a field of
+    floats laid out in rows.  Calls that run at once must not share a row of cells.
+    @param vectors   The vectors of the rows [begin, end), numXBins wide, starting at row begin
+    @param numXBins  The number of bins in the x axis
+    @param numYBins  The number of bins in the y axis
+    @param weights   The weight of each cell, spawnTableCount() of them, added to
+    @param begin     The first row
+    @param end       One past the last row
+ */
+void spawnWeights(BWFloat2 const* vectors
+                  , int numXBins, int numYBins
+                  , float* weights
+                  , int begin, int end
+                  );
+
+/** Add the weight of the bins in the rows [begin, end) to their cells, sampled from the compact field
+    @param field     The compact field; the vector of each bin is looked up as gridInterpolate
+                     would have given it, so this works whichever way the field is stored
+    See spawnWeights() for the other parameters
+ */
+void spawnWeightsSampled(BWSourceField const* field
+                         , int numXBins, int numYBins
+                         , float* weights
+                         , int begin, int end
+                         );
+
+/** Build the alias table from the weights of the cells
+    @param weights  The weight of each cell
+    @param count    The number of cells
+    @param table    Receives the count entries
+    @returns 0 if none of the cells has any weight (the table is then uniform)
+ */
+int spawnTableBuild(float const* weights, uint32_t count, BWSpawnEntry* table);
+
+/** Draw a spawn position from the table
+    @param table     The alias table
+    @param numXBins  The number of bins in the x axis
+    @param numYBins  The number of bins in the y axis
+    @param random    128 random bits: the cell, the coin, and where in the cell
+    @returns The position, somewhere in the cell (and in the grid)
+ */
+BWFloat2 spawnTableSample(BWSpawnTable const* table, int numXBins, int numYBins, uint32_t const random[4]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+/*
+    BWStats.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include "BWStats.h"
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+
+/** Clear the statistics
+    @param stats  The statistics
+ */
+void BWStatsInit(BWStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+
+/// The time, in seconds, on a clock that only goes forward
+double BWStatsNow(void)
+{
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom)
+        mach_timebase_info(&timebase);
+    return 1e-9 * mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1e-9*now.tv_nsec;
+#endif
+}
+
+
+/** Add a sample
+    @param rolling  The samples
+    @param value    The new sample
+ */
+void BWRollingAdd(BWRolling* rolling, double value)
+{
+    rolling->samples[rolling->next] = value;
+    rolling->next = (rolling->next + 1) % BWStatsWindow;
+    if (rolling->count < BWStatsWindow)
+        rolling->count++;
+}
+
+
+/** The average of the samples
+    @param rolling  The samples
+    @returns The average, 0 if there are none
+ */
+double BWRollingAverage(BWRolling const* rolling)
+{
+    if (!rolling->count)
+        return 0.0;
+    double sum = 0.0;
+    for (uint32_t i = 0; i < rolling->count; i++)
+        sum += rolling->samples[i];
+    return sum / rolling->count;
+}
+
+
+/** The 99th percentile of the samples (the nearest rank)
+    @param rolling  The samples
+    @returns The percentile, 0 if there are none
+ */
+double BWRollingP99(BWRolling const* rolling)
+{
+    if (!rolling->count)
+        return 0.0;
+    // This is only done when the statistics are read, so sorting a copy is fine
+    double sorted[BWStatsWindow];
+    std::copy(rolling->samples, rolling->samples + rolling->count, sorted);
+    uint32_t rank = (99*rolling->count + 99) / 100;
+    std::nth_element(sorted, sorted + rank-1, sorted + rolling->count);
+    return sorted[rank-1];
+}
+
+
+/** Add the time a stage took
+    @param stats    The statistics
+    @param stage    The stage
+    @param seconds  The time it took
+ */
+void BWStatsAddTime(BWStats* stats, BWStage stage, double seconds)
+{
+    BWRollingAdd(&stats->stage[stage], 1e3*seconds);
+}
+
+
+/** Close off the counts of a frame
+    @param stats  The statistics
+ */
+void BWStatsEndFrame(BWStats* stats)
+{
+    BWRollingAdd(&stats->respawnedInit, stats->frameInit);
+    BWRollingAdd(&stats->respawnedMove, stats->frameMove);
+    stats->frameInit = 0;
+    stats->frameMove = 0;
+    stats->numFrames++;
+}
+
+
+/** The name of a stage
+    @param stage  The stage
+    @returns The name, as used in BWStatsFormat
+ */
+char const* BWStageName(BWStage stage)
+{
+    static char const* const names[BWNumStages] = {"build", "respawn", "step", "draw", "flush", "frame"};
+    return stage < BWNumStages ? names[stage] : "?";
+}
+
+
+/** Write the rolling averages and 99th percentiles as one line, for the log
+    @param stats  The statistics
+    @param text   Receives the line
+    @param size   The number of bytes text can hold
+ */
+void BWStatsFormat(BWStats const* stats, char* text, size_t size)
+{
+    if (!size)
+        return;
+    text[0] = 0;
+    size_t length = (size_t) snprintf(text, size, "%u frames; ms avg/p99:", stats->numFrames);
+    for (int stage = 0; stage < BWNumStages && length < size; stage++)
+    {
+        if (!stats->stage[stage].count)
+            continue;
+        length += (size_t) snprintf(text + length, size - length, " %s %.2f/%.2f", BWStageName((BWStage) stage)
+                                    , BWRollingAverage(&stats->stage[stage]), BWRollingP99(&stats->stage[stage]));
+    }
+    if (length < size)
+    {
+        snprintf(text + length, size - length, "; respawned/frame avg/p99: init %.0f/%.0f move %.0f/%.0f"
+                 , BWRollingAverage(&stats->respawnedInit), BWRollingP99(&stats->respawnedInit)
+                 , BWRollingAverage(&stats->respawnedMove), BWRollingP99(&stats->respawnedMove));
+    }
+}
@@ -0,0 +1,171 @@
+/*
+    BWStats.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWStats_h
+#define BWStats_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "BWCPUTypes.h"
+
+/*
+    The timings and counts of each stage of the animation, for finding where the time
+    goes when the frames stutter.  The times are taken with a monotonic clock (or, for
+    the openCL kernels, gcl's timers), and kept for the last BWStatsWindow samples of
+    each stage, from which the rolling average and 99th percentile are worked out when
+    they are asked for.
+
+    Building with STATS_EN 0 takes the instrumentation out entirely: the BWStats...
+    macros expand to nothing, so there is no clock read or count in the hot paths.
+
+    The functions are plain C so that the plugin can use them as well.
+ */
+
+/// Setting this to 0 removes the instrumentation (as in AppConfig.h)
+#ifndef STATS_EN
+#define STATS_EN (1)
+#endif
+
+/// The number of samples the rolling statistics cover
+#define BWStatsWindow (128)
+
+/// The stages of the animation that are timed
+typedef enum BWStage
+{
+    /// gridBuildField (or gridBuild, for a compact field), of a new field
+    BWStageFieldBuild,
+    /// particleInit, of the particles being respawned (randomizeParticles)
+    BWStageRespawn,
+    /// particleMove, of all the particles
+    BWStageStep,
+    /// Drawing the particles
+    BWStageDraw,
+    /// Flushing the GL commands
+    BWStageFlush,
+    /// The whole frame
+    BWStageFrame,
+    BWNumStages
+} BWStage;
+
+/// The last few samples of something, for the rolling average and percentile
+typedef struct BWRolling
+{
+    double   samples[BWStatsWindow];
+    /// The number of samples, up to BWStatsWindow
+    uint32_t count;
+    /// Where the next sample goes
+    uint32_t next;
+} BWRolling;
+
+/// The statistics of the animation
+typedef struct BWStats
+{
+    /// The time each stage takes, in milliseconds
+    BWRolling stage[BWNumStages];
+    /// The number of particles respawned each frame by randomizeParticles
+    BWRolling respawnedInit;
+    /// The number of particles respawned each frame by particleMove, since they went
+    /// out of bounds or were moving too slowly (m < 2)
+    BWRolling respawnedMove;
+    /// The counts so far this frame
+    uint32_t  frameInit;
+    uint32_t  frameMove;
+    /// The number of frames
+    uint32_t  numFrames;
+} BWStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Clear the statistics
+    @param stats  The statistics
+ */
+void BWStatsInit(BWStats* stats);
+
+/// The time, in seconds, on a clock that only goes forward
+double BWStatsNow(void);
+
+/** Add a sample
+    @param rolling  The samples
+    @param value    The new sample
+ */
+void BWRollingAdd(BWRolling* rolling, double value);
+
+/** The average of the samples
+    @param rolling  The samples
+    @returns The average, 0 if there are none
+ */
+double BWRollingAverage(BWRolling const* rolling);
+
+/** The 99th percentile of the samples (the nearest rank)
+    @param rolling  The samples
+    @returns The percentile, 0 if there are none
+ */
+double BWRollingP99(BWRolling const* rolling);
+
+/** Add the time a stage took
+    @param stats    The statistics
+    @param stage    The stage
+    @param seconds  The time it took
+ */
+void BWStatsAddTime(BWStats* stats, BWStage stage, double seconds);
+
+/** Close off the counts of a frame
+    @param stats  The statistics
+ */
+void BWStatsEndFrame(BWStats* stats);
+
+/** The name of a stage
+    @param stage  The stage
+    @returns The name, as used in BWStatsFormat
+ */
+char const* BWStageName(BWStage stage);
+
+/** Write the rolling averages and 99th percentiles as one line, for the log
+    @param stats  The statistics
+    @param text   Receives the line
+    @param size   The number of bytes text can hold
+ */
+void BWStatsFormat(BWStats const* stats, char* text, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#if STATS_EN
+/// Note the time a stage starts, in a variable of that name
+#define BWStatsStart(start)               double start = BWStatsNow()
+/// Add the time since the stage started
+#define BWStatsStop(stats, stage, start)  BWStatsAddTime(stats, stage, BWStatsNow() - (start))
+/// Add to one of the counts of the frame
+#define BWStatsCount(stats, count, n)     ((stats)->count += (n))
+#else
+#define BWStatsStart(start)
+#define BWStatsStop(stats, stage, start)
+#define BWStatsCount(stats, count, n)
+#endif
+
+#endif
@@ -0,0 +1,250 @@
+/*
+    BWThreadPool.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <exception>
+#include "BWThreadPool.h"
+
+/// The state of a parallelFor() call
+struct BWThreadPool::Job
+{
+    Body const*             body;
+    /// The number of chunks that haven't finished
+    std::atomic<size_t>     remaining;
+    std::mutex              lock;
+    std::condition_variable done;
+    /// Set once a chunk has thrown; the rest are skipped
+    std::atomic<bool>       failed;
+    /// The first exception thrown, rethrown by parallelFor() (guarded by lock)
+    std::exception_ptr      error;
+};
+
+
+/** Create the pool
+    @param numWorkers  The number of threads that work on the chunks, including
+                       the one that calls parallelFor(); 0 means one per core
+ */
+BWThreadPool::BWThreadPool(int numWorkers)
+    : numQueued(0)
+    , stopping(false)
+{
+    if (numWorkers < 1)
+    {
+        numWorkers = (int) std::thread::hardware_concurrency();
+        if (numWorkers < 1)
+            numWorkers = 1;
+    }
+    for (int i = 0; i < numWorkers; i++)
+    {
+        queues.push_back(std::unique_ptr<Queue>(new Queue));
+    }
+    // Queue 0 belongs to whichever thread calls parallelFor()
+    for (int i = 1; i < numWorkers; i++)
+    {
+        threads.push_back(std::thread(&BWThreadPool::workerLoop, this, i));
+    }
+}
+
+
+BWThreadPool::~BWThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(idleLock);
+        stopping = true;
+    }
+    idle.notify_all();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+
+/// The pool shared by everything that isn't given one of its own
+std::shared_ptr<BWThreadPool> BWThreadPool::shared()
+{
+    static std::shared_ptr<BWThreadPool> pool = std::make_shared<BWThreadPool>();
+    return pool;
+}
+
+
+/** Take a chunk from our own queue, or steal one from another
+    @param index  The index of the worker
+    @param task   Receives the chunk
+    @returns true if a chunk was found
+ */
+bool BWThreadPool::takeTask(int index, Task& task)
+{
+    if (!numQueued.load(std::memory_order_acquire))
+        return false;
+    size_t numQueues = queues.size();
+    for (size_t i = 0; i < numQueues; i++)
+    {
+        Queue& queue = *queues[(index + i) % numQueues];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty())
+            continue;
+        // Our own work comes off the back (it is the most recently queued, and
+        // likely still in cache); stolen work comes off the front
+        if (!i)
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        numQueued.fetch_sub(1, std::memory_order_acq_rel);
+        return true;
+    }
+    return false;
+}
+
+
+/** Run the chunk and mark it done
+    @param task  The chunk
+
+    An exception thrown by the body is kept for parallelFor() to rethrow: the job is on
+    its stack, so the chunk has to be marked done whatever happens.
+ */
+void BWThreadPool::runTask(Task const& task)
+{
+    Job* job = task.job;
+    std::exception_ptr error;
+    if (!job->failed.load(std::memory_order_acquire))
+    {
+        try
+        {
+            (*job->body)(task.begin, task.end);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+    }
+    // This is done holding the lock, so that parallelFor() can't return (and free
+    // the job) between the count reaching zero and the notify
+    std::lock_guard<std::mutex> guard(job->lock);
+    if (error && !job->error)
+    {
+        job->error = error;
+        job->failed.store(true, std::memory_order_release);
+    }
+    if (1 == job->remaining.fetch_sub(1, std::memory_order_acq_rel))
+    {
+        // That was the last one; wake up the thread waiting in parallelFor()
+        job->done.notify_all();
+    }
+}
+
+
+/// The loop each of the background threads runs
+void BWThreadPool::workerLoop(int index)
+{
+    for (;;)
+    {
+        Task task;
+        if (takeTask(index, task))
+        {
+            runTask(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(idleLock);
+        idle.wait(guard, [this]{ return stopping || numQueued.load(std::memory_order_acquire); });
+        if (stopping)
+            return;
+    }
+}
+
+
+/** Apply the body to each chunk of [0, count), and wait for them to finish
+    @param count      The number of items
+    @param chunkSize  The number of items in each chunk
+    @param body       The function to apply to each chunk
+
+    If the body throws, the chunks not yet started are skipped, and the first
+    exception is rethrown here once no thread is still working on the job.
+ */
+void BWThreadPool::parallelFor(size_t count, size_t chunkSize, Body const& body)
+{
+    if (!count)
+        return;
+    if (!chunkSize)
+        chunkSize = 1;
+    size_t numChunks = (count + chunkSize - 1) / chunkSize;
+    // Don't bother the other threads with a single chunk.
+    // The chunks are still run one at a time, as the body may depend on their boundaries
+    if (numChunks < 2 || queues.size() < 2)
+    {
+        for (size_t begin = 0; begin < count; begin += chunkSize)
+        {
+            body(begin, std::min(count, begin + chunkSize));
+        }
+        return;
+    }
+
+    Job job;
+    job.body = &body;
+    job.remaining.store(numChunks);
+    job.failed.store(false);
+
+    // Deal the chunks out to the queues, so that each worker starts with a
+    // contiguous run of them
+    size_t numQueues = queues.size();
+    size_t perQueue  = (numChunks + numQueues - 1) / numQueues;
+    for (size_t q = 0; q < numQueues; q++)
+    {
+        Queue& queue = *queues[q];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        // Push them in reverse, so that the back of the queue is the start of the run
+        size_t first = q * perQueue;
+        size_t last  = std::min(numChunks, first + perQueue);
+        for (size_t c = last; c > first; c--)
+        {
+            Task task = {&job, (c-1)*chunkSize, std::min(count, c*chunkSize)};
+            queue.tasks.push_back(task);
+        }
+        numQueued.fetch_add(last > first ? last - first : 0, std::memory_order_acq_rel);
+    }
+    {
+        std::lock_guard<std::mutex> guard(idleLock);
+    }
+    idle.notify_all();
+
+    // Help out until there is nothing left to take
+    Task task;
+    while (job.remaining.load(std::memory_order_acquire) && takeTask(0, task))
+    {
+        runTask(task);
+    }
+
+    // Wait for the chunks that the other threads are still working on
+    std::unique_lock<std::mutex> guard(job.lock);
+    job.done.wait(guard, [&job]{ return !job.remaining.load(std::memory_order_acquire); });
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
@@ -0,0 +1,109 @@
+/*
+    BWThreadPool.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWThreadPool_h
+#define BWThreadPool_h
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** A work-stealing pool of threads, used to split the kernels across the cores.
+
+    parallelFor() cuts a range into chunks and deals them out to the per-worker
+    queues.  Each worker takes work from the back of its own queue and, when that
+    runs dry, steals from the front of the other workers' queues.  The thread that
+    calls parallelFor() works on the chunks too, until all of them are done.
+ */
+class BWThreadPool
+{
+public:
+    /// The function applied to each chunk: [begin, end)
+    typedef std::function<void(size_t begin, size_t end)> Body;
+
+    /** Create the pool
+        @param numWorkers  The number of threads that work on the chunks, including
+                           the one that calls parallelFor(); 0 means one per core
+     */
+    explicit BWThreadPool(int numWorkers = 0);
+    ~BWThreadPool();
+
+    /// The pool shared by everything that isn't given one of its own
+    static std::shared_ptr<BWThreadPool> shared();
+
+    /// The number of threads that work on the chunks
+    int numWorkers() const { return (int) queues.size(); }
+
+    /** Apply the body to each chunk of [0, count), and wait for them to finish
+        @param count      The number of items
+        @param chunkSize  The number of items in each chunk
+        @param body       The function to apply to each chunk
+
+        If the body throws, the chunks not yet started are skipped, and the first
+        exception is rethrown here once no thread is still working on the job.
+     */
+    void parallelFor(size_t count, size_t chunkSize, Body const& body);
+
+private:
+    struct Job;
+    /// A chunk of a job
+    struct Task
+    {
+        Job*   job;
+        size_t begin;
+        size_t end;
+    };
+    /// The queue of chunks for a worker
+    struct Queue
+    {
+        std::mutex       lock;
+        std::deque<Task> tasks;
+    };
+
+    /// The loop each of the background threads runs
+    void workerLoop(int index);
+    /// Take a chunk from our own queue, or steal one from another
+    bool takeTask(int index, Task& task);
+    /// Run the chunk and mark it done
+    void runTask(Task const& task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    /// The number of chunks that are queued, but haven't been taken yet
+    std::atomic<size_t> numQueued;
+    /// The idle threads wait on this for more chunks to be queued
+    std::mutex              idleLock;
+    std::condition_variable idle;
+    bool                    stopping;
+};
+
+#endif
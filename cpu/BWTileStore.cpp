@@ -0,0 +1,354 @@
+/*
+    BWTileStore.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/magic.h>
+#include <sys/vfs.h>
+#else
+#include <sys/param.h>
+#include <sys/mount.h>
+#endif
+#include <algorithm>
+#include <string>
+#include <thread>
+#include "BWTileStore.h"
+
+
+/** True if a file is kept in memory (in a tmpfs), rather than on a disk
+    @param fd  The file
+ */
+static bool isMemoryBacked(int fd)
+{
+    struct statfs fs;
+    if (fstatfs(fd, &fs))
+        return false;
+#if defined(__linux__)
+    return TMPFS_MAGIC == fs.f_type || RAMFS_MAGIC == fs.f_type;
+#else
+    return !strcmp(fs.f_fstypename, "tmpfs");
+#endif
+}
+
+
+BWTileStore::BWTileStore()
+    : uData(nullptr)
+    , vData(nullptr)
+    , isContinuous(false)
+    , velocityScale(1.0f)
+    , storage(BWFieldStorageFloat)
+    , numXTiles(0)
+    , numTiles(0)
+    , tileBytes(0)
+    , blockBytes(0)
+    , numBlocks(0)
+    , fd(-1)
+    , memoryBacked(false)
+    , mapping(nullptr)
+    , mappingSize(0)
+    , numResident(0)
+    , epoch(0)
+    , builds(0)
+    , evictions(0)
+{
+    tgtSize.x = tgtSize.y = 0;
+}
+
+
+BWTileStore::~BWTileStore()
+{
+    if (mapping)
+        munmap(mapping, mappingSize);
+    if (fd >= 0)
+        close(fd);
+}
+
+
+/** Create a store, with none of the tiles built yet
+    @param header        The size, origin and spacing of the u/v grids
+    @param uData         The u components of the vectors
+    @param vData         The v components of the vectors
+    @param owner         Keeps uData and vData for as long as the store
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize       The number of bins wide and high the field is
+    @param storage       BWFieldStorageFloat or BWFieldStorageHalf
+    @returns The store, or null if the file couldn't be made
+ */
+std::shared_ptr<BWTileStore> BWTileStore::create(BWFieldHeader const& header
+                                                 , float const* uData, float const* vData
+                                                 , std::shared_ptr<void const> owner
+                                                 , float velocityScale
+                                                 , BWUInt2 tgtSize
+                                                 , BWFieldStorage storage
+                                                 )
+{
+    if (!uData || !vData || header.srcSize.x < 1 || header.srcSize.y < 1 || !tgtSize.x || !tgtSize.y)
+    {
+        BWLog("error, could not make the tile store: missing u/v data");
+        return nullptr;
+    }
+    std::shared_ptr<BWTileStore> ret(new BWTileStore());
+    BWTileStore& store = *ret;
+    store.header        = header;
+    store.uData         = uData;
+    store.vData         = vData;
+    store.owner         = owner;
+    store.velocityScale = velocityScale;
+    store.tgtSize       = tgtSize;
+    // The fixed point form scales each whole row, so it can't be built a tile at a time
+    store.storage       = BWFieldStorageFloat == storage ? BWFieldStorageFloat : BWFieldStorageHalf;
+    // Continuous grids wrap around and have an extra column (as in BWCPUGrid::buildField)
+    store.isContinuous  = floor(header.srcSize.x * header.delta.x) >= 360;
+    store.column.resize(header.srcSize.x + (store.isContinuous ? 1 : 0));
+    gridBuildColumns(header.srcSize, store.isContinuous, store.column.data());
+
+    store.numXTiles  = gridNumTiles(tgtSize.x);
+    store.numTiles   = store.numXTiles * gridNumTiles(tgtSize.y);
+    store.tileBytes  = (BWFieldStorageFloat == store.storage ? sizeof(BWFloat2) : sizeof(BWHalf2))
+                     * BWFieldTileSize * BWFieldTileSize;
+    store.blockBytes = store.tileBytes * BWTileBlockTiles;
+    store.numBlocks  = (store.numTiles + BWTileBlockTiles-1) / BWTileBlockTiles;
+    store.mappingSize = store.blockBytes * store.numBlocks;
+
+    // The file is only needed while it is mapped.  It has to be on a disk for the budget to bound
+    // the memory used: in a tmpfs, the pages dropped from the mapping stay in memory, as the file.
+    // /var/tmp is on a disk on most systems where /tmp isn't
+    char const* tmpDir = getenv("TMPDIR");
+    std::vector<std::string> dirs;
+    if (tmpDir && *tmpDir)
+        dirs.push_back(tmpDir);
+    dirs.push_back("/var/tmp");
+    dirs.push_back("/tmp");
+    for (std::string const& dir : dirs)
+    {
+        std::string path = dir + "/BWTileStore.XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0)
+            continue;
+        unlink(path.c_str());
+        bool memoryBacked = isMemoryBacked(fd);
+        if (store.fd >= 0 && memoryBacked)
+        {
+            // The first in memory is kept, in case none is on a disk
+            close(fd);
+            continue;
+        }
+        if (store.fd >= 0)
+            close(store.fd);
+        store.fd           = fd;
+        store.memoryBacked = memoryBacked;
+        if (!memoryBacked)
+            break;
+    }
+    if (store.fd < 0)
+    {
+        BWLog("could not make the tile store in %s: %s", dirs[0].c_str(), strerror(errno));
+        return nullptr;
+    }
+    if (store.memoryBacked)
+        BWLog("the tile store is in memory (tmpfs): the budget bounds what stays mapped, not the memory used");
+    if (ftruncate(store.fd, (off_t) store.mappingSize))
+    {
+        BWLog("could not size the tile store to %zu bytes: %s", store.mappingSize, strerror(errno));
+        return nullptr;
+    }
+    // The file is kept open, to drop the evicted blocks from the page cache
+    void* mapping = mmap(NULL, store.mappingSize, PROT_READ|PROT_WRITE, MAP_SHARED, store.fd, 0);
+    if (MAP_FAILED == mapping)
+    {
+        BWLog("could not map the tile store: %s", strerror(errno));
+        return nullptr;
+    }
+    // Without read ahead, a block read back brings in only its own pages, which trim() knows of;
+    // touch() asks for the whole block at once instead
+    madvise(mapping, store.mappingSize, MADV_RANDOM);
+    store.mapping = mapping;
+
+    store.state  .reset(new std::atomic<uint8_t>[store.numBlocks]);
+    store.touched.reset(new std::atomic<uint8_t>[store.numBlocks]);
+    store.evicted.reset(new std::atomic<uint8_t>[store.numBlocks]);
+    for (uint32_t block = 0; block < store.numBlocks; block++)
+    {
+        store.state  [block].store(0, std::memory_order_relaxed);
+        store.touched[block].store(0, std::memory_order_relaxed);
+        store.evicted[block].store(0, std::memory_order_relaxed);
+    }
+    store.resident.assign(store.numBlocks, 0);
+    store.lastUsed.assign(store.numBlocks, 0);
+    store.written .assign(store.numBlocks, 0);
+    return ret;
+}
+
+
+/** Build a block, or wait for the thread building it
+    @param block  The block
+ */
+void BWTileStore::buildBlock(uint32_t block)
+{
+    uint8_t expected = 0;
+    if (!state[block].compare_exchange_strong(expected, 1, std::memory_order_acquire))
+    {
+        // Another thread is building it; a block takes well under a millisecond
+        while (2 != state[block].load(std::memory_order_acquire))
+            std::this_thread::yield();
+        return;
+    }
+    uint32_t first = block * BWTileBlockTiles;
+    uint32_t last  = std::min(first + BWTileBlockTiles, numTiles);
+    for (uint32_t tile = first; tile < last; tile++)
+    {
+        gridBuildTile(uData, vData, header.srcSize, isContinuous, column.data(), header.origin
+                      , velocityScale, tgtSize, storage, tile % numXTiles, tile / numXTiles
+                      , (char*) mapping + tile*tileBytes);
+    }
+    builds++;
+    state[block].store(2, std::memory_order_release);
+}
+
+
+/** Build the blocks that particles are in, if they haven't been, and mark them as used
+    @param position  The position of each particle
+    @param stride    The number of BWFloat2 from one particle's position to the next
+    @param begin     The first particle
+    @param end       One past the last particle
+ */
+void BWTileStore::touch(BWFloat2 const* position, size_t stride, size_t begin, size_t end)
+{
+    int numXBins = (int) tgtSize.x, numYBins = (int) tgtSize.y;
+    uint32_t lastBlock = numBlocks;
+    for (size_t idx = begin; idx < end; idx++)
+    {
+        // The bin is clamped as in particleMove
+        BWFloat2 p = position[stride*idx];
+        uint32_t x = p.x > 0.0f ? (p.x < numXBins-1 ? (uint32_t) p.x : numXBins-1) : 0;
+        uint32_t y = p.y > 0.0f ? (p.y < numYBins-1 ? (uint32_t) p.y : numYBins-1) : 0;
+        uint32_t block = ((y >> BWFieldTileShift)*numXTiles + (x >> BWFieldTileShift)) / BWTileBlockTiles;
+        // Neighbouring particles are usually in the same block, once they are sorted
+        if (block == lastBlock)
+            continue;
+        lastBlock = block;
+        // (A block is only marked once it is built, so a marked one is ready to read)
+        if (touched[block].load(std::memory_order_acquire))
+            continue;
+        if (2 != state[block].load(std::memory_order_acquire))
+            buildBlock(block);
+        else if (evicted[block].exchange(0, std::memory_order_relaxed))
+        {
+            // The block is read back from the file in one go, rather than a page at a time
+            madvise((char*) mapping + block*blockBytes, blockBytes, MADV_WILLNEED);
+        }
+        touched[block].store(1, std::memory_order_release);
+    }
+}
+
+
+/** Drop the least recently used blocks from memory until the rest fit the budget
+    @param budget  The number of bytes that may stay in memory
+ */
+void BWTileStore::trim(size_t budget)
+{
+    std::lock_guard<std::mutex> guard(trimLock);
+    epoch++;
+    for (uint32_t block = 0; block < numBlocks; block++)
+    {
+        if (!touched[block].load(std::memory_order_relaxed))
+            continue;
+        touched[block].store(0, std::memory_order_relaxed);
+        lastUsed[block] = epoch;
+        if (!resident[block])
+        {
+            resident[block] = 1;
+            numResident++;
+        }
+    }
+    size_t keep = budget / blockBytes;
+    if (numResident <= keep)
+        return;
+
+    // The ones used longest ago go first
+    std::vector<uint32_t> blocks;
+    blocks.reserve(numResident);
+    for (uint32_t block = 0; block < numBlocks; block++)
+    {
+        if (resident[block])
+            blocks.push_back(block);
+    }
+    size_t numEvict = numResident - keep;
+    std::nth_element(blocks.begin(), blocks.begin() + (numEvict-1), blocks.end()
+                     , [this](uint32_t a, uint32_t b){ return lastUsed[a] < lastUsed[b]; });
+    for (size_t i = 0; i < numEvict; i++)
+    {
+        uint32_t block = blocks[i];
+        char* start = (char*) mapping + block*blockBytes;
+        // The pages are written back to the file, and let go of, both by the mapping and (once
+        // they are written) by the page cache; they are read back if the block is used again.
+        // A block is only written when it is built, so only the first eviction has to wait
+        if (!written[block])
+        {
+            msync(start, blockBytes, MS_SYNC);
+            written[block] = 1;
+        }
+        madvise(start, blockBytes, MADV_DONTNEED);
+#if defined(POSIX_FADV_DONTNEED)
+        posix_fadvise(fd, (off_t) (block*blockBytes), (off_t) blockBytes, POSIX_FADV_DONTNEED);
+#endif
+        resident[block] = 0;
+        evicted[block].store(1, std::memory_order_relaxed);
+    }
+    numResident -= (uint32_t) numEvict;
+    evictions   += numEvict;
+}
+
+
+/// The number of bytes of the blocks in memory
+size_t BWTileStore::residentBytes() const
+{
+    std::lock_guard<std::mutex> guard(trimLock);
+    return numResident * blockBytes;
+}
+
+
+/// How the store has done so far
+BWTileStoreStats BWTileStore::statistics() const
+{
+    std::lock_guard<std::mutex> guard(trimLock);
+    BWTileStoreStats ret;
+    ret.builds        = builds;
+    ret.evictions     = evictions;
+    ret.blocks        = numBlocks;
+    ret.built         = 0;
+    for (uint32_t block = 0; block < numBlocks; block++)
+        ret.built += 2 == state[block].load(std::memory_order_relaxed);
+    ret.residentBytes = numResident * blockBytes;
+    ret.mappedBytes   = mappingSize;
+    ret.memoryBacked  = memoryBacked;
+    return ret;
+}
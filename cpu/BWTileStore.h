@@ -0,0 +1,200 @@
+/*
+    BWTileStore.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWTileStore_h
+#define BWTileStore_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "BWCPUTypes.h"
+#include "BWGridBuild.h"
+#include "BWParticleMove.h"
+
+/*
+    The out-of-core form of a (nearest bin) field, for output sizes whose whole field
+    won't fit in memory.  gridBuildField() materializes every bin of the target field
+    up front -- 265MB of floats at 7680 x 4320 -- even though the particles only read
+    the bins they are over.  Here the field is laid out as BWFieldLayoutTiled, in a
+    file that is memory mapped rather than in allocated memory, and each block of
+    tiles is built the first time a particle reaches it.
+
+    The file is made in $TMPDIR (or /var/tmp, or /tmp), and unlinked as soon as it is
+    made, so it goes away with the store however the process ends.  It starts out
+    sparse; only the blocks that are built take any room.  The first of those on a
+    disk is used: a file in a tmpfs is itself memory, so dropping its blocks from the
+    mapping would only bound the resident size of the process, not the memory used.
+    If all of them are in memory, that is logged, and reported in the statistics.
+
+    The particle kernels read the mapping as they would any tiled field.  Before each
+    step, touch() goes over the particles' positions, builds the blocks they are in
+    that haven't been built (in whichever thread is moving that chunk of particles,
+    so the builds run in parallel), and marks the blocks as used.  After the step,
+    trim() drops the least recently used blocks from memory until what is left is
+    within the budget: each is written back to the file, and dropped from the mapping
+    and the page cache.  A dropped block stays built: its pages are in the file, and
+    are read back in if a particle goes there again.
+ */
+
+/// The number of tiles in each block of the store, which is built and dropped as one.
+/// 16 float tiles are 32KB (16KB of half floats), a whole number of pages
+#ifndef BWTileBlockTiles
+#define BWTileBlockTiles (16)
+#endif
+
+/// How the store has done
+typedef struct BWTileStoreStats
+{
+    /// The blocks built
+    uint64_t builds;
+    /// The blocks dropped from memory to stay within the budget
+    uint64_t evictions;
+    /// The number of blocks, and the number that have been built
+    uint32_t blocks;
+    uint32_t built;
+    /// The bytes of the blocks in memory, and of the whole mapping
+    size_t   residentBytes;
+    size_t   mappedBytes;
+    /// True if the file is in memory (a tmpfs), so residentBytes is all the budget bounds
+    bool     memoryBacked;
+} BWTileStoreStats;
+
+
+/** A field whose tiles are built on demand into a memory mapped file, and kept in
+    memory within a budget
+ */
+class BWTileStore
+{
+public:
+    /** Create a store, with none of the tiles built yet
+        @param header        The size, origin and spacing of the u/v grids
+        @param uData         The u components of the vectors; these are read as the tiles are
+                             built, so they must last as long as the store
+        @param vData         The v components of the vectors
+        @param owner         Keeps uData and vData (e.g., a mapped file) for as long as the store
+        @param velocityScale How much to scale the velocity magnitude by
+        @param tgtSize       The number of bins wide and high the field is
+        @param storage       BWFieldStorageFloat or BWFieldStorageHalf
+        @returns The store, or null if the file couldn't be made (logged)
+     */
+    static std::shared_ptr<BWTileStore> create(BWFieldHeader const& header
+                                               , float const* uData, float const* vData
+                                               , std::shared_ptr<void const> owner
+                                               , float velocityScale
+                                               , BWUInt2 tgtSize
+                                               , BWFieldStorage storage
+                                               );
+    ~BWTileStore();
+
+    /// The field, ready to read; only the blocks that touch() has made sure of may be read
+    BWPackedField packedField() const
+    {
+        BWPackedField ret = {storage, mapping, nullptr, BWFieldLayoutTiled, numXTiles};
+        return ret;
+    }
+
+    /** Build the blocks that particles are in, if they haven't been, and mark them as used
+        @param position  The position of each particle
+        @param stride    The number of BWFloat2 from one particle's position to the next
+        @param begin     The first particle
+        @param end       One past the last particle
+
+        This is called before each step of a chunk of particles, from the thread moving it;
+        any number of threads can call it at once.  A block that another thread is
+        building is waited for.
+     */
+    void touch(BWFloat2 const* position, size_t stride, size_t begin, size_t end);
+
+    /** Drop the least recently used blocks from memory until the rest fit the budget
+        @param budget  The number of bytes that may stay in memory
+
+        This is called between steps, while nothing is reading the store.
+     */
+    void trim(size_t budget);
+
+    /// The number of bytes of the blocks in memory
+    size_t residentBytes() const;
+    /// The number of bytes of the whole mapping; the file only takes the ones that are built
+    size_t mappedBytes() const { return mappingSize; }
+
+    /// How the store has done so far
+    BWTileStoreStats statistics() const;
+
+private:
+    BWTileStore();
+    BWTileStore(BWTileStore const&);
+    BWTileStore& operator=(BWTileStore const&);
+
+    /// Build a block, or wait for the thread building it
+    void buildBlock(uint32_t block);
+
+    /// What the tiles are built from
+    BWFieldHeader         header;
+    float const*          uData;
+    float const*          vData;
+    std::shared_ptr<void const> owner;
+    bool                  isContinuous;
+    std::vector<uint32_t> column;
+    float                 velocityScale;
+    BWUInt2               tgtSize;
+    BWFieldStorage        storage;
+
+    /// The number of tiles across and in all, and the bytes of each tile and block
+    uint32_t              numXTiles;
+    uint32_t              numTiles;
+    size_t                tileBytes;
+    size_t                blockBytes;
+    uint32_t              numBlocks;
+
+    /// The file, and whether it is in memory rather than on a disk
+    int                   fd;
+    bool                  memoryBacked;
+    /// The mapping of the file
+    void*                 mapping;
+    size_t                mappingSize;
+
+    /// Each block's state: 0 not built, 1 being built, 2 built
+    std::unique_ptr<std::atomic<uint8_t>[]> state;
+    /// Set as a block is used, and cleared by trim()
+    std::unique_ptr<std::atomic<uint8_t>[]> touched;
+    /// Set as trim() drops a block from memory, and cleared as touch() reads it back
+    std::unique_ptr<std::atomic<uint8_t>[]> evicted;
+    /// The blocks that are in memory, and the trim() each was last used before (guarded by trimLock)
+    std::vector<uint8_t>  resident;
+    std::vector<uint32_t> lastUsed;
+    /// The blocks that have been written back to the file since they were built (guarded by trimLock)
+    std::vector<uint8_t>  written;
+    uint32_t              numResident;
+    uint32_t              epoch;
+    mutable std::mutex    trimLock;
+
+    std::atomic<uint64_t> builds;
+    uint64_t              evictions;
+};
+
+#endif
@@ -113,6 +113,55 @@ float2 interpolate(float2 coord
 }
 
 
+
+/** The vector at a point of the internal grid that gridBuild would have made, read from the u/v arrays
+    @param i           The column of the internal grid
+    @param j           The row
+    @param srcGridSize The number of elements in the original grid
+    @param uData       The grid of the u component's of the vector
+    @param vData       The grid of the v component's of the vector
+    @returns vector
+
+    gridBuild puts column i of the data at (i+180) % width, and repeats its first column
+    as the last; this looks the data column up the other way around.
+ */
+float2 fetchData(uint i, uint j
+                 , uint2 srcGridSize
+                 , __global const float* uData, __global const float* vData)
+{
+    uint col = (i % srcGridSize.x + srcGridSize.x - 180 % srcGridSize.x) % srcGridSize.x;
+    uint p   = j*srcGridSize.x + col;
+    // Note: because the latitude decreases, the direction of the y component is flipped (as in gridBuild)
+    return (float2)(uData[p], (j<360?-1:0)*vData[p]);
+}
+
+
+/** Interpolates, straight from the u/v arrays; this is interpolate() on the grid gridBuild would have made
+    @param coord       The coordinate of the point of discussion
+    @param srcSize     The size of the internal grid, including the wrap around column
+    @param srcGridSize The number of elements in the original grid
+    @param uData       The grid of the u component's of the vector
+    @param vData       The grid of the v component's of the vector
+    @returns vector
+*/
+float2 interpolateData(float2 coord
+                       , uint2 srcSize
+                       , uint2 srcGridSize
+                       , __global const float* uData, __global const float* vData)
+{
+    int fi = floor(coord.x);
+    int fj = floor(coord.y);
+
+    uint ci = min(fi+1u, srcSize.x-1u);
+    uint cj = min(fj+1u, srcSize.y-1u);
+
+    float2 g00 = fetchData(fi, fj, srcGridSize, uData, vData);
+    float2 g10 = fetchData(ci, fj, srcGridSize, uData, vData);
+    float2 g01 = fetchData(fi, cj, srcGridSize, uData, vData);
+    float2 g11 = fetchData(ci, cj, srcGridSize, uData, vData);
+    return bilinear(coord.x - fi, coord.y - fj, g00, g10, g01, g11);
+}
+
 /**
  * Returns the distortion introduced by the specified projection at the given point.
  *
@@ -283,3 +332,48 @@ kernel void gridBuild(
 }
 
 
+/** Build the field used for animation straight from the u/v arrays
+    This is gridBuild and then gridInterpolate in one pass: the 180 degree rotation, the
+    wrap around column and the flip of v are done as each u/v point is read, so the
+    internal grid is never made.
+
+    @param uData       The grid of the u component's of the vector
+    @param vData       The grid of the v component's of the vector
+    @param srcGridSize The number of elements in the original grid
+    @param srcStride   The number of columns in the internal grid (one more if it wraps around)
+    @param origin      The grid's origin (e.g., 0.0E, 90.0N), before the rotation
+    @param velocityScale How much to scale the velocity magnitude by
+    @param tgtSize     The number of bins wide and high the tgtField is
+    @param tgtStride   The number of entries per row (there may be more than in tgtSize)
+    @param tgtField    The field modified for animation
+ */
+kernel void gridBuildField(
+                            __global const float* uData, __global const float* vData
+                          , uint2  srcGridSize
+                          , uint   srcStride
+                          , float2 origin
+                          , float  velocityScale
+                          , uint2  tgtSize
+                          , uint   tgtStride
+                          , __global float2* tgtField
+                          )
+{
+    uint2 tgtPoint = (uint2)(get_global_id(0),get_global_id(1));
+    if (tgtSize.x == 0 || tgtSize.y == 0)
+        return;
+
+    // The size and origin of the grid gridBuild would have made, which is rotated
+    uint2 srcSize = (uint2)(srcStride, srcGridSize.y);
+    origin.x += 90.0f;
+
+    float2 srcPoint= (float2)( clamp((float)(tgtPoint.x*srcSize.x)/(float)tgtSize.x, 0.0f, (float)srcSize.x-0.1f)
+                             , clamp((float)(tgtPoint.y*srcSize.y)/(float)tgtSize.y, 0.0f, (float)srcSize.y-0.1f) );
+    float2 wind = interpolateData(srcPoint, srcSize, srcGridSize, uData, vData);
+
+    float2 latlon;
+    latlon . x = (srcPoint.x -   origin.x);
+    latlon . y  =  (origin.y - srcPoint.y);
+    wind = distort(latlon, velocityScale, wind);
+
+    tgtField[tgtPoint.x +     tgtPoint.y*tgtStride] = wind;
+}
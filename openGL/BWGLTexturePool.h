@@ -0,0 +1,85 @@
+//
+//  BWGLTexturePool.h
+//  OSXGLEssentials
+//
+/*
+    Copyright (c) 2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#import <Foundation/Foundation.h>
+#include "glUtil.h"
+@protocol Logging;
+
+
+/** A pool of render target textures, all the same size, so that each frame doesn't
+    have to allocate (and the driver find memory for) a new one.
+
+    The textures are rectangle textures, GL_RGBA8, which the frames are drawn into
+    and then handed off; when whoever they were handed to is done, they come back
+    with recycle:.  A retired pool (when the size changes) deletes its textures as
+    they come back.
+ */
+@interface BWGLTexturePool : NSObject
+
+/// The number of pixels wide each texture is
+@property(readonly) int width;
+/// The number of pixels high each texture is
+@property(readonly) int height;
+
+/// The number of textures handed out from the pool
+@property(readonly) NSUInteger hits;
+/// The number of textures that had to be allocated, since the pool was empty
+@property(readonly) NSUInteger misses;
+/// The most textures that have been out of the pool at once
+@property(readonly) NSUInteger highWater;
+
+
+/** Initialize an empty pool
+    @param width    The number of pixels wide
+    @param height   The number of pixels high
+    @param cgl_ctx  The core graphics GL context
+    @returns nil on error, otherwise a reference to the object
+ */
+- (id) initWithWidth: (int) width
+              height: (int) height
+             context: (CGLContextObj) cgl_ctx
+                    ;
+
+/** Take a texture from the pool, allocating one if the pool is empty
+    @param logger  The object to log with
+    @returns The texture, 0 on error
+ */
+- (GLuint) texture: (id<Logging>) logger;
+
+/** Return a texture to the pool; thread safe
+    @param texName  The texture, from texture:
+ */
+- (void) recycle: (GLuint) texName;
+
+/// Delete the textures in the pool, and the ones returned from now on
+- (void) retire;
+
+/** Log how well the pool is doing
+    @param logger  The object to log with
+ */
+- (void) logStatistics: (id<Logging>) logger;
+@end
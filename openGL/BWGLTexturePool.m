@@ -0,0 +1,170 @@
+//
+//  BWGLTexturePool.m
+//  OSXGLEssentials
+//
+/*
+    Copyright (c) 2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#import <Quartz/Quartz.h>
+#import "BWGLTexturePool.h"
+#import "glErrorLogging.h"
+
+@implementation BWGLTexturePool
+{
+    /// The core graphics GL context
+    CGLContextObj cgl_ctx;
+
+    /// The textures in the pool (guarded by @synchronized)
+    NSMutableArray* pooled;
+    /// The number of textures out of the pool (guarded by @synchronized)
+    NSUInteger numOut;
+    /// Whether the textures are deleted when they come back (guarded by @synchronized)
+    BOOL retired;
+}
+
+/** Initialize an empty pool
+    @param width    The number of pixels wide
+    @param height   The number of pixels high
+    @param cgl_ctx  The core graphics GL context
+    @returns nil on error, otherwise a reference to the object
+ */
+- (id) initWithWidth: (int) width
+              height: (int) height
+             context: (CGLContextObj) _cgl_ctx
+{
+    // Call the parent initializer
+    if (!(self = [super init]))
+        return nil;
+
+    cgl_ctx = _cgl_ctx;
+    _width  = width;
+    _height = height;
+    pooled  = [[NSMutableArray alloc] init];
+    return self;
+}
+
+
+- (void) dealloc
+{
+    [self retire];
+}
+
+
+/** Take a texture from the pool, allocating one if the pool is empty
+    @param logger  The object to log with
+    @returns The texture, 0 on error
+ */
+- (GLuint) texture: (id<Logging>) logger
+{
+    GLuint texName = 0;
+    @synchronized(self)
+    {
+        if ([pooled count])
+        {
+            texName = [[pooled lastObject] unsignedIntValue];
+            [pooled removeLastObject];
+            _hits++;
+        }
+        else
+        {
+            _misses++;
+        }
+        if (++numOut > _highWater)
+            _highWater = numOut;
+    }
+    if (texName)
+        return texName;
+
+    // Uses GL_TEXTURE_RECTANGLE_EXT since the rectangles may be non power of two
+    GLuint texType = GL_TEXTURE_RECTANGLE_EXT;
+    glGenTextures(1, &texName);
+    glEnable(GL_TEXTURE_RECTANGLE_EXT);
+	glBindTexture(texType, texName);
+    LogGLErrors();
+
+    // The tutorial says we need filtering
+    glTexParameteri(texType, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(texType, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(texType, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(texType, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Define the size and initial contents of the texture buffer.
+    glTexImage2D(texType, 0, GL_RGBA8, _width, _height, 0,
+                 GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    LogGLErrors();
+    return texName;
+}
+
+
+/** Return a texture to the pool; thread safe
+    @param texName  The texture, from texture:
+ */
+- (void) recycle: (GLuint) texName
+{
+    if (!texName)
+        return;
+    @synchronized(self)
+    {
+        if (numOut)
+            numOut--;
+        if (!retired)
+        {
+            [pooled addObject: [NSNumber numberWithUnsignedInt: texName]];
+            return;
+        }
+    }
+    glDeleteTextures(1, &texName);
+}
+
+
+/// Delete the textures in the pool, and the ones returned from now on
+- (void) retire
+{
+    NSArray* textures;
+    @synchronized(self)
+    {
+        retired  = YES;
+        textures = pooled;
+        pooled   = [[NSMutableArray alloc] init];
+    }
+    for (NSNumber* texture in textures)
+    {
+        GLuint texName = [texture unsignedIntValue];
+        glDeleteTextures(1, &texName);
+    }
+}
+
+
+/** Log how well the pool is doing
+    @param logger  The object to log with
+ */
+- (void) logStatistics: (id<Logging>) logger
+{
+    @synchronized(self)
+    {
+        [logger logMessage:LogPrefix @"%d x %d texture pool: %lu hits, %lu misses, %lu high water, %lu pooled"
+         , _width, _height, (unsigned long) _hits, (unsigned long) _misses
+         , (unsigned long) _highWater, (unsigned long) [pooled count]];
+    }
+}
+@end
@@ -128,6 +128,10 @@ enum
                logger: (id<Logging>) logger;
 
 
+/// The range of the elements that draw leaves out; {0, 0} (the default) draws them all
+@property NSRange skipElements;
+
+
 /// This has the vertices attached / drawn to the render buffer
 - (void) draw;
 
@@ -137,4 +141,12 @@ enum
  */
 - (void) draw:(GLenum) typeOfPrimitives;
 
+
+/** This draws the elements, leaving out skipElements: the ones before it, then the ones after
+    @param typeOfPrimitives  This is the way that the vertices are connected to form a fragment
+    @param indices           The element indices, or their offset in the element array buffer
+ */
+- (void) drawElements: (GLenum) typeOfPrimitives
+              indices: (GLubyte const*) indices;
+
 @end
@@ -253,6 +253,24 @@
 {
 	// Bind our vertex array object
 	glBindVertexArray(vertexArray);
-    glDrawElements(typeOfPrimitives, _numElements, elementType, _elements);
+    [self drawElements: typeOfPrimitives
+               indices: _elements];
+}
+
+
+/** This draws the elements, leaving out skipElements: the ones before it, then the ones after
+    @param typeOfPrimitives  This is the way that the vertices are connected to form a fragment
+    @param indices           The element indices, or their offset in the element array buffer
+ */
+- (void) drawElements: (GLenum) typeOfPrimitives
+              indices: (GLubyte const*) indices
+{
+    NSRange skip = self.skipElements;
+    unsigned first = (unsigned) MIN(skip.location,     _numElements);
+    unsigned last  = (unsigned) MIN(NSMaxRange(skip), _numElements);
+    if (first)
+        glDrawElements(typeOfPrimitives, first, elementType, indices);
+    if (last < _numElements)
+        glDrawElements(typeOfPrimitives, _numElements - last, elementType, indices + GLTypeSize(elementType)*last);
 }
 @end
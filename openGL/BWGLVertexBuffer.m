@@ -212,11 +212,12 @@
 //    glBufferSubData( GL_ARRAY_BUFFER, 0, elementSize*_numPositions, vdata );
     glEnableVertexAttribArray(POS_ATTRIB_IDX);
 
-#if E_EN > 0
-    glDrawElements(typeOfPrimitives, _numElements, elementType, 0);
-#else
-    glDrawArrays(typeOfPrimitives,0, _numPositions);
-#endif
+    // With indices (from setElements:), draw through the element array buffer
+    if (_numElements)
+        [self drawElements: typeOfPrimitives
+                   indices: (GLubyte const*) BUFFER_OFFSET(0)];
+    else
+        glDrawArrays(typeOfPrimitives,0, _numPositions);
 }
 
 @end
@@ -24,34 +24,65 @@
 */
 
 #define M_PI   3.1415926535897932384626433832795f
+/// The bins across (and down) each cell of the spawn table (BWSpawnCellSize in cpu/BWSpawnTable.h)
+#define SPAWN_CELL_SIZE (4)
 
 
 // --- Randomize particle location -----------------------
-/**Returns a random number
-   @param seed The Seed to the random number generator
-   @param max  The max number to return
-   @returns A random number
+/** Returns all four words of a random number.
+    This is Philox4x32-10, a counter based generator: the number depends only on
+    the seed and the counter (which particle, which frame, and what for), so there is
+    no shared state between the work-items, and a seed always gives the same particles.
+    cpu/BWRandom.h has the same generator.
+    @param seed    The seed to the random number generator
+    @param idx     The index of the particle
+    @param frame   The frame number
+    @param stream  0 for particleMove, 1 for particleInit, 2 for the lifetimes
+    @returns 128 random bits
  */
-float random(__global ulong* seed, uint max)
+uint4 random4(ulong seed, uint idx, uint frame, uint stream)
 {
-    *seed = (*seed * 0x5DEECE66DL + 0xBL) & ((1L << 48) - 1);
-    uint result = (*seed) >> 16;
-    return result % max;
+    uint2 key = (uint2)((uint) seed, (uint)(seed >> 32));
+    uint4 ctr = (uint4)(idx, frame, stream, 0);
+    for (int round = 0; round < 10; round++)
+    {
+        uint hi0 = mul_hi(0xD2511F53u, ctr.x);
+        uint lo0 = 0xD2511F53u * ctr.x;
+        uint hi1 = mul_hi(0xCD9E8D57u, ctr.z);
+        uint lo1 = 0xCD9E8D57u * ctr.z;
+        ctr = (uint4)(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+        // Bump the key
+        key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+    }
+    return ctr;
+}
+
+
+/** Returns a random number.
+    @param seed    The seed to the random number generator
+    @param idx     The index of the particle
+    @param frame   The frame number
+    @param stream  0 for particleMove, 1 for particleInit, 2 for the lifetimes
+    @returns 32 random bits
+ */
+uint random(ulong seed, uint idx, uint frame, uint stream)
+{
+    return random4(seed, idx, frame, stream).x;
 }
 
 
 /** Find a random location for a particle
     @param numXBins The number of bins in the x axis
     @param numYBins The number of bins in the y axis
-    @param seed     The random number seed
+    @param rand     32 random bits
     @returns A {float2} vector
 */
 float2 particleRandomize(
                        int numXBins, int numYBins,
-                       __global ulong* seed
+                       uint rand
                        )
 {
-    float m =random(seed, (numXBins*numYBins));
+    float m = rand % (uint)(numXBins*numYBins);
     float yy=(int)(m/numXBins);
     float xx = m - numXBins*yy;
     
@@ -69,17 +100,19 @@ float2 particleRandomize(
     @param numYBins The number of bins in the y axis
     @param dataGrid The grid of vectors (mapped to an array)
     @param seed     The random number seed
+    @param frame    The frame number
  */
 __kernel void particleInit( __global float2*   vertex   // position of each particle
                           , int numXBins, int  numYBins    // The size of the data grid
-                          , __global ulong*    seed        // A randomizer
+                          , ulong              seed        // A randomizer
+                          , uint               frame       // Selects the random numbers
                           )
 {
     // The global id of the work item.  (the index i)
     int idx = get_global_id(0);
     // Particle isn't visible, but it still moves through the field.
     // particle has escaped the grid, never to return...
-    float2 position = particleRandomize(numXBins, numYBins, seed);
+    float2 position = particleRandomize(numXBins, numYBins, random(seed, idx, frame, 1));
 
     // Path from (x,y) to (xt,yt) is visible, so add this particle to the appropriate draw bucket.
     // The positions are actually vertices (2)
@@ -96,13 +129,24 @@ __kernel void particleInit( __global float2*   vertex   // position of each part
     @param numXBins    The number of bins in the x axis
     @param numYBins    The number of bins in the y axis
     @param vectorField The field of vectors (mapped to an array), with normalized magnitude within the field
+    @param nextField   The field of vectors at the next time step
+    @param blend       How far from vectorField to nextField the time is, from 0 to 1
     @param seed     The random number seed
+    @param frame    The frame number of the first step
+    @param numSteps The number of steps to take; step s is frame number frame+s, so
+                    this is the same as that many dispatches of one step
+    @param respawns Counts the particles that were respawned; may be NULL
 */
 __kernel void particleMove(  __global float2*   vertex    // position of each particle box
                            , float              dT          // Range from [0, 1]
                            , int numXBins, int  numYBins    // The size of the vector field
                            , __global float2*   vectorField // The data in the grid
-                           , __global ulong*    seed        // A randomizer
+                           , __global float2*   nextField   // The data in the grid at the next time step
+                           , float              blend       // Range from [0, 1]
+                           , ulong              seed        // A randomizer
+                           , uint               frame       // Selects the random numbers
+                           , uint               numSteps    // The number of steps to take
+                           , __global uint*     respawns    // The number of particles respawned
                            )
 {
     // The global id of the work item.  (the index i)
@@ -111,64 +155,344 @@ __kernel void particleMove(  __global float2*   vertex    // position of each pa
     // The positions are actually vertices (4)
     int idx2 = 2*idx;
     
-    // The left two are the key ones
-    // Get the particle position
-    float2 position = vertex[idx2];
-    float2 _v = vectorField[(int)position.x + ((int) position.y)*numXBins];
-    float2 v =_v*dT;
-    float2 origPosition = position;
-    position = position+v;
-
-    float2 position_t;
-    // This to handle wrap around on either edge as elegantly as possible
-    if (position.x < 0.0 && v.x < 0.0)
-    {
-        // We wrapped around to the "east end of the world"
-        position.x = numXBins-0.1;
-        
-        // Sanity check the y coordinate (otherwise we can misindex)
-        if (position.y >= numYBins) position.y = numYBins-0.5;
-        else if (position.y < 0.0) position.y=0.0;
-        
-        position_t = position + v;
-    }
-    else if (position.x > numXBins && v.x > 0.0)
-    {
-        // We wrapped around to the "west end of the world"
-        position.x =0.0;
-        position.y = 0.5*(position.y+origPosition.y);
-        // Sanity check the y coordinate (otherwise we can misindex)
-        if (position.y >= numYBins) position.y = numYBins-0.5;
-        else if (position.y < 0.0) position.y=0.0;
-        position_t = position + v;
-    }
-
-    // Did the particle go out of bounds?
-    else if (position.y< 0.0 || position.y >= numYBins-1.0)
-    {
-        // The particle is moving too fast or too slow; get rid of it
-        position_t = particleRandomize(numXBins, numYBins, seed);
-        position = position_t;
-    }
-    else
+    // The tail is where the particle is; the head is where it is going
+    float2 tail = vertex[idx2];
+    float2 head = vertex[idx2+1];
+    uint numRespawned = 0;
+    for (uint step = 0; step < numSteps; step++)
     {
-        // vector at current position
-        float m = _v.x*_v.x + _v.y*_v.y;
+        float2 position = tail;
+        int bin = (int)position.x + ((int) position.y)*numXBins;
+        float2 _v = vectorField[bin];
+        // Blend between the vector at this time step and the next
+        _v = _v + blend*(nextField[bin] - _v);
+        float2 v =_v*dT;
+        float2 origPosition = position;
+        position = position+v;
 
-        position_t = position + v;
+        float2 position_t;
+        // This to handle wrap around on either edge as elegantly as possible
+        if (position.x < 0.0 && v.x < 0.0)
+        {
+            // We wrapped around to the "east end of the world"
+            position.x = numXBins-0.1;
+            
+            // Sanity check the y coordinate (otherwise we can misindex)
+            if (position.y >= numYBins) position.y = numYBins-0.5;
+            else if (position.y < 0.0) position.y=0.0;
+            
+            position_t = position + v;
+        }
+        else if (position.x > numXBins && v.x > 0.0)
+        {
+            // We wrapped around to the "west end of the world"
+            position.x =0.0;
+            position.y = 0.5*(position.y+origPosition.y);
+            // Sanity check the y coordinate (otherwise we can misindex)
+            if (position.y >= numYBins) position.y = numYBins-0.5;
+            else if (position.y < 0.0) position.y=0.0;
+            position_t = position + v;
+        }
 
-        if (m < 2.0)
+        // Did the particle go out of bounds?
+        else if (position.y< 0.0 || position.y >= numYBins-1.0)
         {
             // The particle is moving too fast or too slow; get rid of it
-            position_t = particleRandomize(numXBins, numYBins, seed);
+            position_t = particleRandomize(numXBins, numYBins, random(seed, idx, frame+step, 0));
             position = position_t;
+            numRespawned++;
+        }
+        else
+        {
+            // vector at current position
+            float m = _v.x*_v.x + _v.y*_v.y;
+
+            position_t = position + v;
+
+            if (m < 2.0)
+            {
+                // The particle is moving too fast or too slow; get rid of it
+                position_t = particleRandomize(numXBins, numYBins, random(seed, idx, frame+step, 0));
+                position = position_t;
+                numRespawned++;
+            }
         }
+        tail = position;
+        head = position_t;
     }
+    // One atomic per particle at most, rather than one per respawn
+    if (respawns && numRespawned)
+        atomic_add(respawns, numRespawned);
 
     
     // Path from (x,y) to (xt,yt) is visible, so add this particle to the appropriate draw bucket.
-    vertex[idx2]   = position;
-    vertex[idx2+1] = position_t;
+    vertex[idx2]   = tail;
+    vertex[idx2+1] = head;
 }
 
 
+
+// --- Particle streams ----------------------------------
+// With PARTICLE_STREAMS_EN, the particles are kept in separate streams of position,
+// previous position, age and lifetime, rather than only the tail/head pairs that are
+// drawn.  Each step is particleAdvance, which moves them and lists the ones that
+// expired, then particleRespawn over just those; particleVertices writes the lines to
+// the vertex buffer after the last step.  cpu/BWParticleMove.cpp has the same kernels.
+
+/** A random place to spawn a particle, from the alias table (see cpu/BWSpawnTable.h)
+    @param spawnTable  The threshold and alias of each cell of bins, in row order
+    @param spawnCount  The number of them; 0 to spawn uniformly, as particleRandomize does
+    @param numXBins    The number of bins in the x axis
+    @param numYBins    The number of bins in the y axis
+    @param rand        128 random bits: the cell, the coin, and where in the cell
+    @returns The position
+ */
+float2 particleSpawnPosition(__global uint2* spawnTable, uint spawnCount
+                             , int numXBins, int numYBins
+                             , uint4 rand
+                             )
+{
+    if (!spawnCount)
+        return particleRandomize(numXBins, numYBins, rand.x);
+    uint cell = mul_hi(rand.x, spawnCount);
+    uint2 entry = spawnTable[cell];
+    if (rand.y >= entry.x)
+        cell = entry.y;
+    uint numXCells = ((uint) numXBins + SPAWN_CELL_SIZE-1) / SPAWN_CELL_SIZE;
+    uint y = (cell / numXCells) * SPAWN_CELL_SIZE;
+    uint x = (cell - (cell / numXCells)*numXCells) * SPAWN_CELL_SIZE;
+    // The cells on the far edges may be cut short by the grid
+    uint width  = min((uint) SPAWN_CELL_SIZE, (uint) numXBins - x);
+    uint height = min((uint) SPAWN_CELL_SIZE, (uint) numYBins - y);
+    // In 1/256ths of the cell, so that the sum can't round up into the next one
+    return (float2)(x + (rand.z >> 24) * width * (1.0f/256.0f), y + (rand.w >> 24) * height * (1.0f/256.0f));
+}
+
+
+/** A random lifetime
+    @param rand    32 random bits
+    @param minAge  The shortest lifetime, in steps (at least 1)
+    @param maxAge  The longest lifetime, in steps
+    @returns The lifetime, from minAge to maxAge
+ */
+ushort particleLifetime(uint rand, int minAge, int maxAge)
+{
+    uint range = maxAge > minAge ? (uint)(maxAge - minAge + 1) : 1u;
+    return (ushort)(minAge + (rand & 0xFFFFu) % range);
+}
+
+
+/** This spawns a particle at a random place, with a random lifetime.  It starts part
+    way through its life, so that a whole set spawned at once doesn't expire at once.
+    @param position     Where each particle is
+    @param prevPosition Where each particle was a step ago
+    @param age          The number of steps since each particle was spawned
+    @param maxAge       The number of steps each particle lives
+    @param numXBins The number of bins in the x axis
+    @param numYBins The number of bins in the y axis
+    @param seed     The random number seed
+    @param frame    The frame number
+    @param minLife  The shortest lifetime, in steps
+    @param maxLife  The longest lifetime, in steps
+    @param spawnTable  The alias table to spawn from
+    @param spawnCount  The number of entries in it; 0 to spawn uniformly
+ */
+__kernel void particleSpawn( __global float2*   position
+                           , __global float2*   prevPosition
+                           , __global ushort*   age
+                           , __global ushort*   maxAge
+                           , int numXBins, int  numYBins    // The size of the data grid
+                           , ulong              seed        // A randomizer
+                           , uint               frame       // Selects the random numbers
+                           , int minLife, int   maxLife     // The range of the lifetimes
+                           , __global uint2*    spawnTable  // Where to spawn them
+                           , uint               spawnCount
+                           )
+{
+    int idx = get_global_id(0);
+    float2 p = particleSpawnPosition(spawnTable, spawnCount, numXBins, numYBins, random4(seed, idx, frame, 1));
+    uint rand = random(seed, idx, frame, 2);
+    ushort lifetime = particleLifetime(rand, minLife, maxLife);
+    position[idx]     = p;
+    prevPosition[idx] = p;
+    age[idx]          = (ushort)((rand >> 16) % lifetime);
+    maxAge[idx]       = lifetime;
+}
+
+
+/** This moves a particle a step.  One that expires -- by age, or by leaving the grid or
+    moving too slowly -- is added to the list for particleRespawn
+    @param position     Where each particle is
+    @param prevPosition Where each particle was a step ago
+    @param age          The number of steps since each particle was spawned
+    @param maxAge       The number of steps each particle lives
+    @param dT           The time step
+    @param numXBins     The number of bins in the x axis
+    @param numYBins     The number of bins in the y axis
+    @param vectorField  The field of vectors (mapped to an array)
+    @param nextField    The field of vectors at the next time step
+    @param blend        How far from vectorField to nextField the time is, from 0 to 1
+    @param expired      Receives the indices of the particles that expired
+    @param numExpired   The number of them; cleared before each step
+ */
+__kernel void particleAdvance( __global float2*   position
+                             , __global float2*   prevPosition
+                             , __global ushort*   age
+                             , __global ushort*   maxAge
+                             , float              dT          // Range from [0, 1]
+                             , int numXBins, int  numYBins    // The size of the vector field
+                             , __global float2*   vectorField // The data in the grid
+                             , __global float2*   nextField   // The data in the grid at the next time step
+                             , float              blend       // Range from [0, 1]
+                             , __global uint*     expired     // The particles to respawn
+                             , __global uint*     numExpired  // The number of them
+                             )
+{
+    int idx = get_global_id(0);
+    float2 origPosition = position[idx];
+    int bin = (int)origPosition.x + ((int) origPosition.y)*numXBins;
+    float2 _v = vectorField[bin];
+    // Blend between the vector at this time step and the next
+    _v = _v + blend*(nextField[bin] - _v);
+    float2 v = _v*dT;
+    float2 p = origPosition + v;
+    float2 prev = origPosition;
+    bool alive = true;
+    if (p.x < 0.0 && v.x < 0.0)
+    {
+        // We wrapped around to the "east end of the world"; the line starts over there
+        p.x = numXBins-0.1;
+        if (p.y >= numYBins) p.y = numYBins-0.5;
+        else if (p.y < 0.0) p.y=0.0;
+        prev = p;
+        p = p + v;
+    }
+    else if (p.x > numXBins && v.x > 0.0)
+    {
+        // We wrapped around to the "west end of the world"
+        p.x = 0.0;
+        p.y = 0.5*(p.y+origPosition.y);
+        if (p.y >= numYBins) p.y = numYBins-0.5;
+        else if (p.y < 0.0) p.y=0.0;
+        prev = p;
+        p = p + v;
+    }
+    // Did the particle go out of bounds, or is it moving too slowly?
+    else if (p.y < 0.0 || p.y >= numYBins-1.0 || _v.x*_v.x + _v.y*_v.y < 2.0)
+    {
+        alive = false;
+    }
+    if (alive)
+    {
+        position[idx]     = p;
+        prevPosition[idx] = prev;
+    }
+    ushort a = age[idx] + 1;
+    age[idx] = a;
+    if (!alive || a >= maxAge[idx])
+    {
+        expired[atomic_inc(numExpired)] = idx;
+    }
+}
+
+
+/** This respawns one of the particles that expired, at a random place with a new lifetime
+    @param expired      The indices of the particles to respawn
+    @param position     Where each particle is
+    @param prevPosition Where each particle was a step ago
+    @param age          The number of steps since each particle was spawned
+    @param maxAge       The number of steps each particle lives
+    @param numXBins The number of bins in the x axis
+    @param numYBins The number of bins in the y axis
+    @param seed     The random number seed
+    @param frame    The frame number
+    @param minLife  The shortest lifetime, in steps
+    @param maxLife  The longest lifetime, in steps
+    @param spawnTable  The alias table to spawn from
+    @param spawnCount  The number of entries in it; 0 to spawn uniformly
+ */
+__kernel void particleRespawn( __global uint*     expired
+                             , __global float2*   position
+                             , __global float2*   prevPosition
+                             , __global ushort*   age
+                             , __global ushort*   maxAge
+                             , int numXBins, int  numYBins    // The size of the data grid
+                             , ulong              seed        // A randomizer
+                             , uint               frame       // Selects the random numbers
+                             , int minLife, int   maxLife     // The range of the lifetimes
+                             , __global uint2*    spawnTable  // Where to spawn them
+                             , uint               spawnCount
+                             )
+{
+    // The random numbers are the particle's own, whatever order they were listed in
+    uint idx = expired[get_global_id(0)];
+    float2 p = particleSpawnPosition(spawnTable, spawnCount, numXBins, numYBins, random4(seed, idx, frame, 0));
+    position[idx]     = p;
+    prevPosition[idx] = p;
+    age[idx]          = 0;
+    maxAge[idx]       = particleLifetime(random(seed, idx, frame, 2), minLife, maxLife);
+}
+
+
+/** This writes the line of a particle to the vertex buffer
+    @param position     Where each particle is
+    @param prevPosition Where each particle was a step ago
+    @param vertex       Receives the tail/head pair of each particle
+ */
+__kernel void particleVertices( __global float2*   position
+                              , __global float2*   prevPosition
+                              , __global float2*   vertex
+                              )
+{
+    int idx = get_global_id(0);
+    vertex[2*idx]   = prevPosition[idx];
+    vertex[2*idx+1] = position[idx];
+}
+
+
+/** This starts the trail of a particle where it is: each of the positions in its ring
+    @param position     Where each particle is
+    @param vertex       The ring of trailLength positions of each particle
+    @param trailLength  The number of positions in each ring
+ */
+__kernel void particleTrailStart( __global float2*   position
+                                , __global float2*   vertex
+                                , uint               trailLength
+                                )
+{
+    int idx = get_global_id(0);
+    __global float2* trail = vertex + trailLength*idx;
+    float2 p = position[idx];
+    for (uint i = 0; i < trailLength; i++)
+        trail[i] = p;
+}
+
+
+/** This writes where a particle is to its slot of the ring, for a step
+    @param position     Where each particle is
+    @param prevPosition Where each particle was a step ago
+    @param vertex       The ring of trailLength positions of each particle
+    @param trailLength  The number of positions in each ring
+    @param slot         The slot this step writes: the frame number modulo trailLength
+
+    The slot before this one holds where the particle was a step ago, unless it was
+    respawned, or wrapped around the world; then the trail starts over from prevPosition.
+ */
+__kernel void particleTrail( __global float2*   position
+                           , __global float2*   prevPosition
+                           , __global float2*   vertex
+                           , uint               trailLength
+                           , uint               slot
+                           )
+{
+    int idx = get_global_id(0);
+    __global float2* trail = vertex + trailLength*idx;
+    float2 prev = prevPosition[idx];
+    float2 last = trail[(slot + trailLength - 1) % trailLength];
+    if (last.x != prev.x || last.y != prev.y)
+    {
+        for (uint i = 0; i < trailLength; i++)
+            trail[i] = prev;
+    }
+    trail[slot] = position[idx];
+}
@@ -0,0 +1,86 @@
+/*
+    BWGridBuildTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks gridBuildField() against gridBuild() followed by gridInterpolate(), in each
+    storage, on a global (wrapping) field and on a regional one.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "BWTestCheck.h"
+#include "BWTestField.h"
+
+
+/** Check the one pass build against the two, in each storage
+    @param source  The u/v planes
+ */
+static void checkFused(BWTestSource const& source)
+{
+    BWUInt2 srcSize = source.header.srcSize;
+    uint32_t srcStride = srcSize.x + (source.isContinuous ? 1 : 0);
+    std::vector<BWFloat2> srcField((size_t) srcStride*srcSize.y);
+    gridBuild(source.u.data(), source.v.data(), srcSize, source.isContinuous, srcField.data(), 0, srcSize.y);
+    // The second stage takes the rotated origin, and the columns with the wrap around one
+    BWUInt2  rotatedSize = {srcStride, srcSize.y};
+    BWFloat2 origin      = {source.header.origin.x + 90.0f, source.header.origin.y};
+
+    BWUInt2 const tgtSize = testFieldSize;
+    BWFieldStorage const storages[] = {BWFieldStorageFloat, BWFieldStorageHalf, BWFieldStorageInt16};
+    for (BWFieldStorage storage : storages)
+    {
+        size_t count = (size_t) tgtSize.x*tgtSize.y;
+        std::vector<uint8_t>  twoStage(count * testBinBytes(storage));
+        std::vector<BWFloat2> twoStageScale(tgtSize.y);
+        if (BWFieldStorageFloat == storage)
+            gridInterpolate(rotatedSize, srcField.data(), origin, 1.0f, tgtSize, tgtSize.x, BWFieldLayoutRows
+                            , (BWFloat2*) twoStage.data(), 0, tgtSize.y);
+        else if (BWFieldStorageHalf == storage)
+            gridInterpolateHalf(rotatedSize, srcField.data(), origin, 1.0f, tgtSize, tgtSize.x, BWFieldLayoutRows
+                                , (BWHalf2*) twoStage.data(), 0, tgtSize.y);
+        else
+            gridInterpolateInt16(rotatedSize, srcField.data(), origin, 1.0f, tgtSize, tgtSize.x, BWFieldLayoutRows
+                                 , (BWShort2*) twoStage.data(), twoStageScale.data(), 0, tgtSize.y);
+        std::vector<BWFloat2> rowScale;
+        std::vector<uint8_t>  fused = testBuildField(source, BWFieldLayoutRows, storage, rowScale);
+        bool same = fused == twoStage;
+        if (BWFieldStorageInt16 == storage)
+            same = same && !memcmp(rowScale.data(), twoStageScale.data(), tgtSize.y*sizeof(BWFloat2));
+        char what[128];
+        snprintf(what, sizeof(what), "%s field, %s: gridBuildField is gridBuild + gridInterpolate", source.name, testStorageName(storage));
+        check(same, what);
+    }
+}
+
+
+int main()
+{
+    BWTestSource global, regional;
+    testSources(global, regional);
+    check(global.isContinuous, "the global field wraps around");
+    checkFused(global);
+    checkFused(regional);
+    return numFailures;
+}
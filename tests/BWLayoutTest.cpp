@@ -0,0 +1,94 @@
+/*
+    BWLayoutTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks the tiled field layout against the rows: the bins of a field built each way, and
+    the particles moved on each.  The particles sorted by tile are in another order than
+    the unsorted ones, so those are checked on one worker against several instead.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include "BWTestField.h"
+#include "BWTestGrid.h"
+
+
+/** Check the tiled layout against the rows, bin for bin, in each storage
+    @param source  The u/v planes
+ */
+static void checkTiled(BWTestSource const& source)
+{
+    BWFieldStorage const storages[] = {BWFieldStorageFloat, BWFieldStorageHalf, BWFieldStorageInt16};
+    for (BWFieldStorage storage : storages)
+    {
+        std::vector<BWFloat2> rowScale, tiledScale;
+        std::vector<uint8_t> rows  = testBuildField(source, BWFieldLayoutRows,  storage, rowScale);
+        std::vector<uint8_t> tiled = testBuildField(source, BWFieldLayoutTiled, storage, tiledScale);
+        size_t   bytes     = testBinBytes(storage);
+        uint32_t numXTiles = gridNumTiles(testFieldSize.x);
+        bool same = !memcmp(rowScale.data(), tiledScale.data(), testFieldSize.y*sizeof(BWFloat2));
+        for (uint32_t y = 0; y < testFieldSize.y && same; y++)
+        {
+            for (uint32_t x = 0; x < testFieldSize.x && same; x++)
+                same = !memcmp(&rows[(x + (size_t) y*testFieldSize.x)*bytes], &tiled[gridTiledIndex(x, y, numXTiles)*bytes], bytes);
+        }
+        char what[128];
+        snprintf(what, sizeof(what), "%s field, %s: the tiled layout has the same bins as the rows", source.name, testStorageName(storage));
+        check(same, what);
+    }
+}
+
+
+int main()
+{
+    BWTestSource global, regional;
+    testSources(global, regional);
+    checkTiled(global);
+    checkTiled(regional);
+
+    BWTestField field;
+    for (BWTestStore const& store : testStores)
+    {
+        auto setup = [&store](BWFieldLayout layout, int sortInterval, int numWorkers)
+        {
+            return [&store, layout, sortInterval, numWorkers](BWCPUGrid& grid)
+            {
+                grid.setParticleStore(store.store);
+                grid.setTrailLength(store.trailLength);
+                grid.setThreadPool(std::make_shared<BWThreadPool>(numWorkers));
+                grid.setMoveISA(BWParticleMoveScalar);
+                grid.setLayout(layout);
+                grid.setSortInterval(sortInterval);
+            };
+        };
+        char what[128];
+        snprintf(what, sizeof(what), "%s: the tiled field moves the particles as the rows do", store.name);
+        checkSameRun(testRun(field, setup(BWFieldLayoutRows, 0, 1)), testRun(field, setup(BWFieldLayoutTiled, 0, 1)), what);
+        snprintf(what, sizeof(what), "%s: sorted by tile, 4 workers move the particles as 1 does", store.name);
+        checkSameRun(testRun(field, setup(BWFieldLayoutTiled, 8, 1)), testRun(field, setup(BWFieldLayoutTiled, 8, 4)), what);
+    }
+    return numFailures;
+}
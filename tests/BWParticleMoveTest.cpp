@@ -0,0 +1,101 @@
+/*
+    BWParticleMoveTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks that the AVX2 and AVX-512 versions of particleMove move the particles to the same
+    bits as the scalar one: the particle streams (pairs and trails), and the tail/head
+    pairs of BWParticleStoreVertices.  A version the CPU can't run falls back to the scalar
+    one, which is noted.  Each version also has to count just the particles it respawned.
+ */
+
+#include <stdio.h>
+#include <memory>
+#include <vector>
+#include "BWTestGrid.h"
+
+
+/** Check the number of respawns each version of particleMove returns.  The left half of
+    the field is still, so the particles there are respawned, and the right half moves them
+    east, so those aren't; none are near the top or bottom edge.
+ */
+static void checkRespawnCount()
+{
+    int const numXBins = 64, numYBins = 32, numParticles = 1001;
+    std::vector<BWFloat2> field((size_t) numXBins*numYBins);
+    for (int y = 0; y < numYBins; y++)
+        for (int x = 0; x < numXBins; x++)
+            field[(size_t) y*numXBins + x] = {x < numXBins/2 ? 0.0f : 4.0f, 0.0f};
+    std::vector<BWFloat2> start((size_t) 2*numParticles);
+    int expected = 0;
+    for (int idx = 0; idx < numParticles; idx++)
+    {
+        BWFloat2 position = {(float)(idx % numXBins) + 0.5f, (float)(idx / numXBins % (numYBins-2)) + 0.5f};
+        start[2*idx] = start[2*idx+1] = position;
+        expected += idx % numXBins < numXBins/2;
+    }
+
+    BWParticleMoveISA const isas[] = {BWParticleMoveScalar, BWParticleMoveAVX2, BWParticleMoveAVX512};
+    for (BWParticleMoveISA isa : isas)
+    {
+        std::vector<BWFloat2> vertex = start;
+        int count = particleMoveISA(isa, vertex.data(), STEP_DT, numXBins, numYBins, field.data(), nullptr, 0.0f
+                                    , 1, 0, 0, numParticles);
+        char what[160];
+        snprintf(what, sizeof(what), "%s counts the %d particles it respawned%s", particleMoveISAName(isa), expected
+                 , isa > particleMoveBestISA() ? " (not on this CPU: scalar)" : "");
+        check(expected == count, what);
+    }
+}
+
+
+int main()
+{
+    checkRespawnCount();
+
+    BWTestField field;
+    BWParticleMoveISA const isas[] = {BWParticleMoveAVX2, BWParticleMoveAVX512};
+    for (BWTestStore const& store : testStores)
+    {
+        auto setup = [&store](BWParticleMoveISA isa)
+        {
+            return [&store, isa](BWCPUGrid& grid)
+            {
+                grid.setParticleStore(store.store);
+                grid.setTrailLength(store.trailLength);
+                grid.setThreadPool(std::make_shared<BWThreadPool>(1));
+                grid.setMoveISA(isa);
+            };
+        };
+        BWTestRun reference = testRun(field, setup(BWParticleMoveScalar));
+        for (BWParticleMoveISA isa : isas)
+        {
+            char what[160];
+            snprintf(what, sizeof(what), "%s: %s moves the particles as the scalar version does%s", store.name
+                     , particleMoveISAName(isa), isa > particleMoveBestISA() ? " (not on this CPU: both are scalar)" : "");
+            checkSameRun(reference, testRun(field, setup(isa)), what);
+        }
+    }
+    return numFailures;
+}
@@ -0,0 +1,80 @@
+/*
+    BWPipelineTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks that a pipelined grid moves the particles as a serial one does, a call later:
+    what it shows is a step behind, until finishStep() brings the step in flight over.
+    Each is checked with one step a call, and with several, as the export and the plug-in
+    step, for the particle streams and the tail/head pairs of BWParticleStoreVertices.  The
+    tail/head pairs respawned by a call show straight away, before the step moves them, so
+    the serial grid respawns them too, for those.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include "BWTestGrid.h"
+
+
+int main()
+{
+    BWTestField field;
+    for (BWTestStore const& store : testStores)
+    {
+        auto setup = [&store](bool pipelined)
+        {
+            return [&store, pipelined](BWCPUGrid& grid)
+            {
+                grid.setParticleStore(store.store);
+                grid.setTrailLength(store.trailLength);
+                grid.setThreadPool(std::make_shared<BWThreadPool>(1));
+                grid.setMoveISA(BWParticleMoveScalar);
+                grid.setPipelined(pipelined);
+            };
+        };
+        // What a call of numSteps respawns before its step, when the pipelined grid shows them
+        auto respawned = [&store](int numSteps) -> std::function<void(BWCPUGrid&)>
+        {
+            if (BWParticleStoreStreams == store.store)
+                return nullptr;
+            return [numSteps](BWCPUGrid& grid) { grid.randomizeParticles(100*numSteps); };
+        };
+        BWTestRun serial = testRun(field, setup(false));
+        BWTestRun behind = testRun(field, setup(true));
+        char what[128];
+        snprintf(what, sizeof(what), "%s: the pipelined grid shows the serial grid's steps one call later", store.name);
+        checkSameRun(testRun(field, setup(false), BWTestSteps, 1, respawned(1)), testRun(field, setup(true), BWTestSteps+1), what);
+        check(behind.vertices.size() == serial.vertices.size()
+              && memcmp(behind.vertices.data(), serial.vertices.data(), behind.vertices.size()*sizeof(BWFloat2))
+              , "    one call fewer doesn't show the step in flight");
+        checkSameRun(testRun(field, setup(false), BWTestSteps-1, 1, respawned(1)), behind, "    but does show the steps before it");
+        checkSameRun(serial, testRun(field, setup(true), BWTestSteps, 1, [](BWCPUGrid& grid) { grid.finishStep(); })
+                     , "    or straight away, after finishStep()");
+
+        snprintf(what, sizeof(what), "%s: 4 steps a call, pipelined shows the serial grid's steps one call later", store.name);
+        checkSameRun(testRun(field, setup(false), BWTestSteps/4, 4, respawned(4)), testRun(field, setup(true), BWTestSteps/4 + 1, 4), what);
+    }
+    return numFailures;
+}
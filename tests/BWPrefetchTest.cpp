@@ -0,0 +1,130 @@
+/*
+    BWPrefetchTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks that the fields built in the background end up where they were asked for:
+    the newest prefetch becomes t1, and the newest replacement becomes t0 at the next
+    frame, whichever order the two kinds are asked for in.
+ */
+
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWTestCheck.h"
+
+/// The size of the grids
+static int const width  = 256;
+static int const height = 128;
+
+
+/// The u/v planes, and the field built from them by a grid of its own
+struct Source
+{
+    std::vector<float>    u;
+    std::vector<float>    v;
+    std::vector<BWFloat2> field;
+};
+
+
+/// A fresh grid; each builds its own fields
+static void setUp(BWCPUGrid& grid)
+{
+    grid.setFieldCache(nullptr);
+}
+
+
+/// True if the grid's field (t0 or t1) is the source's
+static bool isField(BWFloat2 const* field, Source const& source)
+{
+    return field && !memcmp(field, source.field.data(), source.field.size()*sizeof(BWFloat2));
+}
+
+
+/// Step the grid until the replacement is swapped in, or a few seconds have passed
+static bool waitForReplacement(BWCPUGrid& grid, Source const& source)
+{
+    for (int tries = 0; tries < 1000 && !isField(grid.vectorField(), source); tries++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        grid.animationStep();
+    }
+    return isField(grid.vectorField(), source);
+}
+
+
+int main()
+{
+    BWFieldHeader header;
+    Source sources[3];
+    syntheticField(header, sources[0].u, sources[0].v);
+    // The others are the first, scaled
+    for (int i = 1; i < 3; i++)
+    {
+        for (float u : sources[0].u)
+            sources[i].u.push_back(u * (i + 1));
+        for (float v : sources[0].v)
+            sources[i].v.push_back(v * (i + 1));
+    }
+    for (Source& source : sources)
+    {
+        BWCPUGrid grid(1000, width, height, 1234);
+        setUp(grid);
+        grid.interpretData(header, source.u.data(), source.v.data(), 1.0f);
+        source.field.assign(grid.vectorField(), grid.vectorField() + (size_t) width*height);
+    }
+    Source const& a = sources[0];
+    Source const& b = sources[1];
+    Source const& c = sources[2];
+
+    {
+        BWCPUGrid grid(1000, width, height, 1234);
+        setUp(grid);
+        grid.interpretData(header, a.u.data(), a.v.data(), 1.0f);
+        grid.prefetchData(header, a.u.data(), a.v.data(), 1.0f);
+        grid.prefetchData(header, b.u.data(), b.v.data(), 1.0f);
+        grid.prefetchData(header, c.u.data(), c.v.data(), 1.0f);
+        check(grid.advanceField(true) && isField(grid.nextField(), c), "the newest of the prefetches becomes t1");
+    }
+
+    for (int replaceFirst = 0; replaceFirst < 2; replaceFirst++)
+    {
+        BWCPUGrid grid(1000, width, height, 1234);
+        setUp(grid);
+        grid.interpretData(header, a.u.data(), a.v.data(), 1.0f);
+        if (replaceFirst)
+            grid.replaceData(header, b.u.data(), b.v.data(), 1.0f);
+        grid.prefetchData(header, c.u.data(), c.v.data(), 1.0f);
+        if (!replaceFirst)
+            grid.replaceData(header, b.u.data(), b.v.data(), 1.0f);
+        check(grid.advanceField(true) && isField(grid.nextField(), c)
+              , replaceFirst ? "a prefetch after a replacement becomes t1" : "a prefetch before a replacement becomes t1");
+        check(waitForReplacement(grid, b) && !grid.nextField()
+              , replaceFirst ? "    and the replacement still replaces the fields" : "    and the replacement after it still replaces the fields");
+    }
+    return numFailures;
+}
@@ -0,0 +1,101 @@
+/*
+    BWRandomTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks the Philox4x32-10 generator (BWRandom.h) against the known answers that
+    Random123 publishes for it, and the particle streams drawn from it: the numbers are
+    each particle's own, so the same seed moves the particles to the same bits on any
+    number of workers.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include "BWRandom.h"
+#include "BWTestGrid.h"
+
+
+/** Check one known answer
+    @param seed     The key: the low word is k0, and the high word k1
+    @param counter  The counter
+    @param expect   The random bits it should give
+    @param what     What was checked
+ */
+static void checkPhilox(uint64_t seed, uint32_t const counter[4], uint32_t const expect[4], char const* what)
+{
+    uint32_t random[4];
+    memcpy(random, counter, sizeof(random));
+    BWPhilox4x32(seed, random);
+    check(!memcmp(random, expect, sizeof(random)), what);
+}
+
+
+int main()
+{
+    uint32_t const zeros[4]  = {0, 0, 0, 0};
+    uint32_t const expect0[4] = {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8};
+    checkPhilox(0, zeros, expect0, "philox4x32-10, key and counter of 0");
+
+    uint32_t const ones[4]    = {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
+    uint32_t const expect1[4] = {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd};
+    checkPhilox(0xffffffffffffffffull, ones, expect1, "philox4x32-10, key and counter of all ones");
+
+    uint32_t const pi[4]      = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+    uint32_t const expectPi[4] = {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1};
+    checkPhilox(0x299f31d0a4093822ull, pi, expectPi, "philox4x32-10, key and counter from the digits of pi");
+
+    // A particle's number is the first word of the counter (particle, frame, stream, 0)
+    uint32_t random[4];
+    BWParticleRandom4(42, 7, 3, BWRandomStreamAge, random);
+    uint32_t counter[4] = {7, 3, BWRandomStreamAge, 0};
+    BWPhilox4x32(42, counter);
+    check(!memcmp(random, counter, sizeof(random)) && BWParticleRandom(42, 7, 3, BWRandomStreamAge) == counter[0]
+          , "the particle numbers are the generator's for (particle, frame, stream)");
+    check(BWParticleRandom(42, 7, 3, BWRandomStreamMove) != BWParticleRandom(42, 7, 3, BWRandomStreamInit)
+          , "the streams differ");
+
+    BWTestField field;
+    for (BWTestStore const& store : testStores)
+    {
+        auto setup = [&store](int workers)
+        {
+            return [&store, workers](BWCPUGrid& grid)
+            {
+                grid.setParticleStore(store.store);
+                grid.setTrailLength(store.trailLength);
+                grid.setThreadPool(std::make_shared<BWThreadPool>(workers));
+            };
+        };
+        BWTestRun reference = testRun(field, setup(1));
+        int const numWorkers[] = {2, 4, 7};
+        for (int workers : numWorkers)
+        {
+            char what[128];
+            snprintf(what, sizeof(what), "%s: %d workers move the particles as 1 does", store.name, workers);
+            checkSameRun(reference, testRun(field, setup(workers)), what);
+        }
+    }
+    return numFailures;
+}
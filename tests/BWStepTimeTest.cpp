@@ -0,0 +1,62 @@
+/*
+    BWStepTimeTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks that BWStepsForTime() steps at a fixed STEPS_PER_SECOND whatever the frame rate:
+    carrying over the part of a step not yet taken, and taking at most MAX_CATCHUP_STEPS
+    after a stall, dropping the rest of it.
+ */
+
+#include <math.h>
+#include "BWCPUTypes.h"
+#include "BWTestCheck.h"
+
+
+int main()
+{
+    double const stepTime = 1.0 / STEPS_PER_SECOND;
+    double backlog = 0.0;
+
+    // Faster frames than steps: the halves add up to one step
+    check(0 == BWStepsForTime(&backlog, 0.5*stepTime), "half a step takes none");
+    check(1 == BWStepsForTime(&backlog, 0.6*stepTime), "    and the next half takes one");
+    check(fabs(backlog - 0.1*stepTime) < 1e-9, "    leaving the tenth over for the next frame");
+
+    // Slower frames: several steps at once
+    backlog = 0.0;
+    check(2 == BWStepsForTime(&backlog, 2.5*stepTime), "two and a half steps take two");
+    check(fabs(backlog - 0.5*stepTime) < 1e-9, "    leaving the half over");
+
+    // A stall: at most MAX_CATCHUP_STEPS, and the rest is dropped
+    backlog = 0.0;
+    check(MAX_CATCHUP_STEPS == BWStepsForTime(&backlog, (MAX_CATCHUP_STEPS + 10.5)*stepTime)
+          , "a stall takes MAX_CATCHUP_STEPS");
+    check(0.0 == backlog, "    and drops the rest of it");
+
+    // Time going backwards (a restarted composition) doesn't eat into the backlog
+    backlog = 0.5*stepTime;
+    check(0 == BWStepsForTime(&backlog, -1.0) && 0.5*stepTime == backlog, "time going backwards takes no steps");
+    return numFailures;
+}
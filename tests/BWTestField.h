@@ -0,0 +1,115 @@
+/*
+    BWTestField.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWTestField_h
+#define BWTestField_h
+
+#include <math.h>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWGridBuild.h"
+
+/*
+    Builds fields for the tests that check the ways of building a field against each other:
+    a global (wrapping) field and a regional one, at a size that isn't a whole number of
+    tiles.
+ */
+
+/// The size of the fields built
+static BWUInt2 const testFieldSize = {300, 170};
+
+
+/// The u/v planes a field is built from
+struct BWTestSource
+{
+    BWFieldHeader      header;
+    std::vector<float> u;
+    std::vector<float> v;
+    bool               isContinuous;
+    char const*        name;
+};
+
+
+/** Make the sources the fields are built from
+    @param global    Receives the synthetic global field, which wraps around
+    @param regional  Receives the western 100 degrees of it, which don't
+ */
+static inline void testSources(BWTestSource& global, BWTestSource& regional)
+{
+    syntheticField(global.header, global.u, global.v);
+    global.isContinuous = floor(global.header.srcSize.x * global.header.delta.x) >= 360;
+    global.name = "global";
+
+    regional.header = global.header;
+    regional.header.srcSize.x = 100;
+    regional.u.clear();
+    regional.v.clear();
+    for (uint32_t y = 0; y < global.header.srcSize.y; y++)
+    {
+        size_t row = (size_t) y*global.header.srcSize.x;
+        regional.u.insert(regional.u.end(), global.u.begin() + row, global.u.begin() + row + 100);
+        regional.v.insert(regional.v.end(), global.v.begin() + row, global.v.begin() + row + 100);
+    }
+    regional.isContinuous = false;
+    regional.name = "regional";
+}
+
+
+/// The bytes of a bin of each storage
+static inline size_t testBinBytes(BWFieldStorage storage)
+{
+    return BWFieldStorageFloat == storage ? sizeof(BWFloat2) : BWFieldStorageHalf == storage ? sizeof(BWHalf2) : sizeof(BWShort2);
+}
+
+
+/// The name of a storage, for the checks
+static inline char const* testStorageName(BWFieldStorage storage)
+{
+    return BWFieldStorageFloat == storage ? "float" : BWFieldStorageHalf == storage ? "half" : "int16";
+}
+
+
+/** Build a whole field with gridBuildField()
+    @param source    The u/v planes
+    @param layout    How the bins are ordered
+    @param storage   How the vectors are stored
+    @param rowScale  Receives the scale of each row, for BWFieldStorageInt16
+    @returns The bins, in the layout given
+ */
+static inline std::vector<uint8_t> testBuildField(BWTestSource const& source, BWFieldLayout layout, BWFieldStorage storage
+                                                  , std::vector<BWFloat2>& rowScale)
+{
+    bool tiled = BWFieldLayoutTiled == layout;
+    uint32_t stride = tiled ? gridNumTiles(testFieldSize.x) : testFieldSize.x;
+    size_t count = tiled ? (size_t) stride*gridNumTiles(testFieldSize.y)*BWFieldTileSize*BWFieldTileSize
+                         : (size_t) testFieldSize.x*testFieldSize.y;
+    std::vector<uint8_t> field(count * testBinBytes(storage));
+    rowScale.assign(testFieldSize.y, BWFloat2());
+    gridBuildField(source.u.data(), source.v.data(), source.header.srcSize, source.isContinuous, source.header.origin
+                   , 1.0f, testFieldSize, stride, layout, storage, field.data(), rowScale.data(), 0, testFieldSize.y);
+    return field;
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+    BWTestGrid.h
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+#ifndef BWTestGrid_h
+#define BWTestGrid_h
+
+#include <string.h>
+#include <functional>
+#include <vector>
+#include "BWBenchField.h"
+#include "BWCPUGrid.h"
+#include "BWTestCheck.h"
+
+/*
+    Runs grids for the tests that check the particles move the same whichever way the
+    grid is run.  Each run is a fresh grid, with the same seed, size and particles, on a
+    field of its own built from the synthetic u/v planes.
+ */
+
+/// The size of the grids, the particles on them, and the steps they take
+#define BWTestWidth        (512)
+#define BWTestHeight       (256)
+#define BWTestParticles    (20000)
+#define BWTestSteps        (40)
+
+/// The u/v planes the grids are built from
+struct BWTestField
+{
+    BWFieldHeader      header;
+    std::vector<float> u;
+    std::vector<float> v;
+
+    BWTestField() { syntheticField(header, u, v); }
+};
+
+
+/// What a run ends up with
+struct BWTestRun
+{
+    std::vector<BWFloat2> vertices;
+    int                   trailHead;
+};
+
+
+/** Step a grid, and keep its vertices
+    @param field        The u/v planes
+    @param setup        Sets up the grid, before the field is loaded
+    @param numCalls     The number of animationSteps() calls
+    @param stepsPerCall The steps each call takes
+    @param last         Called after the last call, if given: finishStep(), so a pipelined
+                        grid shows the steps in flight too, say
+    @returns The vertices after the last call, and the slot of the rings written last
+ */
+static inline BWTestRun testRun(BWTestField const& field, std::function<void(BWCPUGrid&)> const& setup
+                                , int numCalls = BWTestSteps, int stepsPerCall = 1
+                                , std::function<void(BWCPUGrid&)> const& last = nullptr)
+{
+    BWCPUGrid grid(BWTestParticles, BWTestWidth, BWTestHeight, 1234);
+    // Each grid builds its own field
+    grid.setFieldCache(nullptr);
+    setup(grid);
+    BWTestRun ret;
+    ret.trailHead = -1;
+    if (!grid.interpretData(field.header, field.u.data(), field.v.data(), BWTestWidth / 5000.0f))
+        return ret;
+    for (int call = 0; call < numCalls; call++)
+        grid.animationSteps(stepsPerCall);
+    if (last)
+        last(grid);
+    size_t count = (size_t) grid.numParticles() * grid.verticesPerParticle();
+    ret.vertices.assign(grid.vertices(), grid.vertices() + count);
+    ret.trailHead = grid.trailHead();
+    return ret;
+}
+
+
+/** Check that two runs ended up the same, to the bit
+    @param a     One run
+    @param b     The other
+    @param what  What was checked
+ */
+static inline void checkSameRun(BWTestRun const& a, BWTestRun const& b, char const* what)
+{
+    check(!a.vertices.empty() && a.vertices.size() == b.vertices.size() && a.trailHead == b.trailHead
+          && !memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size()*sizeof(BWFloat2)), what);
+}
+
+
+/// The ways the particles are kept, that each check is made with
+struct BWTestStore
+{
+    char const*     name;
+    BWParticleStore store;
+    int             trailLength;
+};
+static BWTestStore const testStores[] =
+{
+    {"pairs",          BWParticleStoreStreams,  2},
+    {"trails",         BWParticleStoreStreams,  TRAIL_LENGTH},
+    {"vertices store", BWParticleStoreVertices, 2},
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+    BWThreadPoolTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks that BWThreadPool::parallelFor() covers the range exactly once, and that an
+    exception thrown by the body -- on the calling thread or a worker -- comes out of
+    parallelFor() only after the other chunks are done with, leaving the pool usable.
+ */
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "BWTestCheck.h"
+#include "BWThreadPool.h"
+
+
+int main()
+{
+    BWThreadPool pool(4);
+    size_t const count = 100000;
+    size_t const chunk = 100;
+
+    std::vector<int> hits(count, 0);
+    pool.parallelFor(count, chunk, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            hits[i]++;
+    });
+    bool once = true;
+    for (int n : hits)
+        once = once && 1 == n;
+    check(once, "each item is done once");
+
+    // Every chunk throws, so the calling thread does too
+    bool allCaught = true;
+    for (int pass = 0; pass < 20; pass++)
+    {
+        std::string caught;
+        try
+        {
+            pool.parallelFor(count, chunk, [](size_t, size_t)
+            {
+                throw std::runtime_error("chunk failed");
+            });
+        }
+        catch (std::runtime_error const& error)
+        {
+            caught = error.what();
+        }
+        allCaught = allCaught && "chunk failed" == caught;
+    }
+    check(allCaught, "an exception thrown by every chunk comes out of parallelFor");
+
+    // Just one chunk throws, on whichever thread takes it
+    std::string caught;
+    try
+    {
+        pool.parallelFor(count, chunk, [](size_t begin, size_t)
+        {
+            if (begin == count/2)
+                throw std::runtime_error("one chunk failed");
+        });
+    }
+    catch (std::runtime_error const& error)
+    {
+        caught = error.what();
+    }
+    check("one chunk failed" == caught, "an exception thrown by one chunk comes out of parallelFor");
+
+    // And on a pool that runs the chunks in the caller
+    BWThreadPool single(1);
+    caught.clear();
+    try
+    {
+        single.parallelFor(count, chunk, [](size_t, size_t)
+        {
+            throw std::runtime_error("serial chunk failed");
+        });
+    }
+    catch (std::runtime_error const& error)
+    {
+        caught = error.what();
+    }
+    check("serial chunk failed" == caught, "an exception comes out of parallelFor on one worker too");
+
+    hits.assign(count, 0);
+    pool.parallelFor(count, chunk, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            hits[i]++;
+    });
+    once = true;
+    for (int n : hits)
+        once = once && 1 == n;
+    check(once, "the pool still does each item once afterwards");
+    return numFailures;
+}
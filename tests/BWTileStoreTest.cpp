@@ -0,0 +1,102 @@
+/*
+    BWTileStoreTest.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Checks the blocks of a BWTileStore against the whole tiled field, as they are built,
+    and as they are read back from the file after being dropped, on a global (wrapping)
+    field and on a regional one.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include "BWTestCheck.h"
+#include "BWTestField.h"
+#include "BWTileStore.h"
+
+
+/** Check the blocks of a tile store against the whole tiled field
+    @param source  The u/v planes
+ */
+static void checkTileStore(BWTestSource const& source)
+{
+    BWUInt2 const tgtSize = testFieldSize;
+    // The stores are floats or half floats
+    BWFieldStorage const storages[] = {BWFieldStorageFloat, BWFieldStorageHalf};
+    for (BWFieldStorage storage : storages)
+    {
+        std::vector<BWFloat2> rowScale;
+        std::vector<uint8_t> whole = testBuildField(source, BWFieldLayoutTiled, storage, rowScale);
+        std::shared_ptr<BWTileStore> store = BWTileStore::create(source.header, source.u.data(), source.v.data(), nullptr
+                                                                 , 1.0f, tgtSize, storage);
+        char what[128];
+        snprintf(what, sizeof(what), "%s field, %s: the tile store is made", source.name, testStorageName(storage));
+        check(store != nullptr, what);
+        if (!store)
+            continue;
+
+        // A particle in every bin
+        std::vector<BWFloat2> positions;
+        for (uint32_t y = 0; y < tgtSize.y; y++)
+        {
+            for (uint32_t x = 0; x < tgtSize.x; x++)
+                positions.push_back(BWFloat2{x + 0.5f, y + 0.5f});
+        }
+        size_t   bytes     = testBinBytes(storage);
+        uint32_t numXTiles = gridNumTiles(tgtSize.x);
+        for (int pass = 0; pass < 2; pass++)
+        {
+            store->touch(positions.data(), 1, 0, positions.size());
+            uint8_t const* tiles = (uint8_t const*) store->packedField().vectors;
+            bool same = true;
+            for (uint32_t y = 0; y < tgtSize.y && same; y++)
+            {
+                for (uint32_t x = 0; x < tgtSize.x && same; x++)
+                {
+                    size_t idx = gridTiledIndex(x, y, numXTiles)*bytes;
+                    same = !memcmp(&whole[idx], tiles + idx, bytes);
+                }
+            }
+            snprintf(what, sizeof(what), "%s field, %s: the tile store's blocks are the whole field's%s", source.name
+                     , testStorageName(storage), pass ? ", read back after being dropped" : "");
+            check(same, what);
+            // Drop them all, to be read back from the file
+            store->trim(0);
+        }
+        BWTileStoreStats stats = store->statistics();
+        snprintf(what, sizeof(what), "%s field, %s: every block was built once, and dropped twice", source.name, testStorageName(storage));
+        check(stats.built == stats.blocks && stats.builds == stats.blocks && stats.evictions == 2*stats.blocks, what);
+    }
+}
+
+
+int main()
+{
+    BWTestSource global, regional;
+    testSources(global, regional);
+    checkTileStore(global);
+    checkTileStore(regional);
+    return numFailures;
+}
@@ -0,0 +1,63 @@
+/*
+    BWFieldConvert.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Converts an earth style JSON file (as produced by grib2json, and used by
+    https://github.com/cambecc/earth) into a binary vector field file (.bwvf)
+    that can be memory mapped.
+
+    usage: BWFieldConvert input.json output.bwvf
+
+    The JSON file is an array of records, each with a "header" and a "data" array.
+    The record with parameterNumber 2 is the u component, and 3 is the v component.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "BWEarthJSON.h"
+#include "BWFieldFile.h"
+
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s input.json output.%s\n", argv[0], BWFieldFileExtension);
+        return 2;
+    }
+
+    // The file is parsed in pieces, straight into the u/v arrays
+    BWFieldHeader header;
+    float* u;
+    float* v;
+    if (!BWEarthJSONRead(argv[1], &header, &u, &v))
+    {
+        return 1;
+    }
+    bool ok = BWFieldFileWrite(argv[2], &header, u, v);
+    free(u);
+    free(v);
+    return ok ? 0 : 1;
+}
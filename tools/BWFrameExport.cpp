@@ -0,0 +1,173 @@
+/*
+    BWFrameExport.cpp
+    Animate vector field
+    Copyright (c) 2013-2014, Randall Maas
+
+ 
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+ 
+    The above copyright notice and this permission notice shall be included in
+    all copies or substantial portions of the Software.
+ 
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+    THE SOFTWARE.
+*/
+
+/*
+    Renders a vector field animation offline, without openGL, to a PNG sequence or a
+    Y4M or raw RGBA stream.
+
+    usage: BWFrameExport [-frames n] [-fps n] [-size WxH] [-particles n] [-trail n] [-fade f]
+                         [-writers n] [-slots n] [-tiles MB] field.bwvf|field.json output
+
+    The output's extension picks the format: .png (a file per frame; the name may have
+    a %d for the frame number, or one is added), .y4m, or .rgba / .raw.  Each frame
+    takes a fixed STEPS_PER_SECOND / fps of a second's steps, whatever the time it takes
+    to make, so the export is the same on any machine.  The particles are drawn as trails
+    of TRAIL_LENGTH positions, as the plug-in draws them, unless -trail says otherwise
+    (2 for the tail/head pairs).
+
+    The stages overlap: the grid steps on a thread of its own (setPipelined) while the
+    last step is drawn, and the frames go through a ring of slots to the writer threads,
+    which encode several at once and write them out (see BWFrameWriter.h).  At the end,
+    the sustained frames per second, over the whole export, are reported with the time
+    of each stage.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BWCPUGrid.h"
+#include "BWFrameWriter.h"
+#include "BWRaster.h"
+#include "BWStats.h"
+
+
+int main(int argc, char** argv)
+{
+    int    numFrames    = 300;
+    int    fps          = 30;
+    int    width        = 1440;
+    int    height       = 720;
+    int    numParticles = 32768;
+    int    trailLength  = TRAIL_LENGTH;
+    float  fade         = 0.0f;
+    int    numWriters   = 0;
+    int    numSlots     = 0;
+    double tileMB       = 0.0;
+    char const* paths[2] = {NULL, NULL};
+    int numPaths = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-frames") && i+1 < argc)
+            numFrames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-fps") && i+1 < argc)
+            fps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-size") && i+1 < argc)
+        {
+            if (2 != sscanf(argv[++i], "%dx%d", &width, &height))
+                width = height = 0;
+        }
+        else if (!strcmp(argv[i], "-particles") && i+1 < argc)
+            numParticles = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-trail") && i+1 < argc)
+            trailLength = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-fade") && i+1 < argc)
+            fade = (float) atof(argv[++i]);
+        else if (!strcmp(argv[i], "-writers") && i+1 < argc)
+            numWriters = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-slots") && i+1 < argc)
+            numSlots = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-tiles") && i+1 < argc)
+            tileMB = atof(argv[++i]);
+        else if ('-' != argv[i][0] && numPaths < 2)
+            paths[numPaths++] = argv[i];
+        else
+        {
+            numPaths = 0;
+            break;
+        }
+    }
+    BWFrameFormat format;
+    if (2 != numPaths || numFrames < 1 || fps < 1 || width < 1 || height < 1 || numParticles < 1)
+    {
+        fprintf(stderr, "usage: %s [-frames n] [-fps n] [-size WxH] [-particles n] [-trail n] [-fade f]\n"
+                        "       [-writers n] [-slots n] [-tiles MB] field.bwvf|field.json output.png|.y4m|.rgba\n", argv[0]);
+        return 2;
+    }
+    if (!BWFrameWriter::formatForPath(paths[1], format))
+    {
+        fprintf(stderr, "%s: the output should be a .png, .y4m, .rgba or .raw file\n", argv[0]);
+        return 2;
+    }
+
+    BWCPUGrid grid(numParticles, width, height, 1);
+    grid.setTileBudget((size_t)(tileMB * 1e6));
+    grid.setTrailLength(trailLength);
+    if (!grid.interpretFile(paths[0], width / 5000.0f))
+        return 1;
+    grid.setPipelined(true);
+    BWRaster raster(width, height);
+    std::unique_ptr<BWFrameWriter> writer = BWFrameWriter::create(paths[1], format, width, height, fps
+                                                                  , numWriters, numSlots);
+    if (!writer)
+        return 1;
+
+    // The steps due by the end of a frame, counted from the start so they don't drift
+    auto stepsFor = [fps](int frame)
+    {
+        return (int)(floor((frame+1) * STEPS_PER_SECOND / fps) - floor(frame * STEPS_PER_SECOND / fps));
+    };
+    double stepSeconds = 0, drawSeconds = 0, handSeconds = 0;
+    double start = BWStatsNow();
+    // What is drawn is a step behind, so the first frame's steps are taken before the loop
+    grid.animationSteps(stepsFor(0));
+    grid.finishStep();
+    stepSeconds += BWStatsNow() - start;
+    bool ok = true;
+    for (int frame = 0; frame < numFrames && ok; frame++)
+    {
+        double t0 = BWStatsNow();
+        // This returns once this frame's steps are done and the next frame's are started (none
+        // after the last frame); what is drawn is this frame's, while the next one's run
+        grid.animationSteps(frame+1 < numFrames ? stepsFor(frame+1) : 0);
+        double t1 = BWStatsNow();
+        if (fade > 0.0f)
+            raster.fade(fade);
+        else
+            raster.clear();
+        raster.drawTrails(grid.vertices(), grid.numParticles(), grid.verticesPerParticle(), grid.trailHead());
+        double t2 = BWStatsNow();
+        ok = writer->write(raster.pixels(), raster.rowBytes());
+        double t3 = BWStatsNow();
+        stepSeconds += t1 - t0;
+        drawSeconds += t2 - t1;
+        handSeconds += t3 - t2;
+    }
+    grid.finishStep();
+    ok = writer->close() && ok;
+    double seconds = BWStatsNow() - start;
+
+    BWFrameWriterStats stats = writer->statistics();
+    printf("%llu frames of %d x %d, %d particles with trails of %d, in %.2f s: %.1f fps sustained\n"
+           , (unsigned long long) stats.frames, width, height, numParticles, grid.verticesPerParticle()
+           , seconds, stats.frames / seconds);
+    printf("ms a frame: step %.2f  draw %.2f  hand off %.2f (waiting %.2f)"
+           "  encode %.2f  write %.2f  (%d writers, %d slots)\n"
+           , stepSeconds*1e3/numFrames, drawSeconds*1e3/numFrames, handSeconds*1e3/numFrames
+           , stats.waitSeconds*1e3/numFrames, stats.encodeSeconds*1e3/numFrames, stats.writeSeconds*1e3/numFrames
+           , writer->numWriters(), writer->numSlots());
+    printf("%.1f MB written\n", stats.bytes / 1e6);
+    return ok ? 0 : 1;
+}